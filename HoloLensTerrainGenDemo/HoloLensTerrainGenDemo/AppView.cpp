@@ -90,6 +90,10 @@ void AppView::SetWindow(CoreWindow^ window)
 // previously saved app state.
 void AppView::Load(Platform::String^ entryPoint)
 {
+    if (m_main != nullptr)
+    {
+        m_main->LoadAppState();
+    }
 }
 
 // This method is called after the window becomes active. It oversees the
@@ -145,21 +149,28 @@ void AppView::OnSuspending(Platform::Object^ sender, SuspendingEventArgs^ args)
     // the app will be forced to exit.
     SuspendingDeferral^ deferral = args->SuspendingOperation->GetDeferral();
 
-    create_task([this, deferral] ()
-    {
-        m_deviceResources->Trim();
+    // The suspending event is raised on the thread that runs the frame loop, so the app state is copied here
+    // and written out in the background.
+    task<void> saveAppState = m_main != nullptr ? m_main->SaveAppState() : task_from_result();
+
+    //
+    // TODO: Insert code here to save your app state.
+    //
 
-        if (m_main != nullptr)
+    // Complete the deferral whether or not saving succeeded.
+    saveAppState.then([this, deferral] (task<void> saved)
+    {
+        try
+        {
+            saved.get();
+        }
+        catch (Platform::Exception^)
         {
-            m_main->SaveAppState();
         }
 
-        //
-        // TODO: Insert code here to save your app state.
-        //
-
+        m_deviceResources->Trim();
         deferral->Complete();
-    });
+    }, task_continuation_context::use_arbitrary());
 }
 
 void AppView::OnResuming(Platform::Object^ sender, Platform::Object^ args)
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+
+namespace DX
+{
+    // Holds an immutable value that writers replace whole. Readers take the current value with Load and keep it for
+    // as long as they need it; it is never changed under them, and lives until the last reader releases it.
+    // Writers build the next value from the current one in Update, which serializes them, so no update is lost.
+    //
+    // This toolset has no atomic<shared_ptr>, so this uses std::atomic_load and std::atomic_store on a shared_ptr.
+    // MSVC implements them with a short spin lock around the pointer copy: reads never wait for a writer to build a
+    // value, only for another pointer copy to finish.
+    template <typename T>
+    class AtomicSnapshot
+    {
+    public:
+        AtomicSnapshot() = default;
+        explicit AtomicSnapshot(std::shared_ptr<const T> initial) : m_current(std::move(initial)) {}
+
+        AtomicSnapshot(const AtomicSnapshot&) = delete;
+        AtomicSnapshot& operator=(const AtomicSnapshot&) = delete;
+
+        std::shared_ptr<const T> Load() const                 { return std::atomic_load(&m_current);           }
+
+        // Builds the next value from the current one and publishes it. build is given the current value and returns
+        // the next, or nullptr to leave the current one published, as when it only changed something the value
+        // points to. Writers are serialized on a lock that readers never take.
+        template <typename Build>
+        void Update(Build build)
+        {
+            std::lock_guard<std::mutex> guard(m_writerLock);
+            std::shared_ptr<const T> next = build(Load());
+            if (next)
+            {
+                std::atomic_store(&m_current, std::move(next));
+            }
+        }
+
+    private:
+        std::shared_ptr<const T>                              m_current;
+        std::mutex                                            m_writerLock;
+    };
+}
@@ -1,10 +1,17 @@
 #include "common.h"
 #include "pch.h"
 #include "PlaneFinding.h"
-#include "HalfEdgeMesh.h"
+#include "RansacPlanes.h"
+#include "VertexAdjacency.h"
 #include "PCAHelper.h"
 #include "NBest.h"
+#include "RegionLabelling.h"
 #include "Util.h"
+#include "ScratchArena.h"
+#ifdef _WIN32
+#include <ppl.h>
+#endif
+#include <atomic>
 
 using namespace DirectX;
 
@@ -12,7 +19,7 @@ namespace PlaneFinding
 {
     // How we are finding planes:
     //  * First we calculate the curvature for every vertex
-    //  * Next, we flood-fill planar regions, and select the best regions as potential planes
+    //  * Next, we label connected planar regions, and select the best regions as potential planes
     //  * We then generate plane equations for these regions using Principal Component Analysis (PCAHelper)
     //  * Once we have plane equations, re-floodfill to generate our final set of vertices for each plane
     //  * The output of this is a collection of planes, each is a connected set of vertices.
@@ -27,9 +34,7 @@ namespace PlaneFinding
     const UINT32 cMinVertsPerPlane = 10; // minimum vertices required for a planar region to count as a plane
 	const float cMinimumPlaneSize = 0.00125; // 0.125f; // threshold for how large a plane must be when projected onto the tangent/cotangent vectors.  Measured as standard deviation of vertices, in meters.
 
-                                            // constants used for bucketing vertices to planes
-    const float cMaxDistanceFromPlane = 0.0125f; // 0.125f // max distance from a plane equation for a vetex to be considered part of the plane, in meters
-	const float cMinCosAngleBetweenNormalAndPlane = 0.5f * sqrtf(3.0f); // min angle between plane and vertex normal to consider vertex part of the plane (30 degrees)
+                                            // constants used for bucketing vertices to planes: cMaxDistanceFromPlane and cMinCosAngleBetweenNormalAndPlane (Util.h)
 
     const UINT32 INVALID_PLANE = static_cast<UINT32>(-1); // used to identify invalid planes
 
@@ -64,7 +69,7 @@ namespace PlaneFinding
         bool m_ignore = false;
 
     public:
-        bool operator<(_In_ PlaneData &p)
+        bool operator<(_In_ const PlaneData &p) const
         {
             return m_numVerts < p.m_numVerts;
         }
@@ -200,44 +205,19 @@ namespace PlaneFinding
             return XMMatrixTranspose(GetPlaneToMeshRotation());
         }
 
-        BoundingOrientedBox GetBoundsInMeshSpace(_In_ XMFLOAT3 *verts, UINT32 cVerts, _In_ UINT32 *vertColors)
+        // vertsInPlaneSpace are the plane's vertices, already transformed by GetMeshToPlaneRotation
+        BoundingOrientedBox GetBoundsInMeshSpace(_In_ const XMFLOAT3 *vertsInPlaneSpace, UINT32 cVerts)
         {
-            auto includeVert = [&](UINT32 index)
-            {
-                bool ret = false;
-                if (vertColors[index] == m_planeId)
-                {
-                    // we could do more filtering - only include vertices on holes, with neighbors that aren't in the plane, or are not contained within their neighbors when projected to the plane
-                    // TODO: consider this as a potential perf optimization
-                    ret = true;
-
-                }
-                return ret;
-            };
-
-            UINT32 index = 0;
-            const XMMATRIX meshToPlaneTransform = GetMeshToPlaneRotation();
+            // we could do more filtering - only include vertices on holes, with neighbors that aren't in the plane, or are not contained within their neighbors when projected to the plane
+            // TODO: consider this as a potential perf optimization
 
             // If the plane is gravity aligned, then simply fit an axis bounding aligned box in the plane space
             // and don't try to optimize to the tightest fitting oriented bounding box.
             bool findTightestBounds = !IsGravityAligned();
-            auto bestBoxInPlaneSpace = GetBoundsInOrientedSpace(findTightestBounds, [&](XMFLOAT3 *vertInOrientedSpace) -> bool
-            {
-                while (index < cVerts)
-                {
-                    if (includeVert(index))
-                    {
-                        XMStoreFloat3(vertInOrientedSpace, XMVector3TransformCoord(XMLoadFloat3(verts + index), meshToPlaneTransform));
-                        index++;
-                        return true;
-                    }
-                    index++;
-                }
-                return false;
-            });
+            auto bestBoxInPlaneSpace = GetBoundsInOrientedSpace(findTightestBounds, vertsInPlaneSpace, cVerts);
 
             BoundingOrientedBox xmBoundsInMeshSpace;
-            bestBoxInPlaneSpace.Transform(xmBoundsInMeshSpace, XMMatrixTranspose(meshToPlaneTransform));
+            bestBoxInPlaneSpace.Transform(xmBoundsInMeshSpace, GetPlaneToMeshRotation());
             return xmBoundsInMeshSpace;
         }
     };
@@ -253,157 +233,412 @@ namespace PlaneFinding
         return (n1.x * n2.x) + (n1.y * n2.y) + (n1.z * n2.z);
     }
 
-    void FillVertexCurvatures(_Out_ vector<PerVertexData> *vertexData, _In_ HalfEdgeMesh *halfEdge, _In_ XMFLOAT3 *normals, _In_ UINT32 vertCount)
+    // vertices per task when a per-vertex pass runs in parallel. Smaller meshes are processed on the calling thread.
+    const UINT32 cVerticesPerTask = 1024;
+
+    // Calls func(begin, end) over consecutive ranges of [0, vertCount). Each vertex is written by exactly one range
+    // and reads only data that is not written during the pass, so the result does not depend on scheduling.
+    template < typename TFunc >
+    void ForEachVertexRange(UINT32 vertCount, _In_ const TFunc &func)
     {
+        if (vertCount <= cVerticesPerTask)
+        {
+            func(0u, vertCount);
+            return;
+        }
+
+        concurrency::parallel_for(0u, (vertCount + cVerticesPerTask - 1) / cVerticesPerTask, [&](UINT32 task)
+        {
+            func(task * cVerticesPerTask, min(vertCount, (task + 1) * cVerticesPerTask));
+        });
+    }
+
+    void FillVertexCurvatures(_Out_ ScratchVector<float> *curvatures, _In_ const VertexAdjacency *adjacency, _In_ XMFLOAT3 *normals, _In_ UINT32 vertCount)
+    {
+        ScratchArenaScope scope;
+
+        // split the normals into one array per component, so four neighbours' components gather into one vector.
+        float* normalX = scope.Arena().AllocateArray<float>(vertCount);
+        float* normalY = scope.Arena().AllocateArray<float>(vertCount);
+        float* normalZ = scope.Arena().AllocateArray<float>(vertCount);
         for (UINT32 i = 0; i < vertCount; ++i)
         {
-            float dSum = 0.0f;
-            const XMFLOAT3 normal = normals[i];
+            normalX[i] = normals[i].x;
+            normalY[i] = normals[i].y;
+            normalZ[i] = normals[i].z;
+        }
 
-            // find the curvature
-            int numNeighbors = 0;
-            for (UINT32 neighbor : halfEdge->GetNeighborVerts(i))
-            {
-                dSum += Dot(normal, normals[neighbor]);
-                numNeighbors++;
-            }
+        curvatures->resize(vertCount);
+        float* curvature = curvatures->data();
+        const float* x = normalX;
+        const float* y = normalY;
+        const float* z = normalZ;
 
-            if (numNeighbors == 0)
+        ForEachVertexRange(vertCount, [&](UINT32 begin, UINT32 end)
+        {
+            for (UINT32 i = begin; i < end; ++i)
             {
-                numNeighbors = 1;
-            }
+                auto neighbors = adjacency->GetNeighborVerts(i);
+                const UINT32* neighbor = neighbors.begin();
+                const UINT32 numNeighbors = neighbors.size();
+
+                // dot the vertex normal with four neighbour normals at a time.
+                const XMVECTOR normalXi = XMVectorReplicate(x[i]);
+                const XMVECTOR normalYi = XMVectorReplicate(y[i]);
+                const XMVECTOR normalZi = XMVectorReplicate(z[i]);
+                XMVECTOR dots = XMVectorZero();
+
+                UINT32 n = 0;
+                for (; n + 4 <= numNeighbors; n += 4)
+                {
+                    XMVECTOR neighborX = XMVectorSet(x[neighbor[n]], x[neighbor[n + 1]], x[neighbor[n + 2]], x[neighbor[n + 3]]);
+                    XMVECTOR neighborY = XMVectorSet(y[neighbor[n]], y[neighbor[n + 1]], y[neighbor[n + 2]], y[neighbor[n + 3]]);
+                    XMVECTOR neighborZ = XMVectorSet(z[neighbor[n]], z[neighbor[n + 1]], z[neighbor[n + 2]], z[neighbor[n + 3]]);
+                    dots = XMVectorMultiplyAdd(neighborX, normalXi, dots);
+                    dots = XMVectorMultiplyAdd(neighborY, normalYi, dots);
+                    dots = XMVectorMultiplyAdd(neighborZ, normalZi, dots);
+                }
 
-            // the curvature
-            vertexData->push_back({ 1.0f - dSum / (numNeighbors), INVALID_PLANE });
-        }
+                float dSum = XMVectorGetX(XMVector4Dot(dots, XMVectorSplatOne()));
+                for (; n < numNeighbors; ++n)
+                {
+                    dSum += x[i] * x[neighbor[n]] + y[i] * y[neighbor[n]] + z[i] * z[neighbor[n]];
+                }
+
+                // the curvature
+                curvature[i] = 1.0f - dSum / max(numNeighbors, 1u);
+            }
+        });
     }
 
-    void SmoothCurvatures(_Inout_ vector<PerVertexData> *vertexData, _In_ HalfEdgeMesh *halfEdge, _In_ UINT32 vertCount)
+    void SmoothCurvatures(_Inout_ ScratchVector<float> *curvatures, _In_ const VertexAdjacency *adjacency, _In_ UINT32 vertCount)
     {
-        // smooth the curvature
-        // TODO: should be done on a second array to avoid consuming smoothed data, but
-        // avoiding that now to avoid creating yet another large buffer
-        for (UINT32 i = 0; i < vertCount; ++i)
+        // smooth the curvature into a second array, so every vertex averages its neighbours' unsmoothed values.
+        ScratchVector<float> smoothed(vertCount, curvatures->get_allocator());
+        const float* source = curvatures->data();
+        float* destination = smoothed.data();
+
+        ForEachVertexRange(vertCount, [&](UINT32 begin, UINT32 end)
         {
-            // find the normal of each neighbor
-            int numNeighbors = 1;
-            float dSum = (*vertexData)[i].Curvature;
-            for (UINT32 neighbor : halfEdge->GetNeighborVerts(i))
+            for (UINT32 i = begin; i < end; ++i)
             {
-                dSum += (*vertexData)[neighbor].Curvature;
-                numNeighbors++;
+                auto neighbors = adjacency->GetNeighborVerts(i);
+                float dSum = source[i];
+                for (UINT32 neighbor : neighbors)
+                {
+                    dSum += source[neighbor];
+                }
+                destination[i] = dSum / (neighbors.size() + 1);
             }
-            (*vertexData)[i].Curvature = dSum / numNeighbors;
-        }
+        });
+
+        curvatures->swap(smoothed);
     }
 
     template < typename TFunc >
-    void FloodFillVertices(_In_ HalfEdgeMesh *halfEdge, UINT32 startVert, _In_ const TFunc &func)
+    void FloodFillVertices(_In_ const VertexAdjacency *adjacency, UINT32 startVert, _In_ const TFunc &func)
     {
-        if (halfEdge->m_spVertices[startVert] != nullptr)
-        {
-            // we flood-fill from coallesced vertex
-            startVert = halfEdge->m_spVertices[startVert]->vertex;
-        }
+        ScratchArenaScope scope;
 
-        queue<UINT32> toExpand;
-        toExpand.push(startVert);
+        // func accepts a vertex at most once, so the queue never needs to give back the slots it has consumed
+        ScratchVector<UINT32> toExpand(scope.Arena());
+        toExpand.push_back(startVert);
 
-        while (!toExpand.empty())
+        for (size_t head = 0; head < toExpand.size(); ++head)
         {
-            UINT32 vert = toExpand.front();
-            toExpand.pop();
+            UINT32 vert = toExpand[head];
 
-            for (UINT32 neighbor : halfEdge->GetNeighborVerts(vert))
+            for (UINT32 neighbor : adjacency->GetNeighborVerts(vert))
             {
                 if (func(neighbor))
                 {
-                    toExpand.push(neighbor);
+                    toExpand.push_back(neighbor);
                 }
             }
         }
     }
 
-    void FloodFillLowCurvatureRegions(_Inout_ vector<PerVertexData> *pVertexData, _In_ HalfEdgeMesh *halfEdge, _In_ XMFLOAT3 *normals, _In_ XMFLOAT3 *verts, UINT32 vertCount, _Out_ NBest<cMaxPlanesPerSurface, PlaneData> *bestPlanes)
+    void FloodFillLowCurvatureRegions(_Inout_ ScratchVector<PerVertexData> *pVertexData, _In_ const VertexAdjacency *adjacency, _In_ XMFLOAT3 *normals, _In_ XMFLOAT3 *verts, UINT32 vertCount, _Out_ NBest<cMaxPlanesPerSurface, PlaneData> *bestPlanes)
     {
-        vector<PerVertexData> &vertexData = *pVertexData;
+        ScratchVector<PerVertexData> &vertexData = *pVertexData;
 
         UINT32 nextPlane = 1; // assign an id to planar regions
         for (UINT32 i = 0; i < vertCount; ++i)
         {
-            if (!halfEdge->IsCoallesced(i)) // don't process coallesced vertices
+            if (vertexData[i].plane == INVALID_PLANE && vertexData[i].Curvature < cLowCurvatureThreshold)
             {
-                if (vertexData[i].plane == INVALID_PLANE && vertexData[i].Curvature < cLowCurvatureThreshold)
+                // this vertex is not already labelled - start a new region
+                vertexData[i].plane = nextPlane;
+                const XMFLOAT3 normal = normals[i];
+                PlaneData planeData = PlaneData(nextPlane, i, normal);
+
+                // flood fill neighbors with low enough curvature
+                FloodFillVertices(adjacency, i, [&](UINT32 vert)
                 {
-                    // this vertex is not already labelled - start a new region
-                    vertexData[i].plane = nextPlane;
-                    const XMFLOAT3 normal = normals[i];
-                    const XMFLOAT3 vertex = verts[i];
-                    PlaneData planeData = PlaneData(nextPlane, i, normal);
-
-                    // flood fill neighbors with low enough curvature
-                    FloodFillVertices(halfEdge, i, [&](UINT32 vert)
+                    bool ret = ((vertexData[vert].plane == INVALID_PLANE) &&
+                        (vertexData[vert].Curvature < cLowCurvatureThreshold) &&
+                        (Dot(normals[vert], normal) > cMaxDotForNeighbors));
+
+                    if (ret)
                     {
-                        bool ret = ((vertexData[vert].plane == INVALID_PLANE) &&
-                            (vertexData[vert].Curvature < cLowCurvatureThreshold) &&
-                            (Dot(normals[vert], normal) > cMaxDotForNeighbors));
+                        vertexData[vert].plane = nextPlane;
+                        planeData.AddVertex(verts[vert]);
+                    }
+
+                    return ret; // add continue filling this node
+                });
+
+                // we could get a plane with low number of verts - we require at least 3
+                if (planeData.GetNumVertices() > cMinVertsPerPlane)
+                {
+                    bestPlanes->Add(planeData);
+                }
+
+                nextPlane++;
+            }
+        }
+    }
+
+    // Returns the root of x's set. Every parent has a lower index than its child, so the root of a set is its lowest
+    // vertex. Path halving only ever points a vertex at one of its ancestors, which keeps it safe while other threads
+    // are linking sets.
+    UINT32 FindRegionRoot(_Inout_ atomic<UINT32> *parents, UINT32 x)
+    {
+        for (;;)
+        {
+            UINT32 parent = parents[x].load(memory_order_relaxed);
+            if (parent == x)
+            {
+                return x;
+            }
+
+            UINT32 grandparent = parents[parent].load(memory_order_relaxed);
+            if (grandparent != parent)
+            {
+                parents[x].compare_exchange_weak(parent, grandparent, memory_order_relaxed);
+            }
+            x = grandparent;
+        }
+    }
+
+    // Merges the sets of a and b by linking the higher root below the lower one. The link only succeeds while the
+    // higher root is still a root, otherwise both roots are looked up again.
+    void UnionRegions(_Inout_ atomic<UINT32> *parents, UINT32 a, UINT32 b)
+    {
+        for (;;)
+        {
+            a = FindRegionRoot(parents, a);
+            b = FindRegionRoot(parents, b);
+            if (a == b)
+            {
+                return;
+            }
+
+            if (a < b)
+            {
+                swap(a, b);
+            }
 
-                        if (ret)
+            UINT32 expected = a;
+            if (parents[a].compare_exchange_strong(expected, b))
+            {
+                return;
+            }
+        }
+    }
+
+    // Labels the same low curvature regions as FloodFillLowCurvatureRegions with connected components instead of a
+    // flood fill per seed. The flood fill compares every vertex against the normal of the seed it started from, which
+    // is not a relation between neighbours and cannot be unioned directly, so this is a two-pass approximation:
+    //  * neighbouring low curvature vertices whose normals pass cMaxDotForNeighbors against each other are unioned in
+    //    parallel. The root of each set is its lowest vertex, which is the seed the flood fill would have started from.
+    //  * a serial sweep in vertex order then numbers the regions in seed order, drops the vertices whose normal fails
+    //    cMaxDotForNeighbors against their seed's normal, and accumulates each region's sum and count.
+    // The result does not depend on scheduling. It differs from the flood fill when a region drifts around a gentle
+    // curve: vertices the flood fill would have given to a later seed are left unlabelled here, and adjacency is
+    // treated as undirected.
+    void LabelLowCurvatureRegions(_Inout_ ScratchVector<PerVertexData> *pVertexData, _In_ const VertexAdjacency *adjacency, _In_ XMFLOAT3 *normals, _In_ XMFLOAT3 *verts, UINT32 vertCount, _Out_ NBest<cMaxPlanesPerSurface, PlaneData> *bestPlanes)
+    {
+        ScratchArenaScope scope;
+        ScratchVector<PerVertexData> &vertexData = *pVertexData;
+
+        auto isCandidate = [&](UINT32 vert)
+        {
+            return vertexData[vert].Curvature < cLowCurvatureThreshold;
+        };
+
+        atomic<UINT32>* parents = scope.Arena().AllocateArray<atomic<UINT32>>(vertCount);
+        ForEachVertexRange(vertCount, [&](UINT32 begin, UINT32 end)
+        {
+            for (UINT32 i = begin; i < end; ++i)
+            {
+                parents[i].store(i, memory_order_relaxed);
+            }
+        });
+
+        ForEachVertexRange(vertCount, [&](UINT32 begin, UINT32 end)
+        {
+            for (UINT32 i = begin; i < end; ++i)
+            {
+                if (isCandidate(i))
+                {
+                    for (UINT32 neighbor : adjacency->GetNeighborVerts(i))
+                    {
+                        if (neighbor != i && isCandidate(neighbor) && Dot(normals[i], normals[neighbor]) > cMaxDotForNeighbors)
                         {
-                            vertexData[vert].plane = nextPlane;
-                            planeData.AddVertex(verts[vert]);
+                            UnionRegions(parents, i, neighbor);
                         }
+                    }
+                }
+            }
+        });
 
-                        return ret; // add continue filling this node
-                    });
+        // roots come before the rest of their set, so each region exists by the time its members are reached.
+        ScratchVector<PlaneData> regions(scope.Arena());
+        for (UINT32 i = 0; i < vertCount; ++i)
+        {
+            if (isCandidate(i))
+            {
+                UINT32 root = FindRegionRoot(parents, i);
+                if (root == i)
+                {
+                    // like the flood fill, the seed is not counted towards its own region.
+                    regions.push_back(PlaneData(static_cast<UINT32>(regions.size()) + 1, i, normals[i]));
+                    vertexData[i].plane = static_cast<UINT32>(regions.size());
+                }
+                else if (Dot(normals[i], normals[root]) > cMaxDotForNeighbors)
+                {
+                    UINT32 planeId = vertexData[root].plane;
+                    vertexData[i].plane = planeId;
+                    regions[planeId - 1].AddVertex(verts[i]);
+                }
+            }
+        }
+
+        for (PlaneData &region : regions)
+        {
+            if (region.GetNumVertices() > cMinVertsPerPlane)
+            {
+                bestPlanes->Add(region);
+            }
+        }
+    }
 
-                    // we could get a plane with low number of verts - we require at least 3
-                    if (planeData.GetNumVertices() > cMinVertsPerPlane)
+    RegionLabellingComparison CompareRegionLabelling(_In_ const MeshData& mesh)
+    {
+        ScratchArenaScope scope;
+        UINT32 vertCount = mesh.vertCount;
+
+        // the stages before labelling, as FindPlanesInMesh runs them without simplification
+        VertexAdjacency adjacency(scope.Arena(), vertCount, mesh.indexCount, mesh.indices);
+        ScratchVector<float> curvatures(scope.Arena());
+        FillVertexCurvatures(&curvatures, &adjacency, mesh.normals, vertCount);
+        SmoothCurvatures(&curvatures, &adjacency, vertCount);
+        ScratchVector<PerVertexData> labelled(vertCount, scope.Arena());
+        for (UINT32 i = 0; i < vertCount; ++i)
+        {
+            labelled[i] = { curvatures[i], INVALID_PLANE };
+        }
+        ScratchVector<PerVertexData> floodFilled = labelled;
+
+        RegionLabellingComparison comparison;
+        comparison.vertCount = vertCount;
+
+        LARGE_INTEGER start;
+        QueryPerformanceCounter(&start);
+        NBest<cMaxPlanesPerSurface, PlaneData> components;
+        LabelLowCurvatureRegions(&labelled, &adjacency, mesh.normals, mesh.verts, vertCount, &components);
+        comparison.unionFindMilliseconds = LapMilliseconds(&start);
+        NBest<cMaxPlanesPerSurface, PlaneData> floodFillPlanes;
+        FloodFillLowCurvatureRegions(&floodFilled, &adjacency, mesh.normals, mesh.verts, vertCount, &floodFillPlanes);
+        comparison.floodFillMilliseconds = LapMilliseconds(&start);
+
+        // region ids are numbered differently, so compare which vertices were labelled and which pairs of
+        // neighbours were put in the same region.
+        for (UINT32 i = 0; i < vertCount; ++i)
+        {
+            bool inFloodFill = floodFilled[i].plane != INVALID_PLANE;
+            bool inComponents = labelled[i].plane != INVALID_PLANE;
+            if (inFloodFill && inComponents)
+            {
+                comparison.labelledByBoth++;
+                for (UINT32 neighbor : adjacency.GetNeighborVerts(i))
+                {
+                    bool sameInFloodFill = floodFilled[neighbor].plane == floodFilled[i].plane;
+                    bool sameInComponents = labelled[neighbor].plane == labelled[i].plane;
+                    if (sameInFloodFill == sameInComponents)
                     {
-                        bestPlanes->Add(planeData);
+                        comparison.neighborsAgreeing++;
+                    }
+                    else
+                    {
+                        comparison.neighborsDiffering++;
                     }
-
-                    nextPlane++;
                 }
             }
+            else if (inFloodFill != inComponents)
+            {
+                comparison.labelledByOne++;
+            }
+        }
+        return comparison;
+    }
+
+    // Fills planeIndices so planeIndices[id] is the position in bestPlanes of the plane with that id, for every plane
+    // that is not ignored. Other ids map to INVALID_PLANE, or lie past the end.
+    void MapPlaneIdsToIndices(_Inout_ NBest<cMaxPlanesPerSurface, PlaneData> *bestPlanes, _Out_ ScratchVector<UINT32> *planeIndices)
+    {
+        UINT32 maxPlaneId = 0;
+        for (UINT32 i = 0; i < bestPlanes->num; ++i)
+        {
+            if (!(*bestPlanes)[i].ShouldIgnorePlane())
+            {
+                maxPlaneId = max(maxPlaneId, (*bestPlanes)[i].GetPlaneId());
+            }
+        }
+
+        planeIndices->assign(maxPlaneId + 1, INVALID_PLANE);
+        for (UINT32 i = 0; i < bestPlanes->num; ++i)
+        {
+            if (!(*bestPlanes)[i].ShouldIgnorePlane())
+            {
+                (*planeIndices)[(*bestPlanes)[i].GetPlaneId()] = i;
+            }
         }
     }
 
-    void GeneratePlaneEquations(_Inout_ vector<PerVertexData> *pVertexData, _In_ HalfEdgeMesh *halfEdge, UINT32 vertCount, _In_ XMFLOAT3 *verts, _Inout_ NBest<cMaxPlanesPerSurface, PlaneData> *bestPlanes, _In_ const float MeshToMetersScale, _In_ float snapToGravityThreshold, _In_ const XMVECTOR& vUpInSurfaceSpace)
+    void GeneratePlaneEquations(_Inout_ ScratchVector<PerVertexData> *pVertexData, UINT32 vertCount, _In_ XMFLOAT3 *verts, _Inout_ NBest<cMaxPlanesPerSurface, PlaneData> *bestPlanes, _In_ const float MeshToMetersScale, _In_ float snapToGravityThreshold, _In_ const XMVECTOR& vUpInSurfaceSpace)
     {
-        map<UINT32, PCAHelper> pcaMap;
+        ScratchArenaScope scope;
+        ScratchVector<UINT32> planeIndices(scope.Arena());
+        MapPlaneIdsToIndices(bestPlanes, &planeIndices);
 
         // generate the plane equation for each plane
+        ScratchVector<PCAHelper> pcas(bestPlanes->num, scope.Arena());
         for (unsigned int i = 0; i < bestPlanes->num; ++i)
         {
-            PCAHelper pca;
-            pca.SetMean(bestPlanes->best[i].GetMean());
-            pcaMap[bestPlanes->best[i].GetPlaneId()] = pca;
+            pcas[i].SetMean((*bestPlanes)[i].GetMean());
         }
 
         for (unsigned int i = 0; i < vertCount; ++i)
         {
-            if (!halfEdge->IsCoallesced(i)) // don't process coallesced vertices
+            UINT32 plane = (*pVertexData)[i].plane;
+            if (plane < planeIndices.size() && planeIndices[plane] != INVALID_PLANE)
             {
-                auto pca = pcaMap.find((*pVertexData)[i].plane);
-                if (pca != pcaMap.end())
-                {
-                    XMFLOAT3 vert;
-                    XMStoreFloat3(&vert, XMLoadFloat3(&verts[i]));
-                    pca->second.AddVertex(vert);
-                }
+                pcas[planeIndices[plane]].AddVertex(verts[i]);
             }
         }
 
+        PCAHelper::SolveAll(pcas.data(), bestPlanes->num);
+
         for (unsigned int i = 0; i < bestPlanes->num; ++i)
         {
-            auto pca = pcaMap[bestPlanes->best[i].GetPlaneId()];
-            pca.Solve();
+            PCAHelper &pca = pcas[i];
             XMFLOAT3 stdDevs = pca.GetStandardDeviations();
             if (stdDevs.x < cMinimumPlaneSize / MeshToMetersScale || stdDevs.y < cMinimumPlaneSize / MeshToMetersScale)
             {
                 // throw this plane away - it is not large enough in one of the tangent directions
-                bestPlanes->best[i].IgnorePlane();
+                (*bestPlanes)[i].IgnorePlane();
             }
             else
             {
@@ -412,17 +647,22 @@ namespace PlaneFinding
 
                 if (snapToGravityThreshold != 0.0f)
                 {
-                    bool isGravityAligned = SnapToGravity(&plane, &tangent, bestPlanes->best[i].GetMean(), snapToGravityThreshold, vUpInSurfaceSpace);
-                    bestPlanes->best[i].SetIsGravityAligned(isGravityAligned);
+                    bool isGravityAligned = SnapToGravity(&plane, &tangent, (*bestPlanes)[i].GetMean(), snapToGravityThreshold, vUpInSurfaceSpace);
+                    (*bestPlanes)[i].SetIsGravityAligned(isGravityAligned);
                 }
 
-                bestPlanes->best[i].SetPlaneEquationData(plane, tangent);
+                (*bestPlanes)[i].SetPlaneEquationData(plane, tangent);
             }
         }
     }
 
-    void FloodFillPlaneEquation(_Inout_ vector<PerVertexData> *pVertexData, UINT32 vertCount, _In_ HalfEdgeMesh *halfEdge, _In_ XMFLOAT3 *normals, _In_ XMFLOAT3 *verts, _Inout_ NBest<cMaxPlanesPerSurface, PlaneData> *bestPlanes, const float meshToMetersScale)
+    void FloodFillPlaneEquation(_Inout_ ScratchVector<PerVertexData> *pVertexData, UINT32 vertCount, _In_ const VertexAdjacency *adjacency, _In_ XMFLOAT3 *normals, _In_ XMFLOAT3 *verts, _Inout_ NBest<cMaxPlanesPerSurface, PlaneData> *bestPlanes, const float meshToMetersScale)
     {
+        ScratchArenaScope scope;
+
+        // the vertices claimed by the plane being filled, so a rejected plane only has to reset its own vertices
+        ScratchVector<UINT32> claimed(scope.Arena());
+
         for (UINT32 i = 0; i < vertCount; ++i)
         {
             (*pVertexData)[i].plane = INVALID_PLANE;
@@ -432,19 +672,20 @@ namespace PlaneFinding
 
         for (UINT32 i = 0; i < bestPlanes->num; ++i)
         {
-            if (!bestPlanes->best[i].ShouldIgnorePlane())
+            if (!(*bestPlanes)[i].ShouldIgnorePlane())
             {
-                bestPlanes->best[i].ResetCountAndSum();
-                UINT32 startVert = bestPlanes->best[i].GetStartVertexIndex();
+                (*bestPlanes)[i].ResetCountAndSum();
+                UINT32 startVert = (*bestPlanes)[i].GetStartVertexIndex();
 
                 Plane planeEq;
                 XMFLOAT3 tangent;
-                bestPlanes->best[i].GetPlaneEquationData(&planeEq, &tangent);
+                (*bestPlanes)[i].GetPlaneEquationData(&planeEq, &tangent);
                 XMVECTOR plane = planeEq.AsVector();
 
-                UINT32 planeId = bestPlanes->best[i].GetPlaneId();
+                UINT32 planeId = (*bestPlanes)[i].GetPlaneId();
+                claimed.clear();
 
-                FloodFillVertices(halfEdge, startVert, [&](UINT32 vertIndex)
+                FloodFillVertices(adjacency, startVert, [&](UINT32 vertIndex)
                 {
                     // return true if
                     // 1. this vertex isn't already considered part of a plane (on the second pass)
@@ -463,123 +704,435 @@ namespace PlaneFinding
                     // if this vertex is close enough to our plane equation
                     if (expand)
                     {
-                        bestPlanes->best[i].AddVertexAndUpdateBounds(verts[vertIndex], vertIndex);
+                        (*bestPlanes)[i].AddVertexAndUpdateBounds(verts[vertIndex], vertIndex);
                         (*pVertexData)[vertIndex].plane = planeId;
+                        claimed.push_back(vertIndex);
                     }
                     return expand;
                 });
 
-                if (bestPlanes->best[i].GetNumVertices() < 4)
+                if ((*bestPlanes)[i].GetNumVertices() < 4)
                 {
-                    bestPlanes->best[i].IgnorePlane();
+                    (*bestPlanes)[i].IgnorePlane();
 
                     // Reset the planeId for the verts that were part of this plane
-                    for (UINT32 vertIndex = 0; vertIndex < vertCount; ++vertIndex)
+                    for (UINT32 vertIndex : claimed)
                     {
-                        if ((*pVertexData)[vertIndex].plane == planeId)
-                        {
-                            (*pVertexData)[vertIndex].plane = INVALID_PLANE;
-                        }
+                        (*pVertexData)[vertIndex].plane = INVALID_PLANE;
                     }
                 }
             }
         }
     }
 
-    float GetArea(_In_ UINT32 plane, _In_ vector<UINT32> &vertexPlaneMapping, _In_ UINT32 numIndices, _In_ XMFLOAT3 *verts, _In_ INT32 *indices)
+    // What the output needs to know about a kept plane, gathered for all of them at once.
+    struct PlaneStatistics
     {
-        float calcArea = 0.0;
-        for (UINT32 i = 0; i < numIndices; i += 3)
+        UINT32 firstVert = 0; // the plane's vertices, transformed into its plane space, start here in vertsInPlaneSpace
+        UINT32 numVerts = 0;
+        float area = 0.0f; // area of the triangles whose vertices all belong to the plane, in mesh space
+    };
+
+    // Fills one PlaneStatistics per plane in bestPlanes (ignored planes stay empty) with sweeps over the vertices and
+    // the triangles, instead of scanning the whole mesh again for every plane. The planes' vertices are stored one
+    // plane after another in vertsInPlaneSpace.
+    void GatherPlaneStatistics(_Inout_ NBest<cMaxPlanesPerSurface, PlaneData> *bestPlanes, _In_ const ScratchVector<UINT32> &vertexPlaneMapping, _In_ XMFLOAT3 *verts, UINT32 vertCount, _In_ INT32 *indices, UINT32 numIndices, _Out_writes_(cMaxPlanesPerSurface) PlaneStatistics *statistics, _Out_ ScratchVector<XMFLOAT3> *vertsInPlaneSpace)
+    {
+        ScratchArenaScope scope;
+        ScratchVector<UINT32> planeIndices(scope.Arena());
+        MapPlaneIdsToIndices(bestPlanes, &planeIndices);
+
+        XMMATRIX meshToPlaneTransforms[cMaxPlanesPerSurface];
+        for (UINT32 i = 0; i < bestPlanes->num; ++i)
+        {
+            statistics[i] = PlaneStatistics();
+            if (!(*bestPlanes)[i].ShouldIgnorePlane())
+            {
+                meshToPlaneTransforms[i] = (*bestPlanes)[i].GetMeshToPlaneRotation();
+            }
+        }
+
+        auto planeIndexOf = [&](UINT32 planeId)
         {
-            if (vertexPlaneMapping[indices[i]] == plane &&
-                vertexPlaneMapping[indices[i]] == vertexPlaneMapping[indices[i + 1]] &&
-                vertexPlaneMapping[indices[i]] == vertexPlaneMapping[indices[i + 2]])
+            return planeId < planeIndices.size() ? planeIndices[planeId] : INVALID_PLANE;
+        };
+
+        // count the vertices of each plane to lay out their ranges, then fill them in
+        for (UINT32 i = 0; i < vertCount; ++i)
+        {
+            UINT32 planeIndex = planeIndexOf(vertexPlaneMapping[i]);
+            if (planeIndex != INVALID_PLANE)
             {
-                // all vertices are in the same plane - not part of the remainder
-                XMVECTOR v1 = XMLoadFloat3(verts + indices[i]);
-                XMVECTOR v2 = XMLoadFloat3(verts + indices[i + 1]);
-                XMVECTOR v3 = XMLoadFloat3(verts + indices[i + 2]);
-                calcArea += XMVectorGetX(XMVector3Length(XMVector3Cross(v3 - v2, v3 - v1))) / 2.0f;
+                statistics[planeIndex].numVerts++;
             }
         }
 
-        return calcArea;
+        UINT32 totalVerts = 0;
+        for (UINT32 i = 0; i < bestPlanes->num; ++i)
+        {
+            statistics[i].firstVert = totalVerts;
+            totalVerts += statistics[i].numVerts;
+            statistics[i].numVerts = 0;
+        }
+        vertsInPlaneSpace->resize(totalVerts);
+
+        for (UINT32 i = 0; i < vertCount; ++i)
+        {
+            UINT32 planeIndex = planeIndexOf(vertexPlaneMapping[i]);
+            if (planeIndex != INVALID_PLANE)
+            {
+                PlaneStatistics &plane = statistics[planeIndex];
+                XMStoreFloat3(&(*vertsInPlaneSpace)[plane.firstVert + plane.numVerts++], XMVector3TransformCoord(XMLoadFloat3(verts + i), meshToPlaneTransforms[planeIndex]));
+            }
+        }
+
+        for (UINT32 i = 0; i + 2 < numIndices; i += 3)
+        {
+            UINT32 plane = vertexPlaneMapping[indices[i]];
+            if (plane == vertexPlaneMapping[indices[i + 1]] &&
+                plane == vertexPlaneMapping[indices[i + 2]])
+            {
+                UINT32 planeIndex = planeIndexOf(plane);
+                if (planeIndex != INVALID_PLANE)
+                {
+                    // all vertices are in the same plane - not part of the remainder
+                    XMVECTOR v1 = XMLoadFloat3(verts + indices[i]);
+                    XMVECTOR v2 = XMLoadFloat3(verts + indices[i + 1]);
+                    XMVECTOR v3 = XMLoadFloat3(verts + indices[i + 2]);
+                    statistics[planeIndex].area += XMVectorGetX(XMVector3Length(XMVector3Cross(v3 - v2, v3 - v1))) / 2.0f;
+                }
+            }
+        }
     }
 
-    vector<BoundedPlane> FindPlanes(
-        _In_ INT32 numMeshes,
-        _In_count_(numMeshes) MeshData* meshes,
-        _In_ float snapToGravityThreshold)
+    // A mesh simplified by vertex clustering: one vertex for each occupied cell of a grid, at the mean position of the
+    // vertices in the cell and with their mean normal. Triangles that collapse are dropped.
+    struct SimplifiedMesh
     {
-        vector<BoundedPlane> planes;
+        ScratchVector<XMFLOAT3> verts;
+        ScratchVector<XMFLOAT3> normals;
+        ScratchVector<INT32> indices;
+        ScratchVector<UINT32> clusterOf; // the simplified vertex each vertex of the full mesh was merged into
 
-        for (int i = 0; i < numMeshes; ++i)
-        {
-            UINT32 vertCount = meshes[i].vertCount;
-            UINT32 numIndices = meshes[i].indexCount;
-            XMFLOAT3 *verts = meshes[i].verts;
-            XMFLOAT3 *normals = meshes[i].normals;
-            INT32* indices = meshes[i].indices;
-            XMFLOAT4X4 transform = meshes[i].transform;
+        SimplifiedMesh(ScratchArena &arena) : verts(arena), normals(arena), indices(arena), clusterOf(arena) {}
+    };
 
-            vector<PerVertexData> vertexData;
-            vertexData.reserve(vertCount);
+    void SimplifyMesh(_In_ const MeshData& mesh, float cellSize, _Inout_ SimplifiedMesh *simplified)
+    {
+        ScratchArenaScope scope;
+        UINT32 vertCount = mesh.vertCount;
 
-            HalfEdgeMesh halfEdge = HalfEdgeMesh(vertCount, numIndices, reinterpret_cast<array<INT32, VERTICES_PER_TRIANGLE>*>(indices));
+        XMVECTOR minimum = XMVectorReplicate(FLT_MAX);
+        for (UINT32 i = 0; i < vertCount; ++i)
+        {
+            minimum = XMVectorMin(minimum, XMLoadFloat3(mesh.verts + i));
+        }
 
-            XMMATRIX surfaceToObserver = XMLoadFloat4x4(&transform);
-            float meshToMetersScale = XMVectorGetX(XMVector3Length(surfaceToObserver.r[0]));
+        // clusters are found through an open addressing hash of their keys, at most half full, and numbered in the
+        // order of their first vertex, so the simplified mesh only depends on the order of the vertices
+        UINT32 tableSize = 16;
+        while (tableSize < vertCount * 2)
+        {
+            tableSize *= 2;
+        }
+        const UINT32 tableMask = tableSize - 1;
+        ScratchVector<UINT32> table(tableSize, INVALID_PLANE, scope.Arena());
+        ScratchVector<UINT64> clusterKeys(scope.Arena());
+        ScratchVector<UINT32> counts(scope.Arena());
+
+        simplified->clusterOf.resize(vertCount);
+        const XMVECTOR inverseCellSize = XMVectorReplicate(1.0f / cellSize);
+        const XMVECTOR maxCell = XMVectorReplicate(float((1 << 20) - 1));
+        for (UINT32 i = 0; i < vertCount; ++i)
+        {
+            // the vertex's cell, packed 20 bits per axis, measured from the lowest corner of the mesh, and below it the
+            // axis and sign its normal points along most. Vertices on either side of a crease, such as the edge of a
+            // box, then stay apart, and the faces keep their own normals up to the edge.
+            XMFLOAT3 cell;
+            XMStoreFloat3(&cell, XMVectorMin(XMVectorFloor((XMLoadFloat3(mesh.verts + i) - minimum) * inverseCellSize), maxCell));
+            const XMFLOAT3 &normal = mesh.normals[i];
+            UINT32 axis = (fabsf(normal.x) >= fabsf(normal.y) && fabsf(normal.x) >= fabsf(normal.z)) ? 0 : (fabsf(normal.y) >= fabsf(normal.z) ? 1 : 2);
+            UINT32 direction = axis * 2 + ((&normal.x)[axis] < 0.0f ? 1 : 0);
+            UINT64 key = direction | (UINT64(cell.x) << 3) | (UINT64(cell.y) << 23) | (UINT64(cell.z) << 43);
+
+            UINT32 slot = static_cast<UINT32>((key * 0x9e3779b97f4a7c15ull) >> 32) & tableMask;
+            while (table[slot] != INVALID_PLANE && clusterKeys[table[slot]] != key)
+            {
+                slot = (slot + 1) & tableMask;
+            }
+            if (table[slot] == INVALID_PLANE)
+            {
+                table[slot] = static_cast<UINT32>(clusterKeys.size());
+                clusterKeys.push_back(key);
+                simplified->verts.push_back(XMFLOAT3(0.0f, 0.0f, 0.0f));
+                simplified->normals.push_back(XMFLOAT3(0.0f, 0.0f, 0.0f));
+                counts.push_back(0);
+            }
 
-            // First we calculate the curvature for every vertex
-            FillVertexCurvatures(&vertexData, &halfEdge, normals, vertCount);
-            SmoothCurvatures(&vertexData, &halfEdge, vertCount);
+            UINT32 cluster = table[slot];
+            simplified->clusterOf[i] = cluster;
+            XMStoreFloat3(&simplified->verts[cluster], XMLoadFloat3(&simplified->verts[cluster]) + XMLoadFloat3(mesh.verts + i));
+            XMStoreFloat3(&simplified->normals[cluster], XMLoadFloat3(&simplified->normals[cluster]) + XMLoadFloat3(mesh.normals + i));
+            counts[cluster]++;
+        }
+
+        for (UINT32 i = 0; i < simplified->verts.size(); ++i)
+        {
+            XMStoreFloat3(&simplified->verts[i], XMLoadFloat3(&simplified->verts[i]) / float(counts[i]));
 
-            // Next, we flood-fill planar regions, and select the best regions
-            NBest<cMaxPlanesPerSurface, PlaneData> bestPlanes;
-            FloodFillLowCurvatureRegions(&vertexData, &halfEdge, normals, verts, vertCount, &bestPlanes);
+            // normals that cancel out, on a thin sheet seen from both sides, leave a zero normal, which no plane accepts
+            XMStoreFloat3(&simplified->normals[i], XMVector3Normalize(XMLoadFloat3(&simplified->normals[i])));
+        }
 
-            // and we then generate the plane equation
-            XMMATRIX observerToSurface = XMMatrixInverse(nullptr, surfaceToObserver);
-            XMVECTOR vUpInSurfaceSpace = XMVector3Normalize(XMVector3TransformNormal(cUpDirection, observerToSurface));
-            GeneratePlaneEquations(&vertexData, &halfEdge, vertCount, verts, &bestPlanes, meshToMetersScale, snapToGravityThreshold, vUpInSurfaceSpace);
+        for (UINT32 i = 0; i + 2 < static_cast<UINT32>(mesh.indexCount); i += 3)
+        {
+            INT32 a = static_cast<INT32>(simplified->clusterOf[mesh.indices[i]]);
+            INT32 b = static_cast<INT32>(simplified->clusterOf[mesh.indices[i + 1]]);
+            INT32 c = static_cast<INT32>(simplified->clusterOf[mesh.indices[i + 2]]);
+            if (a != b && b != c && a != c)
+            {
+                simplified->indices.push_back(a);
+                simplified->indices.push_back(b);
+                simplified->indices.push_back(c);
+            }
+        }
+    }
 
-            // once we have plane equations, re-floodfill to generate our final set of vertices, and bounds
-            // this can occur in a member when the data is being consumed
-            FloodFillPlaneEquation(&vertexData, vertCount, &halfEdge, normals, verts, &bestPlanes, meshToMetersScale);
+    // Gives each vertex of the full mesh the plane of the simplified vertex it was merged into, as long as it is as
+    // close to the plane, and faces it as closely, as FloodFillPlaneEquation requires.
+    void ReattachVertices(_In_ const MeshData& mesh, _In_ const SimplifiedMesh &simplified, _In_ const ScratchVector<UINT32> &simplifiedPlaneMapping, _In_ NBest<cMaxPlanesPerSurface, PlaneData> *bestPlanes, const float meshToMetersScale, _Inout_ ScratchVector<UINT32> *vertexPlaneMapping)
+    {
+        ScratchArenaScope scope;
+        ScratchVector<UINT32> planeIndices(scope.Arena());
+        MapPlaneIdsToIndices(bestPlanes, &planeIndices);
 
-            vector<UINT32> vertexPlaneMapping = vector<UINT32>(vertCount);
-            for (UINT32 i = 0; i < vertCount; ++i)
+        XMVECTOR planeEquations[cMaxPlanesPerSurface];
+        for (UINT32 i = 0; i < bestPlanes->num; ++i)
+        {
+            if (!(*bestPlanes)[i].ShouldIgnorePlane())
             {
-                // we color vertices according to their coallesced vertex's color
-                vertexPlaneMapping[i] = vertexData[halfEdge.m_spVertices[i] != nullptr ? halfEdge.m_spVertices[i]->vertex : i].plane;
+                Plane planeEq;
+                XMFLOAT3 tangent;
+                (*bestPlanes)[i].GetPlaneEquationData(&planeEq, &tangent);
+                planeEquations[i] = planeEq.AsVector();
             }
+        }
+
+        const float cMaxDistanceFromPlaneInMeshSpace = cMaxDistanceFromPlane / meshToMetersScale;
 
-            // now that we have our "best" planes, create the WinRT objects that expose our data
-            for (unsigned int i = 0; i < bestPlanes.num; ++i)
+        UINT32 reattachedVerts[cMaxPlanesPerSurface] = {};
+        vertexPlaneMapping->assign(mesh.vertCount, INVALID_PLANE);
+        for (UINT32 i = 0; i < static_cast<UINT32>(mesh.vertCount); ++i)
+        {
+            UINT32 planeId = simplifiedPlaneMapping[simplified.clusterOf[i]];
+            UINT32 planeIndex = planeId < planeIndices.size() ? planeIndices[planeId] : INVALID_PLANE;
+            if (planeIndex != INVALID_PLANE)
             {
-                if (!bestPlanes.best[i].ShouldIgnorePlane())
+                float distance = XMVectorGetX(XMVectorAbs(XMPlaneDotCoord(planeEquations[planeIndex], XMLoadFloat3(mesh.verts + i))));
+                float cosAngle = XMVectorGetX(XMPlaneDotNormal(planeEquations[planeIndex], XMLoadFloat3(mesh.normals + i)));
+                if (distance < cMaxDistanceFromPlaneInMeshSpace && cosAngle > cMinCosAngleBetweenNormalAndPlane)
                 {
-                    Plane planeEq;
-                    XMFLOAT3 tangent;
-                    bestPlanes.best[i].GetPlaneEquationData(&planeEq, &tangent);
+                    (*vertexPlaneMapping)[i] = planeId;
+                    reattachedVerts[planeIndex]++;
+                }
+            }
+        }
 
-                    XMVECTOR planeInObserverSpace = XMPlaneNormalize(TransformPlaneBetweenSpaces(planeEq.AsVector(), surfaceToObserver));
-                    planeEq.StoreVector(planeInObserverSpace);
+        // a plane fitted to merged vertices can lie between the full mesh's vertices, as on a surface that zigzags
+        // finer than the cells, and keep too few of them to count as a plane
+        for (UINT32 i = 0; i < bestPlanes->num; ++i)
+        {
+            if (reattachedVerts[i] <= cMinVertsPerPlane)
+            {
+                (*bestPlanes)[i].IgnorePlane();
+            }
+        }
+    }
+
+    // Finds the planes of a single mesh and appends them to planes.
+    void FindPlanesInMesh(
+        _In_ const MeshData& mesh,
+        _In_ float snapToGravityThreshold,
+        _In_ const FindPlanesOptions& options,
+        _Inout_ vector<BoundedPlane>* planes,
+        _Inout_opt_ FindPlanesTimings* timings)
+    {
+        UINT32 vertCount = mesh.vertCount;
+        UINT32 numIndices = mesh.indexCount;
+        XMFLOAT3 *verts = mesh.verts;
+        XMFLOAT3 *normals = mesh.normals;
+        INT32* indices = mesh.indices;
+        XMFLOAT4X4 transform = mesh.transform;
+
+        // all the working memory for this mesh comes from the scope's arena, and is released when it ends
+        ScratchArenaScope scope;
+
+        FindPlanesTimings stageTimings;
+        LARGE_INTEGER stageStart;
+        QueryPerformanceCounter(&stageStart);
+
+        XMMATRIX surfaceToObserver = XMLoadFloat4x4(&transform);
+        float meshToMetersScale = XMVectorGetX(XMVector3Length(surfaceToObserver.r[0]));
+
+        // with simplification, everything up to the bounds works on the simplified mesh
+        bool simplify = options.simplifyCellScale > 0.0f && vertCount > 0;
+        SimplifiedMesh simplified(scope.Arena());
+        if (simplify)
+        {
+            SimplifyMesh(mesh, options.simplifyCellScale * cMaxDistanceFromPlane / meshToMetersScale, &simplified);
+            vertCount = static_cast<UINT32>(simplified.verts.size());
+            numIndices = static_cast<UINT32>(simplified.indices.size());
+            verts = simplified.verts.data();
+            normals = simplified.normals.data();
+            indices = simplified.indices.data();
+            stageTimings.simplify = LapMilliseconds(&stageStart);
+        }
 
-                    BoundingOrientedBox xmBoundsInMeshSpace = bestPlanes.best[i].GetBoundsInMeshSpace(verts, vertCount, vertexPlaneMapping.data());
-                    BoundingOrientedBox xmBoundsInObserverSpace;
-                    xmBoundsInMeshSpace.Transform(xmBoundsInObserverSpace, surfaceToObserver);
+        VertexAdjacency adjacency(scope.Arena(), vertCount, numIndices, indices);
+        stageTimings.adjacency = LapMilliseconds(&stageStart);
 
-                    float area = GetArea(bestPlanes.best[i].GetPlaneId(), vertexPlaneMapping, numIndices, verts, indices);
+        // First we calculate the curvature for every vertex
+        ScratchVector<float> curvatures(scope.Arena());
+        FillVertexCurvatures(&curvatures, &adjacency, normals, vertCount);
+        stageTimings.curvature = LapMilliseconds(&stageStart);
 
-                    // area is in mesh space - scale it to meters
-                    area *= meshToMetersScale * meshToMetersScale;
+        SmoothCurvatures(&curvatures, &adjacency, vertCount);
 
-                    planes.push_back({ planeEq, xmBoundsInObserverSpace, area });
-                }
+        ScratchVector<PerVertexData> vertexData(vertCount, scope.Arena());
+        for (UINT32 i = 0; i < vertCount; ++i)
+        {
+            vertexData[i] = { curvatures[i], INVALID_PLANE };
+        }
+        stageTimings.smoothing = LapMilliseconds(&stageStart);
+
+        // Next, we label planar regions, and select the best regions
+        NBest<cMaxPlanesPerSurface, PlaneData> bestPlanes;
+        LabelLowCurvatureRegions(&vertexData, &adjacency, normals, verts, vertCount, &bestPlanes);
+        stageTimings.regions = LapMilliseconds(&stageStart);
+
+        // and we then generate the plane equation
+        XMMATRIX observerToSurface = XMMatrixInverse(nullptr, surfaceToObserver);
+        XMVECTOR vUpInSurfaceSpace = XMVector3Normalize(XMVector3TransformNormal(cUpDirection, observerToSurface));
+        GeneratePlaneEquations(&vertexData, vertCount, verts, &bestPlanes, meshToMetersScale, snapToGravityThreshold, vUpInSurfaceSpace);
+        stageTimings.planeEquations = LapMilliseconds(&stageStart);
+
+        // once we have plane equations, re-floodfill to generate our final set of vertices, and bounds
+        // this can occur in a member when the data is being consumed
+        FloodFillPlaneEquation(&vertexData, vertCount, &adjacency, normals, verts, &bestPlanes, meshToMetersScale);
+        stageTimings.assignment = LapMilliseconds(&stageStart);
+
+        ScratchVector<UINT32> vertexPlaneMapping(vertCount, scope.Arena());
+        for (UINT32 i = 0; i < vertCount; ++i)
+        {
+            vertexPlaneMapping[i] = vertexData[i].plane;
+        }
+
+        if (simplify && options.reattachVertices)
+        {
+            ScratchVector<UINT32> simplifiedPlaneMapping(move(vertexPlaneMapping));
+            ReattachVertices(mesh, simplified, simplifiedPlaneMapping, &bestPlanes, meshToMetersScale, &vertexPlaneMapping);
+            vertCount = mesh.vertCount;
+            numIndices = mesh.indexCount;
+            verts = mesh.verts;
+            normals = mesh.normals;
+            indices = mesh.indices;
+            stageTimings.assignment += LapMilliseconds(&stageStart);
+        }
+
+        PlaneStatistics statistics[cMaxPlanesPerSurface];
+        ScratchVector<XMFLOAT3> vertsInPlaneSpace(scope.Arena());
+        GatherPlaneStatistics(&bestPlanes, vertexPlaneMapping, verts, vertCount, indices, numIndices, statistics, &vertsInPlaneSpace);
+
+        // now that we have our "best" planes, create the WinRT objects that expose our data
+        for (unsigned int i = 0; i < bestPlanes.num; ++i)
+        {
+            if (!bestPlanes[i].ShouldIgnorePlane())
+            {
+                Plane planeEq;
+                XMFLOAT3 tangent;
+                bestPlanes[i].GetPlaneEquationData(&planeEq, &tangent);
+
+                XMVECTOR planeInObserverSpace = XMPlaneNormalize(TransformPlaneBetweenSpaces(planeEq.AsVector(), surfaceToObserver));
+                planeEq.StoreVector(planeInObserverSpace);
+
+                BoundingOrientedBox xmBoundsInMeshSpace = bestPlanes[i].GetBoundsInMeshSpace(vertsInPlaneSpace.data() + statistics[i].firstVert, statistics[i].numVerts);
+                BoundingOrientedBox xmBoundsInObserverSpace;
+                xmBoundsInMeshSpace.Transform(xmBoundsInObserverSpace, surfaceToObserver);
+
+                float area = statistics[i].area;
+
+                // area is in mesh space - scale it to meters
+                area *= meshToMetersScale * meshToMetersScale;
+
+                planes->push_back({ planeEq, xmBoundsInObserverSpace, area });
+            }
+        }
+        stageTimings.bounds = LapMilliseconds(&stageStart);
+
+        if (timings != nullptr)
+        {
+            timings->Add(stageTimings);
+        }
+    }
+
+    vector<BoundedPlane> FindPlanes(
+        _In_ INT32 numMeshes,
+        _In_count_(numMeshes) MeshData* meshes,
+        _In_ float snapToGravityThreshold,
+        _Out_opt_ FindPlanesTimings* timings,
+        _In_ const FindPlanesOptions& options)
+    {
+        vector<BoundedPlane> planes;
+
+        if (timings != nullptr)
+        {
+            *timings = FindPlanesTimings();
+        }
+
+        if (options.engine == PlaneFindingEngine::Ransac)
+        {
+            FindPlanesRansac(numMeshes, meshes, snapToGravityThreshold, options.isCanceled, &planes, timings);
+            return planes;
+        }
+
+        const auto isCanceled = [&options] { return options.isCanceled && options.isCanceled(); };
+        if (numMeshes == 1)
+        {
+            if (isCanceled())
+            {
+                return planes;
+            }
+            FindPlanesInMesh(meshes[0], snapToGravityThreshold, options, &planes, timings);
+            return planes;
+        }
+
+        // meshes are independent, so each is processed on its own task with its own result vector. The results are
+        // concatenated in mesh order so the output does not depend on scheduling.
+        vector<vector<BoundedPlane>> planesPerMesh(max(numMeshes, 0));
+        vector<FindPlanesTimings> timingsPerMesh(max(numMeshes, 0));
+        concurrency::parallel_for(0, numMeshes, [&](int i)
+        {
+            if (!isCanceled())
+            {
+                FindPlanesInMesh(meshes[i], snapToGravityThreshold, options, &planesPerMesh[i], &timingsPerMesh[i]);
+            }
+        });
+
+        // a mesh skipped after cancellation would leave a gap, so nothing is returned.
+        if (isCanceled())
+        {
+            return planes;
+        }
+
+        for (int i = 0; i < numMeshes; ++i)
+        {
+            planes.insert(planes.end(), planesPerMesh[i].begin(), planesPerMesh[i].end());
+            if (timings != nullptr)
+            {
+                timings->Add(timingsPerMesh[i]);
             }
         }
 
         return planes;
     }
-}
+}
\ No newline at end of file
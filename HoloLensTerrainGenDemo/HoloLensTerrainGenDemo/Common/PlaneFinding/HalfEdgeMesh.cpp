@@ -22,17 +22,181 @@ namespace
 
 HalfEdgeMesh::~HalfEdgeMesh()
 {
-    for (HalfEdgeMesh::Edge* edge : m_spNewEdges)
+    // added edges are released with their blocks.
+}
+
+inline HalfEdgeMesh::Edge* HalfEdgeMesh::FindEdge(int32_t start, int32_t end) const
+{
+    if (m_outgoingEdgeCounts[start] < c_hashedEdgeCount)
+    {
+        return FindExistingEdge(m_spVertices[start], end);
+    }
+    return FindHashedEdge(start, end);
+}
+
+HalfEdgeMesh::Edge* HalfEdgeMesh::FindHashedEdge(int32_t start, int32_t end) const
+{
+    const uint64_t key = EdgeKey(start, end);
+    for (size_t index = EdgeSlotIndex(key); m_edgeTable[index].edge != nullptr; index = (index + 1) & (m_edgeTable.size() - 1))
+    {
+        if (m_edgeTable[index].key == key)
+        {
+            return m_edgeTable[index].edge;
+        }
+    }
+    return nullptr;
+}
+
+inline void HalfEdgeMesh::LinkEdge(int32_t start, _In_ HalfEdgeMesh::Edge* edge)
+{
+    if (m_spVertices[start])
     {
-        delete edge;
+        edge->nextVertexEdge = m_spVertices[start]->nextVertexEdge;
+        m_spVertices[start]->nextVertexEdge = edge;
+    }
+    else
+    {
+        m_spVertices[start] = edge;
+    }
+
+    if (++m_outgoingEdgeCounts[start] >= c_hashedEdgeCount)
+    {
+        HashLinkedEdge(start, edge);
     }
 }
 
+void HalfEdgeMesh::HashLinkedEdge(int32_t start, _In_ HalfEdgeMesh::Edge* edge)
+{
+    if (m_outgoingEdgeCounts[start] == c_hashedEdgeCount)
+    {
+        // the vertex just became high valence, so index all of its edges. Walking the list in order and keeping
+        // the first of any duplicates matches what the list walk would return.
+        for (Edge* vertexEdge = m_spVertices[start]; vertexEdge != nullptr; vertexEdge = vertexEdge->nextVertexEdge)
+        {
+            InsertEdge(start, vertexEdge->next->vertex, vertexEdge, true);
+        }
+    }
+    else
+    {
+        InsertEdge(start, edge->next->vertex, edge, false);
+    }
+}
+
+void HalfEdgeMesh::InsertEdge(int32_t start, int32_t end, _In_ HalfEdgeMesh::Edge* edge, bool keepExisting)
+{
+    // keep the table at most half full so probe sequences stay short.
+    if ((m_edgeTableCount + 1) * 2 > m_edgeTable.size())
+    {
+        vector<EdgeSlot> oldTable;
+        oldTable.swap(m_edgeTable);
+        m_edgeTable.assign(max<size_t>(64, oldTable.size() * 2), { 0, nullptr });
+        m_edgeTableShift = 64;
+        for (size_t capacity = m_edgeTable.size(); capacity > 1; capacity /= 2)
+        {
+            m_edgeTableShift--;
+        }
+
+        for (const EdgeSlot& slot : oldTable)
+        {
+            if (slot.edge != nullptr)
+            {
+                size_t index = EdgeSlotIndex(slot.key);
+                while (m_edgeTable[index].edge != nullptr)
+                {
+                    index = (index + 1) & (m_edgeTable.size() - 1);
+                }
+                m_edgeTable[index] = slot;
+            }
+        }
+    }
+
+    const uint64_t key = EdgeKey(start, end);
+    size_t index = EdgeSlotIndex(key);
+    while (m_edgeTable[index].edge != nullptr)
+    {
+        if (m_edgeTable[index].key == key)
+        {
+            m_duplicateEdgeCounts[start]++;
+
+            // a duplicate edge only happens in non-manifold meshes. New edges are linked in right after the head
+            // of the list, so the list walk finds the head if it matches and otherwise the newest match.
+            if (!keepExisting && m_edgeTable[index].edge != m_spVertices[start])
+            {
+                m_edgeTable[index].edge = edge;
+            }
+            return;
+        }
+        index = (index + 1) & (m_edgeTable.size() - 1);
+    }
+
+    m_edgeTable[index] = { key, edge };
+    m_edgeTableCount++;
+}
+
+void HalfEdgeMesh::EraseEdge(int32_t start, int32_t end)
+{
+    const size_t mask = m_edgeTable.size() - 1;
+    const uint64_t key = EdgeKey(start, end);
+
+    size_t index = EdgeSlotIndex(key);
+    while (m_edgeTable[index].edge != nullptr && m_edgeTable[index].key != key)
+    {
+        index = (index + 1) & mask;
+    }
+
+    if (m_edgeTable[index].edge == nullptr)
+    {
+        return;
+    }
+
+    // shift later entries of the probe sequence back into the hole rather than leaving a tombstone.
+    size_t hole = index;
+    for (size_t next = (hole + 1) & mask; m_edgeTable[next].edge != nullptr; next = (next + 1) & mask)
+    {
+        size_t home = EdgeSlotIndex(m_edgeTable[next].key);
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            m_edgeTable[hole] = m_edgeTable[next];
+            hole = next;
+        }
+    }
+
+    m_edgeTable[hole] = { 0, nullptr };
+    m_edgeTableCount--;
+}
+
+HalfEdgeMesh::Edge* HalfEdgeMesh::AllocateEdge()
+{
+    Edge* edge;
+    if (!m_freeEdges.empty())
+    {
+        edge = m_freeEdges.back();
+        m_freeEdges.pop_back();
+    }
+    else
+    {
+        if (m_edgesUsedInLastBlock == c_edgeBlockSize)
+        {
+            m_edgeBlocks.push_back(unique_ptr<Edge[]>(new Edge[c_edgeBlockSize]));
+            m_edgesUsedInLastBlock = 0;
+        }
+        edge = &m_edgeBlocks.back()[m_edgesUsedInLastBlock++];
+    }
+
+    *edge = Edge();
+    return edge;
+}
+
+void HalfEdgeMesh::FreeEdge(_In_ HalfEdgeMesh::Edge* edge)
+{
+    m_freeEdges.push_back(edge);
+}
+
 bool HalfEdgeMesh::AddTriangle(_In_ const TriangleINT32& triangle, _Out_ HalfEdgeMesh::Edge **edge)
 {
-    Edge* edge1 = new Edge{0};
-    Edge* edge2 = new Edge{0};
-    Edge* edge3 = new Edge{0};
+    Edge* edge1 = AllocateEdge();
+    Edge* edge2 = AllocateEdge();
+    Edge* edge3 = AllocateEdge();
 
     m_spNewEdges.push_back(edge1);
     m_spNewEdges.push_back(edge2);
@@ -61,7 +225,7 @@ bool HalfEdgeMesh::AddTriangle(
     ASSERT(vertex3 != vertex1);
 
     edge1->vertex = vertex1;
-    Edge *pair = FindExistingEdge(m_spVertices[vertex2], vertex1);
+    Edge *pair = FindEdge(vertex2, vertex1);
     if (pair != nullptr && pair->pair == nullptr) 
     {
         edge1->pair = pair;
@@ -74,7 +238,7 @@ bool HalfEdgeMesh::AddTriangle(
     }
 
     edge2->vertex = vertex2;
-    pair = FindExistingEdge(m_spVertices[vertex3], vertex2);
+    pair = FindEdge(vertex3, vertex2);
     if (pair != nullptr && pair->pair == nullptr)
     {
         edge2->pair = pair;
@@ -87,7 +251,7 @@ bool HalfEdgeMesh::AddTriangle(
     }
 
     edge3->vertex = vertex3;
-    pair = FindExistingEdge(m_spVertices[vertex1], vertex3);
+    pair = FindEdge(vertex1, vertex3);
     if (pair != nullptr && pair->pair == nullptr)
     {
         edge3->pair = pair;
@@ -99,46 +263,28 @@ bool HalfEdgeMesh::AddTriangle(
         nonManifold = true;
     }
 
-    if (m_spVertices[vertex1])
-    {
-        edge1->nextVertexEdge = m_spVertices[vertex1]->nextVertexEdge;
-        m_spVertices[vertex1]->nextVertexEdge = edge1;
-    }
-    else
-    {
-        m_spVertices[vertex1] = edge1;
-    }
-
-    if (m_spVertices[vertex2])
-    {
-        edge2->nextVertexEdge = m_spVertices[vertex2]->nextVertexEdge;
-        m_spVertices[vertex2]->nextVertexEdge = edge2;
-    }
-    else
-    {
-        m_spVertices[vertex2] = edge2;
-    }
-
-    if (m_spVertices[vertex3])
-    {
-        edge3->nextVertexEdge = m_spVertices[vertex3]->nextVertexEdge;
-        m_spVertices[vertex3]->nextVertexEdge = edge3;
-    }
-    else
-    {
-        m_spVertices[vertex3] = edge3;
-    }
-
     edge1->next = edge2;
     edge2->next = edge3;
     edge3->next = edge1;
 
+    LinkEdge(vertex1, edge1);
+    LinkEdge(vertex2, edge2);
+    LinkEdge(vertex3, edge3);
+
     return !nonManifold;
 }
 
 // remove edges from the mesh in the range of [startOffset, endOffset).
 void HalfEdgeMesh::RemoveNewEdges(_In_ const uint32_t startOffset, _In_ const uint32_t endOffset)
 {
+    // read the end vertices before any edge of the range is released.
+    vector<int32_t> endVertices;
+    endVertices.reserve(endOffset - startOffset);
+    for (uint32_t i = startOffset; i < endOffset; ++i)
+    {
+        endVertices.push_back(m_spNewEdges[i]->next->vertex);
+    }
+
     for (uint32_t i = startOffset; i < endOffset; ++i)
     {
         Edge* edge = m_spNewEdges[i];
@@ -161,7 +307,38 @@ void HalfEdgeMesh::RemoveNewEdges(_In_ const uint32_t startOffset, _In_ const ui
             vertexNeighbor->nextVertexEdge = edge->nextVertexEdge;
         }
 
-        delete edge;
+        const int32_t start = edge->vertex;
+        const int32_t endVertex = endVertices[i - startOffset];
+        if (m_outgoingEdgeCounts[start] >= c_hashedEdgeCount)
+        {
+            // a non-manifold mesh may have a duplicate of this edge that lookups should find from now on.
+            Edge* duplicate = m_duplicateEdgeCounts[start] > 0 ? FindExistingEdge(m_spVertices[start], endVertex) : nullptr;
+            if (duplicate != nullptr)
+            {
+                m_duplicateEdgeCounts[start]--;
+            }
+
+            if (FindHashedEdge(start, endVertex) == edge)
+            {
+                EraseEdge(start, endVertex);
+                if (duplicate != nullptr)
+                {
+                    InsertEdge(start, endVertex, duplicate, true);
+                }
+            }
+        }
+
+        if (--m_outgoingEdgeCounts[start] == c_hashedEdgeCount - 1)
+        {
+            // back to walking the list, drop the vertex's remaining edges from the table.
+            for (Edge* vertexEdge = m_spVertices[start]; vertexEdge != nullptr; vertexEdge = vertexEdge->nextVertexEdge)
+            {
+                EraseEdge(start, vertexEdge->next->vertex);
+            }
+            m_duplicateEdgeCounts[start] = 0;
+        }
+
+        FreeEdge(edge);
     }
 
     m_spNewEdges.erase(m_spNewEdges.begin() + startOffset, m_spNewEdges.begin() + endOffset);
@@ -175,5 +352,5 @@ HalfEdgeMesh::TriangleINT32 HalfEdgeMesh::GetTriangle(_In_ const HalfEdgeMesh::E
         next->vertex,
         next->next->vertex
     };
-    return move(triangle);
+    return triangle;
 }
\ No newline at end of file
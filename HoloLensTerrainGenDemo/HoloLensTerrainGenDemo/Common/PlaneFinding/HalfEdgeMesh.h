@@ -11,6 +11,9 @@
     half of a Winged edge representation.  They are an edge with a direction that goes around a single triangle, three to a loop.  Adjacent triangles will 
     have an edge going the oposite direction.  Together these two half edges make a whole and represent all the data in a Winged edge.  The big 
     advantage of Half Egde vs Winged Edge representation is that with half edge you don't have to conditionally check which direction you are going.
+
+    FindPlanes no longer builds one: it walks vertex neighbours through a VertexAdjacency, which lists them in the same
+    order. Nothing in the app uses this class now; HalfEdgeMeshBenchmark measures and checks it.
 */
 
 class HalfEdgeMesh
@@ -31,8 +34,10 @@ public:
     {
         ASSERT(numIndices % VERTICES_PER_TRIANGLE == 0);
 
-        m_spEdges.resize(numIndices, { 0 });
+        m_spEdges.resize(numIndices, Edge());
         m_spVertices.resize(numVertices, { 0 });
+        m_outgoingEdgeCounts.resize(numVertices, 0);
+        m_duplicateEdgeCounts.resize(numVertices, 0);
 
         // Create half-edges.
         for (uint32_t faceIndex = 0; faceIndex < numIndices / VERTICES_PER_TRIANGLE; faceIndex++)
@@ -60,7 +65,7 @@ public:
 
     vector<Edge>  m_spEdges;
     vector<Edge*> m_spVertices;
-    // TODO: replace with memory pool.  This is a temporary fix to allow for adding additional edges.
+    // edges added by AddTriangle after construction. They live in m_edgeBlocks.
     vector<Edge*> m_spNewEdges;
 
     class VertexNeighborSet
@@ -189,7 +194,7 @@ public:
     bool IsCoallesced(uint32_t vert)
     {
         // determines if this is a vertex that should be ignored by algorithms because it was coallesced to another vertex
-        return m_spVertices[vert] != nullptr && m_spVertices[vert]->vertex != vert;
+        return m_spVertices[vert] != nullptr && m_spVertices[vert]->vertex != static_cast<int32_t>(vert);
     }
 
 private:
@@ -198,5 +203,56 @@ private:
         _In_ HalfEdgeMesh::Edge* edge1,
         _In_ HalfEdgeMesh::Edge* edge2,
         _In_ HalfEdgeMesh::Edge* edge3);
+
+    // Twins are found by walking the start vertex's outgoing edge list, which is cheapest for the handful of edges
+    // most vertices have. Once a vertex has c_hashedEdgeCount outgoing edges its edges are also kept in an open
+    // addressing table with linear probing, keyed by start and end vertex, so high valence vertices do not make
+    // pairing quadratic. The table holds the edge the list walk would find first.
+    struct EdgeSlot
+    {
+        uint64_t key;
+        Edge* edge; // nullptr for an empty slot
+    };
+
+    static uint64_t EdgeKey(int32_t start, int32_t end)
+    {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(start)) << 32) | static_cast<uint32_t>(end);
+    }
+
+    size_t EdgeSlotIndex(uint64_t key) const
+    {
+        // packed vertex pairs of neighbouring triangles differ in only a few low bits of each half, so mix them
+        // before taking the top bits.
+        key ^= key >> 33;
+        key *= 0xFF51AFD7ED558CCDull;
+        key ^= key >> 33;
+        return static_cast<size_t>(key >> m_edgeTableShift);
+    }
+
+    Edge* FindEdge(int32_t start, int32_t end) const;
+    Edge* FindHashedEdge(int32_t start, int32_t end) const;
+    // Links edge, which starts at start and has its next set, into the start vertex's edge list.
+    void LinkEdge(int32_t start, _In_ Edge* edge);
+    void HashLinkedEdge(int32_t start, _In_ Edge* edge);
+    void InsertEdge(int32_t start, int32_t end, _In_ Edge* edge, bool keepExisting);
+    void EraseEdge(int32_t start, int32_t end);
+
+    static const uint32_t c_hashedEdgeCount = 16;
+    vector<uint32_t> m_outgoingEdgeCounts;
+    // outgoing edges of a hashed vertex that repeat the start and end of another, only found in non-manifold meshes.
+    // Removing an edge walks the vertex's list for a duplicate to index instead only while this is not zero.
+    vector<uint32_t> m_duplicateEdgeCounts;
+    vector<EdgeSlot> m_edgeTable;
+    size_t m_edgeTableCount = 0;
+    uint32_t m_edgeTableShift = 64;
+
+    // Added edges are carved out of fixed size blocks and recycled through a free list when removed.
+    Edge* AllocateEdge();
+    void FreeEdge(_In_ Edge* edge);
+
+    static const size_t c_edgeBlockSize = 256;
+    vector<unique_ptr<Edge[]>> m_edgeBlocks;
+    size_t m_edgesUsedInLastBlock = c_edgeBlockSize;
+    vector<Edge*> m_freeEdges;
 };
 
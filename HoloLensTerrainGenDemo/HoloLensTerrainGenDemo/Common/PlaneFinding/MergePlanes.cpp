@@ -2,6 +2,7 @@
 #include "pch.h"
 #include "PlaneFinding.h"
 #include "Util.h"
+#include "ScratchArena.h"
 
 using namespace DirectX;
 
@@ -9,6 +10,17 @@ namespace PlaneFinding
 {
     const XMVECTOR cUpDirection = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
 
+    const float cMaxNeighborAngle = 0.3f; // sub-planes closer than this, in radians, and with intersecting bounds are merged
+
+    // Unit normals within cMaxNeighborAngle of each other differ by less than 2 * sin(cMaxNeighborAngle / 2), about 0.299,
+    // in every component, so with cells at least that wide they land in the same or adjacent normal cells. The extra
+    // width covers rounding in XMVector3AngleBetweenVectors.
+    const float cNormalCellSize = 0.32f;
+    const UINT32 cNormalCellsPerAxis = 7; // covers [-1, 1] in cells of cNormalCellSize
+    const UINT32 cMaxSpatialCellsPerAxis = 1024; // keeps a spatial cell coordinate within the 11 bits it gets in a key
+    const UINT32 cMaxCellsPerPlane = 64; // planes whose bounds cover more cells are tested against every other plane instead
+    const float cBroadphaseBoundsEpsilon = 0.001f; // growth of each plane's axis aligned bounds, so rounding can't drop a touching pair
+
     struct PlaneGraphNode
     {
         BoundedPlane* plane;
@@ -21,6 +33,209 @@ namespace PlaneFinding
         return XMVectorGetX(XMVector3AngleBetweenVectors(p1.AsVector(), p2.AsVector()));
     }
 
+    bool AreNeighbors(_In_ const BoundedPlane &p1, _In_ const BoundedPlane &p2)
+    {
+        return PlaneAngle(p1.plane, p2.plane) < cMaxNeighborAngle && p1.bounds.Intersects(p2.bounds);
+    }
+
+    UINT64 BroadphaseKey(_In_reads_(3) const UINT32 *normalCell, UINT32 x, UINT32 y, UINT32 z)
+    {
+        UINT64 normalKey = (normalCell[0] * cNormalCellsPerAxis + normalCell[1]) * cNormalCellsPerAxis + normalCell[2];
+        return (normalKey << 33) | (static_cast<UINT64>(x) << 22) | (static_cast<UINT64>(y) << 11) | z;
+    }
+
+    BoundingBox GetBroadphaseBounds(_In_ const BoundedPlane& plane)
+    {
+        XMFLOAT3 corners[BoundingOrientedBox::CORNER_COUNT];
+        plane.bounds.GetCorners(corners);
+        BoundingBox bounds;
+        BoundingBox::CreateFromPoints(bounds, BoundingOrientedBox::CORNER_COUNT, corners, sizeof(XMFLOAT3));
+
+        XMVECTOR extents = XMLoadFloat3(&bounds.Extents) * (1.0f + cBroadphaseBoundsEpsilon) + XMVectorReplicate(cBroadphaseBoundsEpsilon);
+        XMStoreFloat3(&bounds.Extents, extents);
+        return bounds;
+    }
+
+    BroadphaseCells GetBroadphaseCells(_In_ const BoundedPlane& plane, _In_ const BoundingBox& bounds, _In_ FXMVECTOR gridOrigin, _In_ float cellSize)
+    {
+        BroadphaseCells cells;
+
+        XMFLOAT3 normal;
+        XMStoreFloat3(&normal, XMVector3Normalize(plane.plane.AsVector()));
+        const float components[3] = { normal.x, normal.y, normal.z };
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            cells.normal[axis] = min(static_cast<UINT32>(max(0.0f, (components[axis] + 1.0f) / cNormalCellSize)), cNormalCellsPerAxis - 1);
+        }
+
+        XMVECTOR toCells = XMVectorReplicate(1.0f / cellSize);
+        XMVECTOR maxCell = XMVectorReplicate(static_cast<float>(cMaxSpatialCellsPerAxis - 1));
+        XMVECTOR center = XMLoadFloat3(&bounds.Center);
+        XMVECTOR extents = XMLoadFloat3(&bounds.Extents);
+        XMUINT3 first, last;
+        XMStoreUInt3(&first, XMVectorClamp(XMVectorFloor((center - extents - gridOrigin) * toCells), g_XMZero, maxCell));
+        XMStoreUInt3(&last, XMVectorClamp(XMVectorFloor((center + extents - gridOrigin) * toCells), g_XMZero, maxCell));
+        cells.first[0] = first.x;
+        cells.first[1] = first.y;
+        cells.first[2] = first.z;
+        cells.last[0] = last.x;
+        cells.last[1] = last.y;
+        cells.last[2] = last.z;
+
+        UINT32 cellCount = (last.x - first.x + 1) * (last.y - first.y + 1) * (last.z - first.z + 1);
+        cells.oversized = cellCount > cMaxCellsPerPlane;
+        return cells;
+    }
+
+    void ForEachBroadphaseKey(_In_ const BroadphaseCells& cells, _In_ bool neighbors, _In_ const function<void(UINT64)>& onKey)
+    {
+        UINT32 normalFirst[3], normalLast[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            normalFirst[axis] = neighbors && cells.normal[axis] > 0 ? cells.normal[axis] - 1 : cells.normal[axis];
+            normalLast[axis] = neighbors ? min(cells.normal[axis] + 1, cNormalCellsPerAxis - 1) : cells.normal[axis];
+        }
+
+        UINT32 normal[3];
+        for (normal[0] = normalFirst[0]; normal[0] <= normalLast[0]; ++normal[0])
+        {
+            for (normal[1] = normalFirst[1]; normal[1] <= normalLast[1]; ++normal[1])
+            {
+                for (normal[2] = normalFirst[2]; normal[2] <= normalLast[2]; ++normal[2])
+                {
+                    for (UINT32 x = cells.first[0]; x <= cells.last[0]; ++x)
+                    {
+                        for (UINT32 y = cells.first[1]; y <= cells.last[1]; ++y)
+                        {
+                            for (UINT32 z = cells.first[2]; z <= cells.last[2]; ++z)
+                            {
+                                onKey(BroadphaseKey(normal, x, y, z));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    struct BroadphaseEntry
+    {
+        UINT64 key;
+        UINT32 plane;
+    };
+
+    void ForEachNeighborPair(
+        _In_ UINT32 planeCount,
+        _In_count_(planeCount) const BoundedPlane* planes,
+        _In_ const function<void(UINT32, UINT32)>& onNeighbors)
+    {
+        if (planeCount == 0)
+        {
+            return;
+        }
+
+        // Comparing every pair of sub-planes is quadratic, so first bucket them by normal direction and by a uniform grid
+        // over their axis aligned bounds. Only planes in adjacent normal cells that share a spatial cell can be neighbors.
+        ScratchArenaScope scope;
+
+        ScratchVector<BoundingBox> aabbs(planeCount, scope.Arena());
+        XMVECTOR sceneMin = g_XMFltMax;
+        XMVECTOR sceneMax = -g_XMFltMax;
+        float sumOfSizes = 0.0f;
+        for (UINT32 i = 0; i < planeCount; ++i)
+        {
+            aabbs[i] = GetBroadphaseBounds(planes[i]);
+
+            XMVECTOR center = XMLoadFloat3(&aabbs[i].Center);
+            XMVECTOR extents = XMLoadFloat3(&aabbs[i].Extents);
+            sceneMin = XMVectorMin(sceneMin, center - extents);
+            sceneMax = XMVectorMax(sceneMax, center + extents);
+            sumOfSizes += 2.0f * max(aabbs[i].Extents.x, max(aabbs[i].Extents.y, aabbs[i].Extents.z));
+        }
+
+        // cells about the size of an average plane keep both the cells per plane and the planes per cell small
+        XMFLOAT3 sceneSize;
+        XMStoreFloat3(&sceneSize, sceneMax - sceneMin);
+        float cellSize = max(sumOfSizes / planeCount, max(sceneSize.x, max(sceneSize.y, sceneSize.z)) / (cMaxSpatialCellsPerAxis - 1));
+
+        ScratchVector<BroadphaseCells> cells(planeCount, scope.Arena());
+        ScratchVector<BroadphaseEntry> entries(scope.Arena());
+        ScratchVector<UINT32> oversized(scope.Arena());
+        for (UINT32 i = 0; i < planeCount; ++i)
+        {
+            cells[i] = GetBroadphaseCells(planes[i], aabbs[i], sceneMin, cellSize);
+            if (cells[i].oversized)
+            {
+                oversized.push_back(i);
+                continue;
+            }
+
+            ForEachBroadphaseKey(cells[i], false, [&](UINT64 key)
+            {
+                entries.push_back({ key, i });
+            });
+        }
+
+        sort(entries.begin(), entries.end(), [](const BroadphaseEntry &a, const BroadphaseEntry &b)
+        {
+            return a.key < b.key;
+        });
+
+        // Candidates are tested in increasing order, so the pairs come out in the same order as testing every pair would
+        // give them.
+        ScratchVector<UINT32> lastQueriedBy(planeCount, UINT32_MAX, scope.Arena());
+        ScratchVector<UINT32> candidates(scope.Arena());
+        for (UINT32 i = 0; i < planeCount; ++i)
+        {
+            candidates.clear();
+            auto addCandidate = [&](UINT32 j)
+            {
+                if (j > i && lastQueriedBy[j] != i)
+                {
+                    lastQueriedBy[j] = i;
+                    candidates.push_back(j);
+                }
+            };
+
+            if (cells[i].oversized)
+            {
+                for (UINT32 j = i + 1; j < planeCount; ++j)
+                {
+                    addCandidate(j);
+                }
+            }
+            else
+            {
+                for (UINT32 j : oversized)
+                {
+                    addCandidate(j);
+                }
+
+                ForEachBroadphaseKey(cells[i], true, [&](UINT64 key)
+                {
+                    auto bucket = lower_bound(entries.begin(), entries.end(), key, [](const BroadphaseEntry &entry, UINT64 value)
+                    {
+                        return entry.key < value;
+                    });
+
+                    for (; bucket != entries.end() && bucket->key == key; ++bucket)
+                    {
+                        addCandidate(bucket->plane);
+                    }
+                });
+            }
+
+            sort(candidates.begin(), candidates.end());
+            for (UINT32 j : candidates)
+            {
+                if (aabbs[i].Intersects(aabbs[j]) && AreNeighbors(planes[i], planes[j]))
+                {
+                    onNeighbors(i, j);
+                }
+            }
+        }
+    }
+
     vector<PlaneGraphNode> BuildPlaneGraph(
         _In_ INT32 numPlanes,
         _In_count_(numPlanes) BoundedPlane* planes)
@@ -30,26 +245,21 @@ namespace PlaneFinding
         // create PlaneGraphNodes for all the planes
         for (int i = 0; i < numPlanes; ++i)
         {
-            nodes.push_back({ &planes[i], false });
+            nodes.push_back({ &planes[i], false, {} });
         }
 
-        // populate the neighbors
-        for (UINT32 i = 0; i < nodes.size(); ++i)
+        // every node's neighbors end up in increasing order, as testing every pair would give them, so merging walks the
+        // planes in the same order
+        ForEachNeighborPair(static_cast<UINT32>(nodes.size()), planes, [&](UINT32 i, UINT32 j)
         {
-            for (UINT32 j = i + 1; j < nodes.size(); ++j)
-            {
-                if (PlaneAngle(nodes[i].plane->plane, nodes[j].plane->plane) < 0.3f && nodes[i].plane->bounds.Intersects(nodes[j].plane->bounds))
-                {
-                    nodes[i].neighbors.push_back(&nodes[j]);
-                    nodes[j].neighbors.push_back(&nodes[i]);
-                }
-            }
-        }
+            nodes[i].neighbors.push_back(&nodes[j]);
+            nodes[j].neighbors.push_back(&nodes[i]);
+        });
 
         return nodes;
     }
 
-    vector<BoundedPlane*> GetNeighborsRecursive(PlaneGraphNode& startNode, vector<PlaneGraphNode>& nodes)
+    vector<BoundedPlane*> GetNeighborsRecursive(PlaneGraphNode& startNode)
     {
         vector<BoundedPlane*> neighbors;
 
@@ -82,7 +292,6 @@ namespace PlaneFinding
         bool isGravityAligned)
     {
         // find tight bounding box
-        UINT32 index = 0;
         XMVECTOR normal = XMVector3Normalize(XMVectorSetW(plane, 0));
         XMMATRIX planeToObserver;
 
@@ -104,21 +313,100 @@ namespace PlaneFinding
 
         XMMATRIX observerToPlane = XMMatrixInverse(nullptr, planeToObserver);
 
-        auto boundsInPlaneSpace = GetBoundsInOrientedSpace(!isGravityAligned, [&](XMFLOAT3* vert)
-        {
-            if (index < bounds.size())
-            {
-                XMStoreFloat3(vert, XMVector3TransformCoord(XMLoadFloat3(&bounds[index]), observerToPlane));
-            }
-            index++;
-            return index <= bounds.size();
-        });
+        auto boundsInPlaneSpace = GetBoundsInOrientedSpace(!isGravityAligned, bounds.data(), static_cast<UINT32>(bounds.size()), observerToPlane);
 
         BoundingOrientedBox boundsInObserverSpace;
         boundsInPlaneSpace.Transform(boundsInObserverSpace, planeToObserver);
         return boundsInObserverSpace;
     }
 
+    bool MergeSubPlanes(
+        _In_ UINT32 numSubPlanes,
+        _In_count_(numSubPlanes) const BoundedPlane* const* subPlanes,
+        _In_ float minArea,
+        _In_ float snapToGravityThreshold,
+        _Out_ BoundedPlane* merged)
+    {
+        // Compute aggregate area, center, normal, and the collection of vertices that define the bounding boxes for each of the planes
+        // in this clique
+        float totalArea = 0;
+        vector<XMFLOAT3> boundVerts;
+        XMVECTOR averageCenter = g_XMZero;
+        XMVECTOR averageNormal = g_XMZero;
+        for (UINT32 subPlane = 0; subPlane < numSubPlanes; ++subPlane)
+        {
+            const BoundedPlane* boundedPlane = subPlanes[subPlane];
+
+            // Rather than walk all the planes vertices again to re-run PCA, we average the plane equations of the component planes.
+            // This isn't guaranteed to give the plane through all the vertices if there are large angles between the planes.
+            // however, it saves compute time, and in practice our plane equations are close enough that this doesn't
+            // cause significant error.
+            XMVECTOR plane = XMPlaneNormalize(boundedPlane->plane.AsVector());
+
+            // We make a similar performance optimization for the bounding box - we find a tight bounding box that includes all the
+            // bounding boxes for each sub-plane.  We could make it tighter, but it would require walking all vertices again.
+            // Since the component bounding boxes are tight, the box that contains them is also relatively tight.
+            XMMATRIX rotation = XMMatrixRotationQuaternion(XMLoadFloat4(&boundedPlane->bounds.Orientation));
+            XMVECTOR dx = rotation.r[0] * boundedPlane->bounds.Extents.x;
+            XMVECTOR dy = rotation.r[1] * boundedPlane->bounds.Extents.y;
+            XMVECTOR dz = rotation.r[2] * boundedPlane->bounds.Extents.z;
+            XMVECTOR center = XMLoadFloat3(&boundedPlane->bounds.Center);
+
+            double area = boundedPlane->area;
+            totalArea += static_cast<float>(area);
+
+            for (int i = 0; i < 8; ++i)
+            {
+                float signx = i & 1 ? -1.0f : 1.0f;
+                float signy = i & 2 ? -1.0f : 1.0f;
+                float signz = i & 4 ? -1.0f : 1.0f;
+
+                XMFLOAT3 boundVert;
+                XMStoreFloat3(&boundVert, center + dx*signx + dy*signy + dz*signz);
+                boundVerts.push_back(boundVert);
+            }
+
+            // Project center of bounding box onto plane
+            center -= (XMPlaneDotCoord(plane, center) * plane);
+
+            // Add weighted normal and center to averages
+            averageCenter += static_cast<float>(area) * center;
+            averageNormal += static_cast<float>(area) * plane;
+        }
+
+        // If the total area is big enough, then create a merged plane for this clique
+        if (totalArea <= minArea)
+        {
+            return false;
+        }
+
+        averageCenter /= totalArea;
+        averageNormal = XMVector3Normalize(averageNormal);
+        XMVECTOR averagePlane = XMPlaneFromPointNormal(averageCenter, averageNormal);
+        bool isGravityAligned = false;
+        SurfaceType st = UNKNOWN;
+
+        if (snapToGravityThreshold != 0.0f)
+        {
+            Plane plane = Plane(averagePlane);
+            XMFLOAT3 center;
+
+            XMStoreFloat3(&center, averageCenter);
+
+            isGravityAligned = SnapToGravity(&plane, nullptr, center, snapToGravityThreshold, cUpDirection);
+
+            averagePlane = plane.AsVector();
+            st = plane.surface;
+        }
+
+        Plane plane = Plane(averagePlane);
+        plane.surface = st;
+        BoundingOrientedBox bounds = GetTightBounds(boundVerts, averagePlane, isGravityAligned);
+
+        *merged = { plane, bounds, totalArea }; // all our aggregated information for this clique
+        return true;
+    }
+
     vector<BoundedPlane> MergePlanes(
         _In_ INT32 numSubPlanes,
         _In_count_(numSubPlanes) BoundedPlane* subPlanes,
@@ -137,79 +425,13 @@ namespace PlaneFinding
         {
             if (!startNode.walked)
             {
-                vector<BoundedPlane*> neighbors = GetNeighborsRecursive(startNode, nodes);
-
-                // Compute aggregate area, center, normal, and the collection of vertices that define the bounding boxes for each of the planes
-                // in this clique
-                float totalArea = 0;
-                vector<XMFLOAT3> boundVerts;
-                XMVECTOR averageCenter = g_XMZero;
-                XMVECTOR averageNormal = g_XMZero;
-                for (BoundedPlane* boundedPlane : neighbors)
-                {
-                    // Rather than walk all the planes vertices again to re-run PCA, we average the plane equations of the component planes.
-                    // This isn't guaranteed to give the plane through all the vertices if there are large angles between the planes.
-                    // however, it saves compute time, and in practice our plane equations are close enough that this doesn't
-                    // cause significant error.
-                    XMVECTOR plane = XMPlaneNormalize(boundedPlane->plane.AsVector());
-
-                    // We make a similar performance optimization for the bounding box - we find a tight bounding box that includes all the
-                    // bounding boxes for each sub-plane.  We could make it tighter, but it would require walking all vertices again.
-                    // Since the component bounding boxes are tight, the box that contains them is also relatively tight.
-                    XMMATRIX rotation = XMMatrixRotationQuaternion(XMLoadFloat4(&boundedPlane->bounds.Orientation));
-                    XMVECTOR dx = rotation.r[0] * boundedPlane->bounds.Extents.x;
-                    XMVECTOR dy = rotation.r[1] * boundedPlane->bounds.Extents.y;
-                    XMVECTOR dz = rotation.r[2] * boundedPlane->bounds.Extents.z;
-                    XMVECTOR center = XMLoadFloat3(&boundedPlane->bounds.Center);
-
-                    double area = boundedPlane->area;
-                    totalArea += static_cast<float>(area);
-
-                    for (int i = 0; i < 8; ++i)
-                    {
-                        float signx = i & 1 ? -1.0f : 1.0f;
-                        float signy = i & 2 ? -1.0f : 1.0f;
-                        float signz = i & 4 ? -1.0f : 1.0f;
-
-                        XMFLOAT3 boundVert;
-                        XMStoreFloat3(&boundVert, center + dx*signx + dy*signy + dz*signz);
-                        boundVerts.push_back(boundVert);
-                    }
-
-                    // Project center of bounding box onto plane
-                    center -= (XMPlaneDotCoord(plane, center) * plane);
+                vector<BoundedPlane*> neighbors = GetNeighborsRecursive(startNode);
 
-                    // Add weighted normal and center to averages
-                    averageCenter += static_cast<float>(area) * center;
-                    averageNormal += static_cast<float>(area) * plane;
+                BoundedPlane merged;
+                if (MergeSubPlanes(static_cast<UINT32>(neighbors.size()), neighbors.data(), minArea, snapToGravityThreshold, &merged))
+                {
+                    planes.push_back(merged);
                 }
-
-                // If the total area is big enough, then create a merged plane for this clique
-				if (totalArea > minArea) {
-					averageCenter /= totalArea;
-					averageNormal = XMVector3Normalize(averageNormal);
-					XMVECTOR averagePlane = XMPlaneFromPointNormal(averageCenter, averageNormal);
-					bool isGravityAligned = false;
-					SurfaceType st = UNKNOWN;
-
-					if (snapToGravityThreshold != 0.0f) {
-						Plane plane = Plane(averagePlane);
-						XMFLOAT3 center;
-
-						XMStoreFloat3(&center, averageCenter);
-
-						isGravityAligned = SnapToGravity(&plane, nullptr, center, snapToGravityThreshold, cUpDirection);
-
-						averagePlane = plane.AsVector();
-						st = plane.surface;
-					}
-
-					Plane plane = Plane(averagePlane);
-					plane.surface = st;
-					BoundingOrientedBox bounds = GetTightBounds(boundVerts, averagePlane, isGravityAligned);
-
-					planes.push_back({ plane, bounds, totalArea }); // add all our aggregated information for this clique to the surface observer plane, then return it
-				}
             }
         }
 
@@ -0,0 +1,119 @@
+#pragma once
+#include "common.h"
+#include <DirectXPackedVector.h>
+#include <string.h>
+#if defined(_XM_SSE_INTRINSICS_)
+#include <emmintrin.h>
+#endif
+
+namespace PlaneFinding
+{
+    // Decoders for the formats spatial surface meshes are delivered in: SNORM16x4 positions, SNORM8x4 normals and R16
+    // indices. They give the same results as XMLoadShortN4 and XMLoadByteN4 one vertex at a time, and read sources
+    // of any alignment, such as a mesh in a surface capture.
+    //
+    // The SSE2 paths write whole vectors into the XMFLOAT3 arrays, so each store spills one float into the next
+    // element. The last vertices are decoded one at a time so nothing is written past the end. MeshDecodingBenchmark
+    // compares the two paths, and checks that they agree.
+
+    // Decodes the scalar way; the SSE2 paths finish with this too.
+    inline void DecodePositionsScalar(_In_reads_bytes_(count * 8) const void* source, _Out_writes_(count) DirectX::XMFLOAT3* destination, UINT32 count)
+    {
+        const BYTE* bytes = static_cast<const BYTE*>(source);
+        for (UINT32 index = 0; index < count; ++index)
+        {
+            DirectX::PackedVector::XMSHORTN4 position;
+            memcpy(&position, bytes + index * sizeof(position), sizeof(position));
+            DirectX::XMStoreFloat3(&destination[index], DirectX::PackedVector::XMLoadShortN4(&position));
+        }
+    }
+
+    inline void DecodeNormalsScalar(_In_reads_bytes_(count * 4) const void* source, _Out_writes_(count) DirectX::XMFLOAT3* destination, UINT32 count)
+    {
+        const BYTE* bytes = static_cast<const BYTE*>(source);
+        for (UINT32 index = 0; index < count; ++index)
+        {
+            DirectX::PackedVector::XMBYTEN4 normal;
+            memcpy(&normal, bytes + index * sizeof(normal), sizeof(normal));
+            DirectX::XMStoreFloat3(&destination[index], DirectX::PackedVector::XMLoadByteN4(&normal));
+        }
+    }
+
+    inline void DecodeIndicesScalar(_In_reads_bytes_(count * 2) const void* source, _Out_writes_(count) INT32* destination, UINT32 count)
+    {
+        const BYTE* bytes = static_cast<const BYTE*>(source);
+        for (UINT32 index = 0; index < count; ++index)
+        {
+            UINT16 value;
+            memcpy(&value, bytes + index * sizeof(value), sizeof(value));
+            destination[index] = value;
+        }
+    }
+
+    inline void DecodePositions(_In_reads_bytes_(count * 8) const void* source, _Out_writes_(count) DirectX::XMFLOAT3* destination, UINT32 count)
+    {
+        const BYTE* bytes = static_cast<const BYTE*>(source);
+        UINT32 index = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+        const __m128 scale = _mm_set1_ps(1.0f / 32767.0f);
+        const __m128 minimum = _mm_set1_ps(-1.0f);
+        // two positions per 16 bytes.
+        for (; index + 2 < count; index += 2)
+        {
+            __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + index * 8));
+            __m128i first = _mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 16);
+            __m128i second = _mm_srai_epi32(_mm_unpackhi_epi16(raw, raw), 16);
+            _mm_storeu_ps(&destination[index].x, _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(first), scale), minimum));
+            _mm_storeu_ps(&destination[index + 1].x, _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(second), scale), minimum));
+        }
+#endif
+        DecodePositionsScalar(bytes + index * 8, destination + index, count - index);
+    }
+
+    inline void DecodeNormals(_In_reads_bytes_(count * 4) const void* source, _Out_writes_(count) DirectX::XMFLOAT3* destination, UINT32 count)
+    {
+        const BYTE* bytes = static_cast<const BYTE*>(source);
+        UINT32 index = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+        const __m128 scale = _mm_set1_ps(1.0f / 127.0f);
+        const __m128 minimum = _mm_set1_ps(-1.0f);
+        // four normals per 16 bytes. Bytes are widened by unpacking them into the high half of each lane and shifting
+        // them back down, which sign extends them.
+        for (; index + 4 < count; index += 4)
+        {
+            __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + index * 4));
+            __m128i low = _mm_unpacklo_epi8(raw, raw);
+            __m128i high = _mm_unpackhi_epi8(raw, raw);
+            __m128i lanes[4] =
+            {
+                _mm_srai_epi32(_mm_unpacklo_epi16(low, low), 24),
+                _mm_srai_epi32(_mm_unpackhi_epi16(low, low), 24),
+                _mm_srai_epi32(_mm_unpacklo_epi16(high, high), 24),
+                _mm_srai_epi32(_mm_unpackhi_epi16(high, high), 24)
+            };
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                _mm_storeu_ps(&destination[index + lane].x, _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(lanes[lane]), scale), minimum));
+            }
+        }
+#endif
+        DecodeNormalsScalar(bytes + index * 4, destination + index, count - index);
+    }
+
+    inline void DecodeIndices(_In_reads_bytes_(count * 2) const void* source, _Out_writes_(count) INT32* destination, UINT32 count)
+    {
+        const BYTE* bytes = static_cast<const BYTE*>(source);
+        UINT32 index = 0;
+#if defined(_XM_SSE_INTRINSICS_)
+        const __m128i zero = _mm_setzero_si128();
+        // eight indices per 16 bytes.
+        for (; index + 8 <= count; index += 8)
+        {
+            __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + index * 2));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + index), _mm_unpacklo_epi16(raw, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + index + 4), _mm_unpackhi_epi16(raw, zero));
+        }
+#endif
+        DecodeIndicesScalar(bytes + index * 2, destination + index, count - index);
+    }
+}
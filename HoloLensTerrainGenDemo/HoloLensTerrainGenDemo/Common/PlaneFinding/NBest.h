@@ -1,55 +1,115 @@
 #pragma once
 
-// This class represents a sorted list of a maximum of N elements
+// This class keeps the best N elements it has been offered
 // We use it to find the best planes, by finding many potential planes, and throwing those out that aren't considered
 // good enough.
+// Elements are copied once into a fixed pool when they are accepted and are never moved afterwards. A min-heap of
+// pool indices tracks the worst element kept, so offering an element is O(log N) and the instance holds no shared
+// state, several can be filled concurrently. Ties are broken by arrival so the first of equal elements is kept, and
+// once filling is done operator[] visits the elements from best to worst.
 template <unsigned int N, typename T>
 class NBest
 {
 public:
-    virtual void Add(T data)
+    void Add(const T& data)
     {
-        static UINT32 indexToInsert = 0;
-        indexToInsert = 0;
-        static bool fShouldInsert = false;
-        fShouldInsert = false;
+        if (num < N)
+        {
+            UINT32 slot = num++;
+            m_pool[slot] = data;
+            m_arrival[slot] = m_nextArrival++;
+            m_heap[slot] = slot;
+            SiftUp(slot);
+            m_sorted = false;
+        }
+        else if (N > 0 && m_pool[m_heap[0]] < data)
+        {
+            // replace the worst element we kept. data arrived last, so it only wins on a strictly better key.
+            UINT32 slot = m_heap[0];
+            m_pool[slot] = data;
+            m_arrival[slot] = m_nextArrival++;
+            SiftDown(0);
+            m_sorted = false;
+        }
+    }
 
-        for (UINT32 i = 0; i < num && !fShouldInsert; ++i)
+    // Returns the i-th best element. Elements may be modified through this, but the order is fixed the first time it
+    // is called after an Add, so changing an element's key does not reorder them.
+    T& operator[](UINT32 i)
+    {
+        if (!m_sorted)
         {
-            if (best[i] < data)
+            for (UINT32 j = 0; j < num; ++j)
             {
-                indexToInsert = i;
-                fShouldInsert = true;
+                m_order[j] = m_heap[j];
             }
+            std::sort(m_order, m_order + num, [this](UINT32 a, UINT32 b) { return IsWorse(b, a); });
+            m_sorted = true;
         }
 
-        if (!fShouldInsert && num < N)
+        return m_pool[m_order[i]];
+    }
+
+    NBest()
+    {}
+
+    UINT32 num = 0;
+
+private:
+    // true if the element in slot a ranks below the element in slot b.
+    bool IsWorse(UINT32 a, UINT32 b) const
+    {
+        if (m_pool[a] < m_pool[b])
         {
-            indexToInsert = num; // insert at the last element
-            fShouldInsert = true;
+            return true;
         }
+        return !(m_pool[b] < m_pool[a]) && m_arrival[a] > m_arrival[b];
+    }
 
-        if (fShouldInsert)
+    void SiftUp(UINT32 i)
+    {
+        while (i > 0)
         {
-            // add an extra bucket on the end if necessary
-            if (num < N)
+            UINT32 parent = (i - 1) / 2;
+            if (!IsWorse(m_heap[i], m_heap[parent]))
             {
-                num++;
+                break;
             }
+            std::swap(m_heap[i], m_heap[parent]);
+            i = parent;
+        }
+    }
 
-            // insert the item, and shift everything down so we don't overwrite
-            for (UINT32 i = indexToInsert; i < num; ++i)
+    void SiftDown(UINT32 i)
+    {
+        for (;;)
+        {
+            UINT32 worst = i;
+            UINT32 left = 2 * i + 1;
+            UINT32 right = left + 1;
+            if (left < num && IsWorse(m_heap[left], m_heap[worst]))
+            {
+                worst = left;
+            }
+            if (right < num && IsWorse(m_heap[right], m_heap[worst]))
+            {
+                worst = right;
+            }
+            if (worst == i)
             {
-                T temp = best[i];
-                best[i] = data;
-                data = temp;
+                break;
             }
+            std::swap(m_heap[i], m_heap[worst]);
+            i = worst;
         }
     }
 
-    NBest()
-    {}
-
-    UINT32 num = 0;
-    T best[N];
-};
\ No newline at end of file
+    T m_pool[N];
+    UINT32 m_arrival[N];
+    // min-heap of pool slots, the worst element kept is at the top.
+    UINT32 m_heap[N];
+    // pool slots from best to worst, valid while m_sorted is set.
+    UINT32 m_order[N];
+    UINT32 m_nextArrival = 0;
+    bool m_sorted = true;
+};
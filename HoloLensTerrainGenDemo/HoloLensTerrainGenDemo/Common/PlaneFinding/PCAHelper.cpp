@@ -7,6 +7,183 @@ using namespace DirectX;
 
 namespace PlaneFinding
 {
+    // three vectors, one component per SIMD lane
+    struct Vectors3
+    {
+        XMVECTOR x, y, z;
+    };
+
+    inline XMVECTOR Dot(_In_ const Vectors3 &a, _In_ const Vectors3 &b)
+    {
+        return XMVectorMultiplyAdd(a.z, b.z, XMVectorMultiplyAdd(a.y, b.y, XMVectorMultiply(a.x, b.x)));
+    }
+
+    inline Vectors3 Cross(_In_ const Vectors3 &a, _In_ const Vectors3 &b)
+    {
+        return {
+            XMVectorSubtract(XMVectorMultiply(a.y, b.z), XMVectorMultiply(a.z, b.y)),
+            XMVectorSubtract(XMVectorMultiply(a.z, b.x), XMVectorMultiply(a.x, b.z)),
+            XMVectorSubtract(XMVectorMultiply(a.x, b.y), XMVectorMultiply(a.y, b.x)) };
+    }
+
+    inline Vectors3 Scale(_In_ const Vectors3 &a, _In_ const XMVECTOR &s)
+    {
+        return { XMVectorMultiply(a.x, s), XMVectorMultiply(a.y, s), XMVectorMultiply(a.z, s) };
+    }
+
+    // picks b in the lanes where mask is set, and a in the others
+    inline Vectors3 Select(_In_ const Vectors3 &a, _In_ const Vectors3 &b, _In_ const XMVECTOR &mask)
+    {
+        return { XMVectorSelect(a.x, b.x, mask), XMVectorSelect(a.y, b.y, mask), XMVectorSelect(a.z, b.z, mask) };
+    }
+
+    // Closed form eigen decomposition of four symmetric 3x3 matrices, one per lane, given as their upper triangles.
+    // Eigenvalues come out in decreasing order, and the eigenvectors are orthonormal.
+    // The eigenvalues use the trigonometric solution of the characteristic cubic. The eigenvector of whichever of
+    // the largest and smallest eigenvalues is further from the middle one is the longest cross product of two rows of
+    // (M - lambda * I), and the middle eigenvector is solved as a 2x2 problem in the plane orthogonal to it (Eberly,
+    // "A Robust Eigensolver for 3x3 Symmetric Matrices"). Repeated eigenvalues give an arbitrary orthonormal basis of
+    // their eigenspace.
+    void SolveSymmetric3x3(
+        _In_ const XMVECTOR &xx, _In_ const XMVECTOR &xy, _In_ const XMVECTOR &xz, _In_ const XMVECTOR &yy, _In_ const XMVECTOR &yz, _In_ const XMVECTOR &zz,
+        _Out_writes_(3) XMVECTOR *eigenvalues,
+        _Out_writes_(3) Vectors3 *eigenvectors)
+    {
+        const XMVECTOR zero = XMVectorZero();
+        const XMVECTOR one = XMVectorSplatOne();
+
+        // scale the entries to at most one, so the squares and cubes below cannot overflow
+        XMVECTOR scale = XMVectorMax(XMVectorMax(XMVectorMax(XMVectorAbs(xx), XMVectorAbs(xy)), XMVectorMax(XMVectorAbs(xz), XMVectorAbs(yy))), XMVectorMax(XMVectorAbs(yz), XMVectorAbs(zz)));
+        scale = XMVectorSelect(scale, one, XMVectorEqual(scale, zero));
+        const XMVECTOR invScale = XMVectorReciprocal(scale);
+        const XMVECTOR a00 = XMVectorMultiply(xx, invScale);
+        const XMVECTOR a01 = XMVectorMultiply(xy, invScale);
+        const XMVECTOR a02 = XMVectorMultiply(xz, invScale);
+        const XMVECTOR a11 = XMVectorMultiply(yy, invScale);
+        const XMVECTOR a12 = XMVectorMultiply(yz, invScale);
+        const XMVECTOR a22 = XMVectorMultiply(zz, invScale);
+
+        // eigenvalues of M = q + 2p * cos(phi + 2k * pi / 3), where B = (M - q * I) / p and phi = acos(det(B) / 2) / 3
+        const XMVECTOR q = XMVectorScale(XMVectorAdd(XMVectorAdd(a00, a11), a22), 1.0f / 3.0f);
+        const XMVECTOR b00 = XMVectorSubtract(a00, q);
+        const XMVECTOR b11 = XMVectorSubtract(a11, q);
+        const XMVECTOR b22 = XMVectorSubtract(a22, q);
+        XMVECTOR offDiagonal = XMVectorMultiplyAdd(a12, a12, XMVectorMultiplyAdd(a02, a02, XMVectorMultiply(a01, a01)));
+        XMVECTOR p2 = XMVectorMultiplyAdd(b22, b22, XMVectorMultiplyAdd(b11, b11, XMVectorMultiply(b00, b00)));
+        p2 = XMVectorMultiplyAdd(offDiagonal, XMVectorReplicate(2.0f), p2);
+        XMVECTOR p = XMVectorSqrt(XMVectorScale(p2, 1.0f / 6.0f));
+
+        // a multiple of the identity has p = 0, and every direction is an eigenvector
+        const XMVECTOR isIsotropic = XMVectorEqual(p, zero);
+        p = XMVectorSelect(p, zero, isIsotropic);
+        const XMVECTOR invP = XMVectorReciprocal(XMVectorSelect(p, one, isIsotropic));
+
+        const XMVECTOR c00 = XMVectorMultiply(b00, invP);
+        const XMVECTOR c01 = XMVectorMultiply(a01, invP);
+        const XMVECTOR c02 = XMVectorMultiply(a02, invP);
+        const XMVECTOR c11 = XMVectorMultiply(b11, invP);
+        const XMVECTOR c12 = XMVectorMultiply(a12, invP);
+        const XMVECTOR c22 = XMVectorMultiply(b22, invP);
+        XMVECTOR det = XMVectorMultiply(c00, XMVectorSubtract(XMVectorMultiply(c11, c22), XMVectorMultiply(c12, c12)));
+        det = XMVectorSubtract(det, XMVectorMultiply(c01, XMVectorSubtract(XMVectorMultiply(c01, c22), XMVectorMultiply(c12, c02))));
+        det = XMVectorAdd(det, XMVectorMultiply(c02, XMVectorSubtract(XMVectorMultiply(c01, c12), XMVectorMultiply(c11, c02))));
+        const XMVECTOR halfDet = XMVectorClamp(XMVectorScale(det, 0.5f), XMVectorNegate(one), one);
+
+        const XMVECTOR phi = XMVectorScale(XMVectorACos(halfDet), 1.0f / 3.0f);
+        const XMVECTOR twoP = XMVectorAdd(p, p);
+        const XMVECTOR largest = XMVectorMultiplyAdd(twoP, XMVectorCos(phi), q);
+        const XMVECTOR smallest = XMVectorMultiplyAdd(twoP, XMVectorCos(XMVectorAdd(phi, XMVectorReplicate(XM_2PI / 3.0f))), q);
+        const XMVECTOR middle = XMVectorSubtract(XMVectorSubtract(XMVectorScale(q, 3.0f), largest), smallest);
+
+        // the eigenvector of the most isolated eigenvalue is well conditioned, so it is found first
+        const XMVECTOR largestIsolated = XMVectorGreaterOrEqual(XMVectorSubtract(largest, middle), XMVectorSubtract(middle, smallest));
+        const XMVECTOR isolated = XMVectorSelect(smallest, largest, largestIsolated);
+
+        const Vectors3 row0 = { XMVectorSubtract(a00, isolated), a01, a02 };
+        const Vectors3 row1 = { a01, XMVectorSubtract(a11, isolated), a12 };
+        const Vectors3 row2 = { a02, a12, XMVectorSubtract(a22, isolated) };
+        const Vectors3 cross01 = Cross(row0, row1);
+        const Vectors3 cross02 = Cross(row0, row2);
+        const Vectors3 cross12 = Cross(row1, row2);
+        const XMVECTOR length01 = Dot(cross01, cross01);
+        const XMVECTOR length02 = Dot(cross02, cross02);
+        const XMVECTOR length12 = Dot(cross12, cross12);
+
+        XMVECTOR maxLength = length01;
+        Vectors3 first = cross01;
+        XMVECTOR isLonger = XMVectorGreater(length02, maxLength);
+        maxLength = XMVectorSelect(maxLength, length02, isLonger);
+        first = Select(first, cross02, isLonger);
+        isLonger = XMVectorGreater(length12, maxLength);
+        maxLength = XMVectorSelect(maxLength, length12, isLonger);
+        first = Select(first, cross12, isLonger);
+
+        // when all the rows are parallel the eigenvalue is repeated, and any direction will do
+        const XMVECTOR isDegenerate = XMVectorEqual(maxLength, zero);
+        first = Scale(first, XMVectorReciprocalSqrt(XMVectorSelect(maxLength, one, isDegenerate)));
+        first = Select(first, { one, zero, zero }, isDegenerate);
+
+        // an orthonormal basis u, v of the plane orthogonal to the first eigenvector
+        const XMVECTOR useXZ = XMVectorGreater(XMVectorAbs(first.x), XMVectorAbs(first.y));
+        Vectors3 u = Select({ zero, first.z, XMVectorNegate(first.y) }, { XMVectorNegate(first.z), zero, first.x }, useXZ);
+        u = Scale(u, XMVectorReciprocalSqrt(Dot(u, u)));
+        const Vectors3 v = Cross(first, u);
+
+        // restricted to that plane, M is the 2x2 matrix [uu uv; uv vv]
+        const Vectors3 mu = {
+            XMVectorMultiplyAdd(a02, u.z, XMVectorMultiplyAdd(a01, u.y, XMVectorMultiply(a00, u.x))),
+            XMVectorMultiplyAdd(a12, u.z, XMVectorMultiplyAdd(a11, u.y, XMVectorMultiply(a01, u.x))),
+            XMVectorMultiplyAdd(a22, u.z, XMVectorMultiplyAdd(a12, u.y, XMVectorMultiply(a02, u.x))) };
+        const Vectors3 mv = {
+            XMVectorMultiplyAdd(a02, v.z, XMVectorMultiplyAdd(a01, v.y, XMVectorMultiply(a00, v.x))),
+            XMVectorMultiplyAdd(a12, v.z, XMVectorMultiplyAdd(a11, v.y, XMVectorMultiply(a01, v.x))),
+            XMVectorMultiplyAdd(a22, v.z, XMVectorMultiplyAdd(a12, v.y, XMVectorMultiply(a02, v.x))) };
+        const XMVECTOR uu = Dot(u, mu);
+        const XMVECTOR uv = Dot(u, mv);
+        const XMVECTOR vv = Dot(v, mv);
+
+        // The trigonometric eigenvalues lose precision when two of them are close to each other or to zero, so the
+        // returned ones are recomputed: the other two directly from the 2x2 matrix, and the isolated one as the
+        // Rayleigh quotient of its eigenvector.
+        const XMVECTOR mean = XMVectorScale(XMVectorAdd(uu, vv), 0.5f);
+        const XMVECTOR halfDifference = XMVectorScale(XMVectorSubtract(uu, vv), 0.5f);
+        const XMVECTOR radius = XMVectorSqrt(XMVectorMultiplyAdd(uv, uv, XMVectorMultiply(halfDifference, halfDifference)));
+        const XMVECTOR larger = XMVectorAdd(mean, radius);
+        const XMVECTOR smaller = XMVectorSubtract(mean, radius);
+        const Vectors3 mFirst = {
+            XMVectorMultiplyAdd(a02, first.z, XMVectorMultiplyAdd(a01, first.y, XMVectorMultiply(a00, first.x))),
+            XMVectorMultiplyAdd(a12, first.z, XMVectorMultiplyAdd(a11, first.y, XMVectorMultiply(a01, first.x))),
+            XMVectorMultiplyAdd(a22, first.z, XMVectorMultiplyAdd(a12, first.y, XMVectorMultiply(a02, first.x))) };
+        const XMVECTOR isolatedValue = Dot(first, mFirst);
+
+        // the eigenvector of the larger one is the null vector of [uu - larger, uv; uv, vv - larger], which is
+        // orthogonal to its longer row
+        const XMVECTOR m00 = XMVectorSubtract(uu, larger);
+        const XMVECTOR m01 = uv;
+        const XMVECTOR m11 = XMVectorSubtract(vv, larger);
+        const XMVECTOR useRow0 = XMVectorGreaterOrEqual(XMVectorMultiplyAdd(m00, m00, XMVectorMultiply(m01, m01)), XMVectorMultiplyAdd(m11, m11, XMVectorMultiply(m01, m01)));
+        XMVECTOR s = XMVectorSelect(m11, m01, useRow0);
+        XMVECTOR t = XMVectorNegate(XMVectorSelect(m01, m00, useRow0));
+        const XMVECTOR lengthST = XMVectorMultiplyAdd(t, t, XMVectorMultiply(s, s));
+        const XMVECTOR isFlat = XMVectorEqual(lengthST, zero);
+        const XMVECTOR invLengthST = XMVectorReciprocalSqrt(XMVectorSelect(lengthST, one, isFlat));
+        s = XMVectorSelect(XMVectorMultiply(s, invLengthST), one, isFlat);
+        t = XMVectorSelect(XMVectorMultiply(t, invLengthST), zero, isFlat);
+        const Vectors3 second = {
+            XMVectorMultiplyAdd(v.x, t, XMVectorMultiply(u.x, s)),
+            XMVectorMultiplyAdd(v.y, t, XMVectorMultiply(u.y, s)),
+            XMVectorMultiplyAdd(v.z, t, XMVectorMultiply(u.z, s)) };
+
+        const Vectors3 third = Cross(first, second);
+        eigenvectors[0] = Select(second, first, largestIsolated);
+        eigenvectors[1] = Select(third, second, largestIsolated);
+        eigenvectors[2] = Select(first, third, largestIsolated);
+
+        eigenvalues[0] = XMVectorMultiply(XMVectorSelect(larger, isolatedValue, largestIsolated), scale);
+        eigenvalues[1] = XMVectorMultiply(XMVectorSelect(smaller, larger, largestIsolated), scale);
+        eigenvalues[2] = XMVectorMultiply(XMVectorSelect(isolatedValue, smaller, largestIsolated), scale);
+    }
+
     void PCAHelper::AddVertex(XMFLOAT3 vert)
     {
         const float x = vert.x - m_mean.x;
@@ -31,111 +208,63 @@ namespace PlaneFinding
 
     void PCAHelper::Solve()
     {
-        XMFLOAT3X3 mat = {
-            m_xx, m_xy, m_xz,
-            m_xy, m_yy, m_yz,
-            m_xz, m_yz, m_zz
-        };
-
-        FindEigenvectors(mat, &m_tangent, &m_cotangent, &m_normal);
-
-        // Special case handling for the scenario where the points are perfectly planar
-        if (m_normal == XMZero)
-        {
-            XMStoreFloat3(&m_normal, XMVector3Cross(XMLoadFloat3(&m_tangent), XMLoadFloat3(&m_cotangent)));
-        }
+        SolveAll(this, 1);
     }
 
-    void PCAHelper::MakeTridiagonal(XMFLOAT3X3 M, _Out_ XMFLOAT3X3 *Q, _Out_ XMFLOAT3X3 *T)
+    void PCAHelper::SolveAll(_Inout_updates_(count) PCAHelper *helpers, UINT32 count)
     {
-        // Input: M is a symmetric matrix
-        // output: Q is an orthogonal matrix, and T a triagonal symmetric matrix such that Qt*T*Q=M
-        if (M._31 == 0)
+        for (UINT32 first = 0; first < count; first += 4)
         {
-            // we are already tridiagonal
-            *Q = { 1, 0, 0,
-                0, 1, 0,
-                0, 0, 1 };
-            *T = M;
-        }
-        else
-        {
-            // We create a Givens rotation matrix for the similarity transform.
-            // See this wikipedia page for an explanation: http://en.wikipedia.org/wiki/Givens_rotation#Triangularization
-            float theta = atan2f(-M._31, M._21);
-            XMFLOAT3X3 G = { 1, 0, 0,
-                0, cos(theta), -sin(theta),
-                0, sin(theta), cos(theta) };
-
-            XMMATRIX xmG = XMLoadFloat3x3(&G);
-            XMStoreFloat3x3(Q, XMMatrixTranspose(xmG));
-            XMStoreFloat3x3(T, xmG * XMLoadFloat3x3(&M) * XMMatrixTranspose(xmG)); // R
-        }
-    }
+            // unused lanes solve the zero matrix
+            XMFLOAT4A xx = {}, xy = {}, xz = {}, yy = {}, yz = {}, zz = {};
+            const UINT32 lanes = min(count - first, 4u);
+            for (UINT32 lane = 0; lane < lanes; ++lane)
+            {
+                const PCAHelper &helper = helpers[first + lane];
+                (&xx.x)[lane] = helper.m_xx;
+                (&xy.x)[lane] = helper.m_xy;
+                (&xz.x)[lane] = helper.m_xz;
+                (&yy.x)[lane] = helper.m_yy;
+                (&yz.x)[lane] = helper.m_yz;
+                (&zz.x)[lane] = helper.m_zz;
+            }
 
-    void PCAHelper::QRDecomposition(XMFLOAT3X3 M, _Out_ XMFLOAT3X3 *Q, _Out_ XMFLOAT3X3 *R)
-    {
-        // Input: M is a tridiagonal symmetric matrix
-        // Output: Q is an orthogonal matrix, and R is an upper triangular matrix so that A=QR.
-
-        // we use the gram-schmidt process to calculate Q:
-        //      a b 0
-        // M =  b c d
-        //      0 d e
-
-        // the first column is the same as M, but normalized
-        const XMVECTORF32 a1 = { M._11, M._12, 0 };
-        const XMVECTOR u1 = a1;
-        const XMVECTOR e1 = XMVector3Normalize(u1);
-
-        // the second column is made orthogonal, by subtracting out the projection onto the first column vector
-        const XMVECTORF32 a2 = { M._21, M._22, M._23 };
-        const XMVECTOR u2 = a2 - e1 * XMVector3Dot(e1, a2);
-        const XMVECTOR e2 = XMVector3Normalize(u2);
-
-        // the third column is again orthogonal by subtracting out the first two columns
-        const XMVECTORF32 a3 = { 0, M._32, M._33 };
-        const XMVECTOR u3 = a3 - e1 * XMVector3Dot(e1, a3) - e2 * XMVector3Dot(e2, a3);
-        const XMVECTOR e3 = XMVector3Normalize(u3);
-
-        XMMATRIX Qt = XMMatrixIdentity();
-        Qt.r[0] = e1;
-        Qt.r[1] = e2;
-        Qt.r[2] = e3;
-        XMStoreFloat3x3(Q, XMMatrixTranspose(Qt));
-
-        // R=Qt * M
-        XMStoreFloat3x3(R, Qt * XMLoadFloat3x3(&M));
-    }
+            XMVECTOR eigenvalues[3];
+            Vectors3 eigenvectors[3];
+            SolveSymmetric3x3(XMLoadFloat4A(&xx), XMLoadFloat4A(&xy), XMLoadFloat4A(&xz), XMLoadFloat4A(&yy), XMLoadFloat4A(&yz), XMLoadFloat4A(&zz), eigenvalues, eigenvectors);
 
-    void PCAHelper::FindEigenvectors(_In_ const XMFLOAT3X3 &M, _Out_ XMFLOAT3 *eig1, _Out_ XMFLOAT3 *eig2, _Out_ XMFLOAT3 *eig3)
-    {
-        // Input: M is a symmetric matrix
-        // Output: eigenvalues and eigenvectors of M
-        XMFLOAT3X3 Q;
-        XMFLOAT3X3 A;
-        MakeTridiagonal(M, &Q, &A);
-        XMMATRIX QTotal = XMLoadFloat3x3(&Q);
-
-        for (int i = 0; i < 32; ++i)
-        {
-            XMFLOAT3X3 R;
-            QRDecomposition(A, &Q, &R);
-            XMStoreFloat3x3(&A, XMLoadFloat3x3(&R)*XMLoadFloat3x3(&Q));
-            QTotal = QTotal * XMLoadFloat3x3(&Q);
-        }
+            XMFLOAT4A values[3], vectors[3][3];
+            for (int i = 0; i < 3; ++i)
+            {
+                XMStoreFloat4A(&values[i], eigenvalues[i]);
+                XMStoreFloat4A(&vectors[i][0], eigenvectors[i].x);
+                XMStoreFloat4A(&vectors[i][1], eigenvectors[i].y);
+                XMStoreFloat4A(&vectors[i][2], eigenvectors[i].z);
+            }
 
-        // eigenvalues are diagonal entries of A
-        // but we aren't consuming them, so aren't exposing them
+            for (UINT32 lane = 0; lane < lanes; ++lane)
+            {
+                PCAHelper &helper = helpers[first + lane];
+                XMFLOAT3 *results[3] = { &helper.m_tangent, &helper.m_cotangent, &helper.m_normal };
+                for (int i = 0; i < 3; ++i)
+                {
+                    *results[i] = { (&vectors[i][0].x)[lane], (&vectors[i][1].x)[lane], (&vectors[i][2].x)[lane] };
+                }
+                helper.eigenValues = { (&values[0].x)[lane], (&values[1].x)[lane], (&values[2].x)[lane] };
 
-        // eigen vectors are columns of QTotal
-        const XMMATRIX Qt = XMMatrixTranspose(QTotal);
-        XMStoreFloat3(eig1, Qt.r[0]);
-        XMStoreFloat3(eig2, Qt.r[1]);
-        XMStoreFloat3(eig3, Qt.r[2]);
-
-        eigenValues.x = A._11;
-        eigenValues.y = A._22;
-        eigenValues.z = A._33;
+#ifdef _DEBUG
+                // check the decomposition reproduces the covariance, relative to its largest eigenvalue
+                const XMFLOAT3X3 covariance = { helper.m_xx, helper.m_xy, helper.m_xz, helper.m_xy, helper.m_yy, helper.m_yz, helper.m_xz, helper.m_yz, helper.m_zz };
+                const float tolerance = 1e-4f * max(fabsf(helper.eigenValues.x), FLT_MIN);
+                const float laneValues[3] = { helper.eigenValues.x, helper.eigenValues.y, helper.eigenValues.z };
+                for (int i = 0; i < 3; ++i)
+                {
+                    const XMVECTOR vector = XMLoadFloat3(results[i]);
+                    const XMVECTOR residual = XMVector3TransformNormal(vector, XMLoadFloat3x3(&covariance)) - vector * laneValues[i];
+                    ASSERT(XMVectorGetX(XMVector3Length(residual)) <= tolerance);
+                }
+#endif
+            }
+        }
     }
 }
\ No newline at end of file
@@ -41,6 +41,13 @@ namespace PlaneFinding
             return eigenValues;
         }
 
+        // The same values under their right name: the sums of squares of the vertices' offsets from the mean, largest
+        // first, so along the tangent, the cotangent and the normal.
+        DirectX::XMFLOAT3 GetSumsOfSquares()
+        {
+            return eigenValues;
+        }
+
         DirectX::XMFLOAT3 GetTangent()
         {
             return m_tangent;
@@ -48,9 +55,7 @@ namespace PlaneFinding
 
         void Solve();
 
-    private:
-        void MakeTridiagonal(DirectX::XMFLOAT3X3 M, _Out_ DirectX::XMFLOAT3X3 *Q, _Out_ DirectX::XMFLOAT3X3 *T);
-        void QRDecomposition(DirectX::XMFLOAT3X3 M, _Out_ DirectX::XMFLOAT3X3 *Q, _Out_ DirectX::XMFLOAT3X3 *R);
-        void FindEigenvectors(_In_ const DirectX::XMFLOAT3X3 &M, _Out_ DirectX::XMFLOAT3 *eig1, _Out_ DirectX::XMFLOAT3 *eig2, _Out_ DirectX::XMFLOAT3 *eig3);
+        // Solves count helpers, four at a time in SIMD lanes.
+        static void SolveAll(_Inout_updates_(count) PCAHelper *helpers, UINT32 count);
     };
 }
\ No newline at end of file
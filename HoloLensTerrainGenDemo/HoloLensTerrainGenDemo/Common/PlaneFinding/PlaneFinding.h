@@ -46,10 +46,87 @@ namespace PlaneFinding
 
 #pragma pack(pop)
 
+    // Milliseconds FindPlanes spent in each stage, summed over all meshes. Stages the engine that ran does not have
+    // stay at 0.
+    struct FindPlanesTimings
+    {
+        double gather = 0.0;         // RANSAC: moving every mesh into one point cloud and hashing it into cells
+        double hypotheses = 0.0;     // RANSAC: sampling candidate planes and scoring them
+        double simplify = 0.0;       // clustering the vertices of the mesh, when FindPlanesOptions asks for it
+        double adjacency = 0.0;      // building the vertex adjacency
+        double curvature = 0.0;      // per vertex curvature from neighbouring normals
+        double smoothing = 0.0;      // smoothing the curvature
+        double regions = 0.0;        // flood filling low curvature regions and picking the best
+        double planeEquations = 0.0; // fitting and snapping plane equations
+        double assignment = 0.0;     // flood filling vertices onto the fitted planes, and reattaching the full mesh
+        double bounds = 0.0;         // bounds and area of each plane
+
+        void Add(const FindPlanesTimings& other)
+        {
+            gather += other.gather;
+            hypotheses += other.hypotheses;
+            simplify += other.simplify;
+            adjacency += other.adjacency;
+            curvature += other.curvature;
+            smoothing += other.smoothing;
+            regions += other.regions;
+            planeEquations += other.planeEquations;
+            assignment += other.assignment;
+            bounds += other.bounds;
+        }
+
+        double Total() const
+        {
+            return gather + hypotheses + simplify + adjacency + curvature + smoothing + regions + planeEquations + assignment + bounds;
+        }
+    };
+
+    // A reasonable FindPlanesOptions::simplifyCellScale: 5cm cells, which leaves most spatial meshes with a few
+    // vertices per cell.
+    const float cDefaultSimplifyCellScale = 4.0f;
+
+    enum class PlaneFindingEngine
+    {
+        // Grows regions of low curvature over the triangles of each mesh and fits a plane to each of the largest.
+        RegionGrowing,
+
+        // Gathers the vertices of all the meshes into one point cloud and finds planes in it by random sampling
+        // (RANSAC). It does not need the triangles to connect, so it holds up better on noisy surfaces broken into
+        // many small pieces, and a plane that spans several meshes is found once. The simplification options below
+        // do not apply to it. An experiment the app does not use: on the synthetic rooms of PlaneFindingBenchmark it
+        // costs several times as long as region growing for little or no gain in recall.
+        Ransac
+    };
+
+    struct FindPlanesOptions
+    {
+        PlaneFindingEngine engine = PlaneFindingEngine::RegionGrowing;
+
+        // When not 0, each mesh is first simplified by merging the vertices in each cell of a grid that face along the
+        // same axis, at their mean position and with their mean normal, and planes are found on the simplified mesh.
+        // The cells are this many times the largest distance a vertex may be from its plane (1.25cm) across, so large
+        // flat areas cost about as much as small ones. Off by default, and the app leaves it off: on the synthetic room
+        // of PlaneFindingBenchmark, a scale of 4 saves little time and finds fewer of the room's faces.
+        float simplifyCellScale = 0.0f;
+
+        // With simplification, gives the vertices of the full mesh to the planes found, so the bounds and areas are
+        // measured on the full mesh rather than the simplified one.
+        bool reattachVertices = true;
+
+        // When set, FindPlanes asks it now and then whether to give up, and once it returns true stops and returns no
+        // planes. Region growing asks before each mesh, and RANSAC before each plane it searches for and before
+        // measuring the planes it found, so a canceled call returns within one mesh, or within gathering the point
+        // cloud, one plane search or measuring the planes. Called from the
+        // threads FindPlanes runs on.
+        function<bool()> isCanceled;
+    };
+
     vector<BoundedPlane> FindPlanes(
         _In_ INT32 numMeshes,
         _In_count_(numMeshes) MeshData* meshes,
-        _In_ float snapToGravityThreshold);
+        _In_ float snapToGravityThreshold,
+        _Out_opt_ FindPlanesTimings* timings = nullptr,
+        _In_ const FindPlanesOptions& options = FindPlanesOptions());
 
     vector<BoundedPlane> MergePlanes(
         _In_ INT32 numSubPlanes,
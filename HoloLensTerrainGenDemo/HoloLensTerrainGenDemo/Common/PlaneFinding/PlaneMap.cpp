@@ -0,0 +1,466 @@
+#include "common.h"
+#include "pch.h"
+#include "PlaneMap.h"
+
+using namespace DirectX;
+
+namespace PlaneFinding
+{
+    // The broadphase grid has 1024 cells of cBroadphaseCellSize along each axis, centered on the origin of the space the
+    // sub-planes are in. Sub-planes are a few meters across at most, so cells about as large as a sub-plane keep both
+    // the cells per sub-plane and the sub-planes per cell small.
+    const float cBroadphaseCellSize = 1.0f;
+    const XMVECTOR cBroadphaseGridOrigin = XMVectorReplicate(-512.0f * cBroadphaseCellSize);
+
+    PlaneMap::PlaneMap(_In_ float minArea, _In_ float snapToGravityThreshold) :
+        m_minArea(minArea),
+        m_snapToGravityThreshold(snapToGravityThreshold)
+    {
+    }
+
+    void PlaneMap::SetSubPlanes(_In_ UINT32 source, _In_ const vector<BoundedPlane>& subPlanes)
+    {
+        if (subPlanes.empty())
+        {
+            RemoveSource(source);
+            return;
+        }
+
+        // Sub-planes the source already has are kept, so only those that changed are removed and inserted, and only
+        // their cliques are merged again. Both sets are sorted by their bytes and walked together to pair them up.
+        auto less = [](const BoundedPlane &a, const BoundedPlane &b)
+        {
+            return memcmp(&a, &b, sizeof(BoundedPlane)) < 0;
+        };
+
+        vector<UINT32> &sourceSubPlanes = m_sourceSubPlanes[source];
+        sort(sourceSubPlanes.begin(), sourceSubPlanes.end(), [&](UINT32 a, UINT32 b)
+        {
+            return less(m_subPlanes[a].plane, m_subPlanes[b].plane);
+        });
+
+        vector<UINT32> order(subPlanes.size());
+        for (UINT32 i = 0; i < order.size(); ++i)
+        {
+            order[i] = i;
+        }
+        sort(order.begin(), order.end(), [&](UINT32 a, UINT32 b)
+        {
+            return less(subPlanes[a], subPlanes[b]);
+        });
+
+        vector<UINT32> kept;
+        vector<bool> isKept(subPlanes.size(), false);
+        size_t next = 0;
+        for (UINT32 subPlane : sourceSubPlanes)
+        {
+            const BoundedPlane &plane = m_subPlanes[subPlane].plane;
+            while (next < order.size() && less(subPlanes[order[next]], plane))
+            {
+                ++next;
+            }
+
+            if (next < order.size() && !less(plane, subPlanes[order[next]]))
+            {
+                kept.push_back(subPlane);
+                isKept[order[next++]] = true;
+            }
+            else
+            {
+                RemoveSubPlane(subPlane);
+            }
+        }
+
+        // the rest are inserted in the order they were given
+        sourceSubPlanes = move(kept);
+        for (UINT32 i = 0; i < subPlanes.size(); ++i)
+        {
+            if (!isKept[i])
+            {
+                sourceSubPlanes.push_back(InsertSubPlane(source, subPlanes[i]));
+            }
+        }
+    }
+
+    void PlaneMap::RemoveSource(_In_ UINT32 source)
+    {
+        auto iter = m_sourceSubPlanes.find(source);
+        if (iter == m_sourceSubPlanes.end())
+        {
+            return;
+        }
+
+        for (UINT32 subPlane : iter->second)
+        {
+            RemoveSubPlane(subPlane);
+        }
+        m_sourceSubPlanes.erase(iter);
+    }
+
+    UINT32 PlaneMap::InsertSubPlane(UINT32 source, const BoundedPlane& plane)
+    {
+        UINT32 index;
+        if (!m_freeSubPlanes.empty())
+        {
+            index = m_freeSubPlanes.back();
+            m_freeSubPlanes.pop_back();
+        }
+        else
+        {
+            index = static_cast<UINT32>(m_subPlanes.size());
+            m_subPlanes.emplace_back();
+        }
+
+        SubPlane &subPlane = m_subPlanes[index];
+        subPlane.plane = plane;
+        subPlane.broadphaseBounds = GetBroadphaseBounds(plane);
+        subPlane.cells = GetBroadphaseCells(plane, subPlane.broadphaseBounds, cBroadphaseGridOrigin, cBroadphaseCellSize);
+        subPlane.source = source;
+        subPlane.clique = cNone;
+        subPlane.alive = true;
+        subPlane.neighbors.clear();
+
+        FindNeighbors(index);
+
+        if (subPlane.cells.oversized)
+        {
+            m_oversizedSubPlanes.push_back(index);
+        }
+        else
+        {
+            ForEachBroadphaseKey(subPlane.cells, false, [&](UINT64 key)
+            {
+                m_broadphase[key].push_back(index);
+            });
+        }
+
+        m_insertedSubPlanes.push_back(index);
+        return index;
+    }
+
+    void PlaneMap::FindNeighbors(UINT32 index)
+    {
+        SubPlane &subPlane = m_subPlanes[index];
+
+        // only the sub-planes in the cells around this one's, and those too large for the grid, can be its neighbors
+        m_candidates.clear();
+        if (subPlane.cells.oversized)
+        {
+            for (UINT32 other = 0; other < m_subPlanes.size(); ++other)
+            {
+                if (m_subPlanes[other].alive)
+                {
+                    m_candidates.push_back(other);
+                }
+            }
+        }
+        else
+        {
+            m_candidates = m_oversizedSubPlanes;
+            ForEachBroadphaseKey(subPlane.cells, true, [&](UINT64 key)
+            {
+                auto bucket = m_broadphase.find(key);
+                if (bucket != m_broadphase.end())
+                {
+                    m_candidates.insert(m_candidates.end(), bucket->second.begin(), bucket->second.end());
+                }
+            });
+
+            // a sub-plane covering several cells is in several buckets
+            sort(m_candidates.begin(), m_candidates.end());
+            m_candidates.erase(unique(m_candidates.begin(), m_candidates.end()), m_candidates.end());
+        }
+
+        for (UINT32 other : m_candidates)
+        {
+            SubPlane &otherSubPlane = m_subPlanes[other];
+            if (other != index && subPlane.broadphaseBounds.Intersects(otherSubPlane.broadphaseBounds) &&
+                AreNeighbors(subPlane.plane, otherSubPlane.plane))
+            {
+                subPlane.neighbors.push_back(other);
+                otherSubPlane.neighbors.push_back(index);
+            }
+        }
+    }
+
+    void PlaneMap::RemoveSubPlane(UINT32 index)
+    {
+        SubPlane &subPlane = m_subPlanes[index];
+        for (UINT32 neighbor : subPlane.neighbors)
+        {
+            vector<UINT32> &neighborsOfNeighbor = m_subPlanes[neighbor].neighbors;
+            neighborsOfNeighbor.erase(find(neighborsOfNeighbor.begin(), neighborsOfNeighbor.end(), index));
+        }
+
+        // the rest of its clique may have split apart, so it has to be merged again
+        if (subPlane.clique != cNone)
+        {
+            m_changedCliques.push_back(subPlane.clique);
+        }
+
+        auto removeFrom = [index](vector<UINT32> &subPlanes)
+        {
+            auto iter = find(subPlanes.begin(), subPlanes.end(), index);
+            *iter = subPlanes.back();
+            subPlanes.pop_back();
+        };
+        if (subPlane.cells.oversized)
+        {
+            removeFrom(m_oversizedSubPlanes);
+        }
+        else
+        {
+            ForEachBroadphaseKey(subPlane.cells, false, [&](UINT64 key)
+            {
+                auto bucket = m_broadphase.find(key);
+                removeFrom(bucket->second);
+                if (bucket->second.empty())
+                {
+                    m_broadphase.erase(bucket);
+                }
+            });
+        }
+
+        subPlane.neighbors.clear();
+        subPlane.clique = cNone;
+        subPlane.alive = false;
+        m_freeSubPlanes.push_back(index);
+        m_pendingRemovals++;
+    }
+
+    UINT32 PlaneMap::AllocateClique()
+    {
+        if (!m_freeCliques.empty())
+        {
+            UINT32 index = m_freeCliques.back();
+            m_freeCliques.pop_back();
+            return index;
+        }
+
+        m_cliques.emplace_back();
+        return static_cast<UINT32>(m_cliques.size() - 1);
+    }
+
+    PlaneMapUpdateStatistics PlaneMap::Update()
+    {
+        PlaneMapUpdateStatistics statistics;
+        statistics.subPlanesRemoved = m_pendingRemovals;
+
+        // Every clique that lost a sub-plane is dissolved, and so is every clique a new sub-plane touches. Flood filling from
+        // the new sub-planes and the remaining members of changed cliques finds both, and the new cliques that replace them.
+        vector<bool> dissolved(m_cliques.size(), false);
+        vector<UINT32> dissolvedCliques;
+        auto dissolve = [&](UINT32 clique)
+        {
+            if (!dissolved[clique])
+            {
+                dissolved[clique] = true;
+                dissolvedCliques.push_back(clique);
+            }
+        };
+
+        // a slot freed and reused since the last update is listed once for each insertion
+        sort(m_insertedSubPlanes.begin(), m_insertedSubPlanes.end());
+        m_insertedSubPlanes.erase(unique(m_insertedSubPlanes.begin(), m_insertedSubPlanes.end()), m_insertedSubPlanes.end());
+
+        vector<UINT32> seeds;
+        for (UINT32 subPlane : m_insertedSubPlanes)
+        {
+            if (m_subPlanes[subPlane].alive)
+            {
+                seeds.push_back(subPlane);
+                statistics.subPlanesInserted++;
+            }
+        }
+        for (UINT32 clique : m_changedCliques)
+        {
+            dissolve(clique);
+            for (UINT32 member : m_cliques[clique].members)
+            {
+                // the slot may have been reused by a sub-plane inserted since
+                if (m_subPlanes[member].alive && m_subPlanes[member].clique == clique)
+                {
+                    seeds.push_back(member);
+                }
+            }
+        }
+
+        vector<bool> visited(m_subPlanes.size(), false);
+        vector<vector<UINT32>> components;
+        for (UINT32 seed : seeds)
+        {
+            if (visited[seed])
+            {
+                continue;
+            }
+
+            vector<UINT32> component;
+            visited[seed] = true;
+            component.push_back(seed);
+            for (size_t head = 0; head < component.size(); ++head)
+            {
+                const SubPlane &subPlane = m_subPlanes[component[head]];
+                if (subPlane.clique != cNone)
+                {
+                    dissolve(subPlane.clique);
+                }
+
+                for (UINT32 neighbor : subPlane.neighbors)
+                {
+                    if (!visited[neighbor])
+                    {
+                        visited[neighbor] = true;
+                        component.push_back(neighbor);
+                    }
+                }
+            }
+
+            // merge in slot order, so the result doesn't depend on which sub-plane the flood fill started from
+            sort(component.begin(), component.end());
+            components.push_back(move(component));
+        }
+
+        vector<BoundedPlane> merged(components.size());
+        vector<bool> hasPlane(components.size(), false);
+        vector<const BoundedPlane*> members;
+        for (size_t i = 0; i < components.size(); ++i)
+        {
+            members.clear();
+            for (UINT32 subPlane : components[i])
+            {
+                members.push_back(&m_subPlanes[subPlane].plane);
+            }
+            hasPlane[i] = MergeSubPlanes(static_cast<UINT32>(members.size()), members.data(), m_minArea, m_snapToGravityThreshold, &merged[i]);
+
+            statistics.subPlanesMerged += static_cast<UINT32>(components[i].size());
+        }
+        statistics.cliquesMerged = static_cast<UINT32>(components.size());
+
+        // A new clique takes over the id of the dissolved clique it shares the most sub-plane area with. When a source
+        // replaced all of a clique's sub-planes none are shared, so a dissolved plane that a new one would merge with
+        // passes its id on instead.
+        struct IdCandidate
+        {
+            float score;
+            UINT32 component;
+            UINT32 clique;
+        };
+        vector<IdCandidate> candidates;
+        for (UINT32 i = 0; i < components.size(); ++i)
+        {
+            if (!hasPlane[i])
+            {
+                continue;
+            }
+
+            size_t firstCandidate = candidates.size();
+            for (UINT32 subPlane : components[i])
+            {
+                UINT32 clique = m_subPlanes[subPlane].clique;
+                if (clique == cNone || m_cliques[clique].id == INVALID_PLANE_ID)
+                {
+                    continue;
+                }
+
+                auto candidate = find_if(candidates.begin() + firstCandidate, candidates.end(), [&](const IdCandidate &c) { return c.clique == clique; });
+                if (candidate == candidates.end())
+                {
+                    candidates.push_back({ 0.0f, i, clique });
+                    candidate = candidates.end() - 1;
+                }
+                candidate->score += m_subPlanes[subPlane].plane.area;
+            }
+
+            if (candidates.size() == firstCandidate)
+            {
+                for (UINT32 clique : dissolvedCliques)
+                {
+                    const Clique &old = m_cliques[clique];
+                    if (old.id != INVALID_PLANE_ID && AreNeighbors(old.merged, merged[i]))
+                    {
+                        candidates.push_back({ min(old.merged.area, merged[i].area), i, clique });
+                    }
+                }
+            }
+        }
+
+        sort(candidates.begin(), candidates.end(), [](const IdCandidate &a, const IdCandidate &b)
+        {
+            if (a.score != b.score)
+            {
+                return a.score > b.score;
+            }
+            return a.component < b.component || (a.component == b.component && a.clique < b.clique);
+        });
+
+        vector<PlaneId> ids(components.size(), INVALID_PLANE_ID);
+        vector<bool> idTaken(m_cliques.size(), false);
+        for (const IdCandidate &candidate : candidates)
+        {
+            if (ids[candidate.component] == INVALID_PLANE_ID && !idTaken[candidate.clique])
+            {
+                ids[candidate.component] = m_cliques[candidate.clique].id;
+                idTaken[candidate.clique] = true;
+                statistics.planesKept++;
+            }
+        }
+
+        for (UINT32 clique : dissolvedCliques)
+        {
+            Clique &old = m_cliques[clique];
+            if (old.id != INVALID_PLANE_ID && !idTaken[clique])
+            {
+                statistics.planesRemoved++;
+            }
+
+            old.alive = false;
+            old.id = INVALID_PLANE_ID;
+            old.members.clear();
+            m_freeCliques.push_back(clique);
+        }
+
+        for (UINT32 i = 0; i < components.size(); ++i)
+        {
+            if (hasPlane[i] && ids[i] == INVALID_PLANE_ID)
+            {
+                ids[i] = m_nextId++;
+                statistics.planesAdded++;
+            }
+
+            UINT32 index = AllocateClique();
+            Clique &clique = m_cliques[index];
+            clique.alive = true;
+            clique.id = ids[i];
+            clique.merged = merged[i];
+            clique.members = move(components[i]);
+            for (UINT32 member : clique.members)
+            {
+                m_subPlanes[member].clique = index;
+            }
+        }
+
+        if (!dissolvedCliques.empty() || !components.empty())
+        {
+            m_planes.clear();
+            for (const Clique &clique : m_cliques)
+            {
+                if (clique.alive && clique.id != INVALID_PLANE_ID)
+                {
+                    m_planes.push_back({ clique.id, clique.merged });
+                }
+            }
+
+            sort(m_planes.begin(), m_planes.end(), [](const MergedPlane &a, const MergedPlane &b)
+            {
+                return a.id < b.id;
+            });
+            m_version++;
+        }
+
+        m_insertedSubPlanes.clear();
+        m_changedCliques.clear();
+        m_pendingRemovals = 0;
+
+        return statistics;
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include "PlaneFinding.h"
+#include "Util.h"
+#include <unordered_map>
+
+namespace PlaneFinding
+{
+    // Identifies a merged plane for as long as it exists in a PlaneMap. Never 0.
+    typedef UINT32 PlaneId;
+    const PlaneId INVALID_PLANE_ID = 0;
+
+    struct MergedPlane
+    {
+        PlaneId id;
+        BoundedPlane plane;
+    };
+
+    // How much work a PlaneMap::Update did.
+    struct PlaneMapUpdateStatistics
+    {
+        UINT32 subPlanesInserted = 0;
+        UINT32 subPlanesRemoved = 0;
+        UINT32 cliquesMerged = 0;    // cliques of sub-planes that were merged again
+        UINT32 subPlanesMerged = 0;  // sub-planes in those cliques
+        UINT32 planesKept = 0;       // merged planes that were merged again under their existing id
+        UINT32 planesAdded = 0;
+        UINT32 planesRemoved = 0;
+
+        void Add(const PlaneMapUpdateStatistics& other)
+        {
+            subPlanesInserted += other.subPlanesInserted;
+            subPlanesRemoved += other.subPlanesRemoved;
+            cliquesMerged += other.cliquesMerged;
+            subPlanesMerged += other.subPlanesMerged;
+            planesKept += other.planesKept;
+            planesAdded += other.planesAdded;
+            planesRemoved += other.planesRemoved;
+        }
+    };
+
+    // The merged planes of a set of sub-planes, kept up to date as the sub-planes found on each source change.
+    // MergePlanes merges every sub-plane each time it is called. A PlaneMap only merges again the cliques that
+    // gained or lost sub-planes since the last Update, and each merged plane keeps its id across updates for as
+    // long as its clique, or a clique that replaced it in about the same place, exists.
+    class PlaneMap
+    {
+    public:
+        PlaneMap(_In_ float minArea, _In_ float snapToGravityThreshold);
+
+        // Replaces the sub-planes found on a source, such as one surface mesh. Changes take effect on the next Update.
+        // Sub-planes equal to one the source already has are kept, so only the cliques of those that changed are merged
+        // again, even when one source holds every sub-plane, as with PlaneFindingEngine::Ransac.
+        void SetSubPlanes(_In_ UINT32 source, _In_ const vector<BoundedPlane>& subPlanes);
+        void RemoveSource(_In_ UINT32 source);
+
+        // Merges the cliques the changes since the last update touched.
+        PlaneMapUpdateStatistics Update();
+
+        // The merged planes, in increasing order of id.
+        const vector<MergedPlane>& GetPlanes() const { return m_planes; }
+
+        // Changes whenever Update changes the merged planes.
+        UINT32 GetVersion() const { return m_version; }
+
+    private:
+        static const UINT32 cNone = UINT32_MAX;
+
+        struct SubPlane
+        {
+            BoundedPlane plane;
+            DirectX::BoundingBox broadphaseBounds;
+            BroadphaseCells cells;
+            UINT32 source;
+            UINT32 clique = cNone;
+            bool alive = false;
+            vector<UINT32> neighbors;
+        };
+
+        struct Clique
+        {
+            PlaneId id = INVALID_PLANE_ID; // INVALID_PLANE_ID when the clique is too small to be merged
+            BoundedPlane merged;
+            vector<UINT32> members;
+            bool alive = false;
+        };
+
+        void RemoveSubPlane(UINT32 subPlane);
+        UINT32 InsertSubPlane(UINT32 source, const BoundedPlane& plane);
+        void FindNeighbors(UINT32 subPlane);
+        UINT32 AllocateClique();
+
+        float m_minArea;
+        float m_snapToGravityThreshold;
+
+        // Slots are reused, so indices of live sub-planes and cliques stay small.
+        vector<SubPlane> m_subPlanes;
+        vector<UINT32> m_freeSubPlanes;
+        vector<Clique> m_cliques;
+        vector<UINT32> m_freeCliques;
+
+        map<UINT32, vector<UINT32>> m_sourceSubPlanes;
+
+        // The live sub-planes by broadphase cell (see Util.h), on a fixed grid, so a sub-plane is only tested against
+        // those it could be a neighbor of. Those too large for the grid are in m_oversizedSubPlanes instead.
+        unordered_map<UINT64, vector<UINT32>> m_broadphase;
+        vector<UINT32> m_oversizedSubPlanes;
+        vector<UINT32> m_candidates;
+
+        // changes waiting for the next update
+        vector<UINT32> m_insertedSubPlanes;
+        vector<UINT32> m_changedCliques;
+        UINT32 m_pendingRemovals = 0;
+
+        vector<MergedPlane> m_planes;
+        PlaneId m_nextId = INVALID_PLANE_ID + 1;
+        UINT32 m_version = 0;
+    };
+}
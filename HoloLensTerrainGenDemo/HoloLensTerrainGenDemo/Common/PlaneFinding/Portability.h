@@ -0,0 +1,53 @@
+#pragma once
+
+// Stand-ins for the parts of the Windows headers and the Concurrency Runtime that plane finding uses, so the library
+// also builds with GCC or Clang, for tools such as the plane finding replayer. DirectXMath needs a sal.h on these
+// platforms; DirectXMath's own CMake build fetches the one from the .NET runtime, which also covers the annotations
+// used here.
+
+#include <sal.h>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+typedef uint8_t BYTE;
+typedef uint16_t UINT16;
+typedef int32_t INT32;
+typedef uint32_t UINT32;
+typedef int64_t INT64;
+typedef uint64_t UINT64;
+typedef float FLOAT;
+
+struct LARGE_INTEGER
+{
+    int64_t QuadPart;
+};
+
+// Counts nanoseconds of the steady clock.
+inline bool QueryPerformanceCounter(LARGE_INTEGER *counter)
+{
+    counter->QuadPart = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    return true;
+}
+
+inline bool QueryPerformanceFrequency(LARGE_INTEGER *frequency)
+{
+    frequency->QuadPart = 1000000000;
+    return true;
+}
+
+namespace concurrency
+{
+    // Runs the iterations in order on the calling thread. Plane finding gives the same results however its
+    // iterations are scheduled, so only the stage timings differ from a device.
+    template < typename TIndex, typename TFunc >
+    void parallel_for(TIndex first, TIndex last, const TFunc &func)
+    {
+        for (TIndex i = first; i < last; ++i)
+        {
+            func(i);
+        }
+    }
+}
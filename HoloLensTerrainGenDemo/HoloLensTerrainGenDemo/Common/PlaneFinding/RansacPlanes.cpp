@@ -0,0 +1,876 @@
+#include "common.h"
+#include "pch.h"
+#include "PlaneFinding.h"
+#include "RansacPlanes.h"
+#include "PCAHelper.h"
+#include "Util.h"
+#include "ScratchArena.h"
+#ifdef _WIN32
+#include <ppl.h>
+#endif
+
+using namespace DirectX;
+
+namespace PlaneFinding
+{
+    // How we are finding planes with RANSAC:
+    //  * The vertices of all the meshes are moved into observer space and hashed into a grid of cells
+    //  * Candidate planes are made from three nearby vertices: a random vertex, and two from the cells around it, which
+    //    are far more likely to lie on the same plane than three vertices picked from anywhere
+    //  * Each candidate is scored on a random subset of the vertices not yet on a plane. Candidates are made in batches
+    //    that run in parallel, until enough have been tried that the largest plane left has likely been hit
+    //  * The vertices on the best candidate are gathered from the cells it passes through, and cut down to the largest
+    //    connected patch of cells. The plane equation is refitted to them (PCAHelper) and snapped to gravity
+    //  * The patch is taken out of the point cloud, and the search repeats until no candidate is large enough
+
+    // constants for the point cloud
+    const float cCellSize = 0.15f; // size of the cells of the hash, in meters. A candidate's samples come from the 3x3x3 cells around its first
+
+    // constants for making and scoring candidates
+    const float cMinSampleSpread = 0.03f; // the samples of a candidate are at least this far apart, in meters, so noise barely tilts it
+    const UINT32 cMaxSampleAttempts = 8; // tries at finding each of the second and third samples
+    const UINT32 cHypothesesPerTask = 8;
+    const UINT32 cTasksPerBatch = 8;
+    const UINT32 cHypothesesPerBatch = cHypothesesPerTask * cTasksPerBatch;
+    const UINT32 cMaxHypotheses = 4096; // candidates tried for each plane at most
+    const UINT32 cScoreSamples = 1024; // vertices each candidate is scored on
+    const float cConfidence = 0.99f; // chance that the largest plane left was hit before a search stops
+    const float cNeighborInlierProbability = 0.5f; // rough chance that a vertex from the cells around one on a plane is on it too
+
+    // constants for accepting planes
+    const UINT32 cRefinements = 2; // times the plane is refitted to its vertices, which are then gathered again
+    const UINT32 cMinInliers = 30; // minimum vertices required for a plane
+    const float cMinPlaneStandardDeviation = 0.05f; // planes must spread this far along both tangents, measured as standard deviation of vertices, in meters
+    const UINT32 cMaxPlanes = 100;
+    const UINT32 cMaxConsecutiveRejections = 8; // the search ends once this many best candidates in a row are rejected
+
+    const UINT32 cSeed = 0x2545f491;
+
+    const UINT32 INVALID_INDEX = static_cast<UINT32>(-1);
+    const UINT32 REJECTED = INVALID_INDEX - 1; // marks vertices of rejected candidates, which are not sampled again
+
+    const XMVECTOR cUpDirection = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+
+    // PCG32. Every candidate seeds a generator of its own from the search and its number, so the candidates do not
+    // depend on which thread makes them.
+    class Random
+    {
+    public:
+        Random(UINT64 seed, UINT64 stream) : m_state(0), m_increment((stream << 1) | 1)
+        {
+            Next();
+            m_state += seed;
+            Next();
+        }
+
+        UINT32 Next()
+        {
+            UINT64 old = m_state;
+            m_state = old * 6364136223846793005ull + m_increment;
+            UINT32 xorShifted = static_cast<UINT32>(((old >> 18) ^ old) >> 27);
+            UINT32 rotation = static_cast<UINT32>(old >> 59);
+            return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+        }
+
+        // uniform in [0, count)
+        UINT32 Below(UINT32 count)
+        {
+            return static_cast<UINT32>((static_cast<UINT64>(Next()) * count) >> 32);
+        }
+
+    private:
+        UINT64 m_state;
+        UINT64 m_increment;
+    };
+
+    // The vertices of all the meshes in observer space, in mesh order, with unit normals. Vertices with a zero normal
+    // are kept so the triangles still index the right vertices, but no plane accepts them.
+    struct PointCloud
+    {
+        ScratchVector<XMFLOAT3> verts;
+        ScratchVector<XMFLOAT3> normals;
+        ScratchVector<UINT32> firstVertOfMesh;
+
+        PointCloud(ScratchArena &arena) : verts(arena), normals(arena), firstVertOfMesh(arena) {}
+    };
+
+    void GatherPointCloud(INT32 numMeshes, _In_count_(numMeshes) const MeshData* meshes, _Inout_ PointCloud *cloud)
+    {
+        UINT32 vertCount = 0;
+        cloud->firstVertOfMesh.resize(numMeshes);
+        for (INT32 i = 0; i < numMeshes; ++i)
+        {
+            cloud->firstVertOfMesh[i] = vertCount;
+            vertCount += meshes[i].vertCount;
+        }
+        cloud->verts.resize(vertCount);
+        cloud->normals.resize(vertCount);
+
+        // each mesh writes its own range of the cloud
+        concurrency::parallel_for(0, numMeshes, [&](INT32 i)
+        {
+            const MeshData &mesh = meshes[i];
+            XMFLOAT4X4 transform = mesh.transform;
+            XMMATRIX surfaceToObserver = XMLoadFloat4x4(&transform);
+
+            // the transform includes the vertex scale, which need not be uniform, so normals go through its inverse transpose
+            XMMATRIX normalToObserver = XMMatrixTranspose(XMMatrixInverse(nullptr, surfaceToObserver));
+
+            XMFLOAT3 *verts = cloud->verts.data() + cloud->firstVertOfMesh[i];
+            XMFLOAT3 *normals = cloud->normals.data() + cloud->firstVertOfMesh[i];
+            for (INT32 v = 0; v < mesh.vertCount; ++v)
+            {
+                XMStoreFloat3(verts + v, XMVector3TransformCoord(XMLoadFloat3(mesh.verts + v), surfaceToObserver));
+
+                // XMVector3Normalize leaves a zero normal at zero
+                XMStoreFloat3(normals + v, XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(mesh.normals + v), normalToObserver)));
+            }
+        });
+    }
+
+    struct Cell
+    {
+        UINT64 key; // the cell's coordinates, packed 21 bits per axis, measured from the lowest corner of the point cloud
+        UINT32 firstVert; // the cell's vertices start here in the grid's vertex list
+        UINT32 numVerts;
+        XMFLOAT3 center;
+    };
+
+    // The point cloud hashed into a grid of cells, so the vertices near a vertex, or near a plane, are found without
+    // looking at the others. The vertices of each cell are contiguous, and cells are found from their coordinates
+    // through an open addressing hash table.
+    class CellGrid
+    {
+    public:
+        CellGrid(ScratchArena &arena) : m_cells(arena), m_verts(arena), m_cellOf(arena), m_table(arena) {}
+
+        void Build(_In_reads_(vertCount) const XMFLOAT3 *verts, UINT32 vertCount)
+        {
+            ScratchArenaScope scope;
+
+            XMVECTOR minimum = XMVectorReplicate(FLT_MAX);
+            for (UINT32 i = 0; i < vertCount; ++i)
+            {
+                minimum = XMVectorMin(minimum, XMLoadFloat3(verts + i));
+            }
+
+            struct CellVertex
+            {
+                UINT64 cell;
+                UINT32 vert;
+            };
+            ScratchVector<CellVertex> cells(vertCount, scope.Arena());
+            const XMVECTOR inverseCellSize = XMVectorReplicate(1.0f / cCellSize);
+            const XMVECTOR maxCell = XMVectorReplicate(float(cMaxCoordinate));
+            XMVECTOR lastCell = XMVectorZero();
+            for (UINT32 i = 0; i < vertCount; ++i)
+            {
+                XMVECTOR coordinates = XMVectorMin(XMVectorFloor((XMLoadFloat3(verts + i) - minimum) * inverseCellSize), maxCell);
+                lastCell = XMVectorMax(lastCell, coordinates);
+
+                XMFLOAT3 cell;
+                XMStoreFloat3(&cell, coordinates);
+                cells[i] = { Pack(UINT32(cell.x), UINT32(cell.y), UINT32(cell.z)), i };
+            }
+
+            XMFLOAT3 last;
+            XMStoreFloat3(&last, lastCell);
+            XMStoreFloat3(&m_minimum, vertCount > 0 ? minimum : XMVectorZero());
+            m_size[0] = UINT32(last.x) + 1;
+            m_size[1] = UINT32(last.y) + 1;
+            m_size[2] = UINT32(last.z) + 1;
+
+            // the vertex order breaks ties, so the grid does not depend on the sort
+            sort(cells.begin(), cells.end(), [](const CellVertex &a, const CellVertex &b)
+            {
+                return a.cell < b.cell || (a.cell == b.cell && a.vert < b.vert);
+            });
+
+            m_verts.resize(vertCount);
+            m_cellOf.resize(vertCount);
+            for (UINT32 i = 0; i < vertCount; ++i)
+            {
+                if (i == 0 || cells[i].cell != cells[i - 1].cell)
+                {
+                    UINT64 key = cells[i].cell;
+                    XMVECTOR coordinates = XMVectorSet(float(key & cMaxCoordinate), float((key >> 21) & cMaxCoordinate), float(key >> 42), 0.0f);
+                    Cell cell = { key, i, 0, {} };
+                    XMStoreFloat3(&cell.center, minimum + (coordinates + XMVectorReplicate(0.5f)) * XMVectorReplicate(cCellSize));
+                    m_cells.push_back(cell);
+                }
+
+                m_verts[i] = cells[i].vert;
+                m_cellOf[cells[i].vert] = static_cast<UINT32>(m_cells.size() - 1);
+                m_cells.back().numVerts++;
+            }
+
+            // at most half full, so probes stay short
+            UINT32 tableSize = 16;
+            while (tableSize < m_cells.size() * 2)
+            {
+                tableSize *= 2;
+            }
+            m_tableMask = tableSize - 1;
+            m_table.assign(tableSize, INVALID_INDEX);
+            for (UINT32 i = 0; i < m_cells.size(); ++i)
+            {
+                UINT32 slot = Slot(m_cells[i].key);
+                while (m_table[slot] != INVALID_INDEX)
+                {
+                    slot = (slot + 1) & m_tableMask;
+                }
+                m_table[slot] = i;
+            }
+        }
+
+        UINT32 GetCellCount() const { return static_cast<UINT32>(m_cells.size()); }
+        const Cell& GetCell(UINT32 cell) const { return m_cells[cell]; }
+        UINT32 GetCellOf(UINT32 vert) const { return m_cellOf[vert]; }
+        const UINT32* GetVerts(const Cell &cell) const { return m_verts.data() + cell.firstVert; }
+
+        // The cell offset from cell by dx, dy and dz cells, or INVALID_INDEX when no vertex is in it.
+        UINT32 FindNeighbor(UINT32 cell, int dx, int dy, int dz) const
+        {
+            UINT64 key = m_cells[cell].key;
+            INT64 x = INT64(key & cMaxCoordinate) + dx;
+            INT64 y = INT64((key >> 21) & cMaxCoordinate) + dy;
+            INT64 z = INT64(key >> 42) + dz;
+            if (x < 0 || y < 0 || z < 0 || x > cMaxCoordinate || y > cMaxCoordinate || z > cMaxCoordinate)
+            {
+                return INVALID_INDEX;
+            }
+
+            UINT64 neighbor = Pack(UINT32(x), UINT32(y), UINT32(z));
+            for (UINT32 slot = Slot(neighbor); m_table[slot] != INVALID_INDEX; slot = (slot + 1) & m_tableMask)
+            {
+                if (m_cells[m_table[slot]].key == neighbor)
+                {
+                    return m_table[slot];
+                }
+            }
+            return INVALID_INDEX;
+        }
+
+        // The cells whose centers are within reach of plane, in increasing order. Rather than testing every cell, walks
+        // the rows of cells along x that the plane passes near, z and y narrowed down to the range the plane can reach
+        // first, so the cost follows the plane's area and not the size of the point cloud. Each row's cells are
+        // contiguous, and the rows are visited in the order the cells are sorted in, so they are found by searching on
+        // from the last row rather than through the hash.
+        void FindCellsNearPlane(_In_ FXMVECTOR plane, float reach, _Inout_ ScratchVector<UINT32> *cells) const
+        {
+            cells->clear();
+            if (m_cells.empty())
+            {
+                return;
+            }
+
+            // the plane equation at the center of cell x, y, z is atOrigin + step[0] * x + step[1] * y + step[2] * z
+            XMFLOAT4 equation;
+            XMStoreFloat4(&equation, plane);
+            const float step[3] = { equation.x * cCellSize, equation.y * cCellSize, equation.z * cCellSize };
+            const float atOrigin = XMVectorGetX(XMPlaneDotCoord(plane, XMLoadFloat3(&m_minimum) + XMVectorReplicate(0.5f * cCellSize)));
+
+            // the least and the most what axis adds to the plane equation across the grid
+            auto span = [&](UINT32 axis, float *least, float *most)
+            {
+                float end = step[axis] * float(m_size[axis] - 1);
+                *least = min(end, 0.0f);
+                *most = max(end, 0.0f);
+            };
+
+            // the cells along axis within reach of the plane, for the rest of the plane equation between least and most.
+            // Widened a little for rounding, the test against each cell's own center decides
+            auto range = [&](UINT32 axis, float least, float most, UINT32 *first, UINT32 *last)
+            {
+                const float cRounding = 0.01f; // in cells
+                float from = 0.0f;
+                float to = float(m_size[axis] - 1);
+                if (step[axis] != 0.0f)
+                {
+                    float a = (-reach - most) / step[axis];
+                    float b = (reach - least) / step[axis];
+                    from = max(ceilf(min(a, b) - cRounding), from);
+                    to = min(floorf(max(a, b) + cRounding), to);
+                }
+                if (from > to)
+                {
+                    return false;
+                }
+                *first = static_cast<UINT32>(from);
+                *last = static_cast<UINT32>(to);
+                return true;
+            };
+
+            float xLeast, xMost, yLeast, yMost;
+            span(0, &xLeast, &xMost);
+            span(1, &yLeast, &yMost);
+
+            UINT32 firstZ, lastZ;
+            if (!range(2, atOrigin + xLeast + yLeast, atOrigin + xMost + yMost, &firstZ, &lastZ))
+            {
+                return;
+            }
+
+            auto next = m_cells.begin();
+            for (UINT32 z = firstZ; z <= lastZ; ++z)
+            {
+                const float atZ = atOrigin + step[2] * float(z);
+                UINT32 firstY, lastY;
+                if (!range(1, atZ + xLeast, atZ + xMost, &firstY, &lastY))
+                {
+                    continue;
+                }
+
+                for (UINT32 y = firstY; y <= lastY; ++y)
+                {
+                    const float atY = atZ + step[1] * float(y);
+                    UINT32 firstX, lastX;
+                    if (!range(0, atY, atY, &firstX, &lastX))
+                    {
+                        continue;
+                    }
+
+                    // galloping, as the row usually starts a few cells on from where the last one ended
+                    const UINT64 firstKey = Pack(firstX, y, z);
+                    const UINT64 lastKey = Pack(lastX, y, z);
+                    auto bound = next;
+                    for (ptrdiff_t stride = 1; bound != m_cells.end() && bound->key < firstKey; stride *= 2)
+                    {
+                        next = bound + 1;
+                        bound = m_cells.end() - bound > stride ? bound + stride : m_cells.end();
+                    }
+                    next = lower_bound(next, bound, firstKey, [](const Cell &cell, UINT64 key) { return cell.key < key; });
+                    for (; next != m_cells.end() && next->key <= lastKey; ++next)
+                    {
+                        if (fabsf(XMVectorGetX(XMPlaneDotCoord(plane, XMLoadFloat3(&next->center)))) <= reach)
+                        {
+                            cells->push_back(static_cast<UINT32>(next - m_cells.begin()));
+                        }
+                    }
+                    if (next == m_cells.end())
+                    {
+                        return;
+                    }
+                }
+            }
+        }
+
+    private:
+        static const UINT32 cMaxCoordinate = (1 << 21) - 1;
+
+        static UINT64 Pack(UINT32 x, UINT32 y, UINT32 z)
+        {
+            return UINT64(x) | (UINT64(y) << 21) | (UINT64(z) << 42);
+        }
+
+        // mixes every bit of the key into the slot, as the keys of nearby cells differ in few bits, and a single multiply
+        // left them in long runs of neighbouring slots
+        UINT32 Slot(UINT64 key) const
+        {
+            key ^= key >> 33;
+            key *= 0xff51afd7ed558ccdull;
+            key ^= key >> 33;
+            return static_cast<UINT32>(key) & m_tableMask;
+        }
+
+        ScratchVector<Cell> m_cells;
+        ScratchVector<UINT32> m_verts; // the vertices of each cell, one cell after another
+        ScratchVector<UINT32> m_cellOf;
+        ScratchVector<UINT32> m_table;
+        UINT32 m_tableMask = 0;
+        XMFLOAT3 m_minimum = XMFLOAT3(0.0f, 0.0f, 0.0f); // the lowest corner of the point cloud, where cell 0, 0, 0 starts
+        UINT32 m_size[3] = { 1, 1, 1 }; // the cells along each axis, up to the last one holding a vertex
+    };
+
+    // What GatherInliers keeps for each cell of the grid. It is held across calls, and every call leaves it as it found
+    // it, so a call only touches the cells near its plane.
+    struct CellInliers
+    {
+        ScratchVector<UINT32> count; // inliers in the cell
+        ScratchVector<UINT32> patch; // the patch of neighbouring cells the cell is in, or INVALID_INDEX
+
+        CellInliers(UINT32 cellCount, ScratchArena &arena) : count(cellCount, 0u, arena), patch(cellCount, INVALID_INDEX, arena) {}
+    };
+
+    inline bool IsInlier(_In_ const PointCloud &cloud, UINT32 vert, _In_ FXMVECTOR plane)
+    {
+        float distance = fabsf(XMVectorGetX(XMPlaneDotCoord(plane, XMLoadFloat3(&cloud.verts[vert]))));
+        float cosAngle = XMVectorGetX(XMVector3Dot(plane, XMLoadFloat3(&cloud.normals[vert])));
+        return distance < cMaxDistanceFromPlane && cosAngle > cMinCosAngleBetweenNormalAndPlane;
+    }
+
+    // Makes a candidate plane through a random vertex of remaining and two vertices from the cells around it, facing
+    // the way their normals do. Returns false when no such vertices were found, or they do not agree on a plane.
+    bool MakeHypothesis(_In_ const PointCloud &cloud, _In_ const CellGrid &grid, _In_ const ScratchVector<UINT32> &planeOf, _In_ const ScratchVector<UINT32> &remaining, _Inout_ Random &random, _Out_ XMVECTOR *plane)
+    {
+        UINT32 samples[3];
+        samples[0] = remaining[random.Below(static_cast<UINT32>(remaining.size()))];
+        UINT32 firstCell = grid.GetCellOf(samples[0]);
+        for (UINT32 s = 1; s < 3; ++s)
+        {
+            samples[s] = INVALID_INDEX;
+            for (UINT32 attempt = 0; attempt < cMaxSampleAttempts && samples[s] == INVALID_INDEX; ++attempt)
+            {
+                // drawn one at a time, as the order arguments are evaluated in is unspecified
+                int dx = int(random.Below(3)) - 1;
+                int dy = int(random.Below(3)) - 1;
+                int dz = int(random.Below(3)) - 1;
+                UINT32 cell = grid.FindNeighbor(firstCell, dx, dy, dz);
+                if (cell == INVALID_INDEX)
+                {
+                    continue;
+                }
+
+                const Cell &neighbor = grid.GetCell(cell);
+                UINT32 vert = grid.GetVerts(neighbor)[random.Below(neighbor.numVerts)];
+                if (planeOf[vert] != INVALID_INDEX)
+                {
+                    continue;
+                }
+
+                bool spread = true;
+                for (UINT32 previous = 0; previous < s && spread; ++previous)
+                {
+                    spread = XMVectorGetX(XMVector3LengthSq(XMLoadFloat3(&cloud.verts[vert]) - XMLoadFloat3(&cloud.verts[samples[previous]]))) >= cMinSampleSpread * cMinSampleSpread;
+                }
+                if (spread)
+                {
+                    samples[s] = vert;
+                }
+            }
+
+            if (samples[s] == INVALID_INDEX)
+            {
+                return false;
+            }
+        }
+
+        XMVECTOR p0 = XMLoadFloat3(&cloud.verts[samples[0]]);
+        XMVECTOR p1 = XMLoadFloat3(&cloud.verts[samples[1]]);
+        XMVECTOR p2 = XMLoadFloat3(&cloud.verts[samples[2]]);
+        XMVECTOR normal = XMVector3Cross(p1 - p0, p2 - p0);
+
+        // nearly collinear samples leave the plane's tilt to noise
+        if (XMVectorGetX(XMVector3Length(normal)) < 0.5f * cMinSampleSpread * cMinSampleSpread)
+        {
+            return false;
+        }
+        normal = XMVector3Normalize(normal);
+
+        XMVECTOR sampleNormals = XMLoadFloat3(&cloud.normals[samples[0]]) + XMLoadFloat3(&cloud.normals[samples[1]]) + XMLoadFloat3(&cloud.normals[samples[2]]);
+        if (XMVectorGetX(XMVector3Dot(normal, sampleNormals)) < 0.0f)
+        {
+            normal = -normal;
+        }
+
+        *plane = XMPlaneFromPointNormal(p0, normal);
+        for (UINT32 s = 0; s < 3; ++s)
+        {
+            if (!IsInlier(cloud, samples[s], *plane))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    struct Hypothesis
+    {
+        XMFLOAT4 plane;
+        UINT32 score; // inliers among the vertices candidates are scored on
+    };
+
+    // Makes candidates in parallel batches and returns the one with the most inliers, in plane. Batches stop once the
+    // largest plane left has been hit with cConfidence, going by the best candidate so far: a candidate lies on a plane
+    // holding a fraction w of the vertices with a chance of about w * cNeighborInlierProbability^2, so after k
+    // candidates the plane was missed with a chance of (1 - w * cNeighborInlierProbability^2)^k.
+    bool FindBestHypothesis(_In_ const PointCloud &cloud, _In_ const CellGrid &grid, _In_ const ScratchVector<UINT32> &planeOf, _In_ const ScratchVector<UINT32> &remaining, UINT32 search, _Out_ XMVECTOR *plane)
+    {
+        ScratchArenaScope scope;
+
+        // every candidate is scored on the same vertices, so their scores compare
+        Random random(cSeed, search);
+        ScratchVector<UINT32> scoreVerts(scope.Arena());
+        if (remaining.size() <= cScoreSamples)
+        {
+            scoreVerts.assign(remaining.begin(), remaining.end());
+        }
+        else
+        {
+            scoreVerts.resize(cScoreSamples);
+            for (UINT32 i = 0; i < cScoreSamples; ++i)
+            {
+                scoreVerts[i] = remaining[random.Below(static_cast<UINT32>(remaining.size()))];
+            }
+        }
+
+        ScratchVector<Hypothesis> batch(cHypothesesPerBatch, scope.Arena());
+        Hypothesis best = { XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f), 0 };
+        UINT32 required = cMaxHypotheses;
+        for (UINT32 tried = 0; tried < required; tried += cHypothesesPerBatch)
+        {
+            concurrency::parallel_for(0u, cTasksPerBatch, [&](UINT32 task)
+            {
+                for (UINT32 i = task * cHypothesesPerTask; i < (task + 1) * cHypothesesPerTask; ++i)
+                {
+                    Random hypothesisRandom(cSeed + search, tried + i);
+                    XMVECTOR candidate;
+                    batch[i].score = 0;
+                    if (MakeHypothesis(cloud, grid, planeOf, remaining, hypothesisRandom, &candidate))
+                    {
+                        XMStoreFloat4(&batch[i].plane, candidate);
+                        for (UINT32 vert : scoreVerts)
+                        {
+                            batch[i].score += IsInlier(cloud, vert, candidate) ? 1 : 0;
+                        }
+                    }
+                }
+            });
+
+            // the earliest of equal candidates wins, so the result does not depend on scheduling
+            for (const Hypothesis &hypothesis : batch)
+            {
+                if (hypothesis.score > best.score)
+                {
+                    best = hypothesis;
+                }
+            }
+
+            if (best.score > 0)
+            {
+                float hitProbability = float(best.score) / float(scoreVerts.size()) * cNeighborInlierProbability * cNeighborInlierProbability;
+                if (hitProbability >= 1.0f)
+                {
+                    break;
+                }
+                float bound = ceilf(logf(1.0f - cConfidence) / logf(1.0f - hitProbability));
+                required = bound < float(cMaxHypotheses) ? static_cast<UINT32>(bound) : cMaxHypotheses;
+            }
+        }
+
+        *plane = XMLoadFloat4(&best.plane);
+        return best.score > 0;
+    }
+
+    // Gathers the vertices not yet on a plane that are on plane, from the cells it passes through, and keeps those in
+    // the largest patch of neighbouring cells, so coplanar surfaces apart from each other are found as planes of their own.
+    void GatherInliers(_In_ const PointCloud &cloud, _In_ const CellGrid &grid, _In_ const ScratchVector<UINT32> &planeOf, _In_ FXMVECTOR plane, _Inout_ CellInliers *cellInliers, _Out_ ScratchVector<UINT32> *inliers)
+    {
+        ScratchArenaScope scope;
+        const float cellReach = 0.5f * sqrtf(3.0f) * cCellSize + cMaxDistanceFromPlane;
+        ScratchVector<UINT32> &inliersOfCell = cellInliers->count;
+        ScratchVector<UINT32> &patchOf = cellInliers->patch;
+
+        inliers->clear();
+        ScratchVector<UINT32> nearCells(scope.Arena());
+        grid.FindCellsNearPlane(plane, cellReach, &nearCells);
+        ScratchVector<UINT32> inlierCells(scope.Arena());
+        for (UINT32 c : nearCells)
+        {
+            const Cell &cell = grid.GetCell(c);
+            const UINT32 *verts = grid.GetVerts(cell);
+            for (UINT32 i = 0; i < cell.numVerts; ++i)
+            {
+                if (planeOf[verts[i]] == INVALID_INDEX && IsInlier(cloud, verts[i], plane))
+                {
+                    inliers->push_back(verts[i]);
+                    inliersOfCell[c]++;
+                }
+            }
+            if (inliersOfCell[c] > 0)
+            {
+                inlierCells.push_back(c);
+            }
+        }
+
+        // flood fill the cells holding inliers into patches, and keep the one with the most inliers
+        ScratchVector<UINT32> stack(scope.Arena());
+        UINT32 bestPatch = INVALID_INDEX;
+        UINT32 bestPatchInliers = 0;
+        UINT32 patch = 0;
+        for (UINT32 start : inlierCells)
+        {
+            if (patchOf[start] != INVALID_INDEX)
+            {
+                continue;
+            }
+
+            UINT32 patchInliers = 0;
+            patchOf[start] = patch;
+            stack.push_back(start);
+            while (!stack.empty())
+            {
+                UINT32 c = stack.back();
+                stack.pop_back();
+                patchInliers += inliersOfCell[c];
+                for (int dz = -1; dz <= 1; ++dz)
+                {
+                    for (int dy = -1; dy <= 1; ++dy)
+                    {
+                        for (int dx = -1; dx <= 1; ++dx)
+                        {
+                            UINT32 neighbor = grid.FindNeighbor(c, dx, dy, dz);
+                            if (neighbor != INVALID_INDEX && inliersOfCell[neighbor] > 0 && patchOf[neighbor] == INVALID_INDEX)
+                            {
+                                patchOf[neighbor] = patch;
+                                stack.push_back(neighbor);
+                            }
+                        }
+                    }
+                }
+            }
+
+            if (patchInliers > bestPatchInliers)
+            {
+                bestPatch = patch;
+                bestPatchInliers = patchInliers;
+            }
+            ++patch;
+        }
+
+        inliers->erase(remove_if(inliers->begin(), inliers->end(), [&](UINT32 vert)
+        {
+            return patchOf[grid.GetCellOf(vert)] != bestPatch;
+        }), inliers->end());
+
+        for (UINT32 c : inlierCells)
+        {
+            inliersOfCell[c] = 0;
+            patchOf[c] = INVALID_INDEX;
+        }
+    }
+
+    // A plane found by the search, with what the output needs to know about it.
+    struct RansacPlane
+    {
+        Plane plane;
+        XMFLOAT3 tangent;
+        bool isGravityAligned;
+        UINT32 firstVert = 0; // the plane's vertices, transformed into its plane space, start here
+        UINT32 numVerts = 0;
+        float area = 0.0f; // area of the triangles whose vertices all belong to the plane, in square meters
+    };
+
+    void FindPlanesRansac(
+        _In_ INT32 numMeshes,
+        _In_count_(numMeshes) const MeshData* meshes,
+        _In_ float snapToGravityThreshold,
+        _In_ const function<bool()>& isCanceled,
+        _Inout_ vector<BoundedPlane>* planes,
+        _Inout_opt_ FindPlanesTimings* timings)
+    {
+        // all the working memory comes from the scope's arena, and is released when it ends
+        ScratchArenaScope scope;
+
+        FindPlanesTimings stageTimings;
+        LARGE_INTEGER stageStart;
+        QueryPerformanceCounter(&stageStart);
+
+        PointCloud cloud(scope.Arena());
+        GatherPointCloud(max(numMeshes, 0), meshes, &cloud);
+        UINT32 vertCount = static_cast<UINT32>(cloud.verts.size());
+
+        CellGrid grid(scope.Arena());
+        grid.Build(cloud.verts.data(), vertCount);
+
+        // the plane of each vertex, and the vertices that can still be sampled
+        ScratchVector<UINT32> planeOf(vertCount, INVALID_INDEX, scope.Arena());
+        ScratchVector<UINT32> remaining(scope.Arena());
+        remaining.reserve(vertCount);
+        for (UINT32 i = 0; i < vertCount; ++i)
+        {
+            if (XMVector3Equal(XMLoadFloat3(&cloud.normals[i]), XMVectorZero()))
+            {
+                planeOf[i] = REJECTED;
+            }
+            else
+            {
+                remaining.push_back(i);
+            }
+        }
+        stageTimings.gather = LapMilliseconds(&stageStart);
+
+        ScratchVector<RansacPlane> found(scope.Arena());
+        ScratchVector<UINT32> inliers(scope.Arena());
+        CellInliers cellInliers(grid.GetCellCount(), scope.Arena());
+        UINT32 rejections = 0;
+        for (UINT32 search = 0; found.size() < cMaxPlanes && remaining.size() >= cMinInliers && rejections < cMaxConsecutiveRejections; ++search)
+        {
+            if (isCanceled && isCanceled())
+            {
+                return;
+            }
+
+            XMVECTOR plane;
+            bool hasCandidate = FindBestHypothesis(cloud, grid, planeOf, remaining, search, &plane);
+            stageTimings.hypotheses += LapMilliseconds(&stageStart);
+            if (!hasCandidate)
+            {
+                ++rejections;
+                continue;
+            }
+
+            // refit the plane to the vertices on it, and gather them again for the refitted plane
+            PCAHelper pca;
+            XMVECTOR mean = XMVectorZero();
+            inliers.clear();
+            for (UINT32 refinement = 0; refinement < cRefinements; ++refinement)
+            {
+                GatherInliers(cloud, grid, planeOf, plane, &cellInliers, &inliers);
+                stageTimings.assignment += LapMilliseconds(&stageStart);
+                if (inliers.size() < cMinInliers)
+                {
+                    break;
+                }
+
+                mean = XMVectorZero();
+                for (UINT32 vert : inliers)
+                {
+                    mean += XMLoadFloat3(&cloud.verts[vert]);
+                }
+                mean /= float(inliers.size());
+
+                pca = PCAHelper();
+                XMFLOAT3 meanPoint;
+                XMStoreFloat3(&meanPoint, mean);
+                pca.SetMean(meanPoint);
+                for (UINT32 vert : inliers)
+                {
+                    pca.AddVertex(cloud.verts[vert]);
+                }
+                pca.Solve();
+
+                // the fitted normal's sign is arbitrary, keep the candidate's facing
+                XMVECTOR fitted = pca.GetPlaneEquation().AsVector();
+                plane = XMVectorGetX(XMVector3Dot(fitted, plane)) < 0.0f ? -fitted : fitted;
+                stageTimings.planeEquations += LapMilliseconds(&stageStart);
+            }
+
+            bool accepted = inliers.size() >= cMinInliers;
+            if (accepted)
+            {
+                XMFLOAT3 sumsOfSquares = pca.GetSumsOfSquares();
+                float minSumOfSquares = cMinPlaneStandardDeviation * cMinPlaneStandardDeviation * float(inliers.size());
+                accepted = sumsOfSquares.x >= minSumOfSquares && sumsOfSquares.y >= minSumOfSquares;
+            }
+
+            if (!accepted)
+            {
+                // take the candidate's vertices out of the search, so it does not come back
+                for (UINT32 vert : inliers)
+                {
+                    planeOf[vert] = REJECTED;
+                }
+                ++rejections;
+            }
+            else
+            {
+                RansacPlane result;
+                result.plane = Plane(plane);
+                result.plane.surface = UNKNOWN;
+                result.tangent = pca.GetTangent();
+                result.isGravityAligned = false;
+                if (snapToGravityThreshold != 0.0f)
+                {
+                    XMFLOAT3 center;
+                    XMStoreFloat3(&center, mean);
+                    result.isGravityAligned = SnapToGravity(&result.plane, &result.tangent, center, snapToGravityThreshold, cUpDirection);
+                }
+
+                UINT32 planeIndex = static_cast<UINT32>(found.size());
+                for (UINT32 vert : inliers)
+                {
+                    planeOf[vert] = planeIndex;
+                }
+                found.push_back(result);
+                rejections = 0;
+            }
+
+            remaining.erase(remove_if(remaining.begin(), remaining.end(), [&](UINT32 vert)
+            {
+                return planeOf[vert] != INVALID_INDEX;
+            }), remaining.end());
+            stageTimings.planeEquations += LapMilliseconds(&stageStart);
+        }
+
+        if (isCanceled && isCanceled())
+        {
+            return;
+        }
+
+        // the area of each plane, from the triangles whose vertices are all on it, in one sweep over all the triangles
+        const UINT32 numPlanes = static_cast<UINT32>(found.size());
+        for (INT32 m = 0; m < numMeshes; ++m)
+        {
+            const UINT32 firstVert = cloud.firstVertOfMesh[m];
+            const INT32 *indices = meshes[m].indices;
+            for (INT32 i = 0; i + 2 < meshes[m].indexCount; i += 3)
+            {
+                UINT32 a = firstVert + indices[i];
+                UINT32 b = firstVert + indices[i + 1];
+                UINT32 c = firstVert + indices[i + 2];
+                UINT32 planeIndex = planeOf[a];
+                if (planeIndex < numPlanes && planeIndex == planeOf[b] && planeIndex == planeOf[c])
+                {
+                    XMVECTOR v1 = XMLoadFloat3(&cloud.verts[a]);
+                    XMVECTOR v2 = XMLoadFloat3(&cloud.verts[b]);
+                    XMVECTOR v3 = XMLoadFloat3(&cloud.verts[c]);
+                    found[planeIndex].area += XMVectorGetX(XMVector3Length(XMVector3Cross(v3 - v2, v3 - v1))) / 2.0f;
+                }
+            }
+        }
+
+        // plane space is z=-normal, y=dominant tangent, x=orthogonal, as for region growing
+        ScratchVector<XMMATRIX> planeToObserver(numPlanes, scope.Arena());
+        ScratchVector<XMMATRIX> observerToPlane(numPlanes, scope.Arena());
+        for (UINT32 i = 0; i < numPlanes; ++i)
+        {
+            XMMATRIX rotation = XMMatrixIdentity();
+            rotation.r[2] = -XMLoadFloat3(&found[i].plane.normal);
+            rotation.r[1] = XMLoadFloat3(&found[i].tangent);
+            rotation.r[0] = XMVector3Cross(rotation.r[1], rotation.r[2]);
+            planeToObserver[i] = rotation;
+            observerToPlane[i] = XMMatrixTranspose(rotation);
+        }
+
+        // lay out the vertices of each plane one plane after another, in its plane space
+        for (UINT32 i = 0; i < vertCount; ++i)
+        {
+            if (planeOf[i] < numPlanes)
+            {
+                found[planeOf[i]].numVerts++;
+            }
+        }
+        UINT32 totalVerts = 0;
+        for (RansacPlane &plane : found)
+        {
+            plane.firstVert = totalVerts;
+            totalVerts += plane.numVerts;
+            plane.numVerts = 0;
+        }
+        ScratchVector<XMFLOAT3> vertsInPlaneSpace(totalVerts, scope.Arena());
+        for (UINT32 i = 0; i < vertCount; ++i)
+        {
+            if (planeOf[i] < numPlanes)
+            {
+                RansacPlane &plane = found[planeOf[i]];
+                XMStoreFloat3(&vertsInPlaneSpace[plane.firstVert + plane.numVerts++], XMVector3TransformCoord(XMLoadFloat3(&cloud.verts[i]), observerToPlane[planeOf[i]]));
+            }
+        }
+
+        for (UINT32 i = 0; i < numPlanes; ++i)
+        {
+            // gravity aligned planes get a box aligned with gravity, as for region growing
+            BoundingOrientedBox boundsInPlaneSpace = GetBoundsInOrientedSpace(!found[i].isGravityAligned, vertsInPlaneSpace.data() + found[i].firstVert, found[i].numVerts);
+            BoundingOrientedBox boundsInObserverSpace;
+            boundsInPlaneSpace.Transform(boundsInObserverSpace, planeToObserver[i]);
+            planes->push_back({ found[i].plane, boundsInObserverSpace, found[i].area });
+        }
+        stageTimings.bounds = LapMilliseconds(&stageStart);
+
+        if (timings != nullptr)
+        {
+            timings->Add(stageTimings);
+        }
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "common.h"
+#include "PlaneFinding.h"
+
+namespace PlaneFinding
+{
+    // The RANSAC engine behind FindPlanes (see PlaneFindingEngine::Ransac). Finds planes in the vertices of all the
+    // meshes at once, and appends them to planes in observer space. The same meshes always give the same planes,
+    // however the hypotheses are scheduled. Appends nothing if isCanceled returns true (see FindPlanesOptions).
+    void FindPlanesRansac(
+        _In_ INT32 numMeshes,
+        _In_count_(numMeshes) const MeshData* meshes,
+        _In_ float snapToGravityThreshold,
+        _In_ const function<bool()>& isCanceled,
+        _Inout_ vector<BoundedPlane>* planes,
+        _Inout_opt_ FindPlanesTimings* timings);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "common.h"
+#include "PlaneFinding.h"
+
+namespace PlaneFinding
+{
+    // How the connected components labelling of low curvature regions that FindPlanes uses compares with the flood
+    // fill it replaced, on one mesh. Region ids are numbered differently by the two, so they are compared by which
+    // vertices each labels, and by which pairs of neighbours each puts in the same region.
+    struct RegionLabellingComparison
+    {
+        UINT32 vertCount = 0;
+        UINT32 labelledByBoth = 0;
+        UINT32 labelledByOne = 0;
+        UINT32 neighborsAgreeing = 0;  // neighbours of vertices labelled by both, same region in both or in neither
+        UINT32 neighborsDiffering = 0;
+        double unionFindMilliseconds = 0.0;
+        double floodFillMilliseconds = 0.0;
+    };
+
+    // Runs the stages of FindPlanes up to region labelling on mesh, without simplification, then labels the regions
+    // both ways. For RegionLabellingCheck.
+    RegionLabellingComparison CompareRegionLabelling(
+        _In_ const MeshData& mesh);
+}
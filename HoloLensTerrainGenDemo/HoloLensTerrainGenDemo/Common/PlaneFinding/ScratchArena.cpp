@@ -0,0 +1,104 @@
+#include "common.h"
+#include "pch.h"
+#include "ScratchArena.h"
+#include <atomic>
+
+namespace PlaneFinding
+{
+    const size_t cMinimumBlockSize = 64 * 1024;
+
+    atomic<UINT64> s_heapAllocations(0);
+    atomic<UINT64> s_bytesReserved(0);
+
+    // the arenas owned by one thread, one per nesting level of ScratchArenaScope
+    struct ThreadScratch
+    {
+        vector<unique_ptr<ScratchArena>> arenas;
+        UINT32 depth = 0;
+    };
+
+    thread_local ThreadScratch t_scratch;
+
+    ScratchArena::~ScratchArena()
+    {
+        for (auto &block : m_blocks)
+        {
+            s_bytesReserved -= block.size;
+        }
+    }
+
+    void* ScratchArena::Allocate(size_t bytes, size_t alignment)
+    {
+        for (;;)
+        {
+            if (m_currentBlock < m_blocks.size())
+            {
+                Block &block = m_blocks[m_currentBlock];
+                size_t address = reinterpret_cast<size_t>(block.memory.get()) + m_used;
+                size_t padding = (alignment - address % alignment) % alignment;
+                if (m_used + padding + bytes <= block.size)
+                {
+                    m_used += padding + bytes;
+                    m_totalUsed += padding + bytes;
+                    return reinterpret_cast<void*>(address + padding);
+                }
+
+                // the rest of this block is wasted until the next Reset
+                m_totalUsed += block.size - m_used;
+                m_currentBlock++;
+                m_used = 0;
+            }
+            else
+            {
+                AddBlock(bytes + alignment);
+            }
+        }
+    }
+
+    void ScratchArena::AddBlock(size_t minimumSize)
+    {
+        size_t size = max(max(minimumSize, cMinimumBlockSize), m_blocks.empty() ? 0 : m_blocks.back().size * 2);
+        m_blocks.push_back({ unique_ptr<BYTE[]>(new BYTE[size]), size });
+        s_heapAllocations++;
+        s_bytesReserved += size;
+    }
+
+    void ScratchArena::Reset()
+    {
+        if (m_blocks.size() > 1)
+        {
+            // replace the blocks with one that would have held everything
+            for (auto &block : m_blocks)
+            {
+                s_bytesReserved -= block.size;
+            }
+            m_blocks.clear();
+            AddBlock(m_totalUsed);
+        }
+
+        m_currentBlock = 0;
+        m_used = 0;
+        m_totalUsed = 0;
+    }
+
+    ScratchArenaScope::ScratchArenaScope()
+    {
+        if (t_scratch.depth == t_scratch.arenas.size())
+        {
+            t_scratch.arenas.push_back(unique_ptr<ScratchArena>(new ScratchArena()));
+            s_heapAllocations++;
+        }
+        m_arena = t_scratch.arenas[t_scratch.depth++].get();
+    }
+
+    ScratchArenaScope::~ScratchArenaScope()
+    {
+        m_arena->Reset();
+        t_scratch.depth--;
+    }
+
+    ScratchStatistics GetScratchStatistics()
+    {
+        return { s_heapAllocations.load(), s_bytesReserved.load() };
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include "common.h"
+#include <memory>
+#include <type_traits>
+
+namespace PlaneFinding
+{
+    // Bump allocator for the temporaries of plane finding. Allocations are carved out of large blocks and are never
+    // freed individually; the whole arena is rewound at once when the ScratchArenaScope that owns it ends.
+    // When a scope needed more than one block, the blocks are replaced by a single block large enough for all of
+    // them, so once a thread has processed its largest mesh further meshes do not touch the heap.
+    class ScratchArena
+    {
+    public:
+        ScratchArena() {}
+        ~ScratchArena();
+        ScratchArena(const ScratchArena&) = delete;
+        ScratchArena& operator=(const ScratchArena&) = delete;
+
+        void* Allocate(size_t bytes, size_t alignment);
+
+        // Allocates count default constructed elements. Destructors are never run, so T must not need one.
+        template < typename T >
+        T* AllocateArray(size_t count)
+        {
+            static_assert(is_trivially_destructible<T>::value, "scratch memory is released without running destructors");
+            T* elements = static_cast<T*>(Allocate(count * sizeof(T), __alignof(T)));
+            for (size_t i = 0; i < count; ++i)
+            {
+                new (elements + i) T;
+            }
+            return elements;
+        }
+
+        // Makes all the memory handed out since the last Reset available again.
+        void Reset();
+
+    private:
+        struct Block
+        {
+            unique_ptr<BYTE[]> memory;
+            size_t size;
+        };
+
+        void AddBlock(size_t minimumSize);
+
+        vector<Block> m_blocks;
+        size_t m_currentBlock = 0;
+        size_t m_used = 0; // bytes used in the current block
+        size_t m_totalUsed = 0; // bytes used in all blocks since the last Reset, including alignment padding
+    };
+
+    // Borrows this thread's scratch arena for the lifetime of the scope, and rewinds it when the scope ends.
+    // Scopes nest: a scope opened while another is active on the same thread, for example by a task the scheduler
+    // runs while the outer one waits, gets an arena of its own. Everything allocated from a scope must be released
+    // before it ends, so declare the scope before the containers that use it.
+    class ScratchArenaScope
+    {
+    public:
+        ScratchArenaScope();
+        ~ScratchArenaScope();
+        ScratchArenaScope(const ScratchArenaScope&) = delete;
+        ScratchArenaScope& operator=(const ScratchArenaScope&) = delete;
+
+        ScratchArena& Arena() { return *m_arena; }
+
+    private:
+        ScratchArena* m_arena;
+    };
+
+    // Standard allocator over a ScratchArena, so containers can keep their usual interface. Deallocation does
+    // nothing; the memory comes back when the arena is rewound.
+    template < typename T >
+    class ScratchAllocator
+    {
+    public:
+        typedef T value_type;
+
+        ScratchAllocator(ScratchArena& arena) : m_arena(&arena) {}
+
+        template < typename U >
+        ScratchAllocator(const ScratchAllocator<U>& other) : m_arena(other.GetArena()) {}
+
+        T* allocate(size_t count)
+        {
+            return static_cast<T*>(m_arena->Allocate(count * sizeof(T), __alignof(T)));
+        }
+
+        void deallocate(T*, size_t) {}
+
+        ScratchArena* GetArena() const { return m_arena; }
+
+        template < typename U >
+        bool operator==(const ScratchAllocator<U>& other) const { return m_arena == other.GetArena(); }
+
+        template < typename U >
+        bool operator!=(const ScratchAllocator<U>& other) const { return m_arena != other.GetArena(); }
+
+    private:
+        ScratchArena* m_arena;
+    };
+
+    template < typename T >
+    using ScratchVector = vector<T, ScratchAllocator<T>>;
+
+    // Counts of what scratch arenas have taken from the heap since the process started, over all threads. Once
+    // plane finding has reached a steady state the allocation count stops increasing.
+    struct ScratchStatistics
+    {
+        UINT64 heapAllocations; // blocks and arenas allocated
+        UINT64 bytesReserved; // bytes currently held by all arenas
+    };
+
+    ScratchStatistics GetScratchStatistics();
+}
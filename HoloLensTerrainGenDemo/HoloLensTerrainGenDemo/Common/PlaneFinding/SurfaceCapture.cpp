@@ -0,0 +1,109 @@
+#include "common.h"
+#include "pch.h"
+#include "SurfaceCapture.h"
+#include "MeshDecoding.h"
+#include <DirectXPackedVector.h>
+#include <string.h>
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+
+namespace PlaneFinding
+{
+    SurfaceCaptureReader::SurfaceCaptureReader(_In_reads_bytes_(size) const BYTE* data, _In_ size_t size) :
+        m_data(data),
+        m_size(size),
+        m_offset(sizeof(SurfaceCaptureFileHeader)),
+        m_valid(false),
+        m_corrupt(false)
+    {
+        if (size >= sizeof(SurfaceCaptureFileHeader))
+        {
+            SurfaceCaptureFileHeader header;
+            memcpy(&header, data, sizeof(header));
+            m_valid = header.magic == cSurfaceCaptureMagic && header.version == cSurfaceCaptureVersion;
+        }
+    }
+
+    bool SurfaceCaptureReader::Next(_Out_ SurfaceCaptureRecord* record)
+    {
+        if (!m_valid || m_size - m_offset < sizeof(SurfaceCaptureRecordHeader))
+        {
+            return false;
+        }
+
+        memcpy(&record->header, m_data + m_offset, sizeof(SurfaceCaptureRecordHeader));
+        const SurfaceCaptureRecordHeader &header = record->header;
+
+        // everything after a damaged record is unreliable
+        UINT64 bytes = GetSurfaceCaptureRecordBytes(header.vertexCount, header.indexCount);
+        if (header.magic != cSurfaceCaptureRecordMagic || header.recordBytes != bytes || header.indexCount % 3 != 0)
+        {
+            m_valid = false;
+            m_corrupt = true;
+            return false;
+        }
+        if (bytes > m_size - m_offset)
+        {
+            m_valid = false;
+            return false;
+        }
+
+        const BYTE* payload = m_data + m_offset + sizeof(SurfaceCaptureRecordHeader);
+        record->positions = payload;
+        record->normals = payload + size_t(header.vertexCount) * 8;
+        record->indices = payload + size_t(header.vertexCount) * 12;
+
+        for (UINT32 i = 0; i < header.indexCount; ++i)
+        {
+            UINT16 index;
+            memcpy(&index, record->indices + i * sizeof(UINT16), sizeof(index));
+            if (index >= header.vertexCount)
+            {
+                m_valid = false;
+                m_corrupt = true;
+                return false;
+            }
+        }
+
+        m_offset += static_cast<size_t>(bytes);
+        return true;
+    }
+
+    bool DecodeSurfaceCaptureRecord(
+        _In_ const SurfaceCaptureRecord& record,
+        _Inout_ vector<XMFLOAT3>& verts,
+        _Inout_ vector<XMFLOAT3>& normals,
+        _Inout_ vector<INT32>& indices,
+        _Out_ MeshData* mesh)
+    {
+        const SurfaceCaptureRecordHeader &header = record.header;
+        verts.resize(header.vertexCount);
+        normals.resize(header.vertexCount);
+        indices.resize(header.indexCount);
+
+        // the same decoders as the app's, which read the payload whatever its alignment
+        DecodePositions(record.positions, verts.data(), header.vertexCount);
+        DecodeNormals(record.normals, normals.data(), header.vertexCount);
+        DecodeIndices(record.indices, indices.data(), header.indexCount);
+
+        for (UINT32 i = 0; i < header.indexCount; ++i)
+        {
+            if (static_cast<UINT32>(indices[i]) >= header.vertexCount)
+            {
+                return false;
+            }
+        }
+
+        XMFLOAT4X4 meshToCapture(header.meshToCapture);
+        XMFLOAT3 scale(header.vertexPositionScale);
+        XMStoreFloat4x4(&mesh->transform, XMMatrixScalingFromVector(XMLoadFloat3(&scale)) * XMLoadFloat4x4(&meshToCapture));
+
+        mesh->vertCount = static_cast<INT32>(header.vertexCount);
+        mesh->indexCount = static_cast<INT32>(header.indexCount);
+        mesh->verts = verts.data();
+        mesh->normals = normals.data();
+        mesh->indices = indices.data();
+        return true;
+    }
+}
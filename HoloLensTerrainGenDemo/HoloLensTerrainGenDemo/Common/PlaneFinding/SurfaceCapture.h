@@ -0,0 +1,89 @@
+#pragma once
+#include "PlaneFinding.h"
+
+namespace PlaneFinding
+{
+    // A surface capture records every update of every spatial surface mesh in a session, so plane finding can be run
+    // on the same meshes again away from the device. It is a SurfaceCaptureFileHeader followed by one record per
+    // update, in the order they arrived. Each record is a SurfaceCaptureRecordHeader followed by the mesh as the
+    // device delivered it: vertexCount SNORM16x4 positions, vertexCount SNORM8x4 normals and indexCount R16 indices,
+    // padded to a multiple of 8 bytes. Every index is below vertexCount, so a mesh without vertices has no indices
+    // either. Everything is little endian.
+    const UINT32 cSurfaceCaptureMagic = 0x50414353; // 'SCAP'
+    const UINT32 cSurfaceCaptureRecordMagic = 0x43455253; // 'SREC'
+    const UINT32 cSurfaceCaptureVersion = 1;
+
+    struct SurfaceCaptureFileHeader
+    {
+        UINT32 magic;
+        UINT32 version;
+    };
+
+    struct SurfaceCaptureRecordHeader
+    {
+        UINT32 magic;
+        UINT32 recordBytes;           // the whole record, including this header and the padding
+        BYTE surfaceId[16];           // the surface's GUID
+        INT64 updateTime;             // SpatialSurfaceInfo::UpdateTime, in 100ns ticks
+        UINT64 captureTime;           // microseconds from the start of the capture to the update arriving
+        float meshToCapture[16];      // row major transform from the mesh's coordinate system to the capture's
+        float vertexPositionScale[3]; // applied to the positions before meshToCapture
+        UINT32 vertexCount;
+        UINT32 indexCount;
+        UINT32 reserved;
+    };
+
+    static_assert(sizeof(SurfaceCaptureRecordHeader) == 128, "the record header is part of the file format");
+
+    // Bytes taken by a record holding a mesh of this size.
+    inline UINT64 GetSurfaceCaptureRecordBytes(_In_ UINT32 vertexCount, _In_ UINT32 indexCount)
+    {
+        UINT64 bytes = sizeof(SurfaceCaptureRecordHeader) + UINT64(vertexCount) * 12 + UINT64(indexCount) * 2;
+        return (bytes + 7) & ~UINT64(7);
+    }
+
+    // A record read from a capture. The mesh data points into the capture.
+    struct SurfaceCaptureRecord
+    {
+        SurfaceCaptureRecordHeader header;
+        const BYTE* positions;
+        const BYTE* normals;
+        const BYTE* indices;
+    };
+
+    // Walks the records of a capture held in memory, such as a mapped file. Reading stops at the first record that is
+    // cut short, which is usually the last record of a capture the app was closed during, or that is damaged.
+    class SurfaceCaptureReader
+    {
+    public:
+        SurfaceCaptureReader(_In_reads_bytes_(size) const BYTE* data, _In_ size_t size);
+
+        // False if the data does not start with the header of a capture this version can read.
+        bool IsValid() const { return m_valid; }
+
+        // Reads the next record. Returns false once there are no more intact records. Every record it returns decodes.
+        bool Next(_Out_ SurfaceCaptureRecord* record);
+
+        // True once Next has stopped at a damaged record: one that does not start with a record header, does not have
+        // the size its header gives, or has indices past the end of its vertices. A record cut short by the end of
+        // the capture is not damaged.
+        bool IsCorrupt() const { return m_corrupt; }
+
+    private:
+        const BYTE* m_data;
+        size_t m_size;
+        size_t m_offset;
+        bool m_valid;
+        bool m_corrupt;
+    };
+
+    // Decodes the mesh of a record for FindPlanes, giving the same vertices the app decodes from a live mesh. The
+    // vectors are resized to fit, and mesh points into them. Returns false, leaving mesh unset, if an index is past the
+    // end of the vertices, which would send plane finding out of bounds.
+    bool DecodeSurfaceCaptureRecord(
+        _In_ const SurfaceCaptureRecord& record,
+        _Inout_ vector<DirectX::XMFLOAT3>& verts,
+        _Inout_ vector<DirectX::XMFLOAT3>& normals,
+        _Inout_ vector<INT32>& indices,
+        _Out_ MeshData* mesh);
+}
@@ -1,17 +1,19 @@
 #include "pch.h"
 #include "common.h"
 #include "PlaneFinding.h"
+#include "ScratchArena.h"
 
 using namespace DirectX;
 
 namespace PlaneFinding
 {
     const float ROTATING_CALIPERS_EPSILON = 0.01f; // a small epsilon value to handle rounding errors when calculating rotation angles
+    const float ROTATING_CALIPERS_TAN_EPSILON = 0.0100003f; // tan(ROTATING_CALIPERS_EPSILON), to apply it to edge directions
 
-    vector<pair<XMFLOAT2, UINT32>> FindConvexHull(_In_ function<bool(XMFLOAT2*, UINT32*)> vertGenerator)
+    ScratchVector<XMFLOAT2> FindConvexHull(_In_ ScratchArena& arena, _In_reads_(cVerts) const XMFLOAT3 *verts, UINT32 cVerts, _Out_ float *zmin, _Out_ float *zmax)
     {
-        // We find a convex hull for a set of points (as defined by a callback function that iterates them) by
-        // 1) generate the list of points
+        // We find a convex hull for a set of points by
+        // 1) copying their x and y into a list of points
         // 2) sort them
         // 3) iterate along the sorted points to trace along the top/bottom of the convex hull
         // 4) for each vertex we add to the top/bottom, we need to look at the prior element added and check that it should
@@ -19,24 +21,26 @@ namespace PlaneFinding
 
         // We use the Monotone Chain algorithm to calculate the convex-hull - http://en.wikibooks.org/wiki/Algorithm_Implementation/Geometry/Convex_hull/Monotone_chain,
 
-        vector<pair<XMFLOAT2, UINT32>> planarVerts;
+        ScratchVector<XMFLOAT2> planarVerts(cVerts, arena);
 
-        XMFLOAT2 newVert;
-        UINT32 index;
-        while (vertGenerator(&newVert, &index))
+        *zmin = FLT_MAX;
+        *zmax = -FLT_MAX;
+        for (UINT32 i = 0; i < cVerts; ++i)
         {
-            planarVerts.push_back({ newVert, index });
+            planarVerts[i] = { verts[i].x, verts[i].y };
+            *zmin = min(*zmin, verts[i].z);
+            *zmax = max(*zmax, verts[i].z);
         }
 
         // sort in the x-direction, and then if equal in the y-direction.  duplicate vertices will be removed by the isVertAbove/isVertBelow conditions below.
-        std::sort(planarVerts.begin(), planarVerts.end(), [](const pair<XMFLOAT2, UINT32> &v1, const pair<XMFLOAT2, UINT32> &v2)
+        std::sort(planarVerts.begin(), planarVerts.end(), [](const XMFLOAT2 &v1, const XMFLOAT2 &v2)
         {
-            return v1.first.x < v2.first.x || (v1.first.x == v2.first.x && v1.first.y < v2.first.y);
+            return v1.x < v2.x || (v1.x == v2.x && v1.y < v2.y);
         });
 
         // now that we have the sorted list of verts, look at them in order, and generate a convex hull
-        vector<pair<XMFLOAT2, UINT32>> top;
-        vector<pair<XMFLOAT2, UINT32>> bottom;
+        ScratchVector<XMFLOAT2> top(arena);
+        ScratchVector<XMFLOAT2> bottom(arena);
 
         // Given three points, return true if v is above line p1->p2, and false otherwise
         auto isVertAbove = [](const XMFLOAT2 &v, const XMFLOAT2 &p1, const XMFLOAT2 &p2)
@@ -56,13 +60,13 @@ namespace PlaneFinding
         for (auto const &vert : planarVerts)
         {
             // reduce top assuming we will add vert
-            while (top.size() >= 2 && !isVertAbove(vert.first, top[top.size() - 1].first, top[top.size() - 2].first))
+            while (top.size() >= 2 && !isVertAbove(vert, top[top.size() - 1], top[top.size() - 2]))
             {
                 top.pop_back();
             }
 
             // reduce bottom assuming we will add vert
-            while (bottom.size() >= 2 && !isVertBelow(vert.first, bottom[bottom.size() - 1].first, bottom[bottom.size() - 2].first))
+            while (bottom.size() >= 2 && !isVertBelow(vert, bottom[bottom.size() - 1], bottom[bottom.size() - 2]))
             {
                 bottom.pop_back();
             }
@@ -72,7 +76,7 @@ namespace PlaneFinding
         }
 
         // Start by copying the top-list to our returned collection.
-        vector<pair<XMFLOAT2, UINT32>> ret = move(top);
+        ScratchVector<XMFLOAT2> ret = move(top);
 
         ASSERT(bottom.size() >= 2);
         // We traced both top and bottom vertices in left-to-right order in one pass, so we need to reverse the order on the bottom
@@ -85,7 +89,23 @@ namespace PlaneFinding
         return ret;
     }
 
-    DirectX::BoundingOrientedBox GetBoundsInOrientedSpace(_In_ bool findTightestBounds, _In_ function<bool(XMFLOAT3*)> vertGenerator)
+    // Returns true if the clockwise angle from +y to direction a is smaller than the one to direction b, for angles
+    // in [0, 2pi). Neither direction needs to be normalized.
+    bool IsDirectionBefore(const XMFLOAT2 &a, const XMFLOAT2 &b)
+    {
+        // directions with x > 0, or straight up, are in [0, pi); the rest are in [pi, 2pi)
+        bool aInSecondHalf = !(a.x > 0 || (a.x == 0 && a.y > 0));
+        bool bInSecondHalf = !(b.x > 0 || (b.x == 0 && b.y > 0));
+        if (aInSecondHalf != bInSecondHalf)
+        {
+            return bInSecondHalf;
+        }
+
+        // within a half turn, b is further clockwise exactly when the cross product of a and b points into the screen
+        return a.y * b.x - a.x * b.y > 0;
+    }
+
+    DirectX::BoundingOrientedBox GetBoundsInOrientedSpace(_In_ bool findTightestBounds, _In_reads_(cVerts) const XMFLOAT3 *verts, _In_ UINT32 cVerts)
     {
         // we find tight bounds by
         // 1. find the convex hull
@@ -95,45 +115,53 @@ namespace PlaneFinding
         // As we rotate, a vertex may no-longer be extreme in the new rotated coordinate frame, so we increment the index to the next vertex
         // in the convex hull that is now extreme.
 
-        float zmin = FLT_MAX, zmax = -FLT_MAX;
-        auto convexHull = FindConvexHull([&](XMFLOAT2 *planarVert, UINT32 *index) -> bool
+        if (cVerts == 0)
         {
-            *index = 0; // we dont' care about the index here - only useful when exposing the convex hull directly
+            BoundingOrientedBox empty;
+            empty.Center = { 0, 0, 0 };
+            empty.Extents = { 0, 0, 0 };
+            empty.Orientation = { 0, 0, 0, 1 };
+            return empty;
+        }
 
-            XMFLOAT3 vert;
-            bool ret = vertGenerator(&vert);
-            if (ret)
+        if (!findTightestBounds || cVerts < 3)
+        {
+            // an axis-aligned box is just the range of the vertices, there is no need for their hull. Fewer than three
+            // vertices have no hull to turn the calipers around, so they get one too.
+            XMFLOAT3 minv = { FLT_MAX, FLT_MAX, FLT_MAX };
+            XMFLOAT3 maxv = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            for (UINT32 i = 0; i < cVerts; ++i)
             {
-                if (vert.z < zmin)
-                {
-                    zmin = vert.z;
-                }
-
-                if (vert.z > zmax)
-                {
-                    zmax = vert.z;
-                }
+                minv = { min(minv.x, verts[i].x), min(minv.y, verts[i].y), min(minv.z, verts[i].z) };
+                maxv = { max(maxv.x, verts[i].x), max(maxv.y, verts[i].y), max(maxv.z, verts[i].z) };
             }
-            *planarVert = { vert.x, vert.y };
-            return ret;
-        });
+
+            BoundingOrientedBox boxInPlaneSpace;
+            boxInPlaneSpace.Center = { (maxv.x + minv.x) / 2, (maxv.y + minv.y) / 2, (maxv.z + minv.z) / 2 };
+            boxInPlaneSpace.Extents = { (maxv.x - minv.x) / 2, (maxv.y - minv.y) / 2, (maxv.z - minv.z) / 2 };
+            boxInPlaneSpace.Orientation = { 0, 0, 0, 1 };
+            return boxInPlaneSpace;
+        }
+
+        ScratchArenaScope scope;
+        float zmin, zmax;
+        auto convexHull = FindConvexHull(scope.Arena(), verts, cVerts, &zmin, &zmax);
 
         // first we need to set up the calipers - extreme vertices that we will incrementally update as we rotate
-        XMFLOAT2 maxv = convexHull[0].first;
-        XMFLOAT2 minv = convexHull[0].first;
+        XMFLOAT2 maxv = convexHull[0];
+        XMFLOAT2 minv = convexHull[0];
         struct RotatedBoundingBox
         {
             UINT32 maxx, maxy, minx, miny; // these represent the indices of the max/min x and y coordinates in a rotated coordated frame.
             float area;
             float minwidth;
-            float angle;
         };
 
         // find the initial orientation's bounds:
-        RotatedBoundingBox best = { 0, 0, 0, 0, FLT_MAX, FLT_MAX, XM_2PI };
+        RotatedBoundingBox best = { 0, 0, 0, 0, FLT_MAX, FLT_MAX };
         for (UINT32 i = 1; i < convexHull.size(); ++i)
         {
-            const auto vertex = convexHull[i].first;
+            const auto vertex = convexHull[i];
             if (vertex.x > maxv.x)
             {
                 maxv.x = vertex.x;
@@ -156,10 +184,16 @@ namespace PlaneFinding
                 best.miny = i;
             }
         }
-        best.angle = 0;
         best.area = (maxv.x - minv.x) * (maxv.y - minv.y);
         best.minwidth = min(maxv.x - minv.x, maxv.y - minv.y);
 
+        if (best.miny == 0)
+        {
+            // the first vertex is the lowest as well as the leftmost. The ymin caliper reaches it after going round
+            // the hull, so index it past the end; otherwise the loop below would stop before rotating at all.
+            best.miny = static_cast<UINT32>(convexHull.size());
+        }
+
         ASSERT(best.minx != best.maxx); // xmin and xmax indices should never be the same
         ASSERT(best.miny != best.maxy);
 
@@ -175,22 +209,31 @@ namespace PlaneFinding
 
         ASSERT(best.minx == 0); // we expect minx to be the first vertex in the convex hull
 
-                                // Helper to calculate the rotation if we move from the given vertex to the next vertex in the convex hull
+        // Helper to calculate the rotation if we move from the given vertex to the next vertex in the convex hull
         auto getDeltaVectorForIndex = [&](UINT32 vert)
         {
             // return the delta between the given vertex and the subsequent vertex, so we can determine the angle our bounding box
             // would have to rotate to be parallel with this edge
-            auto start = convexHull[vert % convexHull.size()].first;
-            auto next = convexHull[(vert + 1) % convexHull.size()].first;
+            auto start = convexHull[vert % convexHull.size()];
+            auto next = convexHull[(vert + 1) % convexHull.size()];
 
             ASSERT(start.x != next.x || start.y != next.y);
 
             return XMFLOAT2({ next.x - start.x, next.y - start.y });
         };
 
+        // Rotations are kept as the direction (sin(angle), cos(angle)), scaled by any positive length, rather than as an angle:
+        // comparing two of them takes a cross product, and the box for one needs only its normalized sine and cosine.
+        auto isWithinQuarterTurn = [](const XMFLOAT2 &direction)
+        {
+            // true when the angle is at most 90 degrees, plus the epsilon
+            return !IsDirectionBefore({ 0.0f, 1.0f }, direction) ||
+                (direction.x > 0 && -direction.y <= ROTATING_CALIPERS_TAN_EPSILON * direction.x);
+        };
+
         // once we have the extreme vertices, we slowly rotate our coordinate system and adjust them
         // we rotate in such a way that only one extreme vertex changes at a time
-        float angle = 0;
+        XMFLOAT2 rotation = { 0.0f, 1.0f };
         RotatedBoundingBox current = best;
 
         BoundingOrientedBox bestBoxInPlaneSpace;
@@ -198,92 +241,90 @@ namespace PlaneFinding
         bestBoxInPlaneSpace.Extents = { (maxv.x - minv.x) / 2, (maxv.y - minv.y) / 2, (zmax - zmin) / 2 };
         bestBoxInPlaneSpace.Orientation = { 0, 0, 0, 1 };
 
-        if (findTightestBounds)
+        RotatedBoundingBox initial = best;
+
+        // The tightest bounding box will share a side with the convex hull.  We start with a candidate bounding box oriented along
+        // the x/y axes and iterate through all orientations where the box is aligned with an edge of the convex hull.  The maximum possible rotations
+        // we need to consider is convexHull.size(), which would be a rotation of 90 degrees.
+        // Each iteration through the loop, we pick the vertex from our extreme vertices that has the smallest incremental rotation along its outgoing edge.
+        // A neat trick is that the other extreme vertices remain extreme in the new rotated orientation.
+        while (isWithinQuarterTurn(rotation) &&
+            current.minx <= initial.maxy &&
+            current.maxy <= initial.maxx &&
+            current.maxx <= initial.miny &&
+            current.miny <= convexHull.size())
         {
-            RotatedBoundingBox initial = best;
-
-            // The tightest bounding box will share a side with the convex hull.  We start with a candidate bounding box oriented along
-            // the x/y axes and iterate through all orientations where the box is aligned with an edge of the convex hull.  The maximum possible rotations
-            // we need to consider is convexHull.size(), which would be a rotation of 90 degrees.
-            // Each iteration through the loop, we pick the vertex from our extreme vertices that has the smallest incremental rotation along its outgoing edge.
-            // A neat trick is that the other extreme vertices remain extreme in the new rotated orientation.
-            while (angle <= XM_PIDIV2 + ROTATING_CALIPERS_EPSILON &&
-                current.minx <= initial.maxy &&
-                current.maxy <= initial.maxx &&
-                current.maxx <= initial.miny &&
-                current.miny <= convexHull.size())
+            const auto vectForXmin = getDeltaVectorForIndex(current.minx);
+            const auto vectForXmax = getDeltaVectorForIndex(current.maxx);
+            const auto vectForYmin = getDeltaVectorForIndex(current.miny);
+            const auto vectForYmax = getDeltaVectorForIndex(current.maxy);
+
+            // the rotation that would make each caliper parallel with its outgoing edge
+            UINT32* boundIndices[4] = { &current.minx, &current.maxx, &current.miny, &current.maxy };
+            XMFLOAT2 rotations[4] = {
+                { vectForXmin.x, vectForXmin.y },
+                { -vectForXmax.x, -vectForXmax.y },
+                { vectForYmin.y, -vectForYmin.x },
+                { -vectForYmax.y, vectForYmax.x } };
+
+            int index = 0;
+            for (int i = 0; i < 4; ++i)
             {
-                const auto vectForXmin = getDeltaVectorForIndex(current.minx);
-                const auto vectForXmax = getDeltaVectorForIndex(current.maxx);
-                const auto vectForYmin = getDeltaVectorForIndex(current.miny);
-                const auto vectForYmax = getDeltaVectorForIndex(current.maxy);
-
-                UINT32* boundIndices[4] = { &current.minx, &current.maxx, &current.miny, &current.maxy };
-                float angles[4] = {
-                    atan2(vectForXmin.x, vectForXmin.y),
-                    atan2(-vectForXmax.x, -vectForXmax.y),
-                    atan2(vectForYmin.y, -vectForYmin.x),
-                    atan2(-vectForYmax.y, vectForYmax.x) };
-
-                int index = 0;
-                float minAngle = XM_PI * 4 + angle;
-                for (int i = 0; i < 4; ++i)
+                if (rotations[i].x < 0 && rotations[i].y > 0 && -rotations[i].x < ROTATING_CALIPERS_TAN_EPSILON * rotations[i].y)
+                {
+                    // the vector between vertices are horizontal/vertical, so angle is close to 0, treat it as zero
+                    // this can only occur with a rounding error
+                    rotations[i] = { 0.0f, 1.0f };
+                }
+
+                if (IsDirectionBefore(rotations[i], rotations[index]))
                 {
-                    if (angles[i] > -ROTATING_CALIPERS_EPSILON && angles[i] < 0)
-                    {
-                        // the vector between vertices are horizontal/vertical, so angle is close to 0, treat it as zero
-                        // this can only occur with a rounding error
-                        angles[i] = 0;
-                    }
-                    else if (angles[i] < 0)
-                    {
-                        angles[i] += XM_PI * 2;
-                    }
-
-                    if (angles[i] < minAngle)
-                    {
-                        minAngle = angles[i];
-                        index = i;
-                    }
+                    index = i;
                 }
+            }
+
+            *(boundIndices[index]) = ((*(boundIndices[index])) + 1);
 
-                *(boundIndices[index]) = ((*(boundIndices[index])) + 1);
+            ASSERT(current.minx <= current.maxy); // we should remain ordering of vertices xmin->ymax->xmax->ymin as we rotate
+            ASSERT(current.maxy <= current.maxx);
+            ASSERT(current.maxx <= current.miny || best.minx == best.miny);
+            ASSERT(current.miny <= current.minx + convexHull.size());
 
-                ASSERT(current.minx <= current.maxy); // we should remain ordering of vertices xmin->ymax->xmax->ymin as we rotate
-                ASSERT(current.maxy <= current.maxx);
-                ASSERT(current.maxx <= current.miny || best.minx == best.miny);
-                ASSERT(current.miny <= current.minx + convexHull.size());
+            ASSERT(current.minx != current.maxx); // and we shouldn't ever have min and max indices equal
+            ASSERT(current.miny != current.maxy);
 
-                ASSERT(current.minx != current.maxx); // and we shouldn't ever have min and max indices equal
-                ASSERT(current.miny != current.maxy);
 
+            // now update our box:
+            rotation = rotations[index];
+            if (isWithinQuarterTurn(rotation))
+            {
+                float length = sqrtf(rotation.x * rotation.x + rotation.y * rotation.y);
+                float sine = rotation.x / length;
+                float cosine = rotation.y / length;
+
+                // the extreme vertices' coordinates in the rotated plane space, as XMMatrixRotationZ(angle) would transform them
+                float rotated[4];
+                for (int i = 0; i < 4; ++i)
+                {
+                    const XMFLOAT2 &vert = convexHull[(*(boundIndices[i])) % convexHull.size()];
+                    rotated[i] = (i < 2) ? vert.x * cosine - vert.y * sine : vert.x * sine + vert.y * cosine;
+                }
 
-                // now update our box:
-                angle = minAngle;
-                current.angle = minAngle;
-                if (angle < XM_PIDIV2 + ROTATING_CALIPERS_EPSILON)
+                const XMFLOAT2 size = { rotated[1] - rotated[0], rotated[3] - rotated[2] };
+                current.area = size.x * size.y;
+                current.minwidth = min(size.x, size.y);
+                if (current.area < best.area || (current.area == best.area && current.minwidth < best.minwidth))
                 {
-                    XMVECTOR vertsInRotatedPlaneSpace[4];
-                    const XMMATRIX rotationTransform = XMMatrixRotationZ(angle);
-                    for (int i = 0; i < 4; ++i)
-                    {
-                        vertsInRotatedPlaneSpace[i] = XMVector3TransformCoord(XMLoadFloat2(&convexHull[(*(boundIndices[i])) % convexHull.size()].first), rotationTransform);
-                    }
-
-                    BoundingOrientedBox xmBoundsInPlaneSpace;
-                    xmBoundsInPlaneSpace.Center = { XMVectorGetX(vertsInRotatedPlaneSpace[0] + vertsInRotatedPlaneSpace[1]) / 2, XMVectorGetY(vertsInRotatedPlaneSpace[2] + vertsInRotatedPlaneSpace[3]) / 2, (zmax + zmin) / 2 };
-                    xmBoundsInPlaneSpace.Extents = { XMVectorGetX(vertsInRotatedPlaneSpace[1] - vertsInRotatedPlaneSpace[0]) / 2, XMVectorGetY(vertsInRotatedPlaneSpace[3] - vertsInRotatedPlaneSpace[2]) / 2, (zmax - zmin) / 2 };
-                    xmBoundsInPlaneSpace.Orientation = { 0, 0, 0, 1 };
-                    xmBoundsInPlaneSpace.Transform(xmBoundsInPlaneSpace, XMMatrixTranspose(rotationTransform)); // rotate back to plane space from rotated plane space
-
-                    const XMFLOAT2 size = { xmBoundsInPlaneSpace.Extents.x * 2, xmBoundsInPlaneSpace.Extents.y * 2 };
-                    current.area = size.x * size.y;
-                    current.minwidth = min(size.x, size.y);
-                    if (current.area < best.area || (current.area == best.area && current.minwidth < best.minwidth))
-                    {
-                        best = current;
-                        bestBoxInPlaneSpace = xmBoundsInPlaneSpace;
-                    }
+                    best = current;
+
+                    // rotate back to plane space from rotated plane space. The angle is at most a little over 90 degrees, so the cosine
+                    // of half of it is well away from zero, and the sine of half of it is taken from the sine rather than from
+                    // 1 - cosine, which loses small angles to rounding.
+                    const XMFLOAT2 center = { (rotated[0] + rotated[1]) / 2, (rotated[2] + rotated[3]) / 2 };
+                    const float halfCosine = sqrtf((1 + cosine) / 2);
+                    bestBoxInPlaneSpace.Center = { center.x * cosine + center.y * sine, center.y * cosine - center.x * sine, (zmax + zmin) / 2 };
+                    bestBoxInPlaneSpace.Extents = { size.x / 2, size.y / 2, (zmax - zmin) / 2 };
+                    bestBoxInPlaneSpace.Orientation = { 0, 0, -sine / (2 * halfCosine), halfCosine };
                 }
             }
         }
@@ -291,6 +332,15 @@ namespace PlaneFinding
         return bestBoxInPlaneSpace;
     }
 
+    DirectX::BoundingOrientedBox GetBoundsInOrientedSpace(_In_ bool findTightestBounds, _In_reads_(cVerts) const XMFLOAT3 *verts, _In_ UINT32 cVerts, _In_ const XMMATRIX &toOrientedSpace)
+    {
+        ScratchArenaScope scope;
+        XMFLOAT3* vertsInOrientedSpace = scope.Arena().AllocateArray<XMFLOAT3>(cVerts);
+        XMVector3TransformCoordStream(vertsInOrientedSpace, sizeof(XMFLOAT3), verts, sizeof(XMFLOAT3), cVerts, toOrientedSpace);
+
+        return GetBoundsInOrientedSpace(findTightestBounds, vertsInOrientedSpace, cVerts);
+    }
+
     bool SnapToGravity(_Inout_ Plane* plane, _Inout_opt_ XMFLOAT3* tangent, _In_ const XMFLOAT3& center, float snapToGravityThreshold, _In_ const XMVECTOR& vUp)
     {
         XMVECTOR vNormal = XMLoadFloat3(&plane->normal);
@@ -345,4 +395,14 @@ namespace PlaneFinding
 
         return isGravityAligned;
     }
+
+    double LapMilliseconds(_Inout_ LARGE_INTEGER *last)
+    {
+        LARGE_INTEGER now, frequency;
+        QueryPerformanceCounter(&now);
+        QueryPerformanceFrequency(&frequency);
+        double milliseconds = static_cast<double>(now.QuadPart - last->QuadPart) * 1000.0 / static_cast<double>(frequency.QuadPart);
+        *last = now;
+        return milliseconds;
+    }
 }
\ No newline at end of file
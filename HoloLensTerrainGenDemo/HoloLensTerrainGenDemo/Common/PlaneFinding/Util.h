@@ -2,9 +2,24 @@
 
 namespace PlaneFinding
 {
+    // Which vertices are on a plane, for both engines, so region growing and RANSAC agree on what a plane is.
+    const float cMaxDistanceFromPlane = 0.0125f; // max distance from a plane equation for a vertex to be considered part of the plane, in meters
+    const float cMinCosAngleBetweenNormalAndPlane = 0.5f * sqrtf(3.0f); // min angle between plane and vertex normal to consider vertex part of the plane (30 degrees)
+
+    // Fits a box to vertices that are already in the oriented space. The box is aligned with the space's z axis, and
+    // with its x and y axes unless findTightestBounds is set and there are at least three vertices, in which case it is
+    // rotated about z to the smallest area. No vertices give an empty box at the origin.
+    DirectX::BoundingOrientedBox GetBoundsInOrientedSpace(
+        _In_ bool findTightestBounds,
+        _In_reads_(cVerts) const DirectX::XMFLOAT3* verts,
+        _In_ UINT32 cVerts);
+
+    // As above, for vertices that toOrientedSpace transforms into the oriented space.
     DirectX::BoundingOrientedBox GetBoundsInOrientedSpace(
         _In_ bool findTightestBounds,
-        _In_ function<bool(DirectX::XMFLOAT3*)> vertGenerator);
+        _In_reads_(cVerts) const DirectX::XMFLOAT3* verts,
+        _In_ UINT32 cVerts,
+        _In_ const DirectX::XMMATRIX& toOrientedSpace);
 
     bool SnapToGravity(
         _Inout_ Plane* plane,
@@ -12,4 +27,58 @@ namespace PlaneFinding
         _In_ const DirectX::XMFLOAT3& center,
         _In_ float snapToGravityThreshold,
         _In_ const DirectX::XMVECTOR& vUp);
+
+    // True when two sub-planes are close enough in orientation, and overlap, to be merged into one plane.
+    bool AreNeighbors(
+        _In_ const BoundedPlane& p1,
+        _In_ const BoundedPlane& p2);
+
+    // Calls onNeighbors(i, j) for every pair i < j of planes that AreNeighbors, in increasing order of i and then of j.
+    // The planes are bucketed by normal direction and by a grid over their bounds first, so not every pair is tested.
+    void ForEachNeighborPair(
+        _In_ UINT32 numPlanes,
+        _In_count_(numPlanes) const BoundedPlane* planes,
+        _In_ const function<void(UINT32, UINT32)>& onNeighbors);
+
+    // Where the broadphase of ForEachNeighborPair, and that of PlaneMap, puts a plane: the cell its normal falls in, and
+    // the range of cells of a grid over space that its axis aligned bounds cover. Neighbors are in the same or adjacent
+    // normal cells, and share a spatial cell.
+    struct BroadphaseCells
+    {
+        UINT32 normal[3];
+        UINT32 first[3];
+        UINT32 last[3];
+        bool oversized; // covers too many spatial cells to be bucketed, so it is tested against every other plane instead
+    };
+
+    // The axis aligned bounds of a plane's bounds, grown a little so rounding can't drop a touching pair.
+    DirectX::BoundingBox GetBroadphaseBounds(
+        _In_ const BoundedPlane& plane);
+
+    // The cells of a plane with the given broadphase bounds, on a grid of cellSize cells starting at gridOrigin. The grid
+    // is 1024 cells along each axis; bounds past its ends are clamped to it.
+    BroadphaseCells GetBroadphaseCells(
+        _In_ const BoundedPlane& plane,
+        _In_ const DirectX::BoundingBox& bounds,
+        _In_ DirectX::FXMVECTOR gridOrigin,
+        _In_ float cellSize);
+
+    // Calls onKey with the key of every cell a plane with these cells is in or, with neighbors set, of every cell a
+    // neighbor of it could be in.
+    void ForEachBroadphaseKey(
+        _In_ const BroadphaseCells& cells,
+        _In_ bool neighbors,
+        _In_ const function<void(UINT64)>& onKey);
+
+    // Merges a clique of neighboring sub-planes into one plane. Returns false, leaving merged untouched, when their total
+    // area is not above minArea.
+    bool MergeSubPlanes(
+        _In_ UINT32 numSubPlanes,
+        _In_count_(numSubPlanes) const BoundedPlane* const* subPlanes,
+        _In_ float minArea,
+        _In_ float snapToGravityThreshold,
+        _Out_ BoundedPlane* merged);
+
+    // Milliseconds since *last, which is moved on to now, for timing the stages of plane finding.
+    double LapMilliseconds(_Inout_ LARGE_INTEGER *last);
 }
\ No newline at end of file
@@ -0,0 +1,47 @@
+#include "common.h"
+#include "pch.h"
+#include "VertexAdjacency.h"
+
+VertexAdjacency::VertexAdjacency(_In_ PlaneFinding::ScratchArena& arena, _In_ UINT32 numVertices, _In_ UINT32 numIndices, _In_ const INT32* indices) :
+    m_offsets(arena),
+    m_neighbors(arena)
+{
+    ASSERT(numIndices % VERTICES_PER_TRIANGLE == 0);
+
+    // every corner of every triangle gives its vertex one neighbour, so counting corners per vertex sizes the rows.
+    m_offsets.assign(numVertices + 1, 0);
+    for (UINT32 i = 0; i < numIndices; ++i)
+    {
+        ASSERT(static_cast<UINT32>(indices[i]) < numVertices);
+        m_offsets[indices[i] + 1]++;
+    }
+
+    for (UINT32 v = 0; v < numVertices; ++v)
+    {
+        m_offsets[v + 1] += m_offsets[v];
+    }
+
+    // place each corner's successor in its vertex's row, in triangle order.
+    m_neighbors.resize(numIndices);
+    PlaneFinding::ScratchVector<UINT32> cursor(m_offsets.begin(), m_offsets.end() - 1, arena);
+    for (UINT32 i = 0; i < numIndices; i += VERTICES_PER_TRIANGLE)
+    {
+        UINT32 v0 = indices[i];
+        UINT32 v1 = indices[i + 1];
+        UINT32 v2 = indices[i + 2];
+
+        m_neighbors[cursor[v0]++] = v1;
+        m_neighbors[cursor[v1]++] = v2;
+        m_neighbors[cursor[v2]++] = v0;
+    }
+
+    // HalfEdgeMesh lists a vertex's first triangle, then the others newest first. Matching that order keeps the
+    // floating point sums over neighbours identical to what the half-edge path produced.
+    for (UINT32 v = 0; v < numVertices; ++v)
+    {
+        if (m_offsets[v + 1] - m_offsets[v] > 2)
+        {
+            reverse(m_neighbors.begin() + m_offsets[v] + 1, m_neighbors.begin() + m_offsets[v + 1]);
+        }
+    }
+}
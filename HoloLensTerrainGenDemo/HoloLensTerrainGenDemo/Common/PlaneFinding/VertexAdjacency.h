@@ -0,0 +1,40 @@
+#pragma once
+#include "common.h"
+#include "ScratchArena.h"
+
+// Vertex adjacency of a triangle list in compressed sparse row form: one offset per vertex into a single array of
+// neighbour indices. The arrays live in a scratch arena, so the adjacency must not outlive the arena's scope.
+// Neighbours of a vertex are contiguous, so walking them touches one or two cache lines instead of chasing a pointer
+// per neighbour like HalfEdgeMesh does.
+// A vertex's neighbours are the same, and in the same order, as HalfEdgeMesh::GetNeighborVerts: for every triangle
+// using the vertex, the vertex that follows it in winding order.
+class VertexAdjacency
+{
+public:
+    // arena provides the memory for the adjacency. indices is a triangle list, three per triangle.
+    VertexAdjacency(_In_ PlaneFinding::ScratchArena& arena, _In_ UINT32 numVertices, _In_ UINT32 numIndices, _In_ const INT32* indices);
+
+    class NeighborRange
+    {
+    public:
+        NeighborRange(const UINT32* first, const UINT32* last) : m_first(first), m_last(last) {}
+
+        const UINT32* begin() const { return m_first; }
+        const UINT32* end() const { return m_last; }
+        UINT32 size() const { return static_cast<UINT32>(m_last - m_first); }
+
+    private:
+        const UINT32* m_first;
+        const UINT32* m_last;
+    };
+
+    NeighborRange GetNeighborVerts(UINT32 vert) const
+    {
+        return NeighborRange(m_neighbors.data() + m_offsets[vert], m_neighbors.data() + m_offsets[vert + 1]);
+    }
+
+private:
+    // m_offsets[v] to m_offsets[v + 1] is the range of v's neighbours in m_neighbors.
+    PlaneFinding::ScratchVector<UINT32> m_offsets;
+    PlaneFinding::ScratchVector<UINT32> m_neighbors;
+};
@@ -1,10 +1,14 @@
 ﻿#pragma once
 
+#ifdef _WIN32
 #include <windows.h>
 #include <intrin.h>
+#else
+#include "Portability.h"
+#endif
 
-#include <directxmath.h>
-#include <directxcollision.h>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
 #include "MathHelpers.h"
 
 // STL
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "AtomicSnapshot.h"
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace DX
+{
+    // An immutable set of planes, the vertex buffer that draws them and the coordinate system they were found in, as
+    // SurfacePlaneRenderer publishes them. The buffer and coordinate system are type parameters so SnapshotStress
+    // publishes these same snapshots with stand-ins for the Direct3D buffer and the spatial coordinate system.
+    // The vertex buffer is null when there are no planes, and while the device is lost, which keeps the planes.
+    template <typename Plane, typename Buffer, typename CoordinateSystem>
+    struct PlaneSnapshot
+    {
+        std::vector<Plane>                                    planes;
+        Buffer                                                vertexBuffer;
+        CoordinateSystem                                      coordinateSystem;
+    };
+
+    // Merged planes keep their ids while they exist, so planes with the same ids and bounds can be drawn from the
+    // same vertex buffer.
+    template <typename Plane>
+    bool HaveSameBounds(const std::vector<Plane>& a, const std::vector<Plane>& b)
+    {
+        if (a.size() != b.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            if (a[i].id != b[i].id || memcmp(&a[i].plane.bounds, &b[i].plane.bounds, sizeof(a[i].plane.bounds)) != 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Publishes planes found in coordinateSystem. The current vertex buffer is kept if it draws the same planes;
+    // otherwise createBuffer(planes) makes one, under the writer lock, so a slower writer cannot publish a buffer
+    // for planes older than the ones published.
+    template <typename Plane, typename Buffer, typename CoordinateSystem, typename CreateBuffer>
+    void PublishPlanes(
+        AtomicSnapshot<PlaneSnapshot<Plane, Buffer, CoordinateSystem>>& published,
+        std::vector<Plane> planes,
+        CoordinateSystem coordinateSystem,
+        CreateBuffer createBuffer)
+    {
+        typedef PlaneSnapshot<Plane, Buffer, CoordinateSystem> Snapshot;
+        published.Update([&](const std::shared_ptr<const Snapshot>& current)
+        {
+            auto snapshot = std::make_shared<Snapshot>();
+            if (current && current->vertexBuffer && HaveSameBounds(current->planes, planes))
+            {
+                snapshot->vertexBuffer = current->vertexBuffer;
+            }
+            else
+            {
+                snapshot->vertexBuffer = createBuffer(planes);
+            }
+            snapshot->planes = std::move(planes);
+            snapshot->coordinateSystem = coordinateSystem;
+            return std::shared_ptr<const Snapshot>(std::move(snapshot));
+        });
+    }
+
+    // Drops the current snapshot's vertex buffer, which belongs to a device that is going away, and keeps its planes.
+    template <typename Plane, typename Buffer, typename CoordinateSystem>
+    void ReleasePlaneBuffer(AtomicSnapshot<PlaneSnapshot<Plane, Buffer, CoordinateSystem>>& published)
+    {
+        typedef PlaneSnapshot<Plane, Buffer, CoordinateSystem> Snapshot;
+        published.Update([](const std::shared_ptr<const Snapshot>& current)
+        {
+            if (!current || !current->vertexBuffer)
+            {
+                return std::shared_ptr<const Snapshot>();
+            }
+            auto snapshot = std::make_shared<Snapshot>(*current);
+            snapshot->vertexBuffer = Buffer();
+            return std::shared_ptr<const Snapshot>(std::move(snapshot));
+        });
+    }
+
+    // Gives the current snapshot's planes a vertex buffer made by createBuffer on the new device, so they are drawn
+    // again without waiting for the planes to change.
+    template <typename Plane, typename Buffer, typename CoordinateSystem, typename CreateBuffer>
+    void RecreatePlaneBuffer(AtomicSnapshot<PlaneSnapshot<Plane, Buffer, CoordinateSystem>>& published, CreateBuffer createBuffer)
+    {
+        typedef PlaneSnapshot<Plane, Buffer, CoordinateSystem> Snapshot;
+        published.Update([&](const std::shared_ptr<const Snapshot>& current)
+        {
+            if (!current || current->vertexBuffer)
+            {
+                return std::shared_ptr<const Snapshot>();
+            }
+            auto snapshot = std::make_shared<Snapshot>(*current);
+            snapshot->vertexBuffer = createBuffer(snapshot->planes);
+            return std::shared_ptr<const Snapshot>(std::move(snapshot));
+        });
+    }
+}
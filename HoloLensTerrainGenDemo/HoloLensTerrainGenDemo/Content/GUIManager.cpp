@@ -57,6 +57,11 @@ void GUIManager::OnTap(SpatialGestureRecognizer^ sender, SpatialTappedEventArgs^
 
 void GUIManager::OnHoldCompleted(SpatialGestureRecognizer^ sender,	SpatialHoldCompletedEventArgs^ args) {
 	// This will later be related to bringing up the GUI. Either on Hold Started or on Hold Completed.
+	// Until then, in debug builds, a hold starts and stops recording the spatial surfaces for replaying plane finding
+	// offline. Nothing on screen shows a capture is running, so release builds never write one.
+#ifdef _DEBUG
+	captureSurfaces = !captureSurfaces;
+#endif
 }
 
 void GUIManager::CaptureInteraction(SpatialInteraction^ interaction) {
@@ -13,6 +13,8 @@ namespace HoloLensTerrainGenDemo
 		
 		bool GetRenderSurfaces() { return renderSurfaces; }
 		bool GetRenderWireframe() { return renderWireframe; }
+		bool GetCaptureSurfaces() { return captureSurfaces; }
+		void SetCaptureSurfaces(bool capture) { captureSurfaces = capture; }
 
     private:
 		void OnTap(Windows::UI::Input::Spatial::SpatialGestureRecognizer^ sender,
@@ -30,5 +32,6 @@ namespace HoloLensTerrainGenDemo
 
 		bool renderSurfaces = true;
 		bool renderWireframe = false;
+		bool captureSurfaces = false;
     };
 }
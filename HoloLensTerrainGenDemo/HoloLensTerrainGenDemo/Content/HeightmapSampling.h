@@ -0,0 +1,117 @@
+#pragma once
+#include <DirectXMath.h>
+#include <stddef.h>
+
+namespace HoloLensTerrainGenDemo {
+	// Points per chunk when sampling a heightmap.
+	const size_t c_heightmapSampleChunkSize = 1024;
+
+	// Samples the heightmap of a Terrain, with (w + 1) * (h + 1) texels 1cm apart, at up to c_heightmapSampleChunkSize
+	// points. queryToLocal brings the points into the terrain's local space, and modelToQuery is its inverse.
+	// heights receives the bilinearly interpolated height at each point's local x and y, and normals, which may be
+	// null, the surface normal in the space of the points. Points beyond the edge are clamped to it.
+	//
+	// The chunk is transformed into local space in one stream call. Points are then processed four at a time with
+	// one point per vector lane. Each lane gathers its 2x2 texel neighbourhood, which is two adjacent floats in two
+	// adjacent rows, and the interpolation and normals are computed for all four lanes at once.
+	// The height at local (x, y) is the bilinear interpolation of the texels around (100x, 100y), and the normal is
+	// (-dh/dx, -dh/dy, 1) normalized, using the derivatives of the bilinear patch.
+	// Terrain splits larger batches into chunks; TerrainSamplingBenchmark checks and times this on the host.
+	inline void SampleHeightmapChunk(const float* heightmap, unsigned int w, unsigned int h,
+		DirectX::FXMMATRIX queryToLocal, DirectX::CXMMATRIX modelToQuery, const DirectX::XMFLOAT3* points, size_t count,
+		float* heights, DirectX::XMFLOAT3* normals) {
+		using namespace DirectX;
+
+		XMFLOAT3 local[c_heightmapSampleChunkSize];
+		XMVector3TransformCoordStream(local, sizeof(XMFLOAT3), points, sizeof(XMFLOAT3), count, queryToLocal);
+
+		const unsigned int pitch = w + 1;
+		const XMVECTOR texelsPerMeter = XMVectorReplicate(100.0f);
+		// clamp so that x0 + 1 and y0 + 1 stay inside the heightmap.
+		const XMVECTOR maxX = XMVectorReplicate((float)w);
+		const XMVECTOR maxY = XMVectorReplicate((float)h);
+		const XMVECTOR maxX0 = XMVectorReplicate(w > 1 ? (float)w - 1.0f : 0.0f);
+		const XMVECTOR maxY0 = XMVectorReplicate(h > 1 ? (float)h - 1.0f : 0.0f);
+
+		// rows of the linear part of the model transform, used to bring normals into query space.
+		const XMVECTOR rowX = modelToQuery.r[0];
+		const XMVECTOR rowY = modelToQuery.r[1];
+		const XMVECTOR rowZ = modelToQuery.r[2];
+
+		for (size_t i = 0; i < count; i += 4) {
+			// the last group repeats its final point in unused lanes.
+			size_t lane[4];
+			for (auto l = 0u; l < 4; ++l) {
+				lane[l] = i + l < count ? i + l : count - 1;
+			}
+
+			XMVECTOR x = XMVectorSet(local[lane[0]].x, local[lane[1]].x, local[lane[2]].x, local[lane[3]].x);
+			XMVECTOR y = XMVectorSet(local[lane[0]].y, local[lane[1]].y, local[lane[2]].y, local[lane[3]].y);
+			x = XMVectorClamp(XMVectorMultiply(x, texelsPerMeter), g_XMZero, maxX);
+			y = XMVectorClamp(XMVectorMultiply(y, texelsPerMeter), g_XMZero, maxY);
+			XMVECTOR x0 = XMVectorMin(XMVectorFloor(x), maxX0);
+			XMVECTOR y0 = XMVectorMin(XMVectorFloor(y), maxY0);
+			XMVECTOR tx = XMVectorSubtract(x, x0);
+			XMVECTOR ty = XMVectorSubtract(y, y0);
+
+			XMFLOAT4 fx0, fy0;
+			XMStoreFloat4(&fx0, x0);
+			XMStoreFloat4(&fy0, y0);
+			const float* laneX0 = &fx0.x;
+			const float* laneY0 = &fy0.x;
+
+			XMFLOAT4 h00, h10, h01, h11;
+			float* g00 = &h00.x;
+			float* g10 = &h10.x;
+			float* g01 = &h01.x;
+			float* g11 = &h11.x;
+			for (auto l = 0u; l < 4; ++l) {
+				const float* texel = heightmap + (unsigned int)laneX0[l] + (unsigned int)laneY0[l] * pitch;
+				g00[l] = texel[0];
+				g10[l] = texel[1];
+				g01[l] = texel[pitch];
+				g11[l] = texel[pitch + 1];
+			}
+
+			XMVECTOR v00 = XMLoadFloat4(&h00);
+			XMVECTOR v10 = XMLoadFloat4(&h10);
+			XMVECTOR v01 = XMLoadFloat4(&h01);
+			XMVECTOR v11 = XMLoadFloat4(&h11);
+			XMVECTOR top = XMVectorLerpV(v00, v10, tx);
+			XMVECTOR bottom = XMVectorLerpV(v01, v11, tx);
+
+			XMFLOAT4 height;
+			XMStoreFloat4(&height, XMVectorLerpV(top, bottom, ty));
+			const float* laneHeight = &height.x;
+			for (auto l = 0u; l < 4 && i + l < count; ++l) {
+				heights[i + l] = laneHeight[l];
+			}
+
+			if (!normals) {
+				continue;
+			}
+
+			// slopes in meters per meter.
+			XMVECTOR dhdx = XMVectorMultiply(XMVectorLerpV(XMVectorSubtract(v10, v00), XMVectorSubtract(v11, v01), ty), texelsPerMeter);
+			XMVECTOR dhdy = XMVectorMultiply(XMVectorSubtract(bottom, top), texelsPerMeter);
+
+			// transform the local normal (-dhdx, -dhdy, 1) by the model's rotation, then normalize.
+			XMVECTOR qx = XMVectorMultiplyAdd(XMVectorNegate(dhdx), XMVectorSplatX(rowX),
+				XMVectorMultiplyAdd(XMVectorNegate(dhdy), XMVectorSplatX(rowY), XMVectorSplatX(rowZ)));
+			XMVECTOR qy = XMVectorMultiplyAdd(XMVectorNegate(dhdx), XMVectorSplatY(rowX),
+				XMVectorMultiplyAdd(XMVectorNegate(dhdy), XMVectorSplatY(rowY), XMVectorSplatY(rowZ)));
+			XMVECTOR qz = XMVectorMultiplyAdd(XMVectorNegate(dhdx), XMVectorSplatZ(rowX),
+				XMVectorMultiplyAdd(XMVectorNegate(dhdy), XMVectorSplatZ(rowY), XMVectorSplatZ(rowZ)));
+			XMVECTOR invLength = XMVectorReciprocalSqrt(
+				XMVectorMultiplyAdd(qx, qx, XMVectorMultiplyAdd(qy, qy, XMVectorMultiply(qz, qz))));
+
+			XMFLOAT4 nxs, nys, nzs;
+			XMStoreFloat4(&nxs, XMVectorMultiply(qx, invLength));
+			XMStoreFloat4(&nys, XMVectorMultiply(qy, invLength));
+			XMStoreFloat4(&nzs, XMVectorMultiply(qz, invLength));
+			for (auto l = 0u; l < 4 && i + l < count; ++l) {
+				normals[i + l] = XMFLOAT3((&nxs.x)[l], (&nys.x)[l], (&nzs.x)[l]);
+			}
+		}
+	}
+}
@@ -0,0 +1,132 @@
+#include "pch.h"
+#include "PlaneUpdateScheduler.h"
+#include "Common\StepTimer.h"
+
+#include <string>
+
+using namespace HoloLensTerrainGenDemo;
+using namespace concurrency;
+using namespace Windows::Perception::Spatial;
+
+PlaneUpdateScheduler::PlaneUpdateScheduler(Job job) :
+	m_job(job) {
+}
+
+PlaneUpdateScheduler::~PlaneUpdateScheduler() {
+	// this runs on the UI thread, where waiting on a task is not allowed, so wait for the job to say it is done. The
+	// job stops at its next cancellation check, which keeps the wait to one step of plane finding.
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_shuttingDown = true;
+	m_cancellation.cancel();
+	m_finished.wait(lock, [this] { return !m_running; });
+}
+
+void PlaneUpdateScheduler::SetCoordinateSystem(SpatialCoordinateSystem^ coordinateSystem) {
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_coordinateSystem = coordinateSystem;
+	StartIfNeeded();
+}
+
+void PlaneUpdateScheduler::RequestUpdate() {
+	std::lock_guard<std::mutex> guard(m_lock);
+	if (m_pendingEvents == 0) {
+		m_pendingSince = DX::StepTimer::GetTicks();
+	} else {
+		++m_statistics.coalesced;
+	}
+	++m_pendingEvents;
+	m_statistics.maxQueueDepth = max(m_statistics.maxQueueDepth, m_pendingEvents + m_runningEvents);
+
+	if (m_running) {
+		// whatever the running job produces is already out of date, so let it stop at its next stage boundary,
+		// unless the planes have gone without an update for too long already.
+		if (ShouldCancelRunning()) {
+			m_cancellation.cancel();
+		} else if (!m_runningProtected && !m_cancellation.get_token().is_canceled()) {
+			m_runningProtected = true;
+			++m_statistics.protectedFromCancel;
+		}
+	} else {
+		StartIfNeeded();
+	}
+}
+
+bool PlaneUpdateScheduler::ShouldCancelRunning() {
+	if (m_consecutiveCancels >= c_maxConsecutiveCancels) {
+		return false;
+	}
+	int64 waited = DX::StepTimer::GetTicks() - m_runningSince;
+	return waited * 1000 < (int64)c_maxLatencyMilliseconds * (int64)DX::StepTimer::GetPerformanceFrequency();
+}
+
+PlaneUpdateStatistics PlaneUpdateScheduler::GetStatistics() {
+	std::lock_guard<std::mutex> guard(m_lock);
+	PlaneUpdateStatistics statistics = m_statistics;
+	statistics.queueDepth = m_pendingEvents + m_runningEvents;
+	statistics.running = m_running;
+	return statistics;
+}
+
+void PlaneUpdateScheduler::StartIfNeeded() {
+	if (m_running || m_shuttingDown || m_pendingEvents == 0 || m_coordinateSystem == nullptr) {
+		return;
+	}
+
+	// events covered by a canceled job carry over, and latency is measured from the oldest of them.
+	if (m_runningEvents == 0) {
+		m_runningSince = m_pendingSince;
+	}
+	m_runningEvents += m_pendingEvents;
+	m_pendingEvents = 0;
+
+	m_cancellation = cancellation_token_source();
+	cancellation_token token = m_cancellation.get_token();
+	SpatialCoordinateSystem^ coordinateSystem = m_coordinateSystem;
+	m_running = true;
+	m_runningProtected = false;
+	create_task([this, coordinateSystem, token] {
+		Run(coordinateSystem, token);
+	});
+}
+
+void PlaneUpdateScheduler::Run(SpatialCoordinateSystem^ coordinateSystem, cancellation_token token) {
+	// the job runs on a task nobody waits on, so whatever it throws is caught here. Otherwise m_running would stay
+	// set, no later update would start, and the destructor would wait for it forever.
+	bool published = false;
+	Platform::String^ failure = nullptr;
+	try {
+		published = m_job(coordinateSystem, token);
+	}
+	catch (Platform::Exception^ e) {
+		failure = e->Message;
+	}
+	catch (const std::exception& e) {
+		std::string what(e.what());
+		failure = ref new Platform::String(std::wstring(what.begin(), what.end()).c_str());
+	}
+	catch (...) {
+		failure = L"unknown exception";
+	}
+
+	std::lock_guard<std::mutex> guard(m_lock);
+	m_running = false;
+	if (failure != nullptr) {
+		// the events the job covered carry over, so the next event starts an update that covers them too.
+		++m_statistics.failed;
+		Platform::String^ message = L"Plane update failed: " + failure + L"\n";
+		OutputDebugStringW(message->Data());
+	} else if (published) {
+		double latency = (double)(DX::StepTimer::GetTicks() - m_runningSince) * 1000.0 / (double)DX::StepTimer::GetPerformanceFrequency();
+		m_statistics.lastLatency = latency;
+		m_statistics.maxLatency = max(m_statistics.maxLatency, latency);
+		++m_statistics.completed;
+		m_runningEvents = 0;
+		m_consecutiveCancels = 0;
+	} else {
+		++m_statistics.canceled;
+		++m_consecutiveCancels;
+	}
+
+	StartIfNeeded();
+	m_finished.notify_all();
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <ppltasks.h>
+
+namespace HoloLensTerrainGenDemo {
+	// How the plane update scheduler has been keeping up with surface changes.
+	struct PlaneUpdateStatistics {
+		// surface change events not yet covered by a finished update, including those the running update started with.
+		unsigned int	queueDepth;
+		// the most events that have been waiting at once.
+		unsigned int	maxQueueDepth;
+		bool			running;
+		unsigned int	completed;
+		// updates that stopped early because newer events arrived.
+		unsigned int	canceled;
+		// updates that newer events were not allowed to cancel, because the updates before them had been canceled
+		// too often in a row or the events they covered had waited too long.
+		unsigned int	protectedFromCancel;
+		// updates whose job threw; the events they covered are carried over to the next update.
+		unsigned int	failed;
+		// events that were folded into an update another event had already asked for.
+		unsigned int	coalesced;
+		// time from the oldest event an update covered to the update being published, in milliseconds.
+		double			lastLatency;
+		double			maxLatency;
+	};
+
+	// Runs the plane recomputation that follows surface changes in the background.
+	// At most one recomputation is in flight. Events that arrive meanwhile only mark the result dirty and cancel the
+	// running job, which stops at its next stage boundary; one new job then covers all of them. So that a steady
+	// stream of events cannot keep planes from ever being published, a job is left to finish once the jobs before it
+	// were canceled c_maxConsecutiveCancels times in a row, or once the events it covers are older than
+	// c_maxLatencyMilliseconds. Jobs use the coordinate system of the most recent frame instead of creating a frame
+	// of their own.
+	class PlaneUpdateScheduler {
+	public:
+		// Does the work. Returns false if it saw the token canceled and stopped before publishing its result.
+		typedef std::function<bool(Windows::Perception::Spatial::SpatialCoordinateSystem^, const concurrency::cancellation_token&)> Job;
+
+		PlaneUpdateScheduler(Job job);
+		// Cancels the running job and blocks until it returns, so whatever the job uses can be released afterwards.
+		// Jobs check the token between the steps of plane finding (see RealtimeSurfaceMeshRenderer::GetPlanes), so
+		// the wait is at most one step: finding the planes of the largest surface being reanalysed, or merging the
+		// planes.
+		// PlaneFindingReplay reports the longest of these steps as "uncancelable". It runs on the UI thread.
+		~PlaneUpdateScheduler();
+
+		// Called once per frame. A job requested before the first frame starts here.
+		void SetCoordinateSystem(Windows::Perception::Spatial::SpatialCoordinateSystem^ coordinateSystem);
+
+		// Called for every surface change event.
+		void RequestUpdate();
+
+		PlaneUpdateStatistics GetStatistics();
+
+	private:
+		// Starts a job if one is wanted and none is running. m_lock must be held.
+		void StartIfNeeded();
+		// True if newer events should cancel the running job. m_lock must be held.
+		bool ShouldCancelRunning();
+		void Run(Windows::Perception::Spatial::SpatialCoordinateSystem^ coordinateSystem, concurrency::cancellation_token token);
+
+		static const unsigned int c_maxConsecutiveCancels = 3;
+		static const int c_maxLatencyMilliseconds = 2000;
+
+		Job													m_job;
+		std::mutex											m_lock;
+		Windows::Perception::Spatial::SpatialCoordinateSystem^	m_coordinateSystem;
+
+		concurrency::cancellation_token_source				m_cancellation;
+		bool												m_running = false;
+		// jobs canceled since one was last published, and whether newer events have already been kept from canceling
+		// the running job.
+		unsigned int										m_consecutiveCancels = 0;
+		bool												m_runningProtected = false;
+		std::condition_variable								m_finished;
+		bool												m_shuttingDown = false;
+
+		// events received since the running job started, and when the oldest of them arrived.
+		unsigned int										m_pendingEvents = 0;
+		int64												m_pendingSince = 0;
+		// events the running job covers, and when the oldest of them arrived.
+		unsigned int										m_runningEvents = 0;
+		int64												m_runningSince = 0;
+
+		PlaneUpdateStatistics								m_statistics = {};
+	};
+}
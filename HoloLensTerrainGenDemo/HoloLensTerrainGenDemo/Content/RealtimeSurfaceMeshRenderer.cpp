@@ -14,6 +14,8 @@
 
 #include "Common\DirectXHelper.h"
 #include "RealtimeSurfaceMeshRenderer.h"
+#include "Common\PlaneFinding\ScratchArena.h"
+#include <ppl.h>
 
 using namespace HoloLensTerrainGenDemo;
 
@@ -27,9 +29,9 @@ using namespace Windows::Graphics::DirectX;
 using namespace Platform;
 
 RealtimeSurfaceMeshRenderer::RealtimeSurfaceMeshRenderer(const std::shared_ptr<DX::DeviceResources>& deviceResources) :
-	m_deviceResources(deviceResources)
+	m_deviceResources(deviceResources),
+	m_meshCollection(std::make_shared<MeshCollection>())
 {
-	m_meshCollection.clear();
 	CreateDeviceDependentResources();
 };
 
@@ -39,16 +41,15 @@ void RealtimeSurfaceMeshRenderer::Update(
 	SpatialCoordinateSystem^ coordinateSystem
 )
 {
-	std::lock_guard<std::mutex> guard(m_meshCollectionLock);
-
 	const float timeElapsed = static_cast<float>(timer.GetTotalSeconds());
 
 	// Update meshes as needed, based on the current coordinate system.
 	// Also remove meshes that are inactive for too long.
-	for (auto iter = m_meshCollection.begin(); iter != m_meshCollection.end(); )
+	auto collection = GetMeshCollection();
+	std::vector<Guid> expired;
+	for (auto& pair : *collection)
 	{
-		auto& pair = *iter;
-		auto& surfaceMesh = pair.second;
+		auto& surfaceMesh = *pair.second;
 
 		// Update the surface mesh.
 		surfaceMesh.UpdateTransform(
@@ -64,28 +65,36 @@ void RealtimeSurfaceMeshRenderer::Update(
 		if (inactiveDuration > c_maxInactiveMeshTime)
 		{
 			// Surface mesh is expired.
-			m_meshCollection.erase(iter++);
-		}
-		else
-		{
-			++iter;
+			expired.push_back(pair.first);
 		}
 	};
+
+	if (!expired.empty())
+	{
+		m_meshCollection.Update([&expired](const std::shared_ptr<const MeshCollection>& current)
+		{
+			auto updated = std::make_shared<MeshCollection>(*current);
+			for (auto& id : expired)
+			{
+				updated->erase(id);
+			}
+			return std::shared_ptr<const MeshCollection>(updated);
+		});
+	}
 }
 
 void RealtimeSurfaceMeshRenderer::AddSurface(Guid id, SpatialSurfaceInfo^ newSurface)
 {
 	auto fadeInMeshTask = AddOrUpdateSurfaceAsync(id, newSurface).then([this, id]()
 	{
-		if (HasSurface(id))
+		auto collection = GetMeshCollection();
+		auto iter = collection->find(id);
+		if (iter != collection->end())
 		{
-			std::lock_guard<std::mutex> guard(m_meshCollectionLock);
-
 			// In this example, new surfaces are treated differently by highlighting them in a different
 			// color. This allows you to observe changes in the spatial map that are due to new meshes,
 			// as opposed to mesh updates.
-			auto& surfaceMesh = m_meshCollection[id];
-			surfaceMesh.SetColorFadeTimer(c_surfaceMeshFadeInTime);
+			iter->second->SetColorFadeTimer(c_surfaceMeshFadeInTime);
 		}
 	});
 }
@@ -122,38 +131,119 @@ Concurrency::task<void> RealtimeSurfaceMeshRenderer::AddOrUpdateSurfaceAsync(Gui
 	{
 		if (mesh != nullptr)
 		{
-			std::lock_guard<std::mutex> guard(m_meshCollectionLock);
-
-			auto& surfaceMesh = m_meshCollection[id];
-			surfaceMesh.UpdateSurface(mesh);
-			surfaceMesh.SetIsActive(true);
+			auto capture = std::atomic_load(&m_capture);
+			if (capture)
+			{
+				capture->Record(id, mesh);
+			}
+
+			m_meshCollection.Update([id, mesh](const std::shared_ptr<const MeshCollection>& collection)
+			{
+				auto iter = collection->find(id);
+				if (iter != collection->end())
+				{
+					// a known surface is updated in place, and the collection stays as it is.
+					iter->second->UpdateSurface(mesh);
+					iter->second->SetIsActive(true);
+					return std::shared_ptr<const MeshCollection>();
+				}
+
+				// a new surface is given its mesh before it is published, so readers never see it empty.
+				auto surfaceMesh = std::make_shared<SurfaceMesh>();
+				surfaceMesh->UpdateSurface(mesh);
+				surfaceMesh->SetIsActive(true);
+
+				auto updated = std::make_shared<MeshCollection>(*collection);
+				(*updated)[id] = surfaceMesh;
+				return std::shared_ptr<const MeshCollection>(updated);
+			});
 		}
 	}, task_continuation_context::use_current());
 
 	return processMeshTask;
 }
 
+bool RealtimeSurfaceMeshRenderer::StartCapture(String^ path, SpatialCoordinateSystem^ captureCoordinateSystem)
+{
+	auto capture = std::make_shared<SurfaceCaptureWriter>(path, captureCoordinateSystem);
+	if (!capture->IsOpen())
+	{
+		return false;
+	}
+
+	// the surfaces already known are recorded first, so a replay starts from the same map. An update arriving
+	// while they are written may be recorded twice, which replays the same as once.
+	std::atomic_store(&m_capture, capture);
+	auto collection = GetMeshCollection();
+	for (auto& pair : *collection)
+	{
+		capture->Record(pair.first, pair.second->GetSurfaceMesh());
+	}
+	return true;
+}
+
+void RealtimeSurfaceMeshRenderer::StopCapture()
+{
+	auto capture = std::atomic_load(&m_capture);
+	std::atomic_store(&m_capture, std::shared_ptr<SurfaceCaptureWriter>());
+
+#ifdef _DEBUG
+	if (capture)
+	{
+		unsigned int records = capture->GetRecordCount();
+		unsigned int skipped = capture->GetSkippedCount();
+		Platform::String^ message = L"Surface capture: " + records.ToString() + L" records written so far, " + skipped.ToString() + L" skipped\n";
+		OutputDebugStringW(message->Data());
+
+		PlaneFindingStatistics statistics = GetPlaneFindingStatistics();
+		PlaneFinding::FindPlanesTimings& stages = statistics.stages;
+		unsigned int cores = GetProcessorCount();
+		unsigned int decodedKilobytes = (unsigned int)(statistics.decodedBytes / 1024);
+		unsigned int scratchKilobytes = (unsigned int)(statistics.scratchBytes / 1024);
+		unsigned int scratchAllocations = (unsigned int)statistics.scratchAllocations;
+		message = L"Plane finding since launch: " + statistics.updates.ToString() + L" updates on " + cores.ToString() +
+			L" cores. Surfaces reanalysed " + statistics.cacheMisses.ToString() + L", retransformed " +
+			statistics.cacheRetransforms.ToString() + L", cached " + statistics.cacheHits.ToString() + L". Finding took " +
+			statistics.findMilliseconds.ToString() + L"ms, stages (ms): decode " + statistics.decodeMilliseconds.ToString() +
+			L", adjacency " + stages.adjacency.ToString() + L", curvature " + stages.curvature.ToString() + L", smoothing " +
+			stages.smoothing.ToString() + L", regions " + stages.regions.ToString() + L", plane equations " +
+			stages.planeEquations.ToString() + L", assignment " + stages.assignment.ToString() + L", bounds " +
+			stages.bounds.ToString() + L". Merging took " + statistics.mergeMilliseconds.ToString() + L"ms over " +
+			statistics.merges.cliquesMerged.ToString() + L" cliques; planes added " + statistics.merges.planesAdded.ToString() +
+			L", kept " + statistics.merges.planesKept.ToString() + L", removed " + statistics.merges.planesRemoved.ToString() +
+			L". Decoded meshes hold " + decodedKilobytes.ToString() + L"KB, scratch arenas " + scratchKilobytes.ToString() +
+			L"KB after " + scratchAllocations.ToString() + L" allocations\n";
+		OutputDebugStringW(message->Data());
+	}
+#endif
+}
+
 void RealtimeSurfaceMeshRenderer::RemoveSurface(Guid id)
 {
-	std::lock_guard<std::mutex> guard(m_meshCollectionLock);
-	m_meshCollection.erase(id);
+	m_meshCollection.Update([id](const std::shared_ptr<const MeshCollection>& current)
+	{
+		auto updated = std::make_shared<MeshCollection>(*current);
+		updated->erase(id);
+		return std::shared_ptr<const MeshCollection>(updated);
+	});
 }
 
 void RealtimeSurfaceMeshRenderer::ClearSurfaces()
 {
-	std::lock_guard<std::mutex> guard(m_meshCollectionLock);
-	m_meshCollection.clear();
+	m_meshCollection.Update([](const std::shared_ptr<const MeshCollection>&)
+	{
+		return std::shared_ptr<const MeshCollection>(std::make_shared<MeshCollection>());
+	});
 }
 
 void RealtimeSurfaceMeshRenderer::HideInactiveMeshes(IMapView<Guid, SpatialSurfaceInfo^>^ const& surfaceCollection)
 {
-	std::lock_guard<std::mutex> guard(m_meshCollectionLock);
-
 	// Hide surfaces that aren't actively listed in the surface collection.
-	for (auto& pair : m_meshCollection)
+	auto collection = GetMeshCollection();
+	for (auto& pair : *collection)
 	{
 		const auto& id = pair.first;
-		auto& surfaceMesh = pair.second;
+		auto& surfaceMesh = *pair.second;
 
 		surfaceMesh.SetIsActive(surfaceCollection->HasKey(id) ? true : false);
 	};
@@ -221,18 +311,15 @@ void RealtimeSurfaceMeshRenderer::Render(bool isStereo, bool useWireframe, bool
 		}
 	}
 
+	// Draw the meshes. The collection is a snapshot, so surfaces added or removed meanwhile do not hold up the frame.
+	auto collection = GetMeshCollection();
+	auto device = m_deviceResources->GetD3DDevice();
+	for (auto& pair : *collection)
 	{
-		std::lock_guard<std::mutex> guard(m_meshCollectionLock);
-
-		// Draw the meshes.
-		auto device = m_deviceResources->GetD3DDevice();
-		for (auto& pair : m_meshCollection)
-		{
-			auto& id = pair.first;
-			auto& surfaceMesh = pair.second;
+		auto& id = pair.first;
+		auto& surfaceMesh = *pair.second;
 
-			surfaceMesh.Draw(device, context, m_usingVprtShaders, isStereo);
-		}
+		surfaceMesh.Draw(device, context, m_usingVprtShaders, isStereo);
 	}
 }
 
@@ -337,11 +424,11 @@ void RealtimeSurfaceMeshRenderer::CreateDeviceDependentResources()
 	auto finishLoadingTask = shaderTaskGroup.then([this]() {
 
 		// Recreate device-based surface mesh resources.
-		std::lock_guard<std::mutex> guard(m_meshCollectionLock);
-		for (auto& iter : m_meshCollection)
+		auto collection = GetMeshCollection();
+		for (auto& iter : *collection)
 		{
-			iter.second.ReleaseDeviceDependentResources();
-			iter.second.CreateDeviceDependentResources(m_deviceResources->GetD3DDevice());
+			iter.second->ReleaseDeviceDependentResources();
+			iter.second->CreateDeviceDependentResources(m_deviceResources->GetD3DDevice());
 		}
 
 		// Create a default rasterizer state descriptor.
@@ -375,26 +462,26 @@ void RealtimeSurfaceMeshRenderer::ReleaseDeviceDependentResources()
 	m_defaultRasterizerState.Reset();
 	m_wireframeRasterizerState.Reset();
 
-	std::lock_guard<std::mutex> guard(m_meshCollectionLock);
-	for (auto& iter : m_meshCollection)
+	auto collection = GetMeshCollection();
+	for (auto& iter : *collection)
 	{
-		iter.second.ReleaseDeviceDependentResources();
+		iter.second->ReleaseDeviceDependentResources();
 	}
 }
 
 bool RealtimeSurfaceMeshRenderer::HasSurface(Platform::Guid id)
 {
-	std::lock_guard<std::mutex> guard(m_meshCollectionLock);
-	return m_meshCollection.find(id) != m_meshCollection.end();
+	auto collection = GetMeshCollection();
+	return collection->find(id) != collection->end();
 }
 
 Windows::Foundation::DateTime RealtimeSurfaceMeshRenderer::GetLastUpdateTime(Platform::Guid id)
 {
-	std::lock_guard<std::mutex> guard(m_meshCollectionLock);
-	auto& meshIter = m_meshCollection.find(id);
-	if (meshIter != m_meshCollection.end())
+	auto collection = GetMeshCollection();
+	auto meshIter = collection->find(id);
+	if (meshIter != collection->end())
 	{
-		auto const& mesh = meshIter->second;
+		auto const& mesh = *meshIter->second;
 		return mesh.GetLastUpdateTime();
 	}
 	else
@@ -404,17 +491,127 @@ Windows::Foundation::DateTime RealtimeSurfaceMeshRenderer::GetLastUpdateTime(Pla
 	}
 }
 
-vector<PlaneFinding::BoundedPlane> RealtimeSurfaceMeshRenderer::GetPlanes(SpatialCoordinateSystem ^baseCoordinateSystem) {
-	vector<PlaneFinding::BoundedPlane> allPlanes;
+bool RealtimeSurfaceMeshRenderer::GetPlanes(SpatialCoordinateSystem ^baseCoordinateSystem, vector<PlaneFinding::MergedPlane>& planes,
+	const cancellation_token& token) {
+	std::lock_guard<std::mutex> guard(m_planeMapLock);
+
+	// the snapshot keeps its surfaces alive while they are analysed, so surfaces can be added or removed meanwhile
+	// without waiting for plane finding. It is ordered by surface id, so gathering the results in this order keeps
+	// the output independent of which surfaces finish first.
+	auto collection = GetMeshCollection();
+	vector<SurfaceMesh*> surfaces;
+	surfaces.reserve(collection->size());
+	for (auto& iter : *collection) {
+		surfaces.push_back(iter.second.get());
+	}
+
+	PlaneFindingStatistics statistics = {};
+	if (!FindPlanesPerSurface(baseCoordinateSystem, *collection, surfaces, token, statistics)) {
+		return false;
+	}
+
+	// merge the planes created by the collection into a smaller set of larger planes.
+	int64 start = DX::StepTimer::GetTicks();
+	PlaneFinding::PlaneMapUpdateStatistics merges = m_planeMap.Update();
+	double mergeMilliseconds = (double)(DX::StepTimer::GetTicks() - start) * 1000.0 / (double)DX::StepTimer::GetPerformanceFrequency();
+
+	planes = m_planeMap.GetPlanes();
+
+	std::lock_guard<std::mutex> statisticsGuard(m_statisticsLock);
+	m_statistics.updates++;
+	m_statistics.cacheHits += statistics.cacheHits;
+	m_statistics.cacheRetransforms += statistics.cacheRetransforms;
+	m_statistics.cacheMisses += statistics.cacheMisses;
+	m_statistics.findMilliseconds += statistics.findMilliseconds;
+	m_statistics.decodeMilliseconds += statistics.decodeMilliseconds;
+	m_statistics.stages.Add(statistics.stages);
+	m_statistics.mergeMilliseconds += mergeMilliseconds;
+	m_statistics.merges.Add(merges);
+	m_statistics.decodedBytes = statistics.decodedBytes;
+	return true;
+}
+
+PlaneFindingStatistics RealtimeSurfaceMeshRenderer::GetPlaneFindingStatistics() {
+	PlaneFindingStatistics statistics;
+	{
+		std::lock_guard<std::mutex> guard(m_statisticsLock);
+		statistics = m_statistics;
+	}
+	PlaneFinding::ScratchStatistics scratch = PlaneFinding::GetScratchStatistics();
+	statistics.scratchAllocations = scratch.heapAllocations;
+	statistics.scratchBytes = scratch.bytesReserved;
+	return statistics;
+}
 
-	for (auto& iter : m_meshCollection) {
-		auto planes = iter.second.GetPlanes(baseCoordinateSystem);
-		// add all planes found from this surface mesh to the list.
-		allPlanes.insert(allPlanes.end(), planes.begin(), planes.end());
+bool RealtimeSurfaceMeshRenderer::FindPlanesPerSurface(SpatialCoordinateSystem ^baseCoordinateSystem, const MeshCollection& collection,
+	const vector<SurfaceMesh*>& surfaces, const cancellation_token& token, PlaneFindingStatistics& statistics) {
+	// each surface only touches its own mesh and cache, so surfaces that have to be reanalysed are processed
+	// concurrently. Surfaces whose mesh has not changed return the planes they found last time.
+	vector<vector<PlaneFinding::BoundedPlane>> planesPerSurface(surfaces.size());
+	vector<PlaneCacheResult> results(surfaces.size());
+	int64 start = DX::StepTimer::GetTicks();
+	parallel_for(size_t(0), surfaces.size(), [&](size_t i) {
+		// once canceled, surfaces not yet started are skipped. Those already analysed have cached their planes.
+		if (token.is_canceled()) {
+			return;
+		}
+		planesPerSurface[i] = surfaces[i]->GetPlanes(baseCoordinateSystem, results[i]);
+	});
+	if (token.is_canceled()) {
+		return false;
+	}
+	bool reanalysed = false;
+	for (size_t i = 0; i < surfaces.size(); ++i) {
+		if (results[i] == PlaneCacheResult::Miss) {
+			statistics.stages.Add(surfaces[i]->GetFindPlanesTimings());
+			statistics.decodeMilliseconds += surfaces[i]->GetDecodeMilliseconds();
+			reanalysed = true;
+		}
+		statistics.decodedBytes += surfaces[i]->GetLocalMeshBytes();
+	}
+	if (reanalysed) {
+		statistics.findMilliseconds = (double)(DX::StepTimer::GetTicks() - start) * 1000.0 / (double)DX::StepTimer::GetPerformanceFrequency();
 	}
 
-	// attempt to merge the planes created by the collection to create a smaller set of larger planes.
-	auto mergedPlanes = PlaneFinding::MergePlanes(allPlanes.size(), allPlanes.data(), 0.0f, 5.0f);
+	// only surfaces whose planes changed are handed to the plane map again.
+	std::map<Guid, PlaneSource> sources;
+
+	size_t i = 0;
+	for (auto iter = collection.begin(); iter != collection.end(); ++iter, ++i) {
+		switch (results[i]) {
+		case PlaneCacheResult::Unavailable:
+			continue;
+		case PlaneCacheResult::Hit:
+			++statistics.cacheHits;
+			break;
+		case PlaneCacheResult::Retransformed:
+			++statistics.cacheRetransforms;
+			break;
+		case PlaneCacheResult::Miss:
+			++statistics.cacheMisses;
+			break;
+		}
 
-	return mergedPlanes;
-}
\ No newline at end of file
+		unsigned int version = iter->second->GetPlanesVersion();
+		auto previous = m_planeSources.find(iter->first);
+		if (previous == m_planeSources.end()) {
+			PlaneSource source = { m_nextPlaneSource++, version };
+			m_planeMap.SetSubPlanes(source.id, planesPerSurface[i]);
+			sources[iter->first] = source;
+		}
+		else {
+			if (previous->second.version != version) {
+				m_planeMap.SetSubPlanes(previous->second.id, planesPerSurface[i]);
+			}
+			sources[iter->first] = { previous->second.id, version };
+			m_planeSources.erase(previous);
+		}
+	}
+
+	// surfaces that were removed, or are unavailable, no longer contribute planes.
+	for (auto& stale : m_planeSources) {
+		m_planeMap.RemoveSource(stale.second.id);
+	}
+	m_planeSources = std::move(sources);
+	return true;
+}
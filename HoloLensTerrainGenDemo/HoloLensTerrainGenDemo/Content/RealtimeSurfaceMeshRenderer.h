@@ -11,17 +11,45 @@
 
 #pragma once
 
+#include "Common\AtomicSnapshot.h"
 #include "Common\DeviceResources.h"
 #include "Common\StepTimer.h"
 #include "Content\SurfaceMesh.h"
+#include "Content\SurfaceCaptureWriter.h"
+#include "Common\PlaneFinding\PlaneMap.h"
 #include "Content\ShaderStructures.h"
 
+#include <atomic>
 #include <memory>
 #include <map>
+#include <mutex>
 #include <ppltasks.h>
 
 namespace HoloLensTerrainGenDemo
 {
+	// What plane finding has done, summed over every call to GetPlanes that was not canceled.
+	struct PlaneFindingStatistics
+	{
+		unsigned int						updates;
+		// per surface plane cache results; a miss is a surface whose planes were found again.
+		unsigned int						cacheHits;
+		unsigned int						cacheRetransforms;
+		unsigned int						cacheMisses;
+		// wall clock time spent finding the planes of the surfaces that missed, to compare against the number of
+		// cores it ran on, and where that time went summed over the surfaces.
+		double								findMilliseconds;
+		double								decodeMilliseconds;
+		PlaneFinding::FindPlanesTimings		stages;
+		// time spent merging, and what the merges did.
+		double								mergeMilliseconds;
+		PlaneFinding::PlaneMapUpdateStatistics	merges;
+		// as of the last call: the bytes the decoded meshes of all surfaces hold, and the scratch memory plane finding
+		// holds. Once every thread has seen its largest surface, scratchAllocations should stop increasing.
+		size_t								decodedBytes;
+		unsigned long long					scratchAllocations;
+		unsigned long long					scratchBytes;
+	};
+
 	class RealtimeSurfaceMeshRenderer
 	{
 	public:
@@ -46,10 +74,41 @@ namespace HoloLensTerrainGenDemo
 			Windows::Foundation::Collections::IMapView<Platform::Guid,
 			Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo^>^ const& surfaceCollection);
 
-		bool FoundSurfaces() { return (m_meshCollection.size() > 0); }
-
-		std::vector<PlaneFinding::BoundedPlane> GetPlanes(Windows::Perception::Spatial::SpatialCoordinateSystem ^baseCoordinateSystem);
+		bool FoundSurfaces() { return (GetMeshCollection()->size() > 0); }
+
+		// Gets the merged planes of all surfaces. A merged plane keeps its id across calls while it exists.
+		// Returns false without changing planes if the token is canceled before merging starts. Surfaces analysed
+		// by then keep their planes cached, so the next call does not repeat that work.
+		bool GetPlanes(Windows::Perception::Spatial::SpatialCoordinateSystem ^baseCoordinateSystem, std::vector<PlaneFinding::MergedPlane>& planes,
+			const Concurrency::cancellation_token& token = Concurrency::cancellation_token::none());
+
+		// Does not wait for a running GetPlanes.
+		PlaneFindingStatistics GetPlaneFindingStatistics();
+
+		// Records every surface update to a capture file at path, starting with the surfaces already known, until
+		// StopCapture. Returns false if the file could not be created. In debug builds, StopCapture also reports the
+		// plane finding statistics to the debugger, to compare with a replay of the capture.
+		bool StartCapture(Platform::String^ path, Windows::Perception::Spatial::SpatialCoordinateSystem^ captureCoordinateSystem);
+		void StopCapture();
+		bool IsCapturing() const { return std::atomic_load(&m_capture) != nullptr; }
+		// True while capturing after a write to the capture failed; the capture has stopped recording and ends there.
+		bool HasCaptureFailed() const {
+			auto capture = std::atomic_load(&m_capture);
+			return capture && !capture->IsOpen();
+		}
 	private:
+		// The surfaces, keyed by id. A collection is never modified once published: writers copy it, which only
+		// copies pointers to the surfaces, change the copy and swap it in. Readers take the current collection without
+		// waiting for a writer (see DX::AtomicSnapshot), and a removed surface lives until no reader holds it.
+		typedef std::map<Platform::Guid, std::shared_ptr<SurfaceMesh>> MeshCollection;
+
+		std::shared_ptr<const MeshCollection> GetMeshCollection() const { return m_meshCollection.Load(); }
+
+		// GetPlanes before merging: gives the plane map the planes of every surface, and returns false if the token
+		// was canceled first.
+		bool FindPlanesPerSurface(Windows::Perception::Spatial::SpatialCoordinateSystem ^baseCoordinateSystem, const MeshCollection& collection,
+			const std::vector<SurfaceMesh*>& surfaces, const Concurrency::cancellation_token& token, PlaneFindingStatistics& statistics);
+
 		Concurrency::task<void> AddOrUpdateSurfaceAsync(Platform::Guid id, Windows::Perception::Spatial::Surfaces::SpatialSurfaceInfo^ newSurface);
 
 		// Cached pointer to device resources.
@@ -62,11 +121,33 @@ namespace HoloLensTerrainGenDemo
 		Microsoft::WRL::ComPtr<ID3D11PixelShader>       m_lightingPixelShader;
 		Microsoft::WRL::ComPtr<ID3D11PixelShader>       m_colorPixelShader;
 
-		// The set of surfaces in the collection.
-		std::map<Platform::Guid, SurfaceMesh>           m_meshCollection;
-
-		// A way to lock map access.
-		std::mutex                                      m_meshCollectionLock;
+		// The set of surfaces in the collection. Read through GetMeshCollection; writers publish through its Update,
+		// which serializes them.
+		DX::AtomicSnapshot<MeshCollection>              m_meshCollection;
+
+		// Serializes calls to GetPlanes, which own the plane map and the plane sources below.
+		std::mutex                                      m_planeMapLock;
+
+		// The merged planes of all surfaces. Only the cliques of planes that changed since the last call to GetPlanes
+		// are merged again.
+		PlaneFinding::PlaneMap                          m_planeMap{ 0.0f, 5.0f };
+
+		// The source each surface's planes were given to the plane map under, and the planes version they came from.
+		struct PlaneSource
+		{
+			unsigned int id;
+			unsigned int version;
+		};
+		std::map<Platform::Guid, PlaneSource>           m_planeSources;
+		unsigned int                                    m_nextPlaneSource = 0;
+
+		// Taken only to add a call's statistics, so reading them never waits for plane finding.
+		std::mutex                                      m_statisticsLock;
+		PlaneFindingStatistics                          m_statistics = {};
+
+		// The capture surface updates are recorded to, if any. Only accessed with std::atomic_load and
+		// std::atomic_store, since updates arrive on other threads.
+		std::shared_ptr<SurfaceCaptureWriter>           m_capture;
 
 		// Total number of surface meshes.
 		unsigned int                                    m_surfaceMeshCount;
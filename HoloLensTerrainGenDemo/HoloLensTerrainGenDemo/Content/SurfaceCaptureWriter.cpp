@@ -0,0 +1,137 @@
+#include "pch.h"
+#include "SurfaceCaptureWriter.h"
+#include "Common\StepTimer.h"
+#include "GetDataFromIBuffer.h"
+
+#include <ppltasks.h>
+
+using namespace HoloLensTerrainGenDemo;
+using namespace concurrency;
+using namespace PlaneFinding;
+using namespace Windows::Graphics::DirectX;
+using namespace Windows::Perception::Spatial;
+using namespace Windows::Perception::Spatial::Surfaces;
+
+const wchar_t* const SurfaceCaptureWriter::c_fileName = L"surfaces.capture";
+
+SurfaceCaptureWriter::SurfaceCaptureWriter(Platform::String^ path, SpatialCoordinateSystem^ captureCoordinateSystem) :
+	m_captureCoordinateSystem(captureCoordinateSystem),
+	m_startTicks(DX::StepTimer::GetTicks()) {
+	// other processes may read the capture while it is being written, for example to copy it off the device.
+	m_file = CreateFile2(path->Data(), GENERIC_WRITE, FILE_SHARE_READ, CREATE_ALWAYS, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		return;
+	}
+
+	SurfaceCaptureFileHeader header = { cSurfaceCaptureMagic, cSurfaceCaptureVersion };
+	DWORD written = 0;
+	if (!WriteFile(m_file, &header, sizeof(header), &written, nullptr) || written != sizeof(header)) {
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+		return;
+	}
+	m_open = true;
+}
+
+SurfaceCaptureWriter::~SurfaceCaptureWriter() {
+	if (m_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_file);
+	}
+}
+
+bool SurfaceCaptureWriter::Record(Platform::Guid id, SpatialSurfaceMesh^ mesh) {
+	if (!IsOpen() || mesh == nullptr) {
+		return false;
+	}
+
+	// the buffers are stored as they are, so only the formats the replayer knows how to decode can be recorded.
+	auto positions = mesh->VertexPositions;
+	auto normals = mesh->VertexNormals;
+	auto indices = mesh->TriangleIndices;
+	unsigned int vertexCount = positions->ElementCount;
+	unsigned int indexCount = indices->ElementCount;
+	bool supported = normals != nullptr &&
+		positions->Format == DirectXPixelFormat::R16G16B16A16IntNormalized && positions->Stride == 8 &&
+		normals->Format == DirectXPixelFormat::R8G8B8A8IntNormalized && normals->Stride == 4 &&
+		indices->Format == DirectXPixelFormat::R16UInt && indices->Stride == 2 &&
+		normals->ElementCount == vertexCount &&
+		positions->Data->Length >= vertexCount * 8 && normals->Data->Length >= vertexCount * 4 &&
+		indices->Data->Length >= indexCount * 2;
+
+	auto tryTransform = mesh->CoordinateSystem->TryGetTransformTo(m_captureCoordinateSystem);
+	if (!supported || tryTransform == nullptr) {
+		++m_skippedCount;
+		return false;
+	}
+
+	SurfaceCaptureRecordHeader header = {};
+	header.magic = cSurfaceCaptureRecordMagic;
+	header.recordBytes = (uint32)GetSurfaceCaptureRecordBytes(vertexCount, indexCount);
+	GUID surfaceId = id;
+	memcpy(header.surfaceId, &surfaceId, sizeof(header.surfaceId));
+	header.updateTime = mesh->SurfaceInfo->UpdateTime.UniversalTime;
+	double seconds = (double)(DX::StepTimer::GetTicks() - m_startTicks) / (double)DX::StepTimer::GetPerformanceFrequency();
+	header.captureTime = (uint64)(seconds * 1000000.0);
+	memcpy(header.meshToCapture, &tryTransform->Value, sizeof(header.meshToCapture));
+	header.vertexPositionScale[0] = mesh->VertexPositionScale.x;
+	header.vertexPositionScale[1] = mesh->VertexPositionScale.y;
+	header.vertexPositionScale[2] = mesh->VertexPositionScale.z;
+	header.vertexCount = vertexCount;
+	header.indexCount = indexCount;
+
+	// the record is assembled first and written with a single call, so a capture cut short ends with at most one
+	// partial record, which the reader discards. It is assembled here, while the mesh buffers are known to be alive.
+	std::vector<uint8> buffer(header.recordBytes, 0);
+	uint8* record = buffer.data();
+	memcpy(record, &header, sizeof(header));
+	record += sizeof(header);
+	memcpy(record, GetDataFromIBuffer(positions->Data), vertexCount * 8);
+	memcpy(record + vertexCount * 8, GetDataFromIBuffer(normals->Data), vertexCount * 4);
+	memcpy(record + vertexCount * 12, GetDataFromIBuffer(indices->Data), indexCount * 2);
+
+	std::lock_guard<std::mutex> guard(m_lock);
+	if (!m_open || m_queuedBytes + buffer.size() > c_maxQueuedBytes) {
+		++m_skippedCount;
+		return false;
+	}
+	m_queuedBytes += buffer.size();
+	m_queue.push_back(std::move(buffer));
+
+	if (!m_writing) {
+		// the task keeps the writer, and so the file, open until it has written everything queued.
+		m_writing = true;
+		auto self = shared_from_this();
+		create_task([self] {
+			self->WriteQueued();
+		});
+	}
+	return true;
+}
+
+void SurfaceCaptureWriter::WriteQueued() {
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (!m_queue.empty()) {
+		std::vector<uint8> record = std::move(m_queue.front());
+		m_queue.pop_front();
+		lock.unlock();
+
+		// records are written in the order they were queued, since only this task writes.
+		DWORD written = 0;
+		bool failed = !WriteFile(m_file, record.data(), (DWORD)record.size(), &written, nullptr) || written != record.size();
+
+		lock.lock();
+		m_queuedBytes -= record.size();
+		if (failed) {
+			// the reader only tolerates a partial record at the end of the file, so nothing may follow this one.
+			m_skippedCount += 1 + (unsigned int)m_queue.size();
+			m_queue.clear();
+			m_queuedBytes = 0;
+			CloseHandle(m_file);
+			m_file = INVALID_HANDLE_VALUE;
+			m_open = false;
+		} else {
+			++m_recordCount;
+		}
+	}
+	m_writing = false;
+}
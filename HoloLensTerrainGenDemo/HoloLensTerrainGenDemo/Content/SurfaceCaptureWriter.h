@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Common\PlaneFinding\SurfaceCapture.h"
+
+#include <deque>
+#include <memory>
+
+namespace HoloLensTerrainGenDemo {
+	// Writes surface mesh updates to a capture file, in the format described in SurfaceCapture.h, for replaying plane
+	// finding away from the device. Records are appended as they arrive and the file is always readable up to the
+	// last complete record.
+	// Record only copies the mesh; the file is written on a background task, so neither the caller nor another thread
+	// recording at the same time waits on the disk. That task holds the writer alive until the records queued before
+	// the last reference was dropped are written, and the file is closed then, on that task.
+	class SurfaceCaptureWriter : public std::enable_shared_from_this<SurfaceCaptureWriter> {
+	public:
+		// Creates the capture at path, replacing any earlier one. Meshes are recorded relative to captureCoordinateSystem.
+		SurfaceCaptureWriter(Platform::String^ path, Windows::Perception::Spatial::SpatialCoordinateSystem^ captureCoordinateSystem);
+		~SurfaceCaptureWriter();
+
+		// False once the file could not be created, or a write to it failed.
+		bool IsOpen() const { return m_open; }
+
+		// Queues the mesh of a surface update to be appended. Called from any thread, on a writer owned by a shared_ptr.
+		// Meshes that cannot be located relative to the capture, or are not in the formats RealtimeSurfaceMeshRenderer
+		// asks for, are skipped, as are meshes that arrive while c_maxQueuedBytes are already waiting to be written.
+		bool Record(Platform::Guid id, Windows::Perception::Spatial::Surfaces::SpatialSurfaceMesh^ mesh);
+
+		// records written so far, and records skipped or that failed to write. Records still queued are in neither.
+		unsigned int GetRecordCount() const { return m_recordCount; }
+		unsigned int GetSkippedCount() const { return m_skippedCount; }
+
+		static const wchar_t* const c_fileName;
+		// how far the file may fall behind the meshes recorded before new ones are dropped, in bytes.
+		static const size_t c_maxQueuedBytes = 64 * 1024 * 1024;
+
+	private:
+		// Writes queued records until the queue is empty. Runs on the background task.
+		void WriteQueued();
+
+		HANDLE													m_file;
+		std::atomic<bool>										m_open{ false };
+		Windows::Perception::Spatial::SpatialCoordinateSystem^	m_captureCoordinateSystem;
+		int64													m_startTicks;
+
+		// guards the queue, whether the background task is running and closing the file after a failed write.
+		std::mutex												m_lock;
+		std::deque<std::vector<uint8>>							m_queue;
+		size_t													m_queuedBytes = 0;
+		bool													m_writing = false;
+
+		std::atomic<unsigned int>								m_recordCount{ 0 };
+		std::atomic<unsigned int>								m_skippedCount{ 0 };
+	};
+}
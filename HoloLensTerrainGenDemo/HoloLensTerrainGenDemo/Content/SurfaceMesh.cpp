@@ -17,7 +17,9 @@
 #include "Common\StepTimer.h"
 #include "GetDataFromIBuffer.h"
 #include "SurfaceMesh.h"
+#include "Common\PlaneFinding\MeshDecoding.h"
 #include <DirectXPackedVector.h>
+#include <atomic>
 
 using namespace HoloLensTerrainGenDemo;
 using namespace DirectX;
@@ -27,11 +29,25 @@ using namespace Windows::Foundation::Numerics;
 using namespace PlaneFinding;
 using namespace DirectX::PackedVector;
 
+namespace {
+	const XMVECTOR c_upDirection = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+	// transforms closer than this, per element, are treated as unchanged.
+	const float c_transformEpsilon = 1e-5f;
+	// cached planes are only moved into a new frame if it keeps gravity within this cosine of where it was.
+	// Beyond that the planes may snap to gravity differently and have to be found again.
+	const float c_maxRetransformTilt = 0.99999f;
+
+	// plane versions are unique across surfaces, so a surface that is removed and added again never repeats one.
+	std::atomic<unsigned int> s_nextPlanesVersion(1);
+}
+
 SurfaceMesh::SurfaceMesh() {
 	std::lock_guard<std::mutex> lock(m_meshResourcesMutex);
 
 	ReleaseDeviceDependentResources();
 	m_lastUpdateTime.UniversalTime = 0;
+	m_cachedPlanesUpdateTime.UniversalTime = 0;
+	m_cachedPlanesTransform = XMFloat4x4Identity;
 
 	// initialize m_localMesh
 	m_localMesh.indices = nullptr;
@@ -51,10 +67,18 @@ SurfaceMesh::~SurfaceMesh() {
 }
 
 void SurfaceMesh::UpdateSurface(SpatialSurfaceMesh^ surfaceMesh) {
-	m_surfaceMesh = surfaceMesh;
+	{
+		std::lock_guard<std::mutex> lock(m_surfaceMeshLock);
+		m_surfaceMesh = surfaceMesh;
+	}
 	m_updateNeeded = true;
 }
 
+SpatialSurfaceMesh^ SurfaceMesh::GetSurfaceMesh() {
+	std::lock_guard<std::mutex> lock(m_surfaceMeshLock);
+	return m_surfaceMesh;
+}
+
 void SurfaceMesh::UpdateDeviceBasedResources(ID3D11Device* device) {
 	std::lock_guard<std::mutex> lock(m_meshResourcesMutex);
 
@@ -293,103 +317,161 @@ void SurfaceMesh::ReleaseDeviceDependentResources() {
 	m_loadingComplete = false;
 }
 
-// Deletes m_localMesh.
+// Empties m_localMesh. The buffers it points into are kept for the next update.
 void SurfaceMesh::ClearLocalMesh() {
-	if (m_localMesh.verts) {
-		delete m_localMesh.verts;
-	}
-
-	if (m_localMesh.normals) {
-		delete m_localMesh.normals;
-	}
-
-	if (m_localMesh.indices) {
-		delete m_localMesh.indices;
-	}
+	m_localMesh.verts = nullptr;
+	m_localMesh.normals = nullptr;
+	m_localMesh.indices = nullptr;
 
 	m_localMesh.vertCount = 0;
 	m_localMesh.indexCount = 0;
 	m_localMesh.transform = XMFloat4x4Identity;
+	m_hasLocalMesh = false;
 }
 
-// Return a MeshData object from the Raw data buffers.
-void SurfaceMesh::ConstructLocalMesh(SpatialCoordinateSystem^ baseCoordinateSystem) {
+// Decodes the raw data buffers into m_localMesh.
+void SurfaceMesh::ConstructLocalMesh(SpatialSurfaceMesh^ surfaceMesh, const XMFLOAT4X4& meshToBase) {
 	// we configured RealtimeSurfaceMeshRenderer to ensure that the data
 	// we are receiving is in the correct format.
 	// Vertex Positions: R16G16B16A16IntNormalized
 	// Vertex Normals: R8G8B8A8IntNormalized
 	// Indices: R16UInt (we'll convert it from here to R32Int. HoloLens Spatial Mapping doesn't appear to support this format directly.
 
-	m_localMesh.vertCount = m_surfaceMesh->VertexPositions->ElementCount;
-	m_localMesh.verts = new XMFLOAT3[m_localMesh.vertCount];
-	m_localMesh.normals = new XMFLOAT3[m_localMesh.vertCount];
-	m_localMesh.indexCount = m_surfaceMesh->TriangleIndices->ElementCount;
-	m_localMesh.indices = new INT32[m_localMesh.indexCount];
-
-	XMSHORTN4* rawVertexData = (XMSHORTN4*)GetDataFromIBuffer(m_surfaceMesh->VertexPositions->Data);
-	XMBYTEN4* rawNormalData = (XMBYTEN4*)GetDataFromIBuffer(m_surfaceMesh->VertexNormals->Data);
-	UINT16* rawIndexData = (UINT16*)GetDataFromIBuffer(m_surfaceMesh->TriangleIndices->Data);
-	float3 vertexScale = m_surfaceMesh->VertexPositionScale;
-	
-	for (int index = 0; index < m_localMesh.vertCount; ++index) {
-		// read the current position as an XMSHORTN4.
-		XMSHORTN4 currentPos = rawVertexData[index];
-		XMFLOAT4 vals;
-
-		// XMVECTOR knows how to convert XMSHORTN4 to actual floating point coordinates.
-		XMVECTOR vec = XMLoadShortN4(&currentPos);
-
-		// Store that into an XMFLOAT4 so we can read the values.
-		XMStoreFloat4(&vals, vec);
-
-		m_localMesh.verts[index] = XMFLOAT3(vals.x, vals.y, vals.z);
-
-		// now do the same for the normal.
-		XMBYTEN4 currentNormal = rawNormalData[index];
-		XMFLOAT4 norms;
-		XMVECTOR norm = XMLoadByteN4(&currentNormal);
-		XMStoreFloat4(&norms, norm);
-
-		m_localMesh.normals[index] = XMFLOAT3(norms.x, norms.y, norms.z);
+	int64 start = DX::StepTimer::GetTicks();
+
+	unsigned int vertCount = surfaceMesh->VertexPositions->ElementCount;
+	unsigned int indexCount = surfaceMesh->TriangleIndices->ElementCount;
+
+	// the buffers only grow, so once a surface has been decoded at its largest size updates do not allocate.
+	m_localVerts.resize(vertCount);
+	m_localNormals.resize(vertCount);
+	m_localIndices.resize(indexCount);
+
+	XMSHORTN4* rawVertexData = (XMSHORTN4*)GetDataFromIBuffer(surfaceMesh->VertexPositions->Data);
+	XMBYTEN4* rawNormalData = (XMBYTEN4*)GetDataFromIBuffer(surfaceMesh->VertexNormals->Data);
+	UINT16* rawIndexData = (UINT16*)GetDataFromIBuffer(surfaceMesh->TriangleIndices->Data);
+
+	DecodePositions(rawVertexData, m_localVerts.data(), vertCount);
+	DecodeNormals(rawNormalData, m_localNormals.data(), vertCount);
+	DecodeIndices(rawIndexData, m_localIndices.data(), indexCount);
+
+	m_localMesh.vertCount = vertCount;
+	m_localMesh.verts = m_localVerts.data();
+	m_localMesh.normals = m_localNormals.data();
+	m_localMesh.indexCount = indexCount;
+	m_localMesh.indices = m_localIndices.data();
+	m_localMesh.transform = meshToBase;
+	m_localMeshUpdateTime = surfaceMesh->SurfaceInfo->UpdateTime;
+	m_hasLocalMesh = true;
+
+	m_decodeMilliseconds = (double)(DX::StepTimer::GetTicks() - start) * 1000.0 / (double)DX::StepTimer::GetPerformanceFrequency();
+}
+
+size_t SurfaceMesh::GetLocalMeshBytes() const {
+	return (m_localVerts.capacity() + m_localNormals.capacity()) * sizeof(XMFLOAT3) + m_localIndices.capacity() * sizeof(INT32);
+}
+
+MeshData SurfaceMesh::GetLocalMesh(SpatialCoordinateSystem^ baseCoordinateSystem) {
+	SpatialSurfaceMesh^ surfaceMesh;
+	{
+		std::lock_guard<std::mutex> lock(m_surfaceMeshLock);
+		surfaceMesh = m_surfaceMesh;
 	}
 
-	for (int index = 0; index < m_localMesh.indexCount; ++index) {
-		m_localMesh.indices[index] = rawIndexData[index];
+	XMFLOAT4X4 meshToBase;
+	if (!m_isActive || surfaceMesh == nullptr || !TryGetMeshToBaseTransform(surfaceMesh, baseCoordinateSystem, meshToBase)) {
+		MeshData empty = {};
+		empty.transform = XMFloat4x4Identity;
+		return empty;
 	}
 
+	if (!m_hasLocalMesh || surfaceMesh->SurfaceInfo->UpdateTime.UniversalTime != m_localMeshUpdateTime.UniversalTime) {
+		ClearLocalMesh();
+		ConstructLocalMesh(surfaceMesh, meshToBase);
+	}
+	m_localMesh.transform = meshToBase;
+	return m_localMesh;
+}
+
+bool SurfaceMesh::TryGetMeshToBaseTransform(SpatialSurfaceMesh^ surfaceMesh, SpatialCoordinateSystem^ baseCoordinateSystem, XMFLOAT4X4& meshToBase) {
 	// Get the transform to the current reference frame (ie model to world)
-	auto tryTransform = m_surfaceMesh->CoordinateSystem->TryGetTransformTo(baseCoordinateSystem);
-	
-	XMMATRIX transform;
-	if (tryTransform) {
-		// If the transform can be acquired, this spatial mesh is valid right now and
-		// we have the information we need to draw it this frame.
-		transform = XMLoadFloat4x4(&tryTransform->Value);
-	} else {
+	auto tryTransform = surfaceMesh->CoordinateSystem->TryGetTransformTo(baseCoordinateSystem);
+	if (!tryTransform) {
 		// If the transform is not acquired, the spatial mesh is not valid right now
 		// because its location cannot be correlated to the current space.
-		// for now, I'm just setting the transform to the identity matrix. We really should never 
-		// get here anyway because the same check happens on update and
-		// the surface will be set inactive. We check in GetPlanes()
-		// before calling this method whether the surface is active.
-		transform = XMLoadFloat4x4(&XMFloat4x4Identity);
+		return false;
 	}
 
 	// Add a scaling factor to our transform to go from mesh to world.
-	XMMATRIX scaleTransform = XMMatrixScalingFromVector(XMLoadFloat3(&vertexScale));
+	XMMATRIX scaleTransform = XMMatrixScalingFromVector(XMLoadFloat3(&surfaceMesh->VertexPositionScale));
+	XMStoreFloat4x4(&meshToBase, scaleTransform * XMLoadFloat4x4(&tryTransform->Value));
 
-	// save the transform to the local MeshData object.
-	XMStoreFloat4x4(&m_localMesh.transform, scaleTransform * transform);
+	return true;
 }
 
-vector<BoundedPlane> SurfaceMesh::GetPlanes(SpatialCoordinateSystem^ baseCoordinateSystem) {
-	if (m_isActive) {
-		ClearLocalMesh();
-		ConstructLocalMesh(baseCoordinateSystem);
+vector<BoundedPlane> SurfaceMesh::GetPlanes(SpatialCoordinateSystem^ baseCoordinateSystem, PlaneCacheResult& result) {
+	// this runs on the plane update thread while UpdateSurface may replace the mesh, so work on the mesh as it is now.
+	SpatialSurfaceMesh^ surfaceMesh;
+	{
+		std::lock_guard<std::mutex> lock(m_surfaceMeshLock);
+		surfaceMesh = m_surfaceMesh;
+	}
 
-		return FindPlanes(1, &m_localMesh, 5.0f);
+	XMFLOAT4X4 meshToBase;
+	if (!m_isActive || surfaceMesh == nullptr || !TryGetMeshToBaseTransform(surfaceMesh, baseCoordinateSystem, meshToBase)) {
+		// return an empty vector.
+		result = PlaneCacheResult::Unavailable;
+		return vector<BoundedPlane>();
 	}
 
-	// else, return an empty vector.
-	return vector<BoundedPlane>();
-}
\ No newline at end of file
+	auto updateTime = surfaceMesh->SurfaceInfo->UpdateTime;
+	if (m_hasCachedPlanes && updateTime.UniversalTime == m_cachedPlanesUpdateTime.UniversalTime) {
+		XMMATRIX oldTransform = XMLoadFloat4x4(&m_cachedPlanesTransform);
+		XMMATRIX newTransform = XMLoadFloat4x4(&meshToBase);
+
+		bool moved = false;
+		for (int row = 0; row < 4 && !moved; ++row) {
+			moved = !XMVector4NearEqual(oldTransform.r[row], newTransform.r[row], XMVectorReplicate(c_transformEpsilon));
+		}
+
+		if (!moved) {
+			result = PlaneCacheResult::Hit;
+			return m_cachedPlanes;
+		}
+
+		// plane finding snaps planes to gravity in mesh space, so the cached planes only hold if up in mesh space
+		// has barely moved.
+		XMMATRIX oldInverse = XMMatrixInverse(nullptr, oldTransform);
+		XMVECTOR oldUp = XMVector3Normalize(XMVector3TransformNormal(c_upDirection, oldInverse));
+		XMVECTOR newUp = XMVector3Normalize(XMVector3TransformNormal(c_upDirection, XMMatrixInverse(nullptr, newTransform)));
+		if (XMVectorGetX(XMVector3Dot(oldUp, newUp)) > c_maxRetransformTilt) {
+			// move the planes from the old base frame back to mesh space, then out to the new one.
+			XMMATRIX oldToNew = oldInverse * newTransform;
+			for (auto& plane : m_cachedPlanes) {
+				plane.plane.StoreVector(XMPlaneNormalize(TransformPlaneBetweenSpaces(plane.plane.AsVector(), oldToNew)));
+
+				BoundingOrientedBox bounds;
+				plane.bounds.Transform(bounds, oldToNew);
+				plane.bounds = bounds;
+			}
+
+			m_cachedPlanesTransform = meshToBase;
+			m_planesVersion = s_nextPlanesVersion++;
+
+			result = PlaneCacheResult::Retransformed;
+			return m_cachedPlanes;
+		}
+	}
+
+	ClearLocalMesh();
+	ConstructLocalMesh(surfaceMesh, meshToBase);
+
+	m_cachedPlanes = FindPlanes(1, &m_localMesh, 5.0f, &m_findPlanesTimings);
+	m_cachedPlanesUpdateTime = updateTime;
+	m_cachedPlanesTransform = meshToBase;
+	m_hasCachedPlanes = true;
+	m_planesVersion = s_nextPlanesVersion++;
+
+	result = PlaneCacheResult::Miss;
+	return m_cachedPlanes;
+}
@@ -15,6 +15,8 @@
 #include "ShaderStructures.h"
 #include "Common\PlaneFinding\PlaneFinding.h"
 
+#include <atomic>
+
 namespace HoloLensTerrainGenDemo
 {
 	struct SurfaceMeshProperties
@@ -25,6 +27,19 @@ namespace HoloLensTerrainGenDemo
 		DXGI_FORMAT  indexFormat = DXGI_FORMAT_UNKNOWN;
 	};
 
+	// How SurfaceMesh::GetPlanes produced its planes.
+	enum class PlaneCacheResult
+	{
+		// The surface is inactive or could not be located, no planes were returned.
+		Unavailable,
+		// Neither the mesh nor its transform changed, the cached planes were returned.
+		Hit,
+		// Only the transform changed, the cached planes were moved into the new frame.
+		Retransformed,
+		// The mesh changed, plane finding ran on it again.
+		Miss
+	};
+
 	class SurfaceMesh final
 	{
 	public:
@@ -32,6 +47,8 @@ namespace HoloLensTerrainGenDemo
 		~SurfaceMesh();
 
 		void UpdateSurface(Windows::Perception::Spatial::Surfaces::SpatialSurfaceMesh^ surface);
+		// The latest mesh given to UpdateSurface.
+		Windows::Perception::Spatial::Surfaces::SpatialSurfaceMesh^ GetSurfaceMesh();
 		void UpdateDeviceBasedResources(ID3D11Device* device);
 		void UpdateTransform(
 			ID3D11Device* device,
@@ -48,25 +65,45 @@ namespace HoloLensTerrainGenDemo
 		void ReleaseVertexResources();
 		void ReleaseDeviceDependentResources();
 
-		const bool&                             GetIsActive()       const { return m_isActive; }
+		bool                                    GetIsActive()       const { return m_isActive; }
 		const float&                            GetLastActiveTime() const { return m_lastActiveTime; }
 		const Windows::Foundation::DateTime&    GetLastUpdateTime() const { return m_lastUpdateTime; }
 
 		void SetIsActive(const bool& isActive) { m_isActive = isActive; }
 		void SetColorFadeTimer(const float& duration) { m_colorFadeTimeout = duration; m_colorFadeTimer = 0.f; }
 
-		std::vector<PlaneFinding::BoundedPlane> GetPlanes(Windows::Perception::Spatial::SpatialCoordinateSystem^ baseCoordinateSystem);
+		// Returns the planes of this surface in baseCoordinateSystem. Plane finding only runs when the mesh has changed
+		// since the last call, otherwise the planes found then are reused.
+		std::vector<PlaneFinding::BoundedPlane> GetPlanes(Windows::Perception::Spatial::SpatialCoordinateSystem^ baseCoordinateSystem, PlaneCacheResult& result);
+		// Changes whenever GetPlanes returns planes that differ from the previous call.
+		unsigned int GetPlanesVersion() const { return m_planesVersion; }
+		// Stage timings from the last time plane finding ran on this surface.
+		const PlaneFinding::FindPlanesTimings& GetFindPlanesTimings() const { return m_findPlanesTimings; }
+		// How long decoding the spatial mesh buffers took the last time plane finding ran on this surface.
+		double GetDecodeMilliseconds() const { return m_decodeMilliseconds; }
+		// The mesh decoded for plane finding, moved into baseCoordinateSystem, for finding planes across surfaces. It is
+		// only decoded again when the surface has been updated since. The mesh points into buffers of this surface, which
+		// stay valid until the next call to this or GetPlanes. Empty when the surface is inactive or cannot be located.
+		PlaneFinding::MeshData GetLocalMesh(Windows::Perception::Spatial::SpatialCoordinateSystem^ baseCoordinateSystem);
+		// Bytes held by the decoded copy of the mesh, which is kept between updates.
+		size_t GetLocalMeshBytes() const;
 	private:
 		void SwapVertexBuffers();
 		void CreateDirectXBuffer(ID3D11Device* device, D3D11_BIND_FLAG binding,	Windows::Storage::Streams::IBuffer^ buffer,	ID3D11Buffer** target);
 
-		// Deletes m_localMesh.
+		// Empties m_localMesh.
 		void ClearLocalMesh();
 
-		// Return a MeshData object from the Raw data buffers.
-		void ConstructLocalMesh(Windows::Perception::Spatial::SpatialCoordinateSystem^ baseCoordinateSystem);
+		// Decodes the raw data buffers of surfaceMesh into m_localMesh.
+		void ConstructLocalMesh(Windows::Perception::Spatial::Surfaces::SpatialSurfaceMesh^ surfaceMesh, const DirectX::XMFLOAT4X4& meshToBase);
+
+		// Gets the transform from the space of surfaceMesh, including the vertex scale, to baseCoordinateSystem.
+		bool TryGetMeshToBaseTransform(Windows::Perception::Spatial::Surfaces::SpatialSurfaceMesh^ surfaceMesh,
+			Windows::Perception::Spatial::SpatialCoordinateSystem^ baseCoordinateSystem, DirectX::XMFLOAT4X4& meshToBase);
 
 		Windows::Perception::Spatial::Surfaces::SpatialSurfaceMesh^ m_surfaceMesh = nullptr;
+		// guards m_surfaceMesh against GetPlanes, which runs on the plane update thread.
+		std::mutex m_surfaceMeshLock;
 
 		Microsoft::WRL::ComPtr<ID3D11Buffer> m_vertexPositions;
 		Microsoft::WRL::ComPtr<ID3D11Buffer> m_vertexNormals;
@@ -87,7 +124,8 @@ namespace HoloLensTerrainGenDemo
 		bool   m_loadingComplete = false;
 		bool   m_updateNeeded = false;
 		bool   m_updateReady = false;
-		bool   m_isActive = false;
+		// written by the UI thread, read by GetPlanes on the plane update thread.
+		std::atomic<bool> m_isActive{ false };
 		float  m_lastActiveTime = -1.f;
 		float  m_colorFadeTimer = -1.f;
 		float  m_colorFadeTimeout = -1.f;
@@ -95,5 +133,21 @@ namespace HoloLensTerrainGenDemo
 		std::mutex m_meshResourcesMutex;
 
 		PlaneFinding::MeshData	m_localMesh;
+		// the decoded mesh m_localMesh points into.
+		std::vector<DirectX::XMFLOAT3>	m_localVerts;
+		std::vector<DirectX::XMFLOAT3>	m_localNormals;
+		std::vector<INT32>				m_localIndices;
+		double							m_decodeMilliseconds = 0.0;
+		// the update of the mesh m_localMesh was decoded from, while it holds one.
+		Windows::Foundation::DateTime	m_localMeshUpdateTime;
+		bool							m_hasLocalMesh = false;
+
+		// Planes found by the last call to GetPlanes, along with the mesh update time and transform they were found with.
+		std::vector<PlaneFinding::BoundedPlane>	m_cachedPlanes;
+		Windows::Foundation::DateTime			m_cachedPlanesUpdateTime;
+		DirectX::XMFLOAT4X4						m_cachedPlanesTransform;
+		bool									m_hasCachedPlanes = false;
+		unsigned int							m_planesVersion = 0;
+		PlaneFinding::FindPlanesTimings			m_findPlanesTimings;
 	};
 }
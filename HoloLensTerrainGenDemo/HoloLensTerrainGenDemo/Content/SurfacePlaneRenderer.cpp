@@ -14,8 +14,6 @@ using namespace std::placeholders;
 
 SurfacePlaneRenderer::SurfacePlaneRenderer(const std::shared_ptr<DX::DeviceResources>& deviceResources) :
 	m_deviceResources(deviceResources) {
-	m_planeList.clear();
-
 	CreateDeviceDependentResources();
 
 	// Set up a general gesture recognizer for input.
@@ -36,10 +34,11 @@ SurfacePlaneRenderer::~SurfacePlaneRenderer() {
 	}
 }
 
-void SurfacePlaneRenderer::CreateVertexResources() {
-	if (m_planeList.size() < 1) {
+Microsoft::WRL::ComPtr<ID3D11Buffer> SurfacePlaneRenderer::CreateVertexBuffer(const std::vector<MergedPlane>& planes) {
+	Microsoft::WRL::ComPtr<ID3D11Buffer> vertexBuffer;
+	if (planes.size() < 1) {
 		// No planes to draw.
-		return;
+		return vertexBuffer;
 	}
 
 	// define the unit space vertices of the plane we are rendering.
@@ -52,46 +51,39 @@ void SurfacePlaneRenderer::CreateVertexResources() {
 		{ 1.0f, -1.0f, 0.0f, 0.0f }
 	};
 
-	// resources are created off-thread, so that they don't affect rendering latency.
-	auto taskOptions = Concurrency::task_options();
-	auto task = concurrency::create_task([this]() {
-		// lock the vertex buffer down until we are done rebuilding it.
-		std::lock_guard<std::mutex> guard(m_planeListLock);
-
-		// reset the existing vertex buffer.
-		m_vertexBuffer.Reset();
-
-		// Build a vertex buffer containing 6 vertices (2 triangles) for each plane, representing the quad of the bounded plane.
-		std::vector<XMFLOAT3> vertexList;
-
-		for (auto p : m_planeList) {
-			// for each plane in our list, build a quad and add the vertices to our verts list.
-			// Our plane is defined as being centered in the bounding box,
-			// with the z axis always being the thinnest axis.
-			auto center = p.bounds.Center;
-			auto extents = p.bounds.Extents;
-
-			// transformation matrices to go from unit space to object space.
-			XMMATRIX world = XMMatrixRotationQuaternion(XMLoadFloat4(&p.bounds.Orientation));
-			XMMATRIX scale = XMMatrixScaling(extents.x, extents.y, extents.z);
-			XMMATRIX translate = XMMatrixTranslation(center.x, center.y, center.z);
-			XMMATRIX transform = XMMatrixMultiply(scale, world);
-			transform = XMMatrixMultiply(transform, translate);
-
-			for (auto i = 0; i < 6; ++i) {
-				XMVECTOR v = XMVector3Transform(verts[i], transform);
-				XMFLOAT3 vec;
-				XMStoreFloat3(&vec, v);
-				vertexList.push_back(vec);
-			}
+	// Build a vertex buffer containing 6 vertices (2 triangles) for each plane, representing the quad of the bounded plane.
+	std::vector<XMFLOAT3> vertexList;
+	vertexList.reserve(planes.size() * 6);
+
+	for (auto& p : planes) {
+		// for each plane in our list, build a quad and add the vertices to our verts list.
+		// Our plane is defined as being centered in the bounding box,
+		// with the z axis always being the thinnest axis.
+		auto center = p.plane.bounds.Center;
+		auto extents = p.plane.bounds.Extents;
+
+		// transformation matrices to go from unit space to object space.
+		XMMATRIX world = XMMatrixRotationQuaternion(XMLoadFloat4(&p.plane.bounds.Orientation));
+		XMMATRIX scale = XMMatrixScaling(extents.x, extents.y, extents.z);
+		XMMATRIX translate = XMMatrixTranslation(center.x, center.y, center.z);
+		XMMATRIX transform = XMMatrixMultiply(scale, world);
+		transform = XMMatrixMultiply(transform, translate);
+
+		for (auto i = 0; i < 6; ++i) {
+			XMVECTOR v = XMVector3Transform(verts[i], transform);
+			XMFLOAT3 vec;
+			XMStoreFloat3(&vec, v);
+			vertexList.push_back(vec);
 		}
+	}
 
-		// create the vertex buffer.
-		CD3D11_BUFFER_DESC descBuffer(sizeof(XMFLOAT3) * vertexList.size(), D3D11_BIND_VERTEX_BUFFER);
-		D3D11_SUBRESOURCE_DATA dataBuffer;
-		dataBuffer.pSysMem = vertexList.data();
-		DX::ThrowIfFailed(m_deviceResources->GetD3DDevice()->CreateBuffer(&descBuffer, &dataBuffer, &m_vertexBuffer));
-	});
+	// create the vertex buffer. Creating resources is free threaded, so this happens on the caller's background
+	// thread and does not affect rendering latency.
+	CD3D11_BUFFER_DESC descBuffer(sizeof(XMFLOAT3) * vertexList.size(), D3D11_BIND_VERTEX_BUFFER);
+	D3D11_SUBRESOURCE_DATA dataBuffer;
+	dataBuffer.pSysMem = vertexList.data();
+	DX::ThrowIfFailed(m_deviceResources->GetD3DDevice()->CreateBuffer(&descBuffer, &dataBuffer, &vertexBuffer));
+	return vertexBuffer;
 }
 
 void SurfacePlaneRenderer::CreateDeviceDependentResources() {
@@ -99,6 +91,11 @@ void SurfacePlaneRenderer::CreateDeviceDependentResources() {
 	CD3D11_BUFFER_DESC constantBufferDesc(sizeof(ModelConstantBuffer), D3D11_BIND_CONSTANT_BUFFER);
 	DX::ThrowIfFailed(m_deviceResources->GetD3DDevice()->CreateBuffer(&constantBufferDesc, nullptr, &m_constantBuffer));
 
+	// the planes kept through a device loss are drawn again on the new device.
+	DX::RecreatePlaneBuffer(m_snapshot, [this](const std::vector<MergedPlane>& planes) {
+		return CreateVertexBuffer(planes);
+	});
+
 	CreateShaders();
 }
 
@@ -168,37 +165,40 @@ void SurfacePlaneRenderer::CreateShaders() {
 }
 
 void SurfacePlaneRenderer::ReleaseDeviceDependentResources() {
-	m_planeList.clear();
+	// the vertex buffer belongs to the device, but the planes are kept, so they are drawn again once
+	// CreateDeviceDependentResources makes a buffer for them on the new device.
+	DX::ReleasePlaneBuffer(m_snapshot);
+	m_frameSnapshot.reset();
 	m_constantBuffer.Reset();
-	m_vertexBuffer.Reset();
 	m_vertexShader.Reset();
 	m_geometryShader.Reset();
 	m_pixelShader.Reset();
 }
 
-void SurfacePlaneRenderer::UpdatePlanes(vector<BoundedPlane> newList, Windows::Perception::Spatial::SpatialCoordinateSystem^ cs) {
-	// clear the old list and copy the new list.
-	m_planeList.clear();
+void SurfacePlaneRenderer::UpdatePlanes(vector<MergedPlane> newList, Windows::Perception::Spatial::SpatialCoordinateSystem^ cs) {
+	std::vector<MergedPlane> floors;
 
-	for (auto p : newList) {
+	for (auto& p : newList) {
 		// for each plane in our list, check if it
 		// is a PlaneFinding::FLOOR. This means it has a
 		// normal pointing directly up. These are the only
 		// planes we want.
-		if (p.plane.surface == PlaneFinding::FLOOR) {
-			m_planeList.push_back(p);
+		if (p.plane.plane.surface == PlaneFinding::FLOOR) {
+			floors.push_back(p);
 		}
 	}
 
-	// Update the coordinate system
-	m_coordinateSystem = cs;
-
-	CreateVertexResources();
+	// the vertex buffer is only rebuilt when a floor was added, removed or moved.
+	DX::PublishPlanes(m_snapshot, std::move(floors), cs, [this](const std::vector<MergedPlane>& planes) {
+		return CreateVertexBuffer(planes);
+	});
 }
 
 void SurfacePlaneRenderer::Render() {
-	if (m_planeList.size() < 1 || !m_shadersReady) {
-		// nothing to render.
+	// draw the snapshot Update set the transform for, even if a newer one has been published since.
+	auto snapshot = m_frameSnapshot;
+	if (!snapshot || snapshot->planes.size() < 1 || !snapshot->vertexBuffer || !m_shadersReady) {
+		// nothing to render, or the device was lost since the snapshot was published.
 		return;
 	}
 
@@ -229,27 +229,24 @@ void SurfacePlaneRenderer::Render() {
 	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 	context->IASetInputLayout(m_inputLayout.Get());
 		
-	{
-		std::lock_guard<std::mutex> guard(m_planeListLock);
-
-		// draw the meshes.
-		// Each vertex is one instance of the Vertex struct.
-		const UINT stride = sizeof(XMFLOAT3);
-		const UINT offset = 0;
-		context->IASetVertexBuffers(0, 1, m_vertexBuffer.GetAddressOf(), &stride, &offset);
-
-		// Draw the objects.
-		context->DrawInstanced(m_planeList.size() * 6, 2, 0, 0);
-	}
+	// draw the meshes.
+	// Each vertex is one instance of the Vertex struct.
+	const UINT stride = sizeof(XMFLOAT3);
+	const UINT offset = 0;
+	context->IASetVertexBuffers(0, 1, snapshot->vertexBuffer.GetAddressOf(), &stride, &offset);
+
+	// Draw the objects.
+	context->DrawInstanced(snapshot->planes.size() * 6, 2, 0, 0);
 }
 
 void SurfacePlaneRenderer::Update(SpatialCoordinateSystem^ baseCoordinateSystem) {
-	if (m_planeList.size() < 1) {
+	m_frameSnapshot = GetSnapshot();
+	if (!m_frameSnapshot || m_frameSnapshot->planes.size() < 1) {
 		return;
 	}
 
 	// Transform to the correct coordinate system from our anchor's coordinate system.
-	auto tryTransform = m_coordinateSystem->TryGetTransformTo(baseCoordinateSystem);
+	auto tryTransform = m_frameSnapshot->coordinateSystem->TryGetTransformTo(baseCoordinateSystem);
 	XMMATRIX transform;
 	if (tryTransform) {
 		// If the transform can be acquired, this spatial mesh is valid right now and
@@ -272,13 +269,14 @@ void SurfacePlaneRenderer::Update(SpatialCoordinateSystem^ baseCoordinateSystem)
 }
 
 bool SurfacePlaneRenderer::CaptureInteraction(SpatialInteraction^ interaction) {
-	if (m_planeList.size() < 1) {
+	auto snapshot = GetSnapshot();
+	if (!snapshot || snapshot->planes.size() < 1) {
 		// No planes to intersect with.
 		return false;
 	}
 
 	// Get the user's gaze
-	auto gaze = interaction->SourceState->TryGetPointerPose(m_coordinateSystem);
+	auto gaze = interaction->SourceState->TryGetPointerPose(snapshot->coordinateSystem);
 	auto head = gaze->Head;
 	auto position = head->Position;
 	auto look = head->ForwardDirection;
@@ -288,7 +286,7 @@ bool SurfacePlaneRenderer::CaptureInteraction(SpatialInteraction^ interaction) {
 	int index = -1; // index of closest intersected plane.
 	float dist = D3D11_FLOAT32_MAX; // initial distance value.
 	int i = 0;
-	for (auto p : m_planeList) {
+	for (auto& p : snapshot->planes) {
 		// the BoundingOrientedBox object has built in intersection tests we can use to test it against our
 		// gaze.
 		float d = 0;
@@ -296,7 +294,7 @@ bool SurfacePlaneRenderer::CaptureInteraction(SpatialInteraction^ interaction) {
 		XMFLOAT3 _dir = XMFLOAT3(look.x, look.y, look.z);
 		XMVECTOR pos = XMLoadFloat3(&_pos);
 		XMVECTOR dir = XMLoadFloat3(&_dir);
-		p.bounds.Intersects(pos, dir, d);
+		p.plane.bounds.Intersects(pos, dir, d);
 
 		if (d > 0 && d < dist) {
 			dist = d;
@@ -309,7 +307,8 @@ bool SurfacePlaneRenderer::CaptureInteraction(SpatialInteraction^ interaction) {
 	// if we have an index > -1, then we need to handle this interaction.
 	if (index > -1) {
 		// if so, handle the interaction and return true.
-		m_intersectedPlane = index;
+		m_intersectedPlane = snapshot->planes[index];
+		m_intersectedCoordinateSystem = snapshot->coordinateSystem;
 
 		m_gestureRecognizer->CaptureInteraction(interaction);
 		return true;
@@ -323,17 +322,35 @@ void SurfacePlaneRenderer::OnTap(SpatialGestureRecognizer^ sender, SpatialTapped
 	m_WasTapped = true;
 }
 
+BoundedPlane SurfacePlaneRenderer::GetIntersectedPlane(SpatialCoordinateSystem^& coordinateSystem) {
+	auto snapshot = GetSnapshot();
+	if (snapshot) {
+		for (auto& p : snapshot->planes) {
+			if (p.id == m_intersectedPlane.id) {
+				coordinateSystem = snapshot->coordinateSystem;
+				return p.plane;
+			}
+		}
+	}
+
+	// the plane was merged into another or removed since it was hit, so use it as it was then.
+	coordinateSystem = m_intersectedCoordinateSystem;
+	return m_intersectedPlane.plane;
+}
+
 SpatialAnchor^ SurfacePlaneRenderer::GetAnchor() {
-	auto plane = m_planeList[m_intersectedPlane];
+	SpatialCoordinateSystem^ coordinateSystem;
+	auto plane = GetIntersectedPlane(coordinateSystem);
 	auto center = plane.bounds.Center;
 
 	// create the anchor at the plane's center, relative to the coordinate system extant at the time of the
 	// plane's creation.
-	return SpatialAnchor::TryCreateRelativeTo(m_coordinateSystem, float3(center.x, center.y, center.z));
+	return SpatialAnchor::TryCreateRelativeTo(coordinateSystem, float3(center.x, center.y, center.z));
 }
 
 float2 SurfacePlaneRenderer::GetDimensions() {
-	auto plane = m_planeList[m_intersectedPlane];
+	SpatialCoordinateSystem^ coordinateSystem;
+	auto plane = GetIntersectedPlane(coordinateSystem);
 
 	auto extents = plane.bounds.Extents;
 	
@@ -341,7 +358,8 @@ float2 SurfacePlaneRenderer::GetDimensions() {
 }
 
 XMFLOAT4X4 SurfacePlaneRenderer::GetOrientation() {
-	auto plane = m_planeList[m_intersectedPlane];
+	SpatialCoordinateSystem^ coordinateSystem;
+	auto plane = GetIntersectedPlane(coordinateSystem);
 	XMMATRIX world = XMMatrixRotationQuaternion(XMLoadFloat4(&plane.bounds.Orientation));
 
 	XMFLOAT4X4 transform;
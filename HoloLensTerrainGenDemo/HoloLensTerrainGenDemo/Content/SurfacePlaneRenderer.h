@@ -1,7 +1,8 @@
 #pragma once
+#include "Common\PlaneSnapshot.h"
 #include "Common\DeviceResources.h"
 #include "ShaderStructures.h"
-#include "Common\PlaneFinding\PlaneFinding.h"
+#include "Common\PlaneFinding\PlaneMap.h"
 
 namespace HoloLensTerrainGenDemo {
 	class SurfacePlaneRenderer {
@@ -9,11 +10,11 @@ namespace HoloLensTerrainGenDemo {
 		SurfacePlaneRenderer(const std::shared_ptr<DX::DeviceResources>& deviceResources);
 		~SurfacePlaneRenderer();
 
-		void UpdatePlanes(std::vector<PlaneFinding::BoundedPlane> newList, Windows::Perception::Spatial::SpatialCoordinateSystem^ cs);
+		// Builds a new snapshot of the floors in newList and publishes it. Called from a background thread.
+		void UpdatePlanes(std::vector<PlaneFinding::MergedPlane> newList, Windows::Perception::Spatial::SpatialCoordinateSystem^ cs);
 		void Update(Windows::Perception::Spatial::SpatialCoordinateSystem^ baseCoordinateSystem);
 		void Render();
 
-		void CreateVertexResources();
 		void CreateDeviceDependentResources();
 		void ReleaseDeviceDependentResources();
 
@@ -25,8 +26,21 @@ namespace HoloLensTerrainGenDemo {
 		bool WasTappedRecently() { return m_WasTapped;  }
 
 	private:
+		// An immutable set of floors, the vertex buffer that draws them and the coordinate system they were found
+		// in. UpdatePlanes builds a new snapshot and swaps it in whole (see DX::PlaneSnapshot), so readers never wait
+		// while the next is built. A snapshot lives for as long as any reader still holds it.
+		typedef DX::PlaneSnapshot<PlaneFinding::MergedPlane, Microsoft::WRL::ComPtr<ID3D11Buffer>,
+			Windows::Perception::Spatial::SpatialCoordinateSystem^> PlaneSnapshot;
+
+		std::shared_ptr<const PlaneSnapshot> GetSnapshot() const { return m_snapshot.Load(); }
+
+		Microsoft::WRL::ComPtr<ID3D11Buffer> CreateVertexBuffer(const std::vector<PlaneFinding::MergedPlane>& planes);
 		void CreateShaders();
 
+		// The plane the last captured interaction hit, as it is now if it still exists, and the coordinate system
+		// it is in.
+		PlaneFinding::BoundedPlane GetIntersectedPlane(Windows::Perception::Spatial::SpatialCoordinateSystem^& coordinateSystem);
+
 		// Event handler for gesture recognition.
 		void OnTap(Windows::UI::Input::Spatial::SpatialGestureRecognizer^ sender,
 			Windows::UI::Input::Spatial::SpatialTappedEventArgs^ args);
@@ -47,19 +61,18 @@ namespace HoloLensTerrainGenDemo {
 		// Rasterizer states
 		Microsoft::WRL::ComPtr<ID3D11RasterizerState> m_defaultRasterizerState;
 
-		// A way to lock map access.
-		std::mutex m_planeListLock;
+		// The current snapshot. Read through GetSnapshot, and published through DX::PublishPlanes,
+		// DX::ReleasePlaneBuffer and DX::RecreatePlaneBuffer, which publish through its Update.
+		DX::AtomicSnapshot<PlaneSnapshot> m_snapshot;
 
-		std::vector<PlaneFinding::BoundedPlane>	m_planeList;
+		// The snapshot Update computed this frame's transform for, so Render draws the same one.
+		std::shared_ptr<const PlaneSnapshot> m_frameSnapshot;
 
 		Microsoft::WRL::ComPtr<ID3D11Buffer> m_constantBuffer;
-		Microsoft::WRL::ComPtr<ID3D11Buffer> m_vertexBuffer;
 
 		ModelConstantBuffer m_constantBufferData;
 		DirectX::XMFLOAT4X4 m_modelToWorld;
 
-		Windows::Perception::Spatial::SpatialCoordinateSystem^ m_coordinateSystem;
-
 		bool m_shadersReady = false;
 
 		// Recognizes valid gestures passed to the Terrain object.
@@ -68,8 +81,10 @@ namespace HoloLensTerrainGenDemo {
 		// event token
 		Windows::Foundation::EventRegistrationToken			m_tapGestureEventToken;
 
-		// defines the last intersected plane
-		int m_intersectedPlane = -1;
+		// defines the last intersected plane. It is looked up again by id when used, since the plane list may have been
+		// updated since the interaction.
+		PlaneFinding::MergedPlane m_intersectedPlane = {};
+		Windows::Perception::Spatial::SpatialCoordinateSystem^ m_intersectedCoordinateSystem;
 		bool m_WasTapped = false;
 	};
 };
@@ -3,6 +3,7 @@
 #include "Common\DirectXHelper.h"
 #include "Common\MathFunctions.h"
 #include <stdlib.h>
+#include <ppl.h>
 #include <DDSTextureLoader.h>
 
 using namespace HoloLensTerrainGenDemo;
@@ -19,26 +20,44 @@ Terrain::Terrain(const std::shared_ptr<DX::DeviceResources>& deviceResources, fl
 	SpatialAnchor^ anchor, XMFLOAT4X4 orientation) :
 	m_deviceResources(deviceResources), m_wHeightmap(unsigned int(w * 100)), m_hHeightmap(unsigned int(h * 100)),
 	m_anchor(anchor), m_height(h), m_width(w), m_orientation(orientation) {
+	Initialize();
+	CreateDeviceDependentResources();
+}
+
+// Restores a saved terrain.
+Terrain::Terrain(const std::shared_ptr<DX::DeviceResources>& deviceResources, SpatialAnchor^ anchor,
+	const TerrainRecipe& recipe, Platform::String^ snapshotPath) :
+	m_deviceResources(deviceResources), m_wHeightmap(unsigned int(recipe.width * 100)), m_hHeightmap(unsigned int(recipe.height * 100)),
+	m_anchor(anchor), m_height(recipe.height), m_width(recipe.width), m_orientation(recipe.orientation) {
+	Initialize();
+	// the heightmap texture is created from m_heightmap, so the terrain has to be restored first.
+	Restore(recipe, snapshotPath);
+	CreateDeviceDependentResources();
+}
+
+// Sets up state shared by the constructors, apart from the device dependent resources.
+void Terrain::Initialize() {
 	// invert the z-axis of the orientation matrix because for some reason it is backwards to what we need.
 	m_orientation._31 *= -1;
 	m_orientation._32 *= -1;
 	m_orientation._33 *= -1;
 
 	m_heightmap = nullptr;
+	m_heightmapBack = nullptr;
+	m_erosionScale = nullptr;
+	m_coarseHeightmap[0] = m_coarseHeightmap[1] = nullptr;
 	InitializeHeightmap();
 
-	SetPosition(float3(-w / 2.0f, -h / 2.0f, 0.0f));
+	SetPosition(float3(-m_width / 2.0f, -m_height / 2.0f, 0.0f));
 
 	// Set up a general gesture recognizer for input.
-	m_gestureRecognizer = ref new SpatialGestureRecognizer(SpatialGestureSettings::Tap);
+	m_gestureRecognizer = ref new SpatialGestureRecognizer(SpatialGestureSettings::Tap | SpatialGestureSettings::DoubleTap);
 
 	m_tapGestureEventToken =
 		m_gestureRecognizer->Tapped +=
 		ref new Windows::Foundation::TypedEventHandler<SpatialGestureRecognizer^, SpatialTappedEventArgs^>(
 			std::bind(&Terrain::OnTap, this, _1, _2)
 			);
-
-	CreateDeviceDependentResources();
 }
 
 Terrain::~Terrain() {
@@ -46,6 +65,20 @@ Terrain::~Terrain() {
 		delete[] m_heightmap;
 	}
 
+	if (m_heightmapBack) {
+		delete[] m_heightmapBack;
+	}
+
+	if (m_erosionScale) {
+		delete[] m_erosionScale;
+	}
+
+	for (auto coarse : m_coarseHeightmap) {
+		if (coarse) {
+			delete[] coarse;
+		}
+	}
+
 	if (m_gestureRecognizer) {
 		m_gestureRecognizer->Tapped -= m_tapGestureEventToken;
 	}
@@ -56,11 +89,27 @@ void Terrain::InitializeHeightmap() {
 	unsigned int h = m_hHeightmap + 1;
 	unsigned int w = m_wHeightmap + 1;
 	m_heightmap = new float[h * w];
+	m_heightmapBack = new float[h * w];
+	m_erosionScale = new float[h * w];
 
 	for (auto i = 0u; i < h * w; ++i) {
-		m_heightmap[i] = 0.0f;
+		m_heightmapBack[i] = 0.0f;
+		m_erosionScale[i] = 0.0f;
+	}
+
+	// coarse levels round up so that they cover the full heightmap.
+	for (auto l = 0u; l < 2; ++l) {
+		unsigned int step = c_coarseLevelStep[l];
+		m_wCoarseHeightmap[l] = (m_wHeightmap + step - 1) / step;
+		m_hCoarseHeightmap[l] = (m_hHeightmap + step - 1) / step;
+		m_coarseHeightmap[l] = new float[(m_wCoarseHeightmap[l] + 1) * (m_hCoarseHeightmap[l] + 1)];
 	}
 
+	m_tiles = std::make_unique<TiledHeightmap>(m_wHeightmap, m_hHeightmap, c_snapshotTileSize);
+
+	// clears m_heightmap and the coarse levels, and seeds the generator.
+	ResetHeightMap();
+
 //	srand(23412342);
 
 /*	for (int i = 0; i < 100; ++i) {
@@ -72,6 +121,12 @@ void Terrain::InitializeHeightmap() {
 }
 
 void Terrain::ResetHeightMap() {
+	// every reset starts a new terrain. The seed is kept so the terrain can be saved as a recipe.
+	std::random_device seedSource;
+	ResetHeightMap(seedSource());
+}
+
+void Terrain::ResetHeightMap(uint32 seed) {
 	unsigned int h = m_hHeightmap + 1;
 	unsigned int w = m_wHeightmap + 1;
 
@@ -79,49 +134,235 @@ void Terrain::ResetHeightMap() {
 		m_heightmap[i] = 0.0f;
 	}
 
+	for (auto l = 0u; l < 2; ++l) {
+		unsigned int size = (m_wCoarseHeightmap[l] + 1) * (m_hCoarseHeightmap[l] + 1);
+		for (auto i = 0u; i < size; ++i) {
+			m_coarseHeightmap[l][i] = 0.0f;
+		}
+	}
+
+	m_tiles->MarkAllDirty();
+	m_seed = seed;
+	generator.seed(seed);
+
 	m_iIter = 0;
+	m_progressiveActive = m_progressive;
+	m_generationStartTicks = DX::StepTimer::GetTicks();
+	m_timeToFirstPreview = -1.0;
+	m_erosionPasses = 0;
+	m_erosionConverged = false;
 }
 
 // Basic Fault Formation Algorithm
 // FIR erosion filter
-void Terrain::IIRFilter(float filter) {
-	unsigned int h = m_hHeightmap + 1;
-	unsigned int w = m_wHeightmap + 1;
+void Terrain::IIRFilter(float filter, float* heightmap, unsigned int wMap, unsigned int hMap) {
+	unsigned int h = hMap + 1;
+	unsigned int w = wMap + 1;
 	float prev;
 
 	for (int y = 1; y < h - 1; ++y) {
-		prev = m_heightmap[y * w];
+		prev = heightmap[y * w];
 		for (int x = 1; x < w - 1; ++x) {
-			prev = m_heightmap[x + y * w] = filter * prev + (1 - filter) * m_heightmap[x + y * w];
+			prev = heightmap[x + y * w] = filter * prev + (1 - filter) * heightmap[x + y * w];
 		}
 
-		prev = m_heightmap[(w - 1) + y * w];
+		prev = heightmap[(w - 1) + y * w];
 		for (int x = w - 2; x >= 1; --x) {
-			prev = m_heightmap[x + y * w] = filter * prev + (1 - filter) * m_heightmap[x + y * w];
+			prev = heightmap[x + y * w] = filter * prev + (1 - filter) * heightmap[x + y * w];
 		}
 	}
 
 	for (int x = 1; x < w - 1; ++x) {
-		prev = m_heightmap[x];
+		prev = heightmap[x];
 		for (int y = 1; y < h - 1; ++y) {
-			prev = m_heightmap[x + y * w] = filter * prev + (1 - filter) * m_heightmap[x + y * w];
+			prev = heightmap[x + y * w] = filter * prev + (1 - filter) * heightmap[x + y * w];
 		}
 
-		prev = m_heightmap[x + w * (h - 1)];
+		prev = heightmap[x + w * (h - 1)];
 		for (int y = h - 2; y >= 1; --y) {
-			prev = m_heightmap[x + y * w] = filter * prev + (1 - filter) * m_heightmap[x + y * w];
+			prev = heightmap[x + y * w] = filter * prev + (1 - filter) * heightmap[x + y * w];
+		}
+	}
+}
+
+// Thermal erosion filter.
+// Material slides from a texel to each lower neighbour whose height difference exceeds the talus threshold.
+// The amount that leaves a texel is rate * (dmax - talus), split between those neighbours in proportion to
+// their excess height difference (d - talus).
+// Each pass is a Jacobi-style stencil: the first sweep computes the outflow scale of every texel from the
+// current heights, the second sweep gathers outflow and inflow for every texel and writes the result into
+// the back buffer. Neither sweep writes anything the other threads read, so both run tile-parallel and four
+// texels at a time. Border texels are never modified and never exchange material.
+float Terrain::ThermalErosion(float talus, float rate) {
+	const unsigned int h = m_hHeightmap + 1;
+	const unsigned int w = m_wHeightmap + 1;
+
+	// the vector kernels need at least four interior texels per row.
+	if (w < 6 || h < 3) {
+		return 0.0f;
+	}
+
+	const float* src = m_heightmap;
+	float* dst = m_heightmapBack;
+	float* scale = m_erosionScale;
+
+	const XMVECTOR vTalus = XMVectorReplicate(talus);
+	const XMVECTOR vRate = XMVectorReplicate(rate);
+	const XMVECTOR vLaneOffsets = XMVectorSet(0.0f, 1.0f, 2.0f, 3.0f);
+	// neighbours on the border are excluded, so the left neighbour only counts from x = 2
+	// and the right neighbour only up to x = w - 3.
+	const XMVECTOR vFirstWithLeft = XMVectorReplicate(2.0f);
+	const XMVECTOR vLastWithRight = XMVectorReplicate((float)(w - 3));
+
+	auto load = [](const float* p) {
+		return XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(p));
+	};
+
+	// excess height difference from a to b above the talus threshold, zero if b is not a valid neighbour.
+	auto excess = [&](FXMVECTOR a, FXMVECTOR b, FXMVECTOR valid) {
+		return XMVectorAndInt(XMVectorMax(XMVectorSubtract(XMVectorSubtract(a, b), vTalus), g_XMZero), valid);
+	};
+
+	// Walk the interior of a row four texels at a time. The last vector is shifted back so that it ends on the
+	// last interior texel; the overlapping lanes are recomputed with identical inputs.
+	// kernel receives the row offset of the first lane, the lane x coordinates and the index of the first lane
+	// that has not been processed by a previous vector in this row.
+	auto forEachRowVector = [&](unsigned int y, auto kernel) {
+		unsigned int processedTo = 1;
+		for (unsigned int x = 1; processedTo < w - 1; x += 4) {
+			if (x + 3 > w - 2) {
+				x = w - 5;
+			}
+			kernel(x + y * w, XMVectorAdd(XMVectorReplicate((float)x), vLaneOffsets), (float)processedTo);
+			processedTo = x + 4;
+		}
+	};
+
+	const unsigned int numTiles = (h - 2 + c_stencilTileRows - 1) / c_stencilTileRows;
+
+	// First sweep: outflow scale for every interior texel.
+	parallel_for(0u, numTiles, [&](unsigned int tile) {
+		const unsigned int yStart = 1 + tile * c_stencilTileRows;
+		const unsigned int yEnd = min(yStart + c_stencilTileRows, h - 1);
+		for (unsigned int y = yStart; y < yEnd; ++y) {
+			const XMVECTOR upValid = (y > 1) ? XMVectorTrueInt() : XMVectorFalseInt();
+			const XMVECTOR downValid = (y < h - 2) ? XMVectorTrueInt() : XMVectorFalseInt();
+
+			forEachRowVector(y, [&](unsigned int i, FXMVECTOR xs, float) {
+				const XMVECTOR c = load(src + i);
+				const XMVECTOR el = excess(c, load(src + i - 1), XMVectorGreaterOrEqual(xs, vFirstWithLeft));
+				const XMVECTOR er = excess(c, load(src + i + 1), XMVectorLessOrEqual(xs, vLastWithRight));
+				const XMVECTOR eu = excess(c, load(src + i - w), upValid);
+				const XMVECTOR ed = excess(c, load(src + i + w), downValid);
+
+				const XMVECTOR total = XMVectorAdd(XMVectorAdd(el, er), XMVectorAdd(eu, ed));
+				const XMVECTOR maxExcess = XMVectorMax(XMVectorMax(el, er), XMVectorMax(eu, ed));
+				const XMVECTOR hasOutflow = XMVectorGreater(total, g_XMZero);
+				const XMVECTOR s = XMVectorDivide(XMVectorMultiply(vRate, maxExcess), XMVectorMax(total, g_XMEpsilon));
+
+				XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(scale + i), XMVectorSelect(g_XMZero, s, hasOutflow));
+			});
+		}
+	});
+
+	// Second sweep: gather outflow and inflow into the back buffer, and accumulate the change per tile.
+	// Each tile also records which snapshot tile columns it changed, so snapshots only copy those.
+	const unsigned int snapshotTileSize = m_tiles->GetTileSize();
+	std::vector<float> tileChange(numTiles, 0.0f);
+	std::vector<std::vector<uint8>> tileDirtyColumns(numTiles, std::vector<uint8>(m_tiles->GetTilesX(), 0));
+	parallel_for(0u, numTiles, [&](unsigned int tile) {
+		const unsigned int yStart = 1 + tile * c_stencilTileRows;
+		const unsigned int yEnd = min(yStart + c_stencilTileRows, h - 1);
+		std::vector<uint8>& dirtyColumns = tileDirtyColumns[tile];
+		XMVECTOR change = g_XMZero;
+
+		for (unsigned int y = yStart; y < yEnd; ++y) {
+			const XMVECTOR upValid = (y > 1) ? XMVectorTrueInt() : XMVectorFalseInt();
+			const XMVECTOR downValid = (y < h - 2) ? XMVectorTrueInt() : XMVectorFalseInt();
+
+			forEachRowVector(y, [&](unsigned int i, FXMVECTOR xs, float processedTo) {
+				const XMVECTOR leftValid = XMVectorGreaterOrEqual(xs, vFirstWithLeft);
+				const XMVECTOR rightValid = XMVectorLessOrEqual(xs, vLastWithRight);
+
+				const XMVECTOR c = load(src + i);
+				const XMVECTOR l = load(src + i - 1);
+				const XMVECTOR r = load(src + i + 1);
+				const XMVECTOR u = load(src + i - w);
+				const XMVECTOR d = load(src + i + w);
+
+				// material leaving this texel.
+				const XMVECTOR outTotal = XMVectorAdd(
+					XMVectorAdd(excess(c, l, leftValid), excess(c, r, rightValid)),
+					XMVectorAdd(excess(c, u, upValid), excess(c, d, downValid)));
+				XMVECTOR result = XMVectorNegativeMultiplySubtract(load(scale + i), outTotal, c);
+
+				// material arriving from each higher neighbour, using that neighbour's own outflow scale.
+				result = XMVectorMultiplyAdd(load(scale + i - 1), excess(l, c, leftValid), result);
+				result = XMVectorMultiplyAdd(load(scale + i + 1), excess(r, c, rightValid), result);
+				result = XMVectorMultiplyAdd(load(scale + i - w), excess(u, c, upValid), result);
+				result = XMVectorMultiplyAdd(load(scale + i + w), excess(d, c, downValid), result);
+
+				XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(dst + i), result);
+				if (XMVector4NotEqual(result, c)) {
+					unsigned int x = i - y * w;
+					dirtyColumns[x / snapshotTileSize] = 1;
+					dirtyColumns[(x + 3) / snapshotTileSize] = 1;
+				}
+
+				// only count lanes that an earlier vector in this row has not already counted.
+				const XMVECTOR fresh = XMVectorGreaterOrEqual(xs, XMVectorReplicate(processedTo));
+				change = XMVectorAdd(change, XMVectorAndInt(XMVectorAbs(XMVectorSubtract(result, c)), fresh));
+			});
+
+			// border columns are carried over unchanged.
+			dst[y * w] = src[y * w];
+			dst[(w - 1) + y * w] = src[(w - 1) + y * w];
+		}
+
+		XMFLOAT4 sum;
+		XMStoreFloat4(&sum, change);
+		tileChange[tile] = sum.x + sum.y + sum.z + sum.w;
+	});
+
+	// border rows are carried over unchanged.
+	memcpy(dst, src, w * sizeof(float));
+	memcpy(dst + (h - 1) * w, src + (h - 1) * w, w * sizeof(float));
+
+	std::swap(m_heightmap, m_heightmapBack);
+
+	for (auto tile = 0u; tile < numTiles; ++tile) {
+		const unsigned int yStart = 1 + tile * c_stencilTileRows;
+		const unsigned int yEnd = min(yStart + c_stencilTileRows, h - 1);
+		for (auto column = 0u; column < m_tiles->GetTilesX(); ++column) {
+			if (tileDirtyColumns[tile][column]) {
+				m_tiles->MarkDirty(column * snapshotTileSize, yStart, column * snapshotTileSize, yEnd - 1);
+			}
 		}
 	}
+
+	// sum the tiles in order so the metric does not depend on scheduling.
+	float totalChange = 0.0f;
+	for (auto c : tileChange) {
+		totalChange += c;
+	}
+
+	return totalChange / (float)((w - 2) * (h - 2));
 }
 
-void Terrain::IterateFaultFormation(unsigned int treeDepth, float treeAmplitude) {
+void Terrain::IterateFaultFormation(unsigned int treeDepth, float treeAmplitude, float* heightmap,
+	unsigned int wMap, unsigned int hMap, unsigned int step) {
 	BSPNode root;
 	BuildBSPTree(&root, treeDepth);
 
 	// for each point in the height map, walk the BSP Tree to determine height of the point.
+	// The tree is built in full resolution texel coordinates, so scale coarse texels by step.
 	// Don't run on the edges
-	for (unsigned int y = 1; y < m_hHeightmap; ++y) {
-		for (unsigned int x = 1; x < m_wHeightmap; ++x) {
+	// Rows are independent of each other, so they are evaluated in parallel. The tree is built before, so the
+	// random sequence and therefore the result does not depend on scheduling.
+	parallel_for(1u, hMap, [&](unsigned int y) {
+		for (unsigned int x = 1; x < wMap; ++x) {
+			float px = (float)(x * step);
+			float py = (float)(y * step);
 			BSPNode* current = &root;
 			float amp = treeAmplitude;
 			float h = 0;
@@ -131,8 +372,8 @@ void Terrain::IterateFaultFormation(unsigned int treeDepth, float treeAmplitude)
 				auto end = current->GetEndPos();
 				float dx = end.x - start.x;
 				float dy = end.y - start.y;
-				float ddx = x - start.x;
-				float ddy = y - start.y;
+				float ddx = px - start.x;
+				float ddy = py - start.y;
 
 				if (ddx * dy - dx * ddy > 0) {
 					current = current->GetRightChild();
@@ -147,11 +388,346 @@ void Terrain::IterateFaultFormation(unsigned int treeDepth, float treeAmplitude)
 
 			// Use F to attenuate the amplitude of the fault by the distance from the edge.
 			// F = 0 on the edge. F = 1 in the exact center of the height map.
-			float F = CalcManhattanDistFromCenter({ (float)x, (float)y });
-			m_heightmap[y * (m_wHeightmap + 1) + x] += h * F;
+			float F = CalcManhattanDistFromCenter({ px, py });
+			heightmap[y * (wMap + 1) + x] += h * F;
 			// ensure that the height value never drops below zero since that
 			// would put it beneath a surface in the real world.
-			if (m_heightmap[y * (m_wHeightmap + 1) + x] < 0) m_heightmap[y * (m_wHeightmap + 1) + x] = 0;
+			if (heightmap[y * (wMap + 1) + x] < 0) heightmap[y * (wMap + 1) + x] = 0;
+		}
+	});
+}
+
+// Runs the fault formation iterations scheduled for this frame, without going past maxIterations.
+// In progressive mode the first iterations run on the coarse levels, several per frame, and the current level is
+// upsampled into m_heightmap after every batch so it can be displayed right away. When a level is finished, it is
+// upsampled into the next finer level, which continues from there. The last coarse level is already in m_heightmap
+// when the full resolution iterations start.
+// Without preview, as when replaying a recipe, each coarse level runs in one batch and is only upsampled into
+// m_heightmap when it is finished or when maxIterations is reached. The iterations and their order are the same
+// either way, so the result does not depend on preview.
+// Returns true if m_heightmap changed.
+bool Terrain::UpdateFaultFormation(unsigned int maxIterations, bool preview) {
+	maxIterations = min(maxIterations, c_faultFormationIterations);
+	if (m_iIter >= maxIterations) {
+		return false;
+	}
+
+	// find the level the next iteration belongs to.
+	unsigned int level = 0;
+	unsigned int levelStart = 0;
+	if (m_progressiveActive) {
+		while (level < 2 && m_iIter >= levelStart + c_coarseLevelIterations[level]) {
+			levelStart += c_coarseLevelIterations[level];
+			++level;
+		}
+	} else {
+		level = 2;
+	}
+
+	if (level < 2) {
+		unsigned int step = c_coarseLevelStep[level];
+		unsigned int levelEnd = levelStart + c_coarseLevelIterations[level];
+		unsigned int batchEnd = preview ? min(m_iIter + c_coarseLevelIterationsPerFrame[level], levelEnd) : levelEnd;
+		batchEnd = min(batchEnd, maxIterations);
+		// keep the filter's smoothing length the same in meters on the coarser grid.
+		float filter = powf(c_iirFilter, (float)step);
+
+		for (; m_iIter < batchEnd; ++m_iIter) {
+			IterateFaultFormation(c_faultTreeDepth, c_faultAmplitude, m_coarseHeightmap[level],
+				m_wCoarseHeightmap[level], m_hCoarseHeightmap[level], step);
+			IIRFilter(filter, m_coarseHeightmap[level], m_wCoarseHeightmap[level], m_hCoarseHeightmap[level]);
+		}
+
+		if (preview || m_iIter == levelEnd || m_iIter == maxIterations) {
+			Upsample(m_coarseHeightmap[level], m_wCoarseHeightmap[level], m_hCoarseHeightmap[level],
+				m_heightmap, m_wHeightmap, m_hHeightmap, step);
+			m_tiles->MarkAllDirty();
+		}
+
+		// hand the finished level on to the next coarse level.
+		if (m_iIter == levelEnd && level + 1 < 2) {
+			Upsample(m_coarseHeightmap[level], m_wCoarseHeightmap[level], m_hCoarseHeightmap[level],
+				m_coarseHeightmap[level + 1], m_wCoarseHeightmap[level + 1], m_hCoarseHeightmap[level + 1],
+				step / c_coarseLevelStep[level + 1]);
+		}
+	} else {
+		IterateFaultFormation(c_faultTreeDepth, c_faultAmplitude, m_heightmap, m_wHeightmap, m_hHeightmap, 1);
+		IIRFilter(c_iirFilter, m_heightmap, m_wHeightmap, m_hHeightmap);
+		m_tiles->MarkAllDirty();
+		++m_iIter;
+	}
+
+	// report how long it took to get a recognizable terrain. Measured at the same iteration count in
+	// both modes so the numbers can be compared.
+	if (m_timeToFirstPreview < 0.0 && m_iIter >= c_coarseLevelIterations[0]) {
+		m_timeToFirstPreview = (double)(DX::StepTimer::GetTicks() - m_generationStartTicks) /
+			(double)DX::StepTimer::GetPerformanceFrequency();
+
+		Platform::String^ mode = m_progressiveActive ? L"progressive" : L"full resolution";
+		Platform::String^ message = L"Terrain time to first preview (" + mode + L"): " +
+			m_timeToFirstPreview.ToString() + L"s\n";
+		OutputDebugStringW(message->Data());
+	}
+
+	return true;
+}
+
+// Returns a recipe that regenerates the current terrain.
+TerrainRecipe Terrain::GetRecipe() {
+	TerrainRecipe recipe = { 0 };
+	recipe.magic = TerrainPersistence::c_recipeMagic;
+	recipe.version = TerrainPersistence::c_version;
+	recipe.seed = m_seed;
+	recipe.height = m_height;
+	recipe.width = m_width;
+	// undo the z-axis inversion done in the constructor.
+	recipe.orientation = m_orientation;
+	recipe.orientation._31 *= -1;
+	recipe.orientation._32 *= -1;
+	recipe.orientation._33 *= -1;
+	recipe.progressive = m_progressiveActive ? 1 : 0;
+	recipe.treeDepth = c_faultTreeDepth;
+	recipe.faultAmplitude = c_faultAmplitude;
+	recipe.iirFilter = c_iirFilter;
+	recipe.talusThreshold = c_talusThreshold;
+	recipe.erosionRate = c_erosionRate;
+	recipe.faultIterations = m_iIter;
+	recipe.erosionPasses = m_erosionPasses;
+	recipe.erosionConverged = m_erosionConverged ? 1 : 0;
+
+	return recipe;
+}
+
+void Terrain::CopyHeightmap(std::vector<float>& heightmap, unsigned int& w, unsigned int& h) {
+	heightmap.assign(m_heightmap, m_heightmap + (m_wHeightmap + 1) * (m_hHeightmap + 1));
+	w = m_wHeightmap;
+	h = m_hHeightmap;
+}
+
+// Checks that the recipe was written with the generator settings of this build.
+bool Terrain::CanReplay(const TerrainRecipe& recipe) {
+	return recipe.treeDepth == c_faultTreeDepth && recipe.faultAmplitude == c_faultAmplitude &&
+		recipe.iirFilter == c_iirFilter && recipe.talusThreshold == c_talusThreshold &&
+		recipe.erosionRate == c_erosionRate;
+}
+
+// Replays a recipe in one go. Coarse levels run without intermediate upsampling and nothing is uploaded,
+// the caller creates or updates the texture once the heightmap is done.
+void Terrain::Replay(const TerrainRecipe& recipe) {
+	m_progressive = recipe.progressive != 0;
+	ResetHeightMap(recipe.seed);
+	// replays are not previewed, so don't report a preview time.
+	m_timeToFirstPreview = 0.0;
+
+	while (UpdateFaultFormation(recipe.faultIterations, false)) {
+	}
+
+	for (unsigned int i = 0; i < recipe.erosionPasses && i < c_maxErosionPasses; ++i) {
+		ThermalErosion(c_talusThreshold, c_erosionRate);
+	}
+	m_erosionPasses = min(recipe.erosionPasses, c_maxErosionPasses);
+	m_erosionConverged = recipe.erosionConverged != 0;
+}
+
+// Loads the saved terrain before the heightmap texture is created.
+// Snapshots only have to be decoded, so they are preferred. The time taken is kept in m_restoreStatistics, next to
+// the number of frames the interactive generation would take; TerrainSnapshotBenchmark times the decoding on the host.
+void Terrain::Restore(const TerrainRecipe& recipe, Platform::String^ snapshotPath) {
+	const double frequency = (double)DX::StepTimer::GetPerformanceFrequency();
+
+	// snapshots are only written for finished terrains. The snapshot is decoded into the erosion back buffer, which
+	// every erosion pass overwrites in full, and only swapped in once it decoded completely, so a truncated or corrupt
+	// file falls back to the recipe.
+	if (snapshotPath) {
+		int64 start = DX::StepTimer::GetTicks();
+		m_restoreStatistics.fromSnapshot = TerrainPersistence::LoadSnapshot(snapshotPath, m_heightmapBack, m_wHeightmap, m_hHeightmap);
+		if (m_restoreStatistics.fromSnapshot) {
+			std::swap(m_heightmap, m_heightmapBack);
+			m_tiles->MarkAllDirty();
+		}
+		m_restoreStatistics.snapshotMilliseconds = (double)(DX::StepTimer::GetTicks() - start) * 1000.0 / frequency;
+	}
+
+	if (m_restoreStatistics.fromSnapshot) {
+		// pick up the generator state from the recipe so the terrain counts as finished.
+		m_seed = recipe.seed;
+		m_progressiveActive = recipe.progressive != 0;
+		m_iIter = c_faultFormationIterations;
+		m_erosionPasses = recipe.erosionPasses;
+		m_erosionConverged = true;
+	} else if (CanReplay(recipe)) {
+		int64 start = DX::StepTimer::GetTicks();
+		Replay(recipe);
+		m_restoreStatistics.recipeMilliseconds = (double)(DX::StepTimer::GetTicks() - start) * 1000.0 / frequency;
+	}
+
+	// restored terrains are shown as soon as the texture is created.
+	m_timeToFirstPreview = 0.0;
+
+	// interactive generation runs one fault formation step per frame, fewer on the coarse levels, and then the
+	// erosion passes.
+	unsigned int frames = c_faultFormationIterations + (recipe.erosionPasses + c_erosionPassesPerFrame - 1) / c_erosionPassesPerFrame;
+	if (m_progressiveActive) {
+		for (auto l = 0u; l < 2; ++l) {
+			frames -= c_coarseLevelIterations[l];
+			frames += (c_coarseLevelIterations[l] + c_coarseLevelIterationsPerFrame[l] - 1) / c_coarseLevelIterationsPerFrame[l];
+		}
+	}
+	m_restoreStatistics.interactiveFrames = frames;
+}
+
+TerrainSnapshot Terrain::TakeSnapshot() {
+	TerrainSnapshot snapshot;
+	snapshot.tiles = m_tiles->Capture(m_heightmap);
+	snapshot.generator = generator;
+	snapshot.seed = m_seed;
+	snapshot.faultIterations = m_iIter;
+	snapshot.progressiveActive = m_progressiveActive;
+	snapshot.erosionPasses = m_erosionPasses;
+	snapshot.erosionConverged = m_erosionConverged;
+
+	// the coarse levels are only read again while generation is still on one of them.
+	if (m_progressiveActive && m_iIter < c_coarseLevelIterations[0] + c_coarseLevelIterations[1]) {
+		for (auto l = 0u; l < 2; ++l) {
+			unsigned int size = (m_wCoarseHeightmap[l] + 1) * (m_hCoarseHeightmap[l] + 1);
+			snapshot.coarseHeightmaps[l].assign(m_coarseHeightmap[l], m_coarseHeightmap[l] + size);
+		}
+	}
+
+	return snapshot;
+}
+
+// Restores the generator and the coarse levels along with the heights, so an unfinished terrain draws the same
+// faults, at the same resolution, as it would have if the snapshot had never been taken.
+void Terrain::RestoreSnapshot(const TerrainSnapshot& snapshot) {
+	m_tiles->Restore(snapshot.tiles, m_heightmap);
+	for (auto l = 0u; l < 2; ++l) {
+		if (!snapshot.coarseHeightmaps[l].empty()) {
+			std::copy(snapshot.coarseHeightmaps[l].begin(), snapshot.coarseHeightmaps[l].end(), m_coarseHeightmap[l]);
+		}
+	}
+	generator = snapshot.generator;
+	m_seed = snapshot.seed;
+	m_iIter = snapshot.faultIterations;
+	m_progressiveActive = snapshot.progressiveActive;
+	m_erosionPasses = snapshot.erosionPasses;
+	m_erosionConverged = snapshot.erosionConverged;
+	m_uploadPending = true;
+}
+
+std::vector<unsigned int> Terrain::DiffSnapshots(const TerrainSnapshot& a, const TerrainSnapshot& b) {
+	return TiledHeightmap::Diff(a.tiles, b.tiles);
+}
+
+bool Terrain::Undo() {
+	if (m_undoHistory.empty()) {
+		return false;
+	}
+
+	RestoreSnapshot(m_undoHistory.back());
+	m_undoHistory.pop_back();
+	return true;
+}
+
+size_t Terrain::GetUndoMemoryUsage() {
+	std::vector<const TiledHeightmap::Snapshot*> snapshots;
+	for (auto& snapshot : m_undoHistory) {
+		snapshots.push_back(&snapshot.tiles);
+	}
+
+	size_t coarseBytes = 0;
+	for (auto& snapshot : m_undoHistory) {
+		for (auto& coarse : snapshot.coarseHeightmaps) {
+			coarseBytes += coarse.size() * sizeof(float);
+		}
+	}
+
+	return TiledHeightmap::GetMemoryUsage(snapshots) + coarseBytes;
+}
+
+// Points in anchor space are the terrain's local space transformed by its translation and orientation,
+// the same model transform that Update uses for rendering without the anchor's transform.
+void Terrain::SampleAnchorSpace(const XMFLOAT3* points, size_t count, float* heights, XMFLOAT3* normals) {
+	XMMATRIX modelToAnchor = XMMatrixTranslationFromVector(XMLoadFloat3(&m_position)) * XMLoadFloat4x4(&m_orientation);
+	Sample(modelToAnchor, points, count, heights, normals);
+}
+
+bool Terrain::SampleWorldSpace(SpatialCoordinateSystem^ coordinateSystem, const XMFLOAT3* points, size_t count,
+	float* heights, XMFLOAT3* normals) {
+	auto tryTransform = m_anchor->CoordinateSystem->TryGetTransformTo(coordinateSystem);
+	if (!tryTransform) {
+		return false;
+	}
+
+	XMMATRIX modelToWorld = XMMatrixTranslationFromVector(XMLoadFloat3(&m_position)) * XMLoadFloat4x4(&m_orientation) *
+		XMLoadFloat4x4(&tryTransform->Value);
+	Sample(modelToWorld, points, count, heights, normals);
+	return true;
+}
+
+bool Terrain::GetSurfaceCenter(SpatialCoordinateSystem^ coordinateSystem, float3& position, float3& normal) {
+	auto tryTransform = m_anchor->CoordinateSystem->TryGetTransformTo(coordinateSystem);
+	if (!tryTransform) {
+		return false;
+	}
+
+	XMMATRIX modelToWorld = XMMatrixTranslationFromVector(XMLoadFloat3(&m_position)) * XMLoadFloat4x4(&m_orientation) *
+		XMLoadFloat4x4(&tryTransform->Value);
+	XMFLOAT3 base;
+	XMStoreFloat3(&base, XMVector3TransformCoord(XMVectorSet(m_width / 2.0f, m_height / 2.0f, 0.0f, 0.0f), modelToWorld));
+	float height;
+	XMFLOAT3 surfaceNormal;
+	Sample(modelToWorld, &base, 1, &height, &surfaceNormal);
+
+	// heights are measured along the terrain's local z axis.
+	XMVECTOR up = XMVector3Normalize(XMVector3TransformNormal(g_XMIdentityR2, modelToWorld));
+	XMStoreFloat3(&position, XMVectorMultiplyAdd(XMVectorReplicate(height), up, XMLoadFloat3(&base)));
+	normal = float3(surfaceNormal.x, surfaceNormal.y, surfaceNormal.z);
+	return true;
+}
+
+// Splits the batch into chunks and samples them in parallel once the batch is large enough to pay for it.
+void Terrain::Sample(FXMMATRIX modelToQuery, const XMFLOAT3* points, size_t count, float* heights, XMFLOAT3* normals) {
+	XMVECTOR determinant;
+	XMMATRIX queryToLocal = XMMatrixInverse(&determinant, modelToQuery);
+	size_t numChunks = (count + c_heightmapSampleChunkSize - 1) / c_heightmapSampleChunkSize;
+
+	auto sampleChunk = [&](size_t chunk) {
+		size_t start = chunk * c_heightmapSampleChunkSize;
+		SampleHeightmapChunk(m_heightmap, m_wHeightmap, m_hHeightmap, queryToLocal, modelToQuery, points + start,
+			min(c_heightmapSampleChunkSize, count - start), heights + start, normals ? normals + start : nullptr);
+	};
+
+	if (count >= c_parallelSampleThreshold) {
+		parallel_for(size_t(0), numChunks, sampleChunk);
+	} else {
+		for (size_t chunk = 0; chunk < numChunks; ++chunk) {
+			sampleChunk(chunk);
+		}
+	}
+}
+
+// Bilinearly upsamples src into the interior of dst. The border of dst is left untouched so it stays at zero.
+// dst texel (x, y) samples src at (x / ratio, y / ratio). Coarse levels round their size up, so every interior
+// dst texel has a src texel on each side to interpolate between.
+void Terrain::Upsample(const float* src, unsigned int wSrc, unsigned int hSrc,
+	float* dst, unsigned int wDst, unsigned int hDst, unsigned int ratio) {
+	unsigned int srcPitch = wSrc + 1;
+	unsigned int dstPitch = wDst + 1;
+	float invRatio = 1.0f / (float)ratio;
+
+	for (unsigned int y = 1; y < hDst; ++y) {
+		unsigned int sy = min(y / ratio, hSrc - 1);
+		float ty = (float)(y - sy * ratio) * invRatio;
+		const float* row0 = src + sy * srcPitch;
+		const float* row1 = row0 + srcPitch;
+
+		for (unsigned int x = 1; x < wDst; ++x) {
+			unsigned int sx = min(x / ratio, wSrc - 1);
+			float tx = (float)(x - sx * ratio) * invRatio;
+			float top = row0[sx] + (row0[sx + 1] - row0[sx]) * tx;
+			float bottom = row1[sx] + (row1[sx + 1] - row1[sx]) * tx;
+			dst[x + y * dstPitch] = top + (bottom - top) * ty;
 		}
 	}
 }
@@ -398,26 +974,42 @@ void Terrain::Update(const DX::StepTimer& timer, SpatialCoordinateSystem^ coordi
 	);
 
 	// Update the terrain generator.
-	if (m_iIter < 500) {
-		IterateFaultFormation(5, 0.005f);
-		IIRFilter(0.1f);
-
-		D3D11_MAPPED_SUBRESOURCE mappedTex = { 0 };
-		DX::ThrowIfFailed(context->Map(m_hmTexture.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedTex));
-		// Texture data on GPU may have padding added to each row so we need to
-		// take that padding into account when we upload the data.
-		unsigned int rowSpan = (m_wHeightmap + 1) * sizeof(float);
-		BYTE* mappedData = reinterpret_cast<BYTE*>(mappedTex.pData);
-		BYTE* buffer = reinterpret_cast<BYTE*>(m_heightmap);
-		for (unsigned int i = 0; i < (m_hHeightmap + 1); ++i) {
-			memcpy(mappedData, buffer, rowSpan);
-			mappedData += mappedTex.RowPitch;
-			buffer += rowSpan;
+	bool changed = false;
+	if (m_iIter < c_faultFormationIterations) {
+		changed = UpdateFaultFormation(c_faultFormationIterations, true);
+	} else if (!m_erosionConverged) {
+		// Once the fault formation is done, erode the terrain a few passes per frame until it settles.
+		for (unsigned int i = 0; i < c_erosionPassesPerFrame && !m_erosionConverged; ++i) {
+			float change = ThermalErosion(c_talusThreshold, c_erosionRate);
+			++m_erosionPasses;
+			m_erosionConverged = change < c_erosionConvergence || m_erosionPasses >= c_maxErosionPasses;
 		}
+		changed = true;
+	}
 
-		context->Unmap(m_hmTexture.Get(), 0);
-	} 
-	m_iIter = m_iIter < 500 ? m_iIter + 1 : m_iIter;
+	if (changed || m_uploadPending) {
+		UploadHeightmap();
+		m_uploadPending = false;
+	}
+}
+
+void Terrain::UploadHeightmap() {
+	const auto context = m_deviceResources->GetD3DDeviceContext();
+
+	D3D11_MAPPED_SUBRESOURCE mappedTex = { 0 };
+	DX::ThrowIfFailed(context->Map(m_hmTexture.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedTex));
+	// Texture data on GPU may have padding added to each row so we need to
+	// take that padding into account when we upload the data.
+	unsigned int rowSpan = (m_wHeightmap + 1) * sizeof(float);
+	BYTE* mappedData = reinterpret_cast<BYTE*>(mappedTex.pData);
+	BYTE* buffer = reinterpret_cast<BYTE*>(m_heightmap);
+	for (unsigned int i = 0; i < (m_hHeightmap + 1); ++i) {
+		memcpy(mappedData, buffer, rowSpan);
+		mappedData += mappedTex.RowPitch;
+		buffer += rowSpan;
+	}
+
+	context->Unmap(m_hmTexture.Get(), 0);
 }
 
 // Renders one frame using the vertex and pixel shaders.
@@ -649,8 +1241,20 @@ void Terrain::ReleaseDeviceDependentResources() {
 	m_srvDiffuseMaps.Reset();
 }
 
+// A single tap starts a new terrain, keeping the current one for undo. A double tap undoes the last reset.
 void Terrain::OnTap(SpatialGestureRecognizer^ sender, SpatialTappedEventArgs^ args) {
-	ResetHeightMap();
+	switch (args->TapCount) {
+	case 1:
+		m_undoHistory.push_back(TakeSnapshot());
+		if (m_undoHistory.size() > c_maxUndoSnapshots) {
+			m_undoHistory.pop_front();
+		}
+		ResetHeightMap();
+		break;
+	case 2:
+		Undo();
+		break;
+	}
 }
 
 bool Terrain::CaptureInteraction(SpatialInteraction^ interaction) {
@@ -4,14 +4,46 @@
 #include "..\Common\StepTimer.h"
 #include "ShaderStructures.h"
 #include "BSP Tree.h"
+#include "TerrainPersistence.h"
+#include "HeightmapSampling.h"
+#include "TiledHeightmap.h"
+#include <deque>
 #include <random>
 
 namespace HoloLensTerrainGenDemo {
+	// A copy-on-write snapshot of a terrain's heightmap and of the generation state, so an unfinished terrain
+	// continues from a restored snapshot exactly as it would have without it.
+	struct TerrainSnapshot {
+		TiledHeightmap::Snapshot	tiles;
+		// copies of the coarse heightmaps, only taken while progressive generation is on a coarse level.
+		std::vector<float>			coarseHeightmaps[2];
+		// the fault formation generator, which the remaining iterations draw their faults from.
+		std::default_random_engine	generator;
+		uint32						seed;
+		unsigned int				faultIterations;
+		bool						progressiveActive;
+		unsigned int				erosionPasses;
+		bool						erosionConverged;
+	};
+
+	// How a saved terrain was restored. Times are in milliseconds and negative for the path that was not taken.
+	struct TerrainRestoreStatistics {
+		double						snapshotMilliseconds = -1.0;
+		double						recipeMilliseconds = -1.0;
+		bool						fromSnapshot = false;
+		// frames the interactive generation takes to reach the same terrain, for comparison.
+		unsigned int				interactiveFrames = 0;
+	};
+
 	class Terrain {
 	public:
 		// provide h and w in meters.
 		Terrain(const std::shared_ptr<DX::DeviceResources>& deviceResources, float h, float w, 
 			Windows::Perception::Spatial::SpatialAnchor^ anchor, DirectX::XMFLOAT4X4 orientation);
+		// Restores a saved terrain. The snapshot at snapshotPath is used if it can be loaded, otherwise the recipe
+		// is replayed.
+		Terrain(const std::shared_ptr<DX::DeviceResources>& deviceResources, Windows::Perception::Spatial::SpatialAnchor^ anchor,
+			const TerrainRecipe& recipe, Platform::String^ snapshotPath);
 		~Terrain();
 		void CreateDeviceDependentResources();
 		void ReleaseDeviceDependentResources();
@@ -28,16 +60,97 @@ namespace HoloLensTerrainGenDemo {
 		// Reset the Height map to all zeros.
 		void ResetHeightMap();
 
+		// Progressive mode generates the terrain at 1/4 and 1/2 resolution before refining it at full resolution,
+		// so a recognizable preview shows up within a few frames. Takes effect on the next reset.
+		void SetProgressive(bool progressive) { m_progressive = progressive; }
+		bool IsProgressive() { return m_progressive; }
+		// Seconds from the start of generation until the terrain had its first c_coarseLevelIterations[0] fault
+		// formation iterations applied and uploaded. Negative until that point is reached.
+		double GetTimeToFirstPreview() { return m_timeToFirstPreview; }
+
+		// Persistence.
+		Windows::Perception::Spatial::SpatialAnchor^ GetAnchor() { return m_anchor; }
+		TerrainRecipe GetRecipe();
+		// True once generation, including erosion, has finished.
+		bool IsGenerationComplete() { return m_iIter >= c_faultFormationIterations && m_erosionConverged; }
+		// Copies the (w + 1) * (h + 1) texel heightmap, so it can be saved on another thread.
+		void CopyHeightmap(std::vector<float>& heightmap, unsigned int& w, unsigned int& h);
+		// Only set for terrains created from a recipe.
+		const TerrainRestoreStatistics& GetRestoreStatistics() { return m_restoreStatistics; }
+
+		// Copy-on-write snapshots, for undo and for comparing candidate terrains.
+		// Taking a snapshot only copies the heightmap tiles modified since the previous one.
+		TerrainSnapshot TakeSnapshot();
+		// Restores the heightmap and generation state of a snapshot. If the snapshot was taken before generation
+		// finished, generation continues where it was, at the resolution it was at.
+		void RestoreSnapshot(const TerrainSnapshot& snapshot);
+		// Returns the indices of the heightmap tiles that differ between two snapshots.
+		std::vector<unsigned int> DiffSnapshots(const TerrainSnapshot& a, const TerrainSnapshot& b);
+		// Restores the terrain from before the last reset. Returns false if there is nothing to undo.
+		bool Undo();
+		// Bytes held by the snapshots in the undo history. Tiles shared between snapshots are counted once.
+		// Copies of coarse levels are counted for every snapshot that holds one.
+		size_t GetUndoMemoryUsage();
+
+		// Batched height and normal queries, for placing objects on the terrain.
+		// Each point is converted into the terrain's local space using m_position and m_orientation, and the
+		// heightmap is bilinearly interpolated at its x and y. heights receives the height above the terrain's base
+		// plane in meters. normals, which may be null, receives the surface normal in the space of the input points.
+		// Points beyond the edge are clamped to it. Call these from the same thread as Update.
+		void SampleAnchorSpace(const DirectX::XMFLOAT3* points, size_t count, float* heights, DirectX::XMFLOAT3* normals);
+		// Returns false if coordinateSystem can't be located relative to the terrain's anchor right now.
+		bool SampleWorldSpace(Windows::Perception::Spatial::SpatialCoordinateSystem^ coordinateSystem,
+			const DirectX::XMFLOAT3* points, size_t count, float* heights, DirectX::XMFLOAT3* normals);
+		// Finds the point on the terrain's surface above the center of its base, and the surface normal there, in
+		// coordinateSystem, for the image stabilization focus point. Returns false if coordinateSystem can't be
+		// located relative to the terrain's anchor right now.
+		bool GetSurfaceCenter(Windows::Perception::Spatial::SpatialCoordinateSystem^ coordinateSystem,
+			Windows::Foundation::Numerics::float3& position, Windows::Foundation::Numerics::float3& normal);
+
 		bool CaptureInteraction(Windows::UI::Input::Spatial::SpatialInteraction^ interaction);
 
 	private:
+		// Sets up state shared by the constructors, apart from the device dependent resources.
+		void Initialize();
 		// initializes the height map to the supplied dimensions.
 		void InitializeHeightmap();
-		void IterateFaultFormation(unsigned int treeDepth, float treeAmplitude);
+		// Reset the height map to all zeros and restart generation with the given seed.
+		void ResetHeightMap(uint32 seed);
+		// Replays a recipe in one go, without uploading the intermediate results.
+		void Replay(const TerrainRecipe& recipe);
+		// Loads the saved terrain before the heightmap texture is created.
+		void Restore(const TerrainRecipe& recipe, Platform::String^ snapshotPath);
+		// Checks that the recipe was written with the generator settings of this build.
+		bool CanReplay(const TerrainRecipe& recipe);
+		// Runs one fault formation iteration on a heightmap of (w + 1) * (h + 1) texels.
+		// step is the number of full resolution texels between neighbouring texels of heightmap, so coarse levels
+		// sample the same faults as the full resolution map.
+		void IterateFaultFormation(unsigned int treeDepth, float treeAmplitude, float* heightmap,
+			unsigned int w, unsigned int h, unsigned int step);
 		// Recursively generate a BSP Tree of specified depth for use in Fault Formation algorithm.
 		// depth of 1 is a leaf node.
 		void BuildBSPTree(BSPNode* current, unsigned int depth);
-		void IIRFilter(float filter);
+		void IIRFilter(float filter, float* heightmap, unsigned int w, unsigned int h);
+		// Runs the fault formation iterations scheduled for this frame, without going past maxIterations, and
+		// updates m_heightmap. Without preview, coarse levels run to completion and are only upsampled into
+		// m_heightmap when generation moves on or stops. Returns true if m_heightmap changed.
+		bool UpdateFaultFormation(unsigned int maxIterations, bool preview);
+		// Samples points given in the space that modelToQuery maps the terrain's local space to.
+		void Sample(DirectX::FXMMATRIX modelToQuery, const DirectX::XMFLOAT3* points, size_t count, float* heights,
+			DirectX::XMFLOAT3* normals);
+		// Bilinearly upsamples src, with (wSrc + 1) * (hSrc + 1) texels, into the interior of dst, with
+		// (wDst + 1) * (hDst + 1) texels. ratio is the number of dst texels per src texel.
+		void Upsample(const float* src, unsigned int wSrc, unsigned int hSrc,
+			float* dst, unsigned int wDst, unsigned int hDst, unsigned int ratio);
+		// Thermal erosion filter. Moves material from texels whose slope to a neighbour exceeds the talus
+		// threshold onto their lower neighbours. Runs as a Jacobi stencil from m_heightmap into m_heightmapBack
+		// and swaps the two, so rows can be processed in parallel without read/write hazards.
+		// talus is the height difference between neighbouring texels at which material starts to slide.
+		// rate is the fraction of the excess height moved per pass; keep it at or below 0.5 to remain stable.
+		// Returns the mean absolute height change per texel, which is used as the convergence metric.
+		float ThermalErosion(float talus, float rate);
+		// Copies m_heightmap into the dynamic heightmap texture.
+		void UploadHeightmap();
 		// Calculates a distance value for point p from the edge of the height map.
 		// Calculation is calculated as Dx * Dy
 		// Dx = 1 - (|w/2 - px| / (w/2))
@@ -75,15 +188,69 @@ namespace HoloLensTerrainGenDemo {
 		// shader just to set the render target array index.
 		bool											    m_usingVprtShaders = false;
 		float*											 	m_heightmap;
+		// second heightmap buffer that stencil passes write into before being swapped with m_heightmap.
+		float*												m_heightmapBack;
+		// per texel outflow scale used by the thermal erosion stencil.
+		float*												m_erosionScale;
+		// tracks which tiles of m_heightmap changed, for copy-on-write snapshots.
+		std::unique_ptr<TiledHeightmap>						m_tiles;
+		// snapshots taken before each reset, oldest first.
+		std::deque<TerrainSnapshot>							m_undoHistory;
+		// set when m_heightmap was changed outside of generation and has to be uploaded.
+		bool												m_uploadPending = false;
+		// coarse heightmaps used by progressive generation, one per entry in c_coarseLevelStep.
+		float*												m_coarseHeightmap[2];
+		unsigned int										m_wCoarseHeightmap[2];
+		unsigned int										m_hCoarseHeightmap[2];
 		// width of the heightmap texture.
 		unsigned int										m_wHeightmap;
 		// height of the heighmap texture.
 		unsigned int										m_hHeightmap;
 
 		std::default_random_engine							generator;
+		// seed of generator for the current terrain.
+		uint32												m_seed = 0;
+		TerrainRestoreStatistics							m_restoreStatistics;
 
 		// iterator for tracking iteration of terrain generator.
 		unsigned int										m_iIter = 0;
+		// whether the terrain is generated coarse to fine. m_progressiveActive is latched on reset.
+		bool												m_progressive = true;
+		bool												m_progressiveActive = true;
+		// QPC ticks when generation started, and the time to the first preview in seconds.
+		int64												m_generationStartTicks = 0;
+		double												m_timeToFirstPreview = -1.0;
+		// number of thermal erosion passes run since the last reset, and whether they have converged.
+		unsigned int										m_erosionPasses = 0;
+		bool												m_erosionConverged = false;
+
+		// Number of fault formation iterations used to generate a terrain.
+		const unsigned int c_faultFormationIterations = 500;
+		const unsigned int c_faultTreeDepth = 5;
+		const float c_faultAmplitude = 0.005f;
+		const float c_iirFilter = 0.1f;
+		// Progressive generation levels, coarsest first. Each level runs its share of the fault formation
+		// iterations at 1 / c_coarseLevelStep resolution, batched so each frame costs about as much as one
+		// full resolution iteration. The remaining iterations run at full resolution.
+		// With 100 + 100 iterations at 1/4 and 1/2 resolution the total work is about 0.7x the full resolution path.
+		const unsigned int c_coarseLevelStep[2] = { 4, 2 };
+		const unsigned int c_coarseLevelIterations[2] = { 100, 100 };
+		const unsigned int c_coarseLevelIterationsPerFrame[2] = { 16, 4 };
+		// Thermal erosion settings. Texels are 1cm apart, so a 35 degree talus angle allows
+		// tan(35) * 1cm of height difference between neighbours before material slides.
+		const float c_talusThreshold = 0.0070f;
+		const float c_erosionRate = 0.25f;
+		// Erosion stops once the mean height change per texel for a pass drops below this many meters.
+		const float c_erosionConvergence = 0.000001f;
+		const unsigned int c_erosionPassesPerFrame = 4;
+		const unsigned int c_maxErosionPasses = 200;
+		// Rows per tile when running stencil passes in parallel.
+		const unsigned int c_stencilTileRows = 16;
+		// Size of the copy-on-write snapshot tiles in texels, and the number of snapshots kept for undo.
+		const unsigned int c_snapshotTileSize = 64;
+		const unsigned int c_maxUndoSnapshots = 8;
+		// The batch size from which chunks of c_heightmapSampleChunkSize points are sampled in parallel.
+		const size_t c_parallelSampleThreshold = 16384;
 		// spatial anchor
 		Windows::Perception::Spatial::SpatialAnchor^		m_anchor;
 
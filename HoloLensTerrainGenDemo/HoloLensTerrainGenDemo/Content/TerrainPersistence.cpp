@@ -0,0 +1,90 @@
+#include "pch.h"
+#include "TerrainPersistence.h"
+#include "TerrainSnapshotCodec.h"
+#include <vector>
+
+using namespace HoloLensTerrainGenDemo;
+using namespace Windows::Storage;
+
+const wchar_t* const TerrainPersistence::c_recipeFileName = L"terrain.recipe";
+const wchar_t* const TerrainPersistence::c_snapshotFileName = L"terrain.snapshot";
+const wchar_t* const TerrainPersistence::c_anchorName = L"TerrainAnchor";
+
+namespace {
+	bool WriteAll(Platform::String^ path, const void* data, size_t size) {
+		HANDLE file = CreateFile2(path->Data(), GENERIC_WRITE, 0, CREATE_ALWAYS, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+
+		DWORD written = 0;
+		BOOL result = WriteFile(file, data, (DWORD)size, &written, nullptr);
+		CloseHandle(file);
+
+		return result && written == size;
+	}
+}
+
+Platform::String^ TerrainPersistence::GetLocalPath(const wchar_t* fileName) {
+	return ApplicationData::Current->LocalFolder->Path + L"\\" + ref new Platform::String(fileName);
+}
+
+bool TerrainPersistence::SaveRecipe(Platform::String^ path, const TerrainRecipe& recipe) {
+	TerrainRecipe data = recipe;
+	data.magic = c_recipeMagic;
+	data.version = c_version;
+
+	return WriteAll(path, &data, sizeof(data));
+}
+
+bool TerrainPersistence::LoadRecipe(Platform::String^ path, TerrainRecipe& recipe) {
+	HANDLE file = CreateFile2(path->Data(), GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	DWORD read = 0;
+	BOOL result = ReadFile(file, &recipe, sizeof(recipe), &read, nullptr);
+	CloseHandle(file);
+
+	return result && read == sizeof(recipe) && recipe.magic == c_recipeMagic && recipe.version == c_version &&
+		recipe.width > 0.0f && recipe.height > 0.0f;
+}
+
+bool TerrainPersistence::SaveSnapshot(Platform::String^ path, const float* heightmap, unsigned int w, unsigned int h) {
+	std::vector<uint8_t> data = TerrainSnapshotCodec::Encode(heightmap, w, h);
+	return WriteAll(path, data.data(), data.size());
+}
+
+bool TerrainPersistence::LoadSnapshot(Platform::String^ path, float* heightmap, unsigned int w, unsigned int h) {
+	HANDLE file = CreateFile2(path->Data(), GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	FILE_STANDARD_INFO info = { 0 };
+	if (!GetFileInformationByHandleEx(file, FileStandardInfo, &info, sizeof(info)) || info.EndOfFile.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingFromApp(file, nullptr, PAGE_READONLY, 0, nullptr);
+	const uint8* view = mapping ? reinterpret_cast<const uint8*>(MapViewOfFileFromApp(mapping, FILE_MAP_READ, 0, 0)) : nullptr;
+
+	bool result = false;
+	if (view) {
+		result = TerrainSnapshotCodec::Decode(view, (size_t)info.EndOfFile.QuadPart, heightmap, w, h);
+		UnmapViewOfFile(view);
+	}
+
+	if (mapping) {
+		CloseHandle(mapping);
+	}
+	CloseHandle(file);
+
+	return result;
+}
+
+void TerrainPersistence::Delete(Platform::String^ path) {
+	DeleteFileW(path->Data());
+}
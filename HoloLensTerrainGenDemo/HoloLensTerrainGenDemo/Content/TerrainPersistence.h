@@ -0,0 +1,58 @@
+#pragma once
+#include <DirectXMath.h>
+
+namespace HoloLensTerrainGenDemo {
+	// Everything needed to regenerate a terrain deterministically.
+	// The generator parameters are stored so a recipe written by a build with different settings is not replayed
+	// into a different terrain.
+	struct TerrainRecipe {
+		uint32					magic;
+		uint32					version;
+		// seed for the terrain's random engine.
+		uint32					seed;
+		// dimensions of the terrain in meters.
+		float					height;
+		float					width;
+		// orientation of the terrain as passed to the Terrain constructor.
+		DirectX::XMFLOAT4X4		orientation;
+		// generator parameters.
+		uint32					progressive;
+		uint32					treeDepth;
+		float					faultAmplitude;
+		float					iirFilter;
+		float					talusThreshold;
+		float					erosionRate;
+		// how far generation had progressed.
+		uint32					faultIterations;
+		uint32					erosionPasses;
+		uint32					erosionConverged;
+	};
+
+	// Saves and loads terrains in two formats.
+	// A recipe is a few hundred bytes and is replayed by the generator.
+	// A snapshot stores the finished heightmap compressed by TerrainSnapshotCodec. Snapshots are memory mapped when
+	// loaded and decoded straight into the heightmap.
+	class TerrainPersistence {
+	public:
+		// Returns the full path of fileName in the app's local folder.
+		static Platform::String^ GetLocalPath(const wchar_t* fileName);
+
+		static bool SaveRecipe(Platform::String^ path, const TerrainRecipe& recipe);
+		static bool LoadRecipe(Platform::String^ path, TerrainRecipe& recipe);
+
+		// heightmap holds (w + 1) * (h + 1) heights in meters.
+		static bool SaveSnapshot(Platform::String^ path, const float* heightmap, unsigned int w, unsigned int h);
+		// Fails if the file is missing, damaged or does not match the dimensions. heightmap may be partly written when
+		// it fails, so decode into a buffer that is only used on success.
+		static bool LoadSnapshot(Platform::String^ path, float* heightmap, unsigned int w, unsigned int h);
+
+		// Removes a saved file. Missing files are not an error.
+		static void Delete(Platform::String^ path);
+
+		static const wchar_t* const c_recipeFileName;
+		static const wchar_t* const c_snapshotFileName;
+		static const wchar_t* const c_anchorName;
+		static const uint32 c_recipeMagic = 0x50434552; // 'RECP'
+		static const uint32 c_version = 1;
+	};
+}
@@ -0,0 +1,233 @@
+#include "pch.h"
+#include "TerrainSnapshotCodec.h"
+#include <string.h>
+#include <utility>
+
+using namespace HoloLensTerrainGenDemo;
+
+namespace {
+	struct SnapshotHeader {
+		uint32_t	magic;
+		uint32_t	version;
+		// heightmap dimensions as used by Terrain, the map has (width + 1) * (height + 1) texels.
+		uint32_t	width;
+		uint32_t	height;
+		// meters per quantization step.
+		float		scale;
+		// bytes following the header: one Rice parameter per row, then the bit stream.
+		uint32_t	payloadBytes;
+	};
+
+	// Rice quotients at or above c_maxUnary are escaped and the value is stored in c_rawBits bits instead.
+	// Zigzagged residuals of 16 bit values always fit in 17 bits.
+	const uint32_t c_maxUnary = 24;
+	const uint32_t c_rawBits = 17;
+	const uint32_t c_maxRiceParameter = 16;
+
+	// Median edge detector from LOCO-I. a is the left, b the upper and c the upper left neighbour.
+	inline int32_t PredictMED(int32_t a, int32_t b, int32_t c) {
+		int32_t low = a < b ? a : b;
+		int32_t high = a < b ? b : a;
+		if (c >= high) {
+			return low;
+		}
+		if (c <= low) {
+			return high;
+		}
+		return a + b - c;
+	}
+
+	inline int32_t Predict(const int32_t* row, const int32_t* prevRow, unsigned int x, unsigned int y) {
+		if (y == 0) {
+			return x == 0 ? 0 : row[x - 1];
+		}
+		if (x == 0) {
+			return prevRow[0];
+		}
+		return PredictMED(row[x - 1], prevRow[x], prevRow[x - 1]);
+	}
+
+	inline uint32_t ZigZag(int32_t v) { return (uint32_t(v) << 1) ^ uint32_t(v >> 31); }
+	inline int32_t UnZigZag(uint32_t u) { return int32_t(u >> 1) ^ -int32_t(u & 1); }
+
+	// Writes bits most significant first.
+	class BitWriter {
+	public:
+		BitWriter(std::vector<uint8_t>& out) : m_out(out) {}
+
+		void Write(uint32_t value, uint32_t bits) {
+			m_acc = (m_acc << bits) | value;
+			m_count += bits;
+			while (m_count >= 8) {
+				m_count -= 8;
+				m_out.push_back(uint8_t(m_acc >> m_count));
+			}
+		}
+
+		void WriteRice(uint32_t value, uint32_t k) {
+			uint32_t q = value >> k;
+			if (q < c_maxUnary) {
+				Write((1u << q) - 1, q);
+				Write(0, 1);
+				Write(value & ((1u << k) - 1), k);
+			} else {
+				Write((1u << c_maxUnary) - 1, c_maxUnary);
+				Write(value, c_rawBits);
+			}
+		}
+
+		void Flush() {
+			if (m_count > 0) {
+				m_out.push_back(uint8_t(m_acc << (8 - m_count)));
+				m_count = 0;
+			}
+		}
+
+	private:
+		std::vector<uint8_t>&	m_out;
+		uint64_t				m_acc = 0;
+		uint32_t				m_count = 0;
+	};
+
+	class BitReader {
+	public:
+		BitReader(const uint8_t* data, const uint8_t* end) : m_data(data), m_end(end) {}
+
+		bool Read(uint32_t bits, uint32_t& value) {
+			while (m_count < bits) {
+				if (m_data == m_end) {
+					return false;
+				}
+				m_acc = (m_acc << 8) | *m_data++;
+				m_count += 8;
+			}
+			m_count -= bits;
+			value = uint32_t((m_acc >> m_count) & ((uint64_t(1) << bits) - 1));
+			return true;
+		}
+
+		bool ReadRice(uint32_t k, uint32_t& value) {
+			uint32_t q = 0;
+			uint32_t bit = 1;
+			while (q < c_maxUnary) {
+				if (!Read(1, bit)) {
+					return false;
+				}
+				if (!bit) {
+					break;
+				}
+				++q;
+			}
+
+			if (q == c_maxUnary) {
+				return Read(c_rawBits, value);
+			}
+
+			uint32_t remainder = 0;
+			if (k > 0 && !Read(k, remainder)) {
+				return false;
+			}
+			value = (q << k) | remainder;
+			return true;
+		}
+
+	private:
+		const uint8_t*	m_data;
+		const uint8_t*	m_end;
+		uint64_t		m_acc = 0;
+		uint32_t		m_count = 0;
+	};
+}
+
+std::vector<uint8_t> TerrainSnapshotCodec::Encode(const float* heightmap, unsigned int w, unsigned int h) {
+	const unsigned int pitch = w + 1;
+	const unsigned int rows = h + 1;
+
+	float maxHeight = 0.0f;
+	for (auto i = 0u; i < pitch * rows; ++i) {
+		maxHeight = heightmap[i] > maxHeight ? heightmap[i] : maxHeight;
+	}
+
+	SnapshotHeader header;
+	header.magic = c_magic;
+	header.version = c_version;
+	header.width = w;
+	header.height = h;
+	header.scale = maxHeight > 0.0f ? maxHeight / 65535.0f : 1.0f;
+
+	// the header and row parameters are filled in once the rows are encoded.
+	std::vector<uint8_t> data(sizeof(SnapshotHeader) + rows, 0);
+	BitWriter writer(data);
+
+	std::vector<int32_t> row(pitch), prevRow(pitch);
+	std::vector<uint32_t> residuals(pitch);
+	float invScale = 1.0f / header.scale;
+
+	for (auto y = 0u; y < rows; ++y) {
+		const float* src = heightmap + y * pitch;
+		uint64_t sum = 0;
+		for (auto x = 0u; x < pitch; ++x) {
+			float quantized = src[x] * invScale + 0.5f;
+			row[x] = (int32_t)(quantized < 0.0f ? 0.0f : quantized > 65535.0f ? 65535.0f : quantized);
+			residuals[x] = ZigZag(row[x] - Predict(row.data(), prevRow.data(), x, y));
+			sum += residuals[x];
+		}
+
+		// pick the Rice parameter closest to the mean residual for this row.
+		uint32_t k = 0;
+		while (k < c_maxRiceParameter && (uint64_t(pitch) << (k + 1)) <= sum) {
+			++k;
+		}
+		data[sizeof(SnapshotHeader) + y] = (uint8_t)k;
+
+		for (auto x = 0u; x < pitch; ++x) {
+			writer.WriteRice(residuals[x], k);
+		}
+
+		std::swap(row, prevRow);
+	}
+	writer.Flush();
+
+	header.payloadBytes = (uint32_t)(data.size() - sizeof(SnapshotHeader));
+	memcpy(data.data(), &header, sizeof(header));
+	return data;
+}
+
+bool TerrainSnapshotCodec::Decode(const uint8_t* data, size_t size, float* heightmap, unsigned int w, unsigned int h) {
+	if (size < sizeof(SnapshotHeader)) {
+		return false;
+	}
+
+	SnapshotHeader header;
+	memcpy(&header, data, sizeof(header));
+
+	const unsigned int pitch = w + 1;
+	const unsigned int rows = h + 1;
+	if (header.magic != c_magic || header.version != c_version || header.width != w || header.height != h ||
+		header.payloadBytes < rows || sizeof(SnapshotHeader) + (uint64_t)header.payloadBytes > (uint64_t)size) {
+		return false;
+	}
+
+	const uint8_t* rowParameters = data + sizeof(SnapshotHeader);
+	BitReader reader(rowParameters + rows, data + sizeof(SnapshotHeader) + header.payloadBytes);
+	std::vector<int32_t> row(pitch), prevRow(pitch);
+
+	for (auto y = 0u; y < rows; ++y) {
+		uint32_t k = rowParameters[y];
+		if (k > c_maxRiceParameter) {
+			return false;
+		}
+		float* dst = heightmap + y * pitch;
+		for (auto x = 0u; x < pitch; ++x) {
+			uint32_t residual = 0;
+			if (!reader.ReadRice(k, residual)) {
+				return false;
+			}
+			row[x] = Predict(row.data(), prevRow.data(), x, y) + UnZigZag(residual);
+			dst[x] = (float)row[x] * header.scale;
+		}
+
+		std::swap(row, prevRow);
+	}
+	return true;
+}
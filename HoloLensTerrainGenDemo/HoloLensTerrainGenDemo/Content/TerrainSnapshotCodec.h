@@ -0,0 +1,21 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace HoloLensTerrainGenDemo {
+	// The compressed heightmap format of terrain snapshots, apart from the file they are stored in, so
+	// TerrainSnapshotBenchmark can check and time it on the host.
+	// The heightmap is quantized to 16 bits. Each texel is predicted from its left, upper and upper left neighbours
+	// with the median edge detector, and the residuals are Rice coded with one parameter per row.
+	class TerrainSnapshotCodec {
+	public:
+		// heightmap holds (w + 1) * (h + 1) heights in meters, none of them negative.
+		static std::vector<uint8_t> Encode(const float* heightmap, unsigned int w, unsigned int h);
+		// Fails if data is damaged or does not match the dimensions. heightmap may be partly written when it fails.
+		static bool Decode(const uint8_t* data, size_t size, float* heightmap, unsigned int w, unsigned int h);
+
+		static const uint32_t c_magic = 0x504E5354; // 'TSNP'
+		static const uint32_t c_version = 1;
+	};
+}
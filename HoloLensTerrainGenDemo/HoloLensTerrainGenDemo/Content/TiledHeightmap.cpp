@@ -0,0 +1,116 @@
+#include "pch.h"
+#include "TiledHeightmap.h"
+#include <unordered_set>
+
+using namespace HoloLensTerrainGenDemo;
+
+TiledHeightmap::TiledHeightmap(unsigned int w, unsigned int h, unsigned int tileSize) :
+	m_pitch(w + 1), m_rows(h + 1), m_tileSize(tileSize) {
+	m_tilesX = (m_pitch + tileSize - 1) / tileSize;
+	m_tilesY = (m_rows + tileSize - 1) / tileSize;
+	// nothing has been captured yet, so every tile has to be copied the first time.
+	m_dirty.assign(m_tilesX * m_tilesY, 1);
+	m_base.resize(m_tilesX * m_tilesY);
+}
+
+void TiledHeightmap::MarkDirty(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1) {
+	for (auto ty = y0 / m_tileSize; ty <= min(y1, m_rows - 1) / m_tileSize; ++ty) {
+		for (auto tx = x0 / m_tileSize; tx <= min(x1, m_pitch - 1) / m_tileSize; ++tx) {
+			MarkTileDirty(tx, ty);
+		}
+	}
+}
+
+void TiledHeightmap::MarkAllDirty() {
+	std::fill(m_dirty.begin(), m_dirty.end(), 1);
+}
+
+TiledHeightmap::Snapshot TiledHeightmap::Capture(const float* heightmap) {
+	for (auto ty = 0u; ty < m_tilesY; ++ty) {
+		for (auto tx = 0u; tx < m_tilesX; ++tx) {
+			unsigned int index = tx + ty * m_tilesX;
+			if (!m_dirty[index] && m_base[index]) {
+				continue;
+			}
+
+			// edge tiles are smaller when the heightmap is not a multiple of the tile size.
+			unsigned int x0 = tx * m_tileSize;
+			unsigned int y0 = ty * m_tileSize;
+			unsigned int tileW = min(m_tileSize, m_pitch - x0);
+			unsigned int tileH = min(m_tileSize, m_rows - y0);
+
+			auto tile = std::make_shared<std::vector<float>>(tileW * tileH);
+			for (auto y = 0u; y < tileH; ++y) {
+				memcpy(tile->data() + y * tileW, heightmap + x0 + (y0 + y) * m_pitch, tileW * sizeof(float));
+			}
+
+			m_base[index] = tile;
+			m_dirty[index] = 0;
+		}
+	}
+
+	return m_base;
+}
+
+void TiledHeightmap::Restore(const Snapshot& snapshot, float* heightmap) {
+	if (snapshot.size() != m_base.size()) {
+		return;
+	}
+
+	for (auto ty = 0u; ty < m_tilesY; ++ty) {
+		for (auto tx = 0u; tx < m_tilesX; ++tx) {
+			unsigned int index = tx + ty * m_tilesX;
+			if (!m_dirty[index] && m_base[index] == snapshot[index]) {
+				continue;
+			}
+
+			unsigned int x0 = tx * m_tileSize;
+			unsigned int y0 = ty * m_tileSize;
+			unsigned int tileW = min(m_tileSize, m_pitch - x0);
+			unsigned int tileH = min(m_tileSize, m_rows - y0);
+
+			const float* tile = snapshot[index]->data();
+			for (auto y = 0u; y < tileH; ++y) {
+				memcpy(heightmap + x0 + (y0 + y) * m_pitch, tile + y * tileW, tileW * sizeof(float));
+			}
+
+			m_base[index] = snapshot[index];
+			m_dirty[index] = 0;
+		}
+	}
+}
+
+std::vector<unsigned int> TiledHeightmap::Diff(const Snapshot& a, const Snapshot& b) {
+	std::vector<unsigned int> tiles;
+	if (a.size() != b.size()) {
+		return tiles;
+	}
+
+	for (auto i = 0u; i < a.size(); ++i) {
+		if (a[i] == b[i]) {
+			continue;
+		}
+
+		// a tile may have been copied without its heights changing.
+		if (!a[i] || !b[i] || *a[i] != *b[i]) {
+			tiles.push_back(i);
+		}
+	}
+
+	return tiles;
+}
+
+size_t TiledHeightmap::GetMemoryUsage(const std::vector<const Snapshot*>& snapshots) {
+	std::unordered_set<const std::vector<float>*> counted;
+	size_t bytes = 0;
+
+	for (auto snapshot : snapshots) {
+		for (auto& tile : *snapshot) {
+			if (tile && counted.insert(tile.get()).second) {
+				bytes += tile->size() * sizeof(float);
+			}
+		}
+	}
+
+	return bytes;
+}
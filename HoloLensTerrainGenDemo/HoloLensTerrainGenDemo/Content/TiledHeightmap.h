@@ -0,0 +1,53 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+namespace HoloLensTerrainGenDemo {
+	// Copy-on-write snapshots of a heightmap split into square tiles.
+	// The working heightmap stays a flat array since that is what the generator and the texture upload work on.
+	// Whatever modifies it marks the tiles it touched as dirty. Capturing a snapshot copies only the dirty tiles and
+	// shares every other tile with the previous snapshot, so memory grows with the tiles that changed between
+	// snapshots rather than with the number of snapshots.
+	class TiledHeightmap {
+	public:
+		typedef std::shared_ptr<const std::vector<float>> Tile;
+		// Copying a snapshot only copies the tile pointers.
+		typedef std::vector<Tile> Snapshot;
+
+		// provide w and h as used by Terrain, the heightmap has (w + 1) * (h + 1) texels.
+		TiledHeightmap(unsigned int w, unsigned int h, unsigned int tileSize);
+
+		// Marks the tiles overlapping the texels from (x0, y0) to (x1, y1), inclusive, as modified.
+		void MarkDirty(unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1);
+		void MarkTileDirty(unsigned int tileX, unsigned int tileY) { m_dirty[tileX + tileY * m_tilesX] = 1; }
+		void MarkAllDirty();
+
+		// Captures heightmap. Dirty tiles are copied, the others are shared with the last snapshot captured or restored.
+		Snapshot Capture(const float* heightmap);
+		// Writes snapshot into heightmap. Only tiles that are dirty or differ from the last snapshot captured or
+		// restored are copied.
+		void Restore(const Snapshot& snapshot, float* heightmap);
+
+		// Returns the indices of the tiles whose heights differ between a and b. Shared tiles are skipped without
+		// comparing their texels.
+		static std::vector<unsigned int> Diff(const Snapshot& a, const Snapshot& b);
+		// Returns the bytes held by the distinct tiles of the given snapshots.
+		static size_t GetMemoryUsage(const std::vector<const Snapshot*>& snapshots);
+
+		unsigned int GetTileSize() { return m_tileSize; }
+		unsigned int GetTilesX() { return m_tilesX; }
+		unsigned int GetTilesY() { return m_tilesY; }
+
+	private:
+		// texels per row and rows of the heightmap.
+		unsigned int			m_pitch;
+		unsigned int			m_rows;
+		unsigned int			m_tileSize;
+		unsigned int			m_tilesX;
+		unsigned int			m_tilesY;
+		// one flag per tile, set when the heightmap no longer matches m_base for that tile.
+		std::vector<uint8>		m_dirty;
+		// the snapshot the heightmap matched when it was last captured or restored.
+		Snapshot				m_base;
+	};
+}
@@ -35,9 +35,22 @@ void HoloLensTerrainGenDemoMain::SetHolographicSpace(HolographicSpace^ holograph
 
 	m_terrain = nullptr;
 	m_surfaceObserver = nullptr;
+	// finish any plane update still using the old renderers before replacing them.
+	m_planeUpdates = nullptr;
 	m_meshRenderer = std::make_unique<RealtimeSurfaceMeshRenderer>(m_deviceResources);
 	m_planeRenderer = std::make_unique<SurfacePlaneRenderer>(m_deviceResources);
 
+	// finding planes is quite slow, so it is done in the background. Surface changes that arrive while it runs
+	// cancel it, and it stops before merging; a single update then covers them all.
+	m_planeUpdates = std::make_unique<PlaneUpdateScheduler>([this](SpatialCoordinateSystem^ coordinateSystem, const cancellation_token& token) {
+		std::vector<PlaneFinding::MergedPlane> planes;
+		if (!m_meshRenderer->GetPlanes(coordinateSystem, planes, token)) {
+			return false;
+		}
+		m_planeRenderer->UpdatePlanes(planes, coordinateSystem);
+		return true;
+	});
+
 	// Initialize the GUI
 	m_guiManager = std::make_unique<GUIManager>();
 
@@ -210,6 +223,24 @@ HolographicFrame^ HoloLensTerrainGenDemoMain::Update() {
 		m_surfaceObserver->SetBoundingVolume(bounds);
 	}
 
+	// plane updates run in this frame's coordinate system.
+	m_planeUpdates->SetCoordinateSystem(currentCoordinateSystem);
+
+	// surfaces are captured relative to the coordinate system of the frame the capture started in. A capture whose
+	// file could not be written to is stopped, rather than started again over the records it did write.
+	if (m_meshRenderer->HasCaptureFailed()) {
+		m_meshRenderer->StopCapture();
+		m_guiManager->SetCaptureSurfaces(false);
+	}
+	if (m_guiManager->GetCaptureSurfaces() != m_meshRenderer->IsCapturing()) {
+		if (!m_guiManager->GetCaptureSurfaces()) {
+			m_meshRenderer->StopCapture();
+		}
+		else if (!m_meshRenderer->StartCapture(TerrainPersistence::GetLocalPath(SurfaceCaptureWriter::c_fileName), currentCoordinateSystem)) {
+			m_guiManager->SetCaptureSurfaces(false);
+		}
+	}
+
     m_timer.Tick([&] () {
         // Put time-based updates here. By default this code will run once per frame,
         // but if you change the StepTimer to use a fixed time step this code will
@@ -223,6 +254,22 @@ HolographicFrame^ HoloLensTerrainGenDemoMain::Update() {
     });
 
 	
+	// restore a saved terrain once its anchor has been loaded.
+	SpatialAnchor^ savedTerrainAnchor = nullptr;
+	{
+		std::lock_guard<std::mutex> guard(m_savedTerrainLock);
+		savedTerrainAnchor = m_savedTerrainAnchor;
+		m_savedTerrainAnchor = nullptr;
+	}
+
+	if (!m_terrain && savedTerrainAnchor) {
+		TerrainRecipe recipe;
+		if (TerrainPersistence::LoadRecipe(TerrainPersistence::GetLocalPath(TerrainPersistence::c_recipeFileName), recipe)) {
+			m_terrain = std::make_unique<Terrain>(m_deviceResources, savedTerrainAnchor, recipe,
+				TerrainPersistence::GetLocalPath(TerrainPersistence::c_snapshotFileName));
+		}
+	}
+
 	// if we haven't generated a terrain yet, check if we have recently
 	// tapped on a surface plane;
 	if (!m_terrain && m_planeRenderer->WasTappedRecently()) {
@@ -247,8 +294,10 @@ HolographicFrame^ HoloLensTerrainGenDemoMain::Update() {
         // since that is the only hologram available for the user to focus on.
         // You can also set the relative velocity and facing of that content; the sample
         // hologram is at a fixed point so we only need to indicate its position.
-		if (m_terrain) {
-			renderingParameters->SetFocusPoint(currentCoordinateSystem, m_terrain->GetPosition());
+		// The focus point is on the terrain's surface at its center, facing the way the surface does there.
+		float3 focusPosition, focusNormal;
+		if (m_terrain && m_terrain->GetSurfaceCenter(currentCoordinateSystem, focusPosition, focusNormal)) {
+			renderingParameters->SetFocusPoint(currentCoordinateSystem, focusPosition, focusNormal);
 		}
     }
 
@@ -344,22 +393,61 @@ bool HoloLensTerrainGenDemoMain::Render(HolographicFrame^ holographicFrame) {
     });
 }
 
-void HoloLensTerrainGenDemoMain::SaveAppState() {
-    //
-    // TODO: Insert code here to save your app state.
-    //       This method is called when the app is about to suspend.
-    //
-    //       For example, store information in the SpatialAnchorStore.
-    //
+// Saves the terrain as a recipe, and as a snapshot once generation has finished, along with its anchor.
+// This is called from the suspending handler on the thread that updates the terrain, so the terrain is copied here
+// and the files and the anchor are written by the returned task, without blocking on the anchor store. The anchor is
+// stored on a background thread too, rather than back on the frame thread.
+task<void> HoloLensTerrainGenDemoMain::SaveAppState() {
+	if (!m_terrain) {
+		return task_from_result();
+	}
+
+	TerrainRecipe recipe = m_terrain->GetRecipe();
+	SpatialAnchor^ anchor = m_terrain->GetAnchor();
+	// a snapshot of an unfinished terrain can't continue generating, so leave those to the recipe.
+	auto heightmap = std::make_shared<std::vector<float>>();
+	unsigned int w = 0;
+	unsigned int h = 0;
+	if (m_terrain->IsGenerationComplete()) {
+		m_terrain->CopyHeightmap(*heightmap, w, h);
+	}
+
+	return create_task([recipe, heightmap, w, h]() {
+		TerrainPersistence::SaveRecipe(TerrainPersistence::GetLocalPath(TerrainPersistence::c_recipeFileName), recipe);
+
+		String^ snapshotPath = TerrainPersistence::GetLocalPath(TerrainPersistence::c_snapshotFileName);
+		if (heightmap->empty() || !TerrainPersistence::SaveSnapshot(snapshotPath, heightmap->data(), w, h)) {
+			TerrainPersistence::Delete(snapshotPath);
+		}
+	}).then([]() {
+		return SpatialAnchorManager::RequestStoreAsync();
+	}).then([anchor](SpatialAnchorStore^ store) {
+		if (store) {
+			String^ anchorName = ref new String(TerrainPersistence::c_anchorName);
+			store->Remove(anchorName);
+			store->TrySave(anchorName, anchor);
+		}
+	}, task_continuation_context::use_arbitrary());
 }
 
+// Looks up the anchor of a saved terrain. The terrain itself is restored in Update.
 void HoloLensTerrainGenDemoMain::LoadAppState() {
-    //
-    // TODO: Insert code here to load your app state.
-    //       This method is called when the app resumes.
-    //
-    //       For example, load information from the SpatialAnchorStore.
-    //
+	if (m_terrain) {
+		return;
+	}
+
+	create_task(SpatialAnchorManager::RequestStoreAsync()).then([this](SpatialAnchorStore^ store) {
+		if (!store) {
+			return;
+		}
+
+		String^ anchorName = ref new String(TerrainPersistence::c_anchorName);
+		auto anchors = store->GetAllSavedAnchors();
+		if (anchors->HasKey(anchorName)) {
+			std::lock_guard<std::mutex> guard(m_savedTerrainLock);
+			m_savedTerrainAnchor = anchors->Lookup(anchorName);
+		}
+	});
 }
 
 // Notifies classes that use Direct3D device resources that the device resources
@@ -497,21 +585,8 @@ void HoloLensTerrainGenDemoMain::OnSurfacesChanged(SpatialSurfaceObserver^ sende
 	// they will no longer be hidden.
 	m_meshRenderer->HideInactiveMeshes(surfaceCollection);
 
-	// The HolographicFrame has information that the app needs in order
-	// to update and render the current frame. The app begins each new
-	// frame by calling CreateNextFrame.
-	HolographicFrame^ holographicFrame = m_holographicSpace->CreateNextFrame();
-
-	// Get a prediction of where holographic cameras will be when this frame
-	// is presented.
-	HolographicFramePrediction^ prediction = holographicFrame->CurrentPrediction;
-	SpatialCoordinateSystem^ currentCoordinateSystem = m_referenceFrame->GetStationaryCoordinateSystemAtTimestamp(prediction->Timestamp);
-	// use it to find all surface planes and pass them to the planeRenderer.
-	// this is quite slow, so it is done asynchronously.
-	auto getPlanesTask = create_task([this, currentCoordinateSystem] {
-		auto planes = m_meshRenderer->GetPlanes(currentCoordinateSystem);
-		m_planeRenderer->UpdatePlanes(planes, currentCoordinateSystem);
-	});
+	// find all surface planes again and pass them to the planeRenderer.
+	m_planeUpdates->RequestUpdate();
 }
 
 void HoloLensTerrainGenDemoMain::OnInteractionDetected(SpatialInteractionManager^ sender, SpatialInteractionDetectedEventArgs^ args) {
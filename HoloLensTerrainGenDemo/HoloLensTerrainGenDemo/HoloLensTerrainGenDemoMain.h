@@ -6,6 +6,8 @@
 #include "Content\Terrain.h"
 #include "Content\RealtimeSurfaceMeshRenderer.h"
 #include "Content\SurfacePlaneRenderer.h"
+#include "Content\PlaneUpdateScheduler.h"
+#include <ppltasks.h>
 
 // Updates, renders, and presents holographic content using Direct3D.
 namespace HoloLensTerrainGenDemo {
@@ -25,7 +27,9 @@ namespace HoloLensTerrainGenDemo {
         bool Render(Windows::Graphics::Holographic::HolographicFrame^ holographicFrame);
 
         // Handle saving and loading of app state owned by AppMain.
-        void SaveAppState();
+        // SaveAppState copies the state on the calling thread, which has to be the one that calls Update, and
+        // returns a task that writes it out.
+        concurrency::task<void> SaveAppState();
         void LoadAppState();
 
         // IDeviceNotify
@@ -109,5 +113,13 @@ namespace HoloLensTerrainGenDemo {
 
 		// A data handler for surface planes.
 		std::unique_ptr<SurfacePlaneRenderer> m_planeRenderer;
+
+		// Recomputes the surface planes after surface changes. Declared after the renderers its job uses, so it is
+		// destroyed, and its job finished, before they are.
+		std::unique_ptr<PlaneUpdateScheduler> m_planeUpdates;
+
+		// Anchor of a saved terrain. Set once the anchor store has been read, the terrain is restored on the next Update.
+		Windows::Perception::Spatial::SpatialAnchor^						m_savedTerrainAnchor;
+		std::mutex															m_savedTerrainLock;
     };
 }
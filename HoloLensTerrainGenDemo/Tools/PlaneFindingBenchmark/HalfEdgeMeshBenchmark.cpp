@@ -0,0 +1,450 @@
+// Checks and benchmarks the twin lookup and the edge pool of HalfEdgeMesh against a reference that pairs half-edges
+// by walking each vertex's edge list only, the way HalfEdgeMesh did before high valence vertices were hashed.
+//
+//   check      random meshes are built, then grown and shrunk with AddTriangle and RemoveNewEdges, in HalfEdgeMesh
+//              and in the reference. Most go through a few hub vertices, so vertices cross the hashing threshold both
+//              ways, and some triangles repeat edges, as non-manifold spatial meshes do. After every step each edge
+//              must have the same twin as in the reference, AddTriangle must report the same non-manifold triangles,
+//              and every vertex must list its edges in the same order.
+//   benchmark  grids, the shape of most spatial-mapping surfaces, and fans around one high valence hub are built,
+//              and batches of triangles are added around the hub and removed again, as mesh simplification does.
+//
+// Usage: HalfEdgeMeshBenchmark [options]
+//
+//   --meshes <n>    random meshes to check, default 2000
+//   --repeat <n>    runs per benchmark mesh, default 5; times are from the fastest run
+//
+// Built by Tools/CMakeLists.txt. Build with PLANEFINDING_SANITIZE=address to have AddressSanitizer check the edge
+// pool as well. Exits with 1 if HalfEdgeMesh and the reference disagree.
+
+#include "common.h"
+#include "pch.h"
+#include "HalfEdgeMesh.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <unordered_map>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+    typedef HalfEdgeMesh::TriangleINT32 Triangle;
+
+    double MillisecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // Pairs half-edges as HalfEdgeMesh does, but always by walking the start vertex's edge list. Edges are indices
+    // into one vector: the constructor's edges first, in triangle order, then added ones, reusing removed slots.
+    class ListWalkMesh
+    {
+    public:
+        struct Edge
+        {
+            int32_t start;
+            int32_t end;
+            int32_t nextVertexEdge;
+            int32_t pair;
+        };
+
+        ListWalkMesh(uint32_t numVertices, const vector<Triangle>& triangles) :
+            m_heads(numVertices, -1)
+        {
+            m_edges.resize(triangles.size() * VERTICES_PER_TRIANGLE);
+            for (uint32_t i = 0; i < triangles.size(); ++i)
+            {
+                AddTriangle(triangles[i], i * VERTICES_PER_TRIANGLE);
+            }
+        }
+
+        bool AddNewTriangle(const Triangle& triangle)
+        {
+            int32_t first;
+            if (m_freeTriangles.empty())
+            {
+                first = static_cast<int32_t>(m_edges.size());
+                m_edges.resize(m_edges.size() + VERTICES_PER_TRIANGLE);
+            }
+            else
+            {
+                first = m_freeTriangles.back();
+                m_freeTriangles.pop_back();
+            }
+            for (int32_t i = 0; i < VERTICES_PER_TRIANGLE; ++i)
+            {
+                m_newEdges.push_back(first + i);
+            }
+            return AddTriangle(triangle, first);
+        }
+
+        // Removes the added edges [startOffset, endOffset), which must be whole triangles.
+        void RemoveNewEdges(uint32_t startOffset, uint32_t endOffset)
+        {
+            for (uint32_t i = startOffset; i < endOffset; ++i)
+            {
+                Edge& edge = m_edges[m_newEdges[i]];
+                if (edge.pair != -1)
+                {
+                    m_edges[edge.pair].pair = -1;
+                }
+
+                int32_t* link = &m_heads[edge.start];
+                while (*link != m_newEdges[i])
+                {
+                    link = &m_edges[*link].nextVertexEdge;
+                }
+                *link = edge.nextVertexEdge;
+
+                if (i % VERTICES_PER_TRIANGLE == 0)
+                {
+                    m_freeTriangles.push_back(m_newEdges[i]);
+                }
+            }
+            m_newEdges.erase(m_newEdges.begin() + startOffset, m_newEdges.begin() + endOffset);
+        }
+
+        const vector<Edge>& Edges() const         { return m_edges;    }
+        const vector<int32_t>& NewEdges() const   { return m_newEdges; }
+        int32_t FirstEdge(uint32_t vertex) const  { return m_heads[vertex]; }
+
+    private:
+        int32_t FindEdge(int32_t start, int32_t end) const
+        {
+            for (int32_t edge = m_heads[start]; edge != -1; edge = m_edges[edge].nextVertexEdge)
+            {
+                if (m_edges[edge].end == end)
+                {
+                    return edge;
+                }
+            }
+            return -1;
+        }
+
+        void LinkEdge(int32_t start, int32_t edge)
+        {
+            if (m_heads[start] != -1)
+            {
+                m_edges[edge].nextVertexEdge = m_edges[m_heads[start]].nextVertexEdge;
+                m_edges[m_heads[start]].nextVertexEdge = edge;
+            }
+            else
+            {
+                m_heads[start] = edge;
+            }
+        }
+
+        bool AddTriangle(const Triangle& triangle, int32_t first)
+        {
+            bool nonManifold = false;
+            for (int32_t i = 0; i < VERTICES_PER_TRIANGLE; ++i)
+            {
+                Edge& edge = m_edges[first + i];
+                edge = { triangle[i], triangle[(i + 1) % VERTICES_PER_TRIANGLE], -1, -1 };
+                int32_t pair = FindEdge(edge.end, edge.start);
+                if (pair != -1 && m_edges[pair].pair == -1)
+                {
+                    edge.pair = pair;
+                    m_edges[pair].pair = first + i;
+                }
+                else if (pair != -1)
+                {
+                    nonManifold = true;
+                }
+            }
+            for (int32_t i = 0; i < VERTICES_PER_TRIANGLE; ++i)
+            {
+                LinkEdge(triangle[i], first + i);
+            }
+            return !nonManifold;
+        }
+
+        vector<Edge> m_edges;
+        vector<int32_t> m_heads;
+        vector<int32_t> m_newEdges;
+        vector<int32_t> m_freeTriangles;
+    };
+
+    // Compares the twins and the vertex edge lists of the two meshes; returns what differs, or nullptr.
+    const char* CompareMeshes(const HalfEdgeMesh& mesh, const ListWalkMesh& reference)
+    {
+        std::unordered_map<const HalfEdgeMesh::Edge*, int32_t> ids;
+        ids[nullptr] = -1;
+        for (uint32_t i = 0; i < mesh.m_spEdges.size(); ++i)
+        {
+            ids[&mesh.m_spEdges[i]] = i;
+        }
+        if (mesh.m_spNewEdges.size() != reference.NewEdges().size())
+        {
+            return "different numbers of added edges";
+        }
+        for (uint32_t i = 0; i < mesh.m_spNewEdges.size(); ++i)
+        {
+            ids[mesh.m_spNewEdges[i]] = reference.NewEdges()[i];
+        }
+
+        for (const auto& pair : ids)
+        {
+            if (pair.first == nullptr)
+            {
+                continue;
+            }
+            const ListWalkMesh::Edge& expected = reference.Edges()[pair.second];
+            if (pair.first->vertex != expected.start || pair.first->next->vertex != expected.end)
+            {
+                return "an edge joins other vertices";
+            }
+            auto twin = ids.find(pair.first->pair);
+            if (twin == ids.end() || twin->second != expected.pair)
+            {
+                return "an edge has another twin";
+            }
+        }
+
+        for (uint32_t vertex = 0; vertex < mesh.m_spVertices.size(); ++vertex)
+        {
+            int32_t expected = reference.FirstEdge(vertex);
+            for (const HalfEdgeMesh::Edge* edge = mesh.m_spVertices[vertex]; edge != nullptr; edge = edge->nextVertexEdge)
+            {
+                auto id = ids.find(edge);
+                if (id == ids.end() || id->second != expected)
+                {
+                    return "a vertex lists its edges in another order";
+                }
+                expected = reference.Edges()[expected].nextVertexEdge;
+            }
+            if (expected != -1)
+            {
+                return "a vertex lists fewer edges";
+            }
+        }
+        return nullptr;
+    }
+
+    Triangle RandomTriangle(std::mt19937& random, uint32_t vertexCount, uint32_t hubCount)
+    {
+        Triangle triangle;
+        do
+        {
+            // most triangles go through a hub, so hubs cross the hashing threshold
+            triangle[0] = random() % 4 != 0 ? random() % hubCount : random() % vertexCount;
+            triangle[1] = random() % vertexCount;
+            triangle[2] = random() % vertexCount;
+        } while (triangle[0] == triangle[1] || triangle[1] == triangle[2] || triangle[2] == triangle[0]);
+        return triangle;
+    }
+
+    const char* CheckRandomMesh(std::mt19937& random)
+    {
+        uint32_t vertexCount = 4 + random() % 60;
+        uint32_t hubCount = 1 + random() % 3;
+        vector<Triangle> triangles(random() % 40);
+        for (Triangle& triangle : triangles)
+        {
+            triangle = RandomTriangle(random, vertexCount, hubCount);
+        }
+
+        HalfEdgeMesh mesh(vertexCount, static_cast<uint32_t>(triangles.size() * VERTICES_PER_TRIANGLE), triangles.data());
+        ListWalkMesh reference(vertexCount, triangles);
+        const char* difference = CompareMeshes(mesh, reference);
+
+        for (uint32_t step = 0; step < 40 && difference == nullptr; ++step)
+        {
+            if (random() % 3 != 0 || mesh.m_spNewEdges.empty())
+            {
+                for (uint32_t i = 1 + random() % 24; i > 0; --i)
+                {
+                    Triangle triangle = RandomTriangle(random, vertexCount, hubCount);
+                    HalfEdgeMesh::Edge* added;
+                    if (mesh.AddTriangle(triangle, &added) != reference.AddNewTriangle(triangle))
+                    {
+                        return "AddTriangle disagrees on a non-manifold triangle";
+                    }
+                }
+            }
+            else
+            {
+                // whole triangles, from anywhere in the added edges
+                uint32_t addedTriangles = static_cast<uint32_t>(mesh.m_spNewEdges.size() / VERTICES_PER_TRIANGLE);
+                uint32_t first = random() % addedTriangles;
+                uint32_t last = first + 1 + random() % (addedTriangles - first);
+                mesh.RemoveNewEdges(first * VERTICES_PER_TRIANGLE, last * VERTICES_PER_TRIANGLE);
+                reference.RemoveNewEdges(first * VERTICES_PER_TRIANGLE, last * VERTICES_PER_TRIANGLE);
+            }
+            difference = CompareMeshes(mesh, reference);
+        }
+        return difference;
+    }
+
+    vector<Triangle> Grid(uint32_t size)
+    {
+        vector<Triangle> triangles;
+        for (uint32_t y = 0; y + 1 < size; ++y)
+        {
+            for (uint32_t x = 0; x + 1 < size; ++x)
+            {
+                int32_t a = y * size + x, b = a + 1, c = a + size, d = c + 1;
+                triangles.push_back({ a, c, b });
+                triangles.push_back({ b, c, d });
+            }
+        }
+        return triangles;
+    }
+
+    vector<Triangle> Fan(uint32_t vertexCount)
+    {
+        vector<Triangle> triangles;
+        for (int32_t i = 1; i + 1 < static_cast<int32_t>(vertexCount); ++i)
+        {
+            triangles.push_back({ 0, i, i + 1 });
+        }
+        return triangles;
+    }
+
+    template <typename Mesh>
+    double TimeBuild(uint32_t vertexCount, const vector<Triangle>& triangles, uint32_t runs);
+
+    template <>
+    double TimeBuild<HalfEdgeMesh>(uint32_t vertexCount, const vector<Triangle>& triangles, uint32_t runs)
+    {
+        double fastest = 1e30;
+        for (uint32_t run = 0; run < runs; ++run)
+        {
+            Clock::time_point start = Clock::now();
+            HalfEdgeMesh mesh(vertexCount, static_cast<uint32_t>(triangles.size() * VERTICES_PER_TRIANGLE), triangles.data());
+            fastest = min(fastest, MillisecondsSince(start));
+        }
+        return fastest;
+    }
+
+    template <>
+    double TimeBuild<ListWalkMesh>(uint32_t vertexCount, const vector<Triangle>& triangles, uint32_t runs)
+    {
+        double fastest = 1e30;
+        for (uint32_t run = 0; run < runs; ++run)
+        {
+            Clock::time_point start = Clock::now();
+            ListWalkMesh mesh(vertexCount, triangles);
+            fastest = min(fastest, MillisecondsSince(start));
+        }
+        return fastest;
+    }
+
+    const uint32_t cChurnTriangles = 64;
+
+    // Adds cycles batches of cChurnTriangles triangles around the hub of a fan of fanVertices vertices, each batch a
+    // second fan over the spare vertices that follow, and removes each batch again.
+    template <typename Mesh>
+    double TimeChurn(Mesh& mesh, uint32_t fanVertices, uint32_t cycles, bool (*add)(Mesh&, const Triangle&), uint32_t (*added)(const Mesh&))
+    {
+        Clock::time_point start = Clock::now();
+        for (uint32_t cycle = 0; cycle < cycles; ++cycle)
+        {
+            uint32_t first = added(mesh);
+            for (int32_t i = 0; i < static_cast<int32_t>(cChurnTriangles); ++i)
+            {
+                int32_t rim = fanVertices + i;
+                add(mesh, { 0, rim, rim + 1 });
+            }
+            mesh.RemoveNewEdges(first, added(mesh));
+        }
+        return MillisecondsSince(start);
+    }
+
+    bool AddToMesh(HalfEdgeMesh& mesh, const Triangle& triangle)
+    {
+        HalfEdgeMesh::Edge* added;
+        return mesh.AddTriangle(triangle, &added);
+    }
+
+    uint32_t AddedToMesh(const HalfEdgeMesh& mesh)
+    {
+        return static_cast<uint32_t>(mesh.m_spNewEdges.size());
+    }
+
+    bool AddToReference(ListWalkMesh& mesh, const Triangle& triangle)
+    {
+        return mesh.AddNewTriangle(triangle);
+    }
+
+    uint32_t AddedToReference(const ListWalkMesh& mesh)
+    {
+        return static_cast<uint32_t>(mesh.NewEdges().size());
+    }
+
+    bool ParseArgument(int argc, char** argv, int& i, const char* name, double& value)
+    {
+        if (strcmp(argv[i], name) != 0 || i + 1 >= argc)
+        {
+            return false;
+        }
+        value = atof(argv[++i]);
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double meshes = 2000.0;
+    double repeat = 5.0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!ParseArgument(argc, argv, i, "--meshes", meshes) &&
+            !ParseArgument(argc, argv, i, "--repeat", repeat))
+        {
+            fprintf(stderr, "%s: unknown option %s; see the top of HalfEdgeMeshBenchmark.cpp\n", argv[0], argv[i]);
+            return 2;
+        }
+    }
+
+    uint32_t meshCount = static_cast<uint32_t>(meshes);
+    uint32_t runs = max(1u, static_cast<uint32_t>(repeat));
+
+    std::mt19937 random(1);
+    for (uint32_t i = 0; i < meshCount; ++i)
+    {
+        const char* difference = CheckRandomMesh(random);
+        if (difference != nullptr)
+        {
+            fprintf(stderr, "check failed: %s (mesh %u)\n", difference, i);
+            printf("FAILED\n");
+            return 1;
+        }
+    }
+    printf("check: %u random meshes match the reference\n\n", meshCount);
+
+    printf("%-22s %12s %14s %9s\n", "mesh", "hashed ms", "list walk ms", "speedup");
+    for (uint32_t size : { 40u, 150u, 600u })
+    {
+        vector<Triangle> triangles = Grid(size);
+        double hashed = TimeBuild<HalfEdgeMesh>(size * size, triangles, runs);
+        double listWalk = TimeBuild<ListWalkMesh>(size * size, triangles, runs);
+        printf("build grid %4ux%-4u      %12.3f %14.3f %8.1fx\n", size, size, hashed, listWalk, listWalk / max(hashed, 1e-6));
+    }
+    for (uint32_t valence : { 100u, 1000u, 5000u })
+    {
+        vector<Triangle> triangles = Fan(valence);
+        double hashed = TimeBuild<HalfEdgeMesh>(valence, triangles, runs);
+        double listWalk = TimeBuild<ListWalkMesh>(valence, triangles, runs);
+        printf("build fan %-5u          %12.3f %14.3f %8.1fx\n", valence, hashed, listWalk, listWalk / max(hashed, 1e-6));
+    }
+    for (uint32_t valence : { 100u, 1000u, 5000u })
+    {
+        vector<Triangle> triangles = Fan(valence);
+        uint32_t vertexCount = valence + cChurnTriangles + 1;
+        HalfEdgeMesh mesh(vertexCount, static_cast<uint32_t>(triangles.size() * VERTICES_PER_TRIANGLE), triangles.data());
+        ListWalkMesh reference(vertexCount, triangles);
+        double hashed = 1e30, listWalk = 1e30;
+        for (uint32_t run = 0; run < runs; ++run)
+        {
+            hashed = min(hashed, TimeChurn<HalfEdgeMesh>(mesh, valence, 100, AddToMesh, AddedToMesh));
+            listWalk = min(listWalk, TimeChurn<ListWalkMesh>(reference, valence, 100, AddToReference, AddedToReference));
+        }
+        printf("add/remove fan %-5u     %12.3f %14.3f %8.1fx\n", valence, hashed, listWalk, listWalk / max(hashed, 1e-6));
+    }
+    return 0;
+}
@@ -0,0 +1,297 @@
+// Benchmarks the broadphase MergePlanes uses to find neighboring sub-planes (ForEachNeighborPair, see Util.h) against
+// testing every pair with AreNeighbors, and checks that both find the same pairs in the same order.
+//
+// It also fills a PlaneMap with the same sub-planes, ten to a source, then replaces the sub-planes of one source in ten
+// with others and removes as many sources. After each step the merged planes of the map must be those MergePlanes
+// gives for the sub-planes the map holds: as many, with the same areas. It prints the time the map took per source
+// set, which its own broadphase keeps from growing with the number of sub-planes.
+//
+// Last, it puts all the sub-planes in one source, as the RANSAC engine does, and sets them again with one in ten
+// replaced. Only the replaced sub-planes may be removed and inserted, and the merged planes must again match MergePlanes.
+//
+// The sub-planes are random, shaped like those of a scanned room: three in four have a normal near one of the axes,
+// like floors and walls, the rest point anywhere. They are boxes 0.2 to 1 m across, one in fifty much longer, spread
+// through a cube that grows with their number so the density stays about the same. Counts step by a factor of 10.
+//
+// Usage: MergeBroadphaseBenchmark [options]
+//
+//   --min-planes <n>   default 100
+//   --max-planes <n>   default 10000
+//   --repeat <n>       runs per count, default 3; times are from the fastest run
+//   --seed <n>         default 1
+//
+// Built by Tools/CMakeLists.txt. Exits with 1 if the broadphase and the all pairs test disagree anywhere, or the plane
+// map and MergePlanes do.
+
+#include "common.h"
+#include "pch.h"
+#include "PlaneFinding.h"
+#include "PlaneMap.h"
+#include "Util.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+using namespace DirectX;
+using namespace PlaneFinding;
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    double MillisecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    vector<BoundedPlane> GenerateSubPlanes(UINT32 count, UINT32 seed)
+    {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> signedUnit(-1.0f, 1.0f);
+        const float roomSize = 2.0f * powf(count / 100.0f, 1.0f / 3.0f);
+
+        vector<BoundedPlane> planes(count);
+        for (BoundedPlane& plane : planes)
+        {
+            XMFLOAT3 normal;
+            switch (random() % 4)
+            {
+            case 0: normal = XMFLOAT3(0.0f, 1.0f, 0.0f); break;
+            case 1: normal = XMFLOAT3(1.0f, 0.0f, 0.0f); break;
+            case 2: normal = XMFLOAT3(0.0f, 0.0f, 1.0f); break;
+            default: normal = XMFLOAT3(signedUnit(random), signedUnit(random), signedUnit(random)); break;
+            }
+            XMVECTOR noise = XMVectorSet(signedUnit(random), signedUnit(random), signedUnit(random), 0.0f) * 0.15f;
+            XMStoreFloat3(&normal, XMVector3Normalize(XMLoadFloat3(&normal) + noise));
+            plane.plane = Plane(normal, signedUnit(random));
+            plane.plane.surface = UNKNOWN;
+
+            XMVECTOR orientation = XMVector4Normalize(XMVectorSet(signedUnit(random), signedUnit(random), signedUnit(random), signedUnit(random)));
+            bool isLong = random() % 50 == 0;
+            plane.bounds.Center = XMFLOAT3(signedUnit(random) * roomSize, signedUnit(random) * roomSize, signedUnit(random) * roomSize);
+            plane.bounds.Extents = XMFLOAT3(0.2f + fabsf(signedUnit(random)) * (isLong ? roomSize : 0.8f), 0.2f + fabsf(signedUnit(random)), 0.01f);
+            XMStoreFloat4(&plane.bounds.Orientation, orientation);
+            plane.area = 1.0f;
+        }
+        return planes;
+    }
+
+    const UINT32 cSubPlanesPerSource = 10;
+    const UINT32 cSingleSourceSets = 5;
+
+    // The areas of merged planes, in increasing order, so two sets can be compared without regard to order.
+    vector<float> SortedAreas(const vector<BoundedPlane>& planes)
+    {
+        vector<float> areas;
+        for (const BoundedPlane& plane : planes)
+        {
+            areas.push_back(plane.area);
+        }
+        sort(areas.begin(), areas.end());
+        return areas;
+    }
+
+    bool MapMatchesMergePlanes(const PlaneMap& planeMap, const map<UINT32, vector<BoundedPlane>>& sources)
+    {
+        vector<BoundedPlane> subPlanes;
+        for (const auto& source : sources)
+        {
+            subPlanes.insert(subPlanes.end(), source.second.begin(), source.second.end());
+        }
+        vector<BoundedPlane> expected = MergePlanes(static_cast<INT32>(subPlanes.size()), subPlanes.data(), 0.0f, 0.0f);
+
+        vector<BoundedPlane> merged;
+        for (const MergedPlane& plane : planeMap.GetPlanes())
+        {
+            merged.push_back(plane.plane);
+        }
+
+        // the two sum the areas of a clique in different orders
+        vector<float> expectedAreas = SortedAreas(expected);
+        vector<float> mergedAreas = SortedAreas(merged);
+        if (expectedAreas.size() != mergedAreas.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < expectedAreas.size(); ++i)
+        {
+            if (fabsf(expectedAreas[i] - mergedAreas[i]) > 1e-4f * expectedAreas[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Fills a plane map with planes, cSubPlanesPerSource to a source, then churns it. Returns the mean milliseconds
+    // SetSubPlanes or RemoveSource and Update took per source, and whether every step matched MergePlanes.
+    double TimePlaneMap(const vector<BoundedPlane>& planes, UINT32 seed, bool* match)
+    {
+        PlaneMap planeMap(0.0f, 0.0f);
+        map<UINT32, vector<BoundedPlane>> sources;
+        UINT32 sourceCount = static_cast<UINT32>(planes.size() + cSubPlanesPerSource - 1) / cSubPlanesPerSource;
+        double milliseconds = 0.0;
+        UINT32 steps = 0;
+
+        auto setSource = [&](UINT32 source, vector<BoundedPlane> subPlanes)
+        {
+            Clock::time_point start = Clock::now();
+            planeMap.SetSubPlanes(source, subPlanes);
+            planeMap.Update();
+            milliseconds += MillisecondsSince(start);
+            steps++;
+            sources[source] = move(subPlanes);
+        };
+
+        for (UINT32 source = 0; source < sourceCount; ++source)
+        {
+            size_t first = source * cSubPlanesPerSource;
+            setSource(source, vector<BoundedPlane>(planes.begin() + first, planes.begin() + min(planes.size(), first + cSubPlanesPerSource)));
+        }
+        *match = MapMatchesMergePlanes(planeMap, sources);
+
+        // replacements come from a second set of planes spread through the same space
+        vector<BoundedPlane> replacements = GenerateSubPlanes(static_cast<UINT32>(planes.size()), seed);
+        std::mt19937 random(seed);
+        for (UINT32 i = 0; i < sourceCount / 10; ++i)
+        {
+            UINT32 source = random() % sourceCount;
+            size_t first = source * cSubPlanesPerSource;
+            setSource(source, vector<BoundedPlane>(replacements.begin() + first, replacements.begin() + min(replacements.size(), first + cSubPlanesPerSource)));
+
+            source = random() % sourceCount;
+            Clock::time_point start = Clock::now();
+            planeMap.RemoveSource(source);
+            planeMap.Update();
+            milliseconds += MillisecondsSince(start);
+            steps++;
+            sources.erase(source);
+        }
+        *match = *match && MapMatchesMergePlanes(planeMap, sources);
+
+        return milliseconds / max(steps, 1u);
+    }
+
+    // Puts every plane in one source, as the RANSAC engine hands its planes over, and sets them again unchanged, then
+    // cSingleSourceSets times with one in ten replaced. Returns the mean milliseconds SetSubPlanes and Update took per
+    // changed set, and whether each update only inserted and removed the planes that changed, and matched MergePlanes.
+    double TimeSingleSource(const vector<BoundedPlane>& planes, UINT32 seed, bool* match)
+    {
+        PlaneMap planeMap(0.0f, 0.0f);
+        vector<BoundedPlane> subPlanes = planes;
+        planeMap.SetSubPlanes(0, subPlanes);
+        planeMap.Update();
+
+        planeMap.SetSubPlanes(0, subPlanes);
+        PlaneMapUpdateStatistics unchanged = planeMap.Update();
+        *match = unchanged.subPlanesInserted == 0 && unchanged.subPlanesRemoved == 0 && unchanged.cliquesMerged == 0;
+
+        // each set replaces different planes, so every one it replaces changes
+        vector<BoundedPlane> replacements = GenerateSubPlanes(static_cast<UINT32>(planes.size()), seed);
+        double milliseconds = 0.0;
+        for (UINT32 set = 0; set < cSingleSourceSets; ++set)
+        {
+            UINT32 replaced = 0;
+            for (size_t i = set; i < subPlanes.size(); i += 10)
+            {
+                subPlanes[i] = replacements[i];
+                replaced++;
+            }
+
+            Clock::time_point start = Clock::now();
+            planeMap.SetSubPlanes(0, subPlanes);
+            PlaneMapUpdateStatistics statistics = planeMap.Update();
+            milliseconds += MillisecondsSince(start);
+            *match = *match && statistics.subPlanesInserted == replaced && statistics.subPlanesRemoved == replaced;
+        }
+
+        map<UINT32, vector<BoundedPlane>> sources;
+        sources[0] = move(subPlanes);
+        *match = *match && MapMatchesMergePlanes(planeMap, sources);
+
+        return milliseconds / cSingleSourceSets;
+    }
+
+    bool ParseArgument(int argc, char** argv, int& i, const char* name, double& value)
+    {
+        if (strcmp(argv[i], name) != 0 || i + 1 >= argc)
+        {
+            return false;
+        }
+        value = atof(argv[++i]);
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double minPlanes = 100.0;
+    double maxPlanes = 10000.0;
+    double repeat = 3.0;
+    double seed = 1.0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!ParseArgument(argc, argv, i, "--min-planes", minPlanes) &&
+            !ParseArgument(argc, argv, i, "--max-planes", maxPlanes) &&
+            !ParseArgument(argc, argv, i, "--repeat", repeat) &&
+            !ParseArgument(argc, argv, i, "--seed", seed))
+        {
+            fprintf(stderr, "%s: unknown option %s; see the top of MergeBroadphaseBenchmark.cpp\n", argv[0], argv[i]);
+            return 2;
+        }
+    }
+
+    UINT32 runs = max(1u, static_cast<UINT32>(repeat));
+    bool allMatch = true;
+
+    printf("%10s %10s %14s %14s %9s %8s %17s %8s %17s %8s\n", "sub-planes", "pairs", "broadphase ms", "all pairs ms", "speedup", "match",
+        "plane map ms/set", "match", "one source ms/set", "match");
+    for (double count = minPlanes; count <= maxPlanes * 1.0001; count *= 10.0)
+    {
+        UINT32 planeCount = static_cast<UINT32>(llround(count));
+        vector<BoundedPlane> planes = GenerateSubPlanes(planeCount, static_cast<UINT32>(seed) * 7919u + planeCount);
+
+        vector<pair<UINT32, UINT32>> broadphasePairs, allPairs;
+        double broadphase = 1e30, brute = 1e30;
+        for (UINT32 run = 0; run < runs; ++run)
+        {
+            broadphasePairs.clear();
+            Clock::time_point start = Clock::now();
+            ForEachNeighborPair(planeCount, planes.data(), [&](UINT32 i, UINT32 j)
+            {
+                broadphasePairs.emplace_back(i, j);
+            });
+            broadphase = min(broadphase, MillisecondsSince(start));
+
+            allPairs.clear();
+            start = Clock::now();
+            for (UINT32 i = 0; i < planeCount; ++i)
+            {
+                for (UINT32 j = i + 1; j < planeCount; ++j)
+                {
+                    if (AreNeighbors(planes[i], planes[j]))
+                    {
+                        allPairs.emplace_back(i, j);
+                    }
+                }
+            }
+            brute = min(brute, MillisecondsSince(start));
+        }
+
+        bool match = broadphasePairs == allPairs;
+        bool mapMatch = false;
+        double planeMap = TimePlaneMap(planes, static_cast<UINT32>(seed) * 104729u + planeCount, &mapMatch);
+        bool singleSourceMatch = false;
+        double singleSource = TimeSingleSource(planes, static_cast<UINT32>(seed) * 15485863u + planeCount, &singleSourceMatch);
+        allMatch = allMatch && match && mapMatch && singleSourceMatch;
+        printf("%10u %10zu %14.2f %14.2f %8.1fx %8s %17.3f %8s %17.3f %8s\n", planeCount, allPairs.size(), broadphase, brute, brute / max(broadphase, 1e-6),
+            match ? "yes" : "NO", planeMap, mapMatch ? "yes" : "NO", singleSource, singleSourceMatch ? "yes" : "NO");
+    }
+
+    return allMatch ? 0 : 1;
+}
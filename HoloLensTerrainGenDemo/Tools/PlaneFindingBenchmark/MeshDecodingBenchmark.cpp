@@ -0,0 +1,282 @@
+// Checks and benchmarks the decoders of spatial surface meshes (see MeshDecoding.h), which turn SNORM16x4 positions,
+// SNORM8x4 normals and R16 indices into the XMFLOAT3 and INT32 arrays plane finding takes.
+//
+//   check      every SNORM16 and SNORM8 value, then random meshes of 0 to 40 vertices and indices, which cover every
+//              tail the SSE2 paths leave to the scalar one, read from every offset within 8 bytes, go through both
+//              paths. They must agree to the bit with XMLoadShortN4 and XMLoadByteN4, and write nothing past the
+//              end of their output.
+//   benchmark  meshes of 1k to 64k vertices, with three indices per vertex, are decoded both ways.
+//
+// Usage: MeshDecodingBenchmark [options]
+//
+//   --meshes <n>        random meshes to check, default 20000
+//   --max-vertices <n>  largest benchmark mesh, default 65536
+//   --repeat <n>        runs per benchmark mesh, default 5; times are from the fastest run
+//
+// Built by Tools/CMakeLists.txt. Exits with 1 if a decoder is wrong. Without SSE2 (_XM_SSE_INTRINSICS_) both paths
+// are the scalar one, which the check says.
+
+#include "common.h"
+#include "pch.h"
+#include "PlaneFinding.h"
+#include "MeshDecoding.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+using namespace PlaneFinding;
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // what is written past the end of the output, to see that it stays
+    const UINT32 cGuard = 0xdeadbeef;
+    const UINT32 cGuardElements = 4;
+
+    // the decoded meshes are summed here, so decoding them cannot be optimized away
+    volatile float g_sink;
+
+    double MillisecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    bool SameBits(const XMFLOAT3& a, const XMFLOAT3& b)
+    {
+        return memcmp(&a, &b, sizeof(a)) == 0;
+    }
+
+    // Returns what is wrong with the fast decoders on count vertices and indices read from offset bytes into a
+    // buffer, or nullptr.
+    const char* CheckMesh(std::mt19937& random, UINT32 count, UINT32 offset)
+    {
+        vector<BYTE> positions(offset + count * 8);
+        vector<BYTE> normals(offset + count * 4);
+        vector<BYTE> indices(offset + count * 2);
+        for (auto* bytes : { &positions, &normals, &indices })
+        {
+            for (BYTE& byte : *bytes)
+            {
+                byte = static_cast<BYTE>(random());
+            }
+        }
+
+        // one XMFLOAT3 or INT32 holds three or one UINT32, so the guard fills whole elements
+        vector<XMFLOAT3> verts(count + cGuardElements);
+        vector<XMFLOAT3> norms(count + cGuardElements);
+        vector<INT32> decoded(count + cGuardElements);
+        for (auto* floats : { &verts, &norms })
+        {
+            for (XMFLOAT3& value : *floats)
+            {
+                memcpy(&value.x, &cGuard, 4);
+                memcpy(&value.y, &cGuard, 4);
+                memcpy(&value.z, &cGuard, 4);
+            }
+        }
+        for (INT32& value : decoded)
+        {
+            value = static_cast<INT32>(cGuard);
+        }
+
+        DecodePositions(positions.data() + offset, verts.data(), count);
+        DecodeNormals(normals.data() + offset, norms.data(), count);
+        DecodeIndices(indices.data() + offset, decoded.data(), count);
+
+        for (UINT32 i = 0; i < count + cGuardElements; ++i)
+        {
+            XMFLOAT3 expectedVert, expectedNorm;
+            INT32 expectedIndex;
+            if (i < count)
+            {
+                XMSHORTN4 position;
+                memcpy(&position, positions.data() + offset + i * 8, sizeof(position));
+                XMStoreFloat3(&expectedVert, XMLoadShortN4(&position));
+                XMBYTEN4 normal;
+                memcpy(&normal, normals.data() + offset + i * 4, sizeof(normal));
+                XMStoreFloat3(&expectedNorm, XMLoadByteN4(&normal));
+                UINT16 index;
+                memcpy(&index, indices.data() + offset + i * 2, sizeof(index));
+                expectedIndex = index;
+            }
+            else
+            {
+                memcpy(&expectedVert.x, &cGuard, 4);
+                memcpy(&expectedVert.y, &cGuard, 4);
+                memcpy(&expectedVert.z, &cGuard, 4);
+                expectedNorm = expectedVert;
+                expectedIndex = static_cast<INT32>(cGuard);
+            }
+
+            if (!SameBits(verts[i], expectedVert))
+            {
+                return i < count ? "a position differs from XMLoadShortN4" : "a position was written past the end";
+            }
+            if (!SameBits(norms[i], expectedNorm))
+            {
+                return i < count ? "a normal differs from XMLoadByteN4" : "a normal was written past the end";
+            }
+            if (decoded[i] != expectedIndex)
+            {
+                return i < count ? "an index differs" : "an index was written past the end";
+            }
+        }
+        return nullptr;
+    }
+
+    // Every value of each component, through both paths. The values are laid out one per lane, so each of the
+    // four components of a position or a normal sees all of them.
+    const char* CheckEveryValue()
+    {
+        vector<int16_t> shorts(65536 * 4);
+        for (UINT32 i = 0; i < shorts.size(); ++i)
+        {
+            shorts[i] = static_cast<int16_t>(i / 4 + (i % 4) * 16384);
+        }
+        vector<XMFLOAT3> fast(65536), scalar(65536);
+        DecodePositions(shorts.data(), fast.data(), 65536);
+        DecodePositionsScalar(shorts.data(), scalar.data(), 65536);
+        if (memcmp(fast.data(), scalar.data(), fast.size() * sizeof(XMFLOAT3)) != 0)
+        {
+            return "some SNORM16 value decodes differently";
+        }
+
+        vector<int8_t> bytes(256 * 4);
+        for (UINT32 i = 0; i < bytes.size(); ++i)
+        {
+            bytes[i] = static_cast<int8_t>(i / 4 + (i % 4) * 64);
+        }
+        fast.resize(256);
+        scalar.resize(256);
+        DecodeNormals(bytes.data(), fast.data(), 256);
+        DecodeNormalsScalar(bytes.data(), scalar.data(), 256);
+        if (memcmp(fast.data(), scalar.data(), fast.size() * sizeof(XMFLOAT3)) != 0)
+        {
+            return "some SNORM8 value decodes differently";
+        }
+
+        vector<UINT16> indices(65536);
+        for (UINT32 i = 0; i < indices.size(); ++i)
+        {
+            indices[i] = static_cast<UINT16>(i);
+        }
+        vector<INT32> decoded(65536);
+        DecodeIndices(indices.data(), decoded.data(), 65536);
+        for (UINT32 i = 0; i < decoded.size(); ++i)
+        {
+            if (decoded[i] != static_cast<INT32>(i))
+            {
+                return "some R16 index decodes differently";
+            }
+        }
+        return nullptr;
+    }
+
+    typedef void (*DecodeVerts)(const void*, XMFLOAT3*, UINT32);
+    typedef void (*DecodeIndexList)(const void*, INT32*, UINT32);
+
+    double TimeDecode(const vector<BYTE>& positions, const vector<BYTE>& normals, const vector<BYTE>& indices,
+        DecodeVerts decodePositions, DecodeVerts decodeNormals, DecodeIndexList decodeIndices, UINT32 runs)
+    {
+        UINT32 vertCount = static_cast<UINT32>(positions.size() / 8);
+        UINT32 indexCount = static_cast<UINT32>(indices.size() / 2);
+        vector<XMFLOAT3> verts(vertCount), norms(vertCount);
+        vector<INT32> decoded(indexCount);
+
+        // meshes are decoded repeatedly until each timed run takes a while, to time even the small ones
+        UINT32 calls = max(1u, 1000000u / vertCount);
+        double fastest = 1e30;
+        for (UINT32 run = 0; run < runs; ++run)
+        {
+            Clock::time_point start = Clock::now();
+            for (UINT32 call = 0; call < calls; ++call)
+            {
+                decodePositions(positions.data(), verts.data(), vertCount);
+                decodeNormals(normals.data(), norms.data(), vertCount);
+                decodeIndices(indices.data(), decoded.data(), indexCount);
+                g_sink = verts[call % vertCount].x + norms[call % vertCount].y + float(decoded[call % indexCount]);
+            }
+            fastest = min(fastest, MillisecondsSince(start) / calls);
+        }
+        return fastest;
+    }
+
+    bool ParseArgument(int argc, char** argv, int& i, const char* name, double& value)
+    {
+        if (strcmp(argv[i], name) != 0 || i + 1 >= argc)
+        {
+            return false;
+        }
+        value = atof(argv[++i]);
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double meshes = 20000.0;
+    double maxVertices = 65536.0;
+    double repeat = 5.0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!ParseArgument(argc, argv, i, "--meshes", meshes) &&
+            !ParseArgument(argc, argv, i, "--max-vertices", maxVertices) &&
+            !ParseArgument(argc, argv, i, "--repeat", repeat))
+        {
+            fprintf(stderr, "%s: unknown option %s; see the top of MeshDecodingBenchmark.cpp\n", argv[0], argv[i]);
+            return 2;
+        }
+    }
+
+    UINT32 meshCount = static_cast<UINT32>(meshes);
+    UINT32 runs = max(1u, static_cast<UINT32>(repeat));
+
+    const char* problem = CheckEveryValue();
+    std::mt19937 random(1);
+    for (UINT32 i = 0; i < meshCount && problem == nullptr; ++i)
+    {
+        UINT32 count = i % 41;
+        UINT32 offset = (i / 41) % 8;
+        problem = CheckMesh(random, count, offset);
+        if (problem != nullptr)
+        {
+            fprintf(stderr, "check failed: %s (mesh %u, %u vertices and indices at offset %u)\n", problem, i, count, offset);
+        }
+    }
+    if (problem != nullptr)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+#if defined(_XM_SSE_INTRINSICS_)
+    printf("check: every value and %u meshes, SSE2 against scalar\n\n", meshCount);
+#else
+    printf("check: every value and %u meshes, scalar only: this build has no SSE2 path\n\n", meshCount);
+#endif
+
+    printf("%8s %10s %10s %8s\n", "vertices", "scalar us", "fast us", "speedup");
+    for (double count = 1024.0; count <= maxVertices * 1.0001; count *= 4.0)
+    {
+        UINT32 vertCount = static_cast<UINT32>(count);
+        vector<BYTE> positions(vertCount * 8), normals(vertCount * 4), indices(vertCount * 3 * 2);
+        for (auto* bytes : { &positions, &normals, &indices })
+        {
+            for (BYTE& byte : *bytes)
+            {
+                byte = static_cast<BYTE>(random());
+            }
+        }
+
+        double scalar = TimeDecode(positions, normals, indices, DecodePositionsScalar, DecodeNormalsScalar, DecodeIndicesScalar, runs);
+        double fast = TimeDecode(positions, normals, indices, DecodePositions, DecodeNormals, DecodeIndices, runs);
+        printf("%8u %10.2f %10.2f %7.2fx\n", vertCount, scalar * 1000.0, fast * 1000.0, scalar / fast);
+    }
+    return 0;
+}
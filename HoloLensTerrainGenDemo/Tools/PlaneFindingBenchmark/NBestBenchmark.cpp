@@ -0,0 +1,262 @@
+// Checks and benchmarks NBest, the selector FindPlanes keeps its best candidate planes in.
+//
+//   check      random candidate streams, with many equal keys, go through NBest and through a stable sort of the
+//              whole stream; both must keep the same elements in the same order, the first of equal elements first.
+//   threads    several threads fill their own selectors at once, as concurrent FindPlanes calls do, and check them
+//              the same way. Build with PLANEFINDING_SANITIZE=thread (see CMakeLists.txt) to have ThreadSanitizer
+//              look for state the instances share.
+//   benchmark  streams of 100 to 100k candidates the size of a PlaneData go through NBest and through a sorted
+//              insertion list, the way NBest kept its elements before it became a heap.
+//
+// Usage: NBestBenchmark [options]
+//
+//   --streams <n>    random streams to check, default 20000
+//   --threads <n>    threads filling selectors at once, default 4
+//   --max-stream <n> longest benchmark stream, default 100000
+//   --repeat <n>     runs per stream length, default 3; times are from the fastest run
+//
+// Built by Tools/CMakeLists.txt. Exits with 1 if a selector keeps the wrong elements.
+
+#include "common.h"
+#include "pch.h"
+#include "NBest.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const UINT32 cMaxPlanesPerSurface = 30; // as in FindPlanes.cpp
+
+    std::atomic<UINT64> g_failures{ 0 };
+
+    double MillisecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // Ranked on its key alone, like PlaneData on its vertex count; the id tells equal keys apart.
+    struct Candidate
+    {
+        UINT32 key = 0;
+        UINT32 id = 0;
+        float payload[14] = {}; // brings it to about the size of a PlaneData
+
+        bool operator<(const Candidate& other) const
+        {
+            return key < other.key;
+        }
+    };
+
+    // The sorted insertion list NBest used before: each accepted element shifts the worse ones down a slot.
+    template <unsigned int N, typename T>
+    class SortedInsertionList
+    {
+    public:
+        void Add(T data)
+        {
+            UINT32 insertAt = num;
+            for (UINT32 i = 0; i < num; ++i)
+            {
+                if (best[i] < data)
+                {
+                    insertAt = i;
+                    break;
+                }
+            }
+            if (insertAt == N)
+            {
+                return;
+            }
+            if (num < N)
+            {
+                num++;
+            }
+            for (UINT32 i = insertAt; i < num; ++i)
+            {
+                swap(best[i], data);
+            }
+        }
+
+        T& operator[](UINT32 i)
+        {
+            return best[i];
+        }
+
+        UINT32 num = 0;
+        T best[N];
+    };
+
+    void Fail(const char* what, UINT32 stream)
+    {
+        if (g_failures++ == 0)
+        {
+            fprintf(stderr, "check failed: %s (stream %u)\n", what, stream);
+        }
+    }
+
+    vector<Candidate> GenerateStream(std::mt19937& random, UINT32 length, UINT32 keyRange)
+    {
+        vector<Candidate> stream(length);
+        for (UINT32 i = 0; i < length; ++i)
+        {
+            stream[i].key = random() % keyRange;
+            stream[i].id = i;
+        }
+        return stream;
+    }
+
+    template <unsigned int N>
+    void CheckStream(const vector<Candidate>& stream, UINT32 streamIndex)
+    {
+        NBest<N, Candidate> selector;
+        for (const Candidate& candidate : stream)
+        {
+            selector.Add(candidate);
+        }
+
+        vector<Candidate> expected = stream;
+        stable_sort(expected.begin(), expected.end(), [](const Candidate& a, const Candidate& b) { return b < a; });
+        expected.resize(min<size_t>(expected.size(), N));
+
+        if (selector.num != expected.size())
+        {
+            Fail("kept the wrong number of elements", streamIndex);
+            return;
+        }
+        for (UINT32 i = 0; i < selector.num; ++i)
+        {
+            if (selector[i].id != expected[i].id)
+            {
+                Fail("kept other elements, or kept them out of order", streamIndex);
+                return;
+            }
+        }
+    }
+
+    void CheckStreams(UINT32 seed, UINT32 count)
+    {
+        std::mt19937 random(seed);
+        for (UINT32 i = 0; i < count && g_failures == 0; ++i)
+        {
+            // short key ranges give long runs of equal keys
+            UINT32 keyRange = 1 + random() % (i % 2 == 0 ? 8 : 100000);
+            vector<Candidate> stream = GenerateStream(random, random() % 400, keyRange);
+            CheckStream<1>(stream, i);
+            CheckStream<7>(stream, i);
+            CheckStream<cMaxPlanesPerSurface>(stream, i);
+            CheckStream<128>(stream, i);
+        }
+    }
+
+    template <typename Selector>
+    double TimeStream(const vector<Candidate>& stream, UINT32 runs, UINT64* checksum)
+    {
+        double fastest = 1e30;
+        for (UINT32 run = 0; run < runs; ++run)
+        {
+            Clock::time_point start = Clock::now();
+            Selector selector;
+            for (const Candidate& candidate : stream)
+            {
+                selector.Add(candidate);
+            }
+            // the kept ids go into the checksum inside the timing, so the selection cannot be optimized away
+            *checksum = 0;
+            for (UINT32 i = 0; i < selector.num; ++i)
+            {
+                *checksum = *checksum * 31 + selector[i].id;
+            }
+            fastest = min(fastest, MillisecondsSince(start));
+        }
+        return fastest;
+    }
+
+    bool ParseArgument(int argc, char** argv, int& i, const char* name, double& value)
+    {
+        if (strcmp(argv[i], name) != 0 || i + 1 >= argc)
+        {
+            return false;
+        }
+        value = atof(argv[++i]);
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double streams = 20000.0;
+    double threads = 4.0;
+    double maxStream = 100000.0;
+    double repeat = 3.0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!ParseArgument(argc, argv, i, "--streams", streams) &&
+            !ParseArgument(argc, argv, i, "--threads", threads) &&
+            !ParseArgument(argc, argv, i, "--max-stream", maxStream) &&
+            !ParseArgument(argc, argv, i, "--repeat", repeat))
+        {
+            fprintf(stderr, "%s: unknown option %s; see the top of NBestBenchmark.cpp\n", argv[0], argv[i]);
+            return 2;
+        }
+    }
+
+    UINT32 streamCount = static_cast<UINT32>(streams);
+    UINT32 threadCount = max(1u, static_cast<UINT32>(threads));
+    UINT32 runs = max(1u, static_cast<UINT32>(repeat));
+
+    CheckStreams(1, streamCount);
+    printf("check:   %u streams\n", streamCount);
+
+    vector<std::thread> workers;
+    for (UINT32 i = 0; i < threadCount; ++i)
+    {
+        workers.emplace_back(CheckStreams, 100 + i, streamCount / threadCount);
+    }
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    printf("threads: %u threads, %u streams each\n\n", threadCount, streamCount / threadCount);
+
+    // rising keys are the worst case for both: every candidate is accepted, and the list shifts all it holds
+    printf("%10s %10s %12s %12s %9s\n", "candidates", "keys", "NBest ms", "list ms", "speedup");
+    std::mt19937 random(7);
+    for (double length = 100.0; length <= maxStream * 1.0001; length *= 10.0)
+    {
+        vector<Candidate> randomKeys = GenerateStream(random, static_cast<UINT32>(llround(length)), 1u << 30);
+        vector<Candidate> risingKeys = randomKeys;
+        for (UINT32 i = 0; i < risingKeys.size(); ++i)
+        {
+            risingKeys[i].key = i;
+        }
+
+        for (const vector<Candidate>* stream : { &randomKeys, &risingKeys })
+        {
+            UINT64 heapChecksum = 0, listChecksum = 0;
+            double heap = TimeStream<NBest<cMaxPlanesPerSurface, Candidate>>(*stream, runs, &heapChecksum);
+            double list = TimeStream<SortedInsertionList<cMaxPlanesPerSurface, Candidate>>(*stream, runs, &listChecksum);
+            if (heapChecksum != listChecksum)
+            {
+                Fail("benchmark selectors kept different elements", 0);
+            }
+            printf("%10zu %10s %12.3f %12.3f %8.1fx\n", stream->size(), stream == &randomKeys ? "random" : "rising", heap, list, list / max(heap, 1e-6));
+        }
+    }
+
+    if (g_failures > 0)
+    {
+        printf("FAILED: %llu checks failed\n", static_cast<unsigned long long>(g_failures));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,327 @@
+// Checks and benchmarks GetBoundsInOrientedSpace (see Util.h), which fits a box to the vertices of a plane with a
+// convex hull and trig-free rotating calipers.
+//
+//   check      random point sets go through it: rotated clouds, clouds snapped to a grid, so that hull edges tie in
+//              direction and boxes tie in area, and clouds squashed onto a line. Every box must hold every point, its
+//              z range must be the points' own, an axis-aligned box must be the points' x and y range, and a tight
+//              box's area must be the smallest one a double precision brute force finds: the convex hull is computed
+//              again and the points are measured along every hull edge, as the smallest box shares a side with one.
+//   benchmark  clouds of 16 to 16k points filling a disk, where the hull keeps few of them, and spread on a circle,
+//              where every point is on the hull, are fitted axis-aligned and tight. The brute force is timed too.
+//
+// Usage: OrientedBoundsBenchmark [options]
+//
+//   --sets <n>      random point sets to check, default 20000
+//   --max-points <n> largest benchmark cloud, default 16384
+//   --repeat <n>    runs per benchmark cloud, default 5; times are from the fastest run
+//
+// Built by Tools/CMakeLists.txt. Exits with 1 if a box is wrong.
+
+#include "common.h"
+#include "pch.h"
+#include "PlaneFinding.h"
+#include "Util.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+using namespace DirectX;
+using namespace PlaneFinding;
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // boxes are single precision, so extents are compared to this fraction of the cloud's size or of its distance from
+    // the origin, whichever is larger
+    const double cRelativeTolerance = 1e-5;
+
+    // the timed boxes are written here, so fitting them cannot be optimized away
+    volatile float g_sink;
+
+    double MillisecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    struct Point2
+    {
+        double x, y;
+    };
+
+    double Cross(const Point2& o, const Point2& a, const Point2& b)
+    {
+        return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+    }
+
+    vector<Point2> ReferenceHull(const vector<XMFLOAT3>& verts)
+    {
+        vector<Point2> points(verts.size());
+        for (size_t i = 0; i < verts.size(); ++i)
+        {
+            points[i] = { verts[i].x, verts[i].y };
+        }
+        sort(points.begin(), points.end(), [](const Point2& a, const Point2& b) { return a.x < b.x || (a.x == b.x && a.y < b.y); });
+
+        vector<Point2> hull(2 * points.size());
+        size_t count = 0;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            while (count >= 2 && Cross(hull[count - 2], hull[count - 1], points[i]) <= 0)
+            {
+                count--;
+            }
+            hull[count++] = points[i];
+        }
+        for (size_t i = points.size() - 1, lower = count + 1; i-- > 0;)
+        {
+            while (count >= lower && Cross(hull[count - 2], hull[count - 1], points[i]) <= 0)
+            {
+                count--;
+            }
+            hull[count++] = points[i];
+        }
+        hull.resize(count > 1 ? count - 1 : count);
+        return hull;
+    }
+
+    // The smallest area of a box around the points, in double precision.
+    double ReferenceMinArea(const vector<XMFLOAT3>& verts)
+    {
+        vector<Point2> hull = ReferenceHull(verts);
+        if (hull.size() < 3)
+        {
+            return 0.0;
+        }
+
+        double best = DBL_MAX;
+        for (size_t i = 0; i < hull.size(); ++i)
+        {
+            const Point2& a = hull[i];
+            const Point2& b = hull[(i + 1) % hull.size()];
+            double length = hypot(b.x - a.x, b.y - a.y);
+            Point2 u = { (b.x - a.x) / length, (b.y - a.y) / length };
+
+            double minU = DBL_MAX, maxU = -DBL_MAX, minV = DBL_MAX, maxV = -DBL_MAX;
+            for (const Point2& p : hull)
+            {
+                double along = p.x * u.x + p.y * u.y;
+                double across = p.y * u.x - p.x * u.y;
+                minU = min(minU, along);
+                maxU = max(maxU, along);
+                minV = min(minV, across);
+                maxV = max(maxV, across);
+            }
+            best = min(best, (maxU - minU) * (maxV - minV));
+        }
+        return best;
+    }
+
+    // Returns what is wrong with box as the bounds of verts, or nullptr.
+    const char* CheckBox(const BoundingOrientedBox& box, const vector<XMFLOAT3>& verts, bool tight)
+    {
+        double minX = DBL_MAX, maxX = -DBL_MAX, minY = DBL_MAX, maxY = -DBL_MAX, minZ = DBL_MAX, maxZ = -DBL_MAX;
+        double distance = 0.0;
+        for (const XMFLOAT3& vert : verts)
+        {
+            distance = max<double>(distance, max(fabsf(vert.x), fabsf(vert.y)));
+            minX = min<double>(minX, vert.x);
+            maxX = max<double>(maxX, vert.x);
+            minY = min<double>(minY, vert.y);
+            maxY = max<double>(maxY, vert.y);
+            minZ = min<double>(minZ, vert.z);
+            maxZ = max<double>(maxZ, vert.z);
+        }
+        double size = max(max(maxX - minX, maxY - minY), 1e-3);
+        double tolerance = cRelativeTolerance * max(size, distance);
+
+        if (box.Orientation.x != 0.0f || box.Orientation.y != 0.0f)
+        {
+            return "the box is not rotated about z only";
+        }
+        if (fabs(box.Center.z - (minZ + maxZ) / 2) > tolerance || fabs(box.Extents.z - (maxZ - minZ) / 2) > tolerance)
+        {
+            return "the box has another z range";
+        }
+
+        // the box's x axis is at angle theta, with Orientation = (0, 0, sin(theta / 2), cos(theta / 2))
+        double cosine = static_cast<double>(box.Orientation.w) * box.Orientation.w - static_cast<double>(box.Orientation.z) * box.Orientation.z;
+        double sine = 2.0 * box.Orientation.w * box.Orientation.z;
+        for (const XMFLOAT3& vert : verts)
+        {
+            double x = vert.x - box.Center.x;
+            double y = vert.y - box.Center.y;
+            double along = x * cosine + y * sine;
+            double across = y * cosine - x * sine;
+            if (fabs(along) > box.Extents.x + tolerance || fabs(across) > box.Extents.y + tolerance)
+            {
+                return "a point is outside the box";
+            }
+        }
+
+        double area = 4.0 * box.Extents.x * box.Extents.y;
+        if (!tight)
+        {
+            if (box.Orientation.z != 0.0f || fabs(2.0 * box.Extents.x - (maxX - minX)) > tolerance || fabs(2.0 * box.Extents.y - (maxY - minY)) > tolerance)
+            {
+                return "the axis-aligned box is not the points' range";
+            }
+            return nullptr;
+        }
+
+        double expected = ReferenceMinArea(verts);
+        if (fabs(area - expected) > 4.0 * tolerance * size)
+        {
+            return "the tight box is not the smallest";
+        }
+        return nullptr;
+    }
+
+    enum CloudKind
+    {
+        RotatedCloud,
+        GridCloud,
+        LineCloud,
+        CloudKinds
+    };
+
+    vector<XMFLOAT3> RandomCloud(std::mt19937& random, CloudKind kind)
+    {
+        std::uniform_real_distribution<float> signedUnit(-1.0f, 1.0f);
+        vector<XMFLOAT3> verts(3 + random() % 400);
+        float angle = signedUnit(random) * 3.2f;
+        float width = 0.2f + 2.0f * fabsf(signedUnit(random));
+        float height = kind == LineCloud ? 1e-4f : 0.1f + fabsf(signedUnit(random));
+        XMFLOAT2 offset = { signedUnit(random) * 5.0f, signedUnit(random) * 5.0f };
+        for (XMFLOAT3& vert : verts)
+        {
+            float x = signedUnit(random) * width;
+            float y = signedUnit(random) * height;
+            vert = { offset.x + x * cosf(angle) - y * sinf(angle), offset.y + x * sinf(angle) + y * cosf(angle), signedUnit(random) * 0.01f };
+            if (kind == GridCloud)
+            {
+                vert.x = roundf(vert.x * 4.0f) / 4.0f;
+                vert.y = roundf(vert.y * 4.0f) / 4.0f;
+            }
+        }
+        return verts;
+    }
+
+    // The grid snapping can leave every point on one line, or one point; such sets have no box to compare areas of.
+    bool HasArea(const vector<XMFLOAT3>& verts)
+    {
+        return ReferenceHull(verts).size() >= 3;
+    }
+
+    vector<XMFLOAT3> BenchmarkCloud(std::mt19937& random, UINT32 count, bool onCircle)
+    {
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        vector<XMFLOAT3> verts(count);
+        for (XMFLOAT3& vert : verts)
+        {
+            float angle = unit(random) * XM_2PI;
+            float radius = onCircle ? 1.0f : sqrtf(unit(random));
+            vert = { radius * cosf(angle), 0.5f * radius * sinf(angle), unit(random) * 0.01f };
+        }
+        return verts;
+    }
+
+    double TimeBounds(const vector<XMFLOAT3>& verts, bool tight, UINT32 runs)
+    {
+        // clouds are fitted repeatedly until each timed run takes a while, to time even the small ones
+        UINT32 calls = max(1u, 200000u / static_cast<UINT32>(verts.size()));
+        double fastest = 1e30;
+        for (UINT32 run = 0; run < runs; ++run)
+        {
+            Clock::time_point start = Clock::now();
+            for (UINT32 call = 0; call < calls; ++call)
+            {
+                g_sink = GetBoundsInOrientedSpace(tight, verts.data(), static_cast<UINT32>(verts.size())).Extents.x;
+            }
+            fastest = min(fastest, MillisecondsSince(start) / calls);
+        }
+        return fastest;
+    }
+
+    bool ParseArgument(int argc, char** argv, int& i, const char* name, double& value)
+    {
+        if (strcmp(argv[i], name) != 0 || i + 1 >= argc)
+        {
+            return false;
+        }
+        value = atof(argv[++i]);
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double sets = 20000.0;
+    double maxPoints = 16384.0;
+    double repeat = 5.0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!ParseArgument(argc, argv, i, "--sets", sets) &&
+            !ParseArgument(argc, argv, i, "--max-points", maxPoints) &&
+            !ParseArgument(argc, argv, i, "--repeat", repeat))
+        {
+            fprintf(stderr, "%s: unknown option %s; see the top of OrientedBoundsBenchmark.cpp\n", argv[0], argv[i]);
+            return 2;
+        }
+    }
+
+    UINT32 setCount = static_cast<UINT32>(sets);
+    UINT32 runs = max(1u, static_cast<UINT32>(repeat));
+
+    std::mt19937 random(1);
+    UINT32 checked[CloudKinds] = {};
+    for (UINT32 i = 0; i < setCount; ++i)
+    {
+        CloudKind kind = static_cast<CloudKind>(i % CloudKinds);
+        vector<XMFLOAT3> verts = RandomCloud(random, kind);
+        if (!HasArea(verts))
+        {
+            continue;
+        }
+
+        for (bool tight : { false, true })
+        {
+            const char* problem = CheckBox(GetBoundsInOrientedSpace(tight, verts.data(), static_cast<UINT32>(verts.size())), verts, tight);
+            if (problem != nullptr)
+            {
+                fprintf(stderr, "check failed: %s (set %u, %zu points, %s)\n", problem, i, verts.size(), tight ? "tight" : "axis-aligned");
+                printf("FAILED\n");
+                return 1;
+            }
+        }
+        checked[kind]++;
+    }
+    printf("check: %u rotated, %u grid-snapped and %u line-like point sets\n\n", checked[RotatedCloud], checked[GridCloud], checked[LineCloud]);
+
+    printf("%8s %8s %6s %14s %10s %16s\n", "points", "shape", "hull", "axis-aligned us", "tight us", "brute force us");
+    for (double count = 16.0; count <= maxPoints * 1.0001; count *= 4.0)
+    {
+        for (bool onCircle : { false, true })
+        {
+            vector<XMFLOAT3> verts = BenchmarkCloud(random, static_cast<UINT32>(count), onCircle);
+            double axisAligned = TimeBounds(verts, false, runs);
+            double tight = TimeBounds(verts, true, runs);
+
+            double bruteForce = 1e30;
+            for (UINT32 run = 0; run < runs; ++run)
+            {
+                Clock::time_point start = Clock::now();
+                g_sink = static_cast<float>(ReferenceMinArea(verts));
+                bruteForce = min(bruteForce, MillisecondsSince(start));
+            }
+            printf("%8zu %8s %6zu %14.2f %10.2f %16.2f\n", verts.size(), onCircle ? "circle" : "disk", ReferenceHull(verts).size(),
+                axisAligned * 1000.0, tight * 1000.0, bruteForce * 1000.0);
+        }
+    }
+    return 0;
+}
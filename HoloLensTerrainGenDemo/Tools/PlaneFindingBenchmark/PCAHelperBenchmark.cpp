@@ -0,0 +1,399 @@
+// Checks PCAHelper::SolveAll, the closed form eigen solver plane equations come from, against a double precision
+// Jacobi solver, and times both.
+//
+// Point clouds of each kind below are added to helpers the way FindPlanes adds a plane's vertices, with the mean set
+// first, and solved four at a time. The same points' covariance is decomposed in double precision by cyclic Jacobi
+// rotations. For every helper:
+//   - each eigenvalue must match the reference to 1e-4 of the largest one, as the Debug build asserts;
+//   - each eigenvector v must have a residual |C v - lambda v| under 1e-4 of the largest eigenvalue, and the three
+//     must be orthonormal;
+//   - the normal, and the tangent, must point along the reference's wherever its eigenvalue is apart from the
+//     others by at least 1% of the largest one; closer eigenvalues leave the direction to rounding.
+// Helpers solved in batches of 1 to 9 must come out the same as solved one at a time, whichever lane they take.
+//
+//   plane         points on a rectangle, with noise across it of 1e-3 of its size
+//   flat plane    points exactly on a rectangle, so the smallest eigenvalue is zero up to rounding
+//   disc          points on a disc, the two tangent eigenvalues equal
+//   line          points along a segment, with noise of 1e-4 of its length, so two eigenvalues nearly vanish
+//   isotropic     points in a ball, three eigenvalues nearly equal
+//   near tie      a plane whose noise across is nearly its width, the normal eigenvalue just below the other
+//   far           planes 100 m from the origin, their mean set from the points as FindPlanes does
+//
+// Usage: PCAHelperBenchmark [options]
+//
+//   --clouds <n>    clouds of each kind, default 20000
+//   --seed <n>      default 1
+//
+// Built by Tools/CMakeLists.txt. Exits with 1 if a check fails.
+
+#include "common.h"
+#include "pch.h"
+#include "PlaneFinding.h"
+#include "PCAHelper.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+using namespace DirectX;
+using namespace PlaneFinding;
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const double cEigenvalueTolerance = 1e-4;
+    const double cResidualTolerance = 1e-4;
+    const double cOrthonormalTolerance = 1e-5;
+    const double cDistinctGap = 1e-2;
+    const double cMaxAngle = 1e-3; // radians
+
+    double MillisecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    struct Reference
+    {
+        double covariance[3][3];
+        double values[3];     // decreasing
+        double vectors[3][3]; // vectors[i] belongs to values[i]
+    };
+
+    // Cyclic Jacobi rotations until the off-diagonal vanishes, in double precision.
+    void SolveJacobi(Reference* reference)
+    {
+        double a[3][3], v[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+        memcpy(a, reference->covariance, sizeof(a));
+        for (int sweep = 0; sweep < 50; ++sweep)
+        {
+            double off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+            if (off <= 1e-30 * (a[0][0] * a[0][0] + a[1][1] * a[1][1] + a[2][2] * a[2][2]))
+            {
+                break;
+            }
+            for (int p = 0; p < 2; ++p)
+            {
+                for (int q = p + 1; q < 3; ++q)
+                {
+                    if (a[p][q] == 0.0)
+                    {
+                        continue;
+                    }
+                    double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+                    double t = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                    double c = 1.0 / sqrt(t * t + 1.0), s = t * c;
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        double akp = a[k][p], akq = a[k][q];
+                        a[k][p] = c * akp - s * akq;
+                        a[k][q] = s * akp + c * akq;
+                    }
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        double apk = a[p][k], aqk = a[q][k];
+                        a[p][k] = c * apk - s * aqk;
+                        a[q][k] = s * apk + c * aqk;
+                    }
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        double vkp = v[k][p], vkq = v[k][q];
+                        v[k][p] = c * vkp - s * vkq;
+                        v[k][q] = s * vkp + c * vkq;
+                    }
+                }
+            }
+        }
+
+        int order[3] = { 0, 1, 2 };
+        sort(order, order + 3, [&](int i, int j) { return a[i][i] > a[j][j]; });
+        for (int i = 0; i < 3; ++i)
+        {
+            reference->values[i] = a[order[i]][order[i]];
+            for (int k = 0; k < 3; ++k)
+            {
+                reference->vectors[i][k] = v[k][order[i]];
+            }
+        }
+    }
+
+    enum CloudKind
+    {
+        PlaneCloud,
+        FlatPlaneCloud,
+        DiscCloud,
+        LineCloud,
+        IsotropicCloud,
+        NearTieCloud,
+        FarCloud,
+        CloudKinds
+    };
+
+    const char* const cCloudNames[CloudKinds] = { "plane", "flat plane", "disc", "line", "isotropic", "near tie", "far" };
+
+    vector<XMFLOAT3> GenerateCloud(std::mt19937& random, CloudKind kind)
+    {
+        std::uniform_real_distribution<float> signedUnit(-1.0f, 1.0f);
+        std::normal_distribution<float> normal;
+
+        // a random orientation, a size of 0.1 to 3 m and a position within a room, or far away
+        XMVECTOR orientation = XMVector4Normalize(XMVectorSet(normal(random), normal(random), normal(random), normal(random)));
+        XMMATRIX rotation = XMMatrixRotationQuaternion(orientation);
+        float size = 0.1f + 2.9f * fabsf(signedUnit(random));
+        float distance = kind == FarCloud ? 100.0f : 3.0f;
+        XMVECTOR center = XMVectorSet(signedUnit(random), signedUnit(random), signedUnit(random), 0.0f) * distance;
+
+        vector<XMFLOAT3> points(8 + random() % 400);
+        for (XMFLOAT3& point : points)
+        {
+            XMFLOAT3 local;
+            switch (kind)
+            {
+            case PlaneCloud:
+            case FarCloud:
+                local = { signedUnit(random), 0.6f * signedUnit(random), 1e-3f * normal(random) };
+                break;
+            case FlatPlaneCloud:
+                local = { signedUnit(random), 0.6f * signedUnit(random), 0.0f };
+                break;
+            case DiscCloud:
+            {
+                float angle = signedUnit(random) * XM_PI;
+                float radius = sqrtf(fabsf(signedUnit(random)));
+                local = { radius * cosf(angle), radius * sinf(angle), 1e-3f * normal(random) };
+                break;
+            }
+            case LineCloud:
+                local = { signedUnit(random), 1e-4f * normal(random), 1e-4f * normal(random) };
+                break;
+            case IsotropicCloud:
+                local = { normal(random), normal(random), normal(random) };
+                break;
+            default:
+                local = { signedUnit(random), 0.3f * signedUnit(random), 0.29f * signedUnit(random) };
+                break;
+            }
+            XMStoreFloat3(&point, XMVector3TransformNormal(XMLoadFloat3(&local) * size, rotation) + center);
+        }
+        return points;
+    }
+
+    XMFLOAT3 Mean(const vector<XMFLOAT3>& points)
+    {
+        XMVECTOR sum = XMVectorZero();
+        for (const XMFLOAT3& point : points)
+        {
+            sum += XMLoadFloat3(&point);
+        }
+        XMFLOAT3 mean;
+        XMStoreFloat3(&mean, sum / static_cast<float>(points.size()));
+        return mean;
+    }
+
+    void FillHelper(const vector<XMFLOAT3>& points, PCAHelper* helper, Reference* reference)
+    {
+        XMFLOAT3 mean = Mean(points);
+        *helper = PCAHelper();
+        helper->SetMean(mean);
+        memset(reference->covariance, 0, sizeof(reference->covariance));
+        for (const XMFLOAT3& point : points)
+        {
+            helper->AddVertex(point);
+            double d[3] = { point.x - mean.x, point.y - mean.y, point.z - mean.z };
+            for (int i = 0; i < 3; ++i)
+            {
+                for (int j = 0; j < 3; ++j)
+                {
+                    reference->covariance[i][j] += d[i] * d[j];
+                }
+            }
+        }
+    }
+
+    double Dot(const double* a, const XMFLOAT3& b)
+    {
+        return a[0] * b.x + a[1] * b.y + a[2] * b.z;
+    }
+
+    // sine of the angle between two lines
+    double LineAngle(const double* reference, const XMFLOAT3& v)
+    {
+        double cosine = fabs(Dot(reference, v)) / sqrt(static_cast<double>(v.x) * v.x + static_cast<double>(v.y) * v.y + static_cast<double>(v.z) * v.z);
+        return sqrt(max(0.0, 1.0 - cosine * cosine));
+    }
+
+    struct Worst
+    {
+        UINT32 clouds = 0;
+        double eigenvalue = 0;
+        double residual = 0;
+        double orthonormal = 0;
+        double normalAngle = 0;
+        UINT32 normals = 0;
+        double tangentAngle = 0;
+        UINT32 tangents = 0;
+    };
+
+    // Checks the helper's solution against the reference; returns what failed, or nullptr.
+    const char* Check(PCAHelper& helper, const Reference& reference, Worst* worst)
+    {
+        XMFLOAT3 values = helper.GetStandardDeviations();
+        Plane plane = helper.GetPlaneEquation();
+        XMFLOAT3 normal = plane.normal;
+        XMFLOAT3 tangent = helper.GetTangent();
+        XMFLOAT3 cotangent;
+        XMStoreFloat3(&cotangent, XMVector3Cross(XMLoadFloat3(&normal), XMLoadFloat3(&tangent)));
+
+        const double largest = max(fabs(reference.values[0]), 1e-30);
+        const double solved[3] = { values.x, values.y, values.z };
+        const XMFLOAT3* vectors[3] = { &tangent, &cotangent, &normal };
+
+        worst->clouds++;
+        for (int i = 0; i < 3; ++i)
+        {
+            double error = fabs(solved[i] - reference.values[i]) / largest;
+            worst->eigenvalue = max(worst->eigenvalue, error);
+
+            const XMFLOAT3& v = *vectors[i];
+            double residual = 0;
+            for (int row = 0; row < 3; ++row)
+            {
+                double r = reference.covariance[row][0] * v.x + reference.covariance[row][1] * v.y + reference.covariance[row][2] * v.z - solved[i] * (&v.x)[row];
+                residual += r * r;
+            }
+            worst->residual = max(worst->residual, sqrt(residual) / largest);
+        }
+
+        // the cotangent is built from the other two, so it is unit length exactly when they are orthonormal
+        double normalLength = sqrt(static_cast<double>(normal.x) * normal.x + static_cast<double>(normal.y) * normal.y + static_cast<double>(normal.z) * normal.z);
+        double tangentLength = sqrt(static_cast<double>(tangent.x) * tangent.x + static_cast<double>(tangent.y) * tangent.y + static_cast<double>(tangent.z) * tangent.z);
+        double across = static_cast<double>(normal.x) * tangent.x + static_cast<double>(normal.y) * tangent.y + static_cast<double>(normal.z) * tangent.z;
+        worst->orthonormal = max(worst->orthonormal, max(max(fabs(normalLength - 1.0), fabs(tangentLength - 1.0)), fabs(across)));
+
+        if ((reference.values[1] - reference.values[2]) / largest >= cDistinctGap)
+        {
+            worst->normals++;
+            worst->normalAngle = max(worst->normalAngle, LineAngle(reference.vectors[2], normal));
+        }
+        if ((reference.values[0] - reference.values[1]) / largest >= cDistinctGap)
+        {
+            worst->tangents++;
+            worst->tangentAngle = max(worst->tangentAngle, LineAngle(reference.vectors[0], tangent));
+        }
+
+        if (worst->eigenvalue > cEigenvalueTolerance)
+        {
+            return "an eigenvalue is off";
+        }
+        if (worst->residual > cResidualTolerance)
+        {
+            return "an eigenvector is off";
+        }
+        if (worst->orthonormal > cOrthonormalTolerance)
+        {
+            return "the eigenvectors are not orthonormal";
+        }
+        if (worst->normalAngle > cMaxAngle || worst->tangentAngle > cMaxAngle)
+        {
+            return "a well separated eigenvector points elsewhere";
+        }
+        return nullptr;
+    }
+
+    bool SameSolution(PCAHelper& a, PCAHelper& b)
+    {
+        XMFLOAT3 valuesA = a.GetStandardDeviations(), valuesB = b.GetStandardDeviations();
+        XMFLOAT3 tangentA = a.GetTangent(), tangentB = b.GetTangent();
+        Plane planeA = a.GetPlaneEquation(), planeB = b.GetPlaneEquation();
+        return memcmp(&valuesA, &valuesB, sizeof(valuesA)) == 0 && memcmp(&tangentA, &tangentB, sizeof(tangentA)) == 0 &&
+            memcmp(&planeA.normal, &planeB.normal, sizeof(planeA.normal)) == 0;
+    }
+
+    bool ParseArgument(int argc, char** argv, int& i, const char* name, double& value)
+    {
+        if (strcmp(argv[i], name) != 0 || i + 1 >= argc)
+        {
+            return false;
+        }
+        value = atof(argv[++i]);
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double clouds = 20000.0;
+    double seed = 1.0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!ParseArgument(argc, argv, i, "--clouds", clouds) &&
+            !ParseArgument(argc, argv, i, "--seed", seed))
+        {
+            fprintf(stderr, "%s: unknown option %s; see the top of PCAHelperBenchmark.cpp\n", argv[0], argv[i]);
+            return 2;
+        }
+    }
+
+    UINT32 cloudCount = max(1u, static_cast<UINT32>(clouds));
+    std::mt19937 random(static_cast<UINT32>(seed));
+    bool passed = true;
+    double solveMilliseconds = 0, jacobiMilliseconds = 0;
+    UINT32 solved = 0;
+
+    printf("%-11s %7s %10s %10s %11s %8s %12s %8s %12s\n", "cloud", "clouds", "eigenvalue", "residual", "orthonormal",
+        "normals", "normal angle", "tangents", "tangent angle");
+    for (int kind = 0; kind < CloudKinds && passed; ++kind)
+    {
+        Worst worst;
+        for (UINT32 cloud = 0; cloud < cloudCount && passed; )
+        {
+            // a batch of 1 to 9 helpers, so the last lanes of a pass are left empty as often as not
+            UINT32 batch = min<UINT32>(1 + random() % 9, cloudCount - cloud);
+            vector<PCAHelper> helpers(batch);
+            vector<Reference> references(batch);
+            for (UINT32 i = 0; i < batch; ++i)
+            {
+                FillHelper(GenerateCloud(random, static_cast<CloudKind>(kind)), &helpers[i], &references[i]);
+            }
+            vector<PCAHelper> alone = helpers;
+
+            Clock::time_point start = Clock::now();
+            PCAHelper::SolveAll(helpers.data(), batch);
+            solveMilliseconds += MillisecondsSince(start);
+
+            start = Clock::now();
+            for (Reference& reference : references)
+            {
+                SolveJacobi(&reference);
+            }
+            jacobiMilliseconds += MillisecondsSince(start);
+            solved += batch;
+
+            for (UINT32 i = 0; i < batch && passed; ++i)
+            {
+                alone[i].Solve();
+                const char* problem = SameSolution(helpers[i], alone[i]) ? Check(helpers[i], references[i], &worst) : "a batch solved a helper differently";
+                if (problem != nullptr)
+                {
+                    fprintf(stderr, "check failed: %s (%s cloud %u)\n", problem, cCloudNames[kind], cloud + i);
+                    passed = false;
+                }
+            }
+            cloud += batch;
+        }
+        printf("%-11s %7u %10.2g %10.2g %11.2g %8u %12.2g %8u %12.2g\n", cCloudNames[kind], worst.clouds, worst.eigenvalue, worst.residual,
+            worst.orthonormal, worst.normals, worst.normalAngle, worst.tangents, worst.tangentAngle);
+    }
+
+    printf("\nSolveAll %.1f ns per helper, double Jacobi %.1f ns per matrix\n", solveMilliseconds * 1e6 / solved, jacobiMilliseconds * 1e6 / solved);
+    if (!passed)
+    {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,358 @@
+// Benchmarks FindPlanes and MergePlanes on synthetic room scans (see SyntheticRoom.h) of increasing size. For each
+// size it prints the time of each stage, the heap allocations each call made, and how well the planes found match the
+// faces the room was built from, so a change made for speed also shows what it did to precision and recall.
+//
+// Usage: PlaneFindingBenchmark [options]
+//
+//   --min-vertices <n>   smallest scan, default 1000
+//   --max-vertices <n>   largest scan, default 1000000; sizes step by a factor of sqrt(10) in between
+//   --repeat <n>         runs per size, default 3; times are from the fastest run
+//   --seed <n>           room layout and noise, default 1
+//   --noise <meters>     default 0.005
+//   --holes <fraction>   of the walls, floor and ceiling, default 0.02
+//   --tables <n>         default 2
+//   --clutter <n>        default 12
+//   --chunk <meters>     splits the scan into meshes like spatial surfaces, default 2; 0 for a single mesh
+//   --no-seams           leaves out the non-manifold fins along the seams of the walls
+//   --min-area <m^2>     planes smaller than this are left out of precision and recall, default 0.05
+//   --simplify <scale>   also runs with FindPlanesOptions::simplifyCellScale set to this, and compares the two
+//   --no-reattach        with --simplify, measures bounds and areas on the simplified meshes
+//   --ransac             also runs with FindPlanesOptions::engine set to PlaneFindingEngine::Ransac, and compares the two
+//   --write-capture <path>  writes the room of --max-vertices as a surface capture for PlaneFindingReplay instead of
+//                        benchmarking, with every mesh as a surface
+//   --passes <n>         with --write-capture, how many times every surface is recorded, default 3
+//
+// Built by Tools/CMakeLists.txt. By hand, with GCC or Clang: compile it as C++14 with SyntheticRoom.cpp, PlaneScore.cpp
+// and every .cpp file of Common/PlaneFinding, with this directory, Common/PlaneFinding, the Inc directory of
+// DirectXMath and the directory of a sal.h on the include path.
+//
+// Plane finding's parallel loops run serially in this build (see Portability.h).
+
+#include "common.h"
+#include "pch.h"
+#include "SyntheticRoom.h"
+#include "PlaneScore.h"
+#include "ScratchArena.h"
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+using namespace DirectX;
+using namespace PlaneFinding;
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // the app's snap to gravity threshold, in degrees
+    const float cSnapToGravityThreshold = 5.0f;
+
+    std::atomic<UINT64> g_allocations{ 0 };
+    std::atomic<UINT64> g_allocatedBytes{ 0 };
+}
+
+// Every heap allocation in the process goes through here, so each call can be charged with the ones it made.
+void* operator new(size_t size)
+{
+    ++g_allocations;
+    g_allocatedBytes += size;
+    void* memory = malloc(size > 0 ? size : 1);
+    if (!memory)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+    free(memory);
+}
+
+namespace
+{
+    struct Allocations
+    {
+        UINT64 count = 0;
+        UINT64 bytes = 0;
+
+        static Allocations Now()
+        {
+            Allocations now;
+            now.count = g_allocations;
+            now.bytes = g_allocatedBytes;
+            return now;
+        }
+
+        Allocations Since(const Allocations& start) const
+        {
+            Allocations since;
+            since.count = count - start.count;
+            since.bytes = bytes - start.bytes;
+            return since;
+        }
+    };
+
+    double MillisecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    struct Run
+    {
+        double find = 0.0;
+        double merge = 0.0;
+        FindPlanesTimings stages;
+        Allocations findAllocations;
+        Allocations mergeAllocations;
+        vector<BoundedPlane> subPlanes;
+        vector<BoundedPlane> mergedPlanes;
+    };
+
+    Run RunOnce(vector<MeshData>& meshes, const FindPlanesOptions& findOptions)
+    {
+        Run run;
+
+        Allocations before = Allocations::Now();
+        Clock::time_point start = Clock::now();
+        run.subPlanes = FindPlanes(static_cast<INT32>(meshes.size()), meshes.data(), cSnapToGravityThreshold, &run.stages, findOptions);
+        run.find = MillisecondsSince(start);
+        run.findAllocations = Allocations::Now().Since(before);
+
+        before = Allocations::Now();
+        start = Clock::now();
+        run.mergedPlanes = MergePlanes(static_cast<INT32>(run.subPlanes.size()), run.subPlanes.data(), 0.0f, cSnapToGravityThreshold);
+        run.merge = MillisecondsSince(start);
+        run.mergeAllocations = Allocations::Now().Since(before);
+
+        return run;
+    }
+
+    void PrintAllocations(const char* name, const Allocations& first, const Allocations& last)
+    {
+        printf("  %-13s %8" PRIu64 " allocations %10.1f KB on the first run, %8" PRIu64 " allocations %10.1f KB on the last\n",
+            name, first.count, first.bytes / 1024.0, last.count, last.bytes / 1024.0);
+    }
+
+    void PrintScore(const char* name, size_t count, const PlaneScore& score)
+    {
+        printf("  %-13s %5zu found, precision %.3f (%u/%u), recall %.3f (%u/%u)\n",
+            name, count, score.Precision(), score.matched, score.found, score.Recall(), score.recovered, score.reference);
+    }
+
+    struct Summary
+    {
+        const char* engine;
+        UINT32 vertices;
+        UINT32 triangles;
+        size_t meshes;
+        double find;
+        double merge;
+        UINT64 steadyAllocations;
+        PlaneScore subPlanes;
+        PlaneScore mergedPlanes;
+    };
+
+    // Runs plane finding on the room repeatedly and prints what the runs took and how well they did.
+    Summary Measure(const char* engine, SyntheticRoom& room, vector<MeshData>& meshes, UINT32 runs, const FindPlanesOptions& findOptions, float minArea)
+    {
+        Run fastest;
+        Allocations firstFind, firstMerge, lastFind, lastMerge;
+        for (UINT32 i = 0; i < runs; ++i)
+        {
+            Run run = RunOnce(meshes, findOptions);
+            if (i == 0)
+            {
+                firstFind = run.findAllocations;
+                firstMerge = run.mergeAllocations;
+            }
+            lastFind = run.findAllocations;
+            lastMerge = run.mergeAllocations;
+            if (i == 0 || run.find + run.merge < fastest.find + fastest.merge)
+            {
+                fastest = move(run);
+            }
+        }
+
+        Summary summary;
+        summary.engine = engine;
+        summary.vertices = room.GetVertexCount();
+        summary.triangles = room.GetTriangleCount();
+        summary.meshes = meshes.size();
+        summary.find = fastest.find;
+        summary.merge = fastest.merge;
+        summary.steadyAllocations = lastFind.count + lastMerge.count;
+        summary.subPlanes = ScorePlanes(fastest.subPlanes, room.groundTruth, minArea);
+        summary.mergedPlanes = ScorePlanes(fastest.mergedPlanes, room.groundTruth, minArea);
+
+        const FindPlanesTimings& stages = fastest.stages;
+        printf(" %s:\n", engine);
+        printf("  find planes   %10.3f ms: gather %.3f, hypotheses %.3f, simplify %.3f, adjacency %.3f, curvature %.3f, smoothing %.3f, regions %.3f, plane equations %.3f, assignment %.3f, bounds %.3f\n",
+            fastest.find, stages.gather, stages.hypotheses, stages.simplify, stages.adjacency, stages.curvature, stages.smoothing,
+            stages.regions, stages.planeEquations, stages.assignment, stages.bounds);
+        printf("  merge planes  %10.3f ms\n", fastest.merge);
+        PrintAllocations("find planes", firstFind, lastFind);
+        PrintAllocations("merge planes", firstMerge, lastMerge);
+        PrintScore("sub-planes", fastest.subPlanes.size(), summary.subPlanes);
+        PrintScore("merged planes", fastest.mergedPlanes.size(), summary.mergedPlanes);
+        return summary;
+    }
+
+    bool ParseArgument(int argc, char** argv, int& i, const char* name, double& value)
+    {
+        if (strcmp(argv[i], name) != 0 || i + 1 >= argc)
+        {
+            return false;
+        }
+        value = atof(argv[++i]);
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    SyntheticRoomOptions options;
+    options.chunkSize = 2.0f;
+    FindPlanesOptions simplifiedOptions;
+    bool ransac = false;
+    const char* capturePath = nullptr;
+    double passes = 3.0;
+    double minVertices = 1000.0;
+    double maxVertices = 1000000.0;
+    double repeat = 3.0;
+    double minArea = 0.05;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        double value = 0.0;
+        if (ParseArgument(argc, argv, i, "--min-vertices", minVertices) ||
+            ParseArgument(argc, argv, i, "--max-vertices", maxVertices) ||
+            ParseArgument(argc, argv, i, "--repeat", repeat) ||
+            ParseArgument(argc, argv, i, "--min-area", minArea) ||
+            ParseArgument(argc, argv, i, "--passes", passes))
+        {
+            continue;
+        }
+        else if (ParseArgument(argc, argv, i, "--seed", value))
+        {
+            options.seed = static_cast<UINT32>(value);
+        }
+        else if (ParseArgument(argc, argv, i, "--noise", value))
+        {
+            options.noise = static_cast<float>(value);
+        }
+        else if (ParseArgument(argc, argv, i, "--holes", value))
+        {
+            options.holeFraction = static_cast<float>(value);
+        }
+        else if (ParseArgument(argc, argv, i, "--tables", value))
+        {
+            options.tables = static_cast<UINT32>(value);
+        }
+        else if (ParseArgument(argc, argv, i, "--clutter", value))
+        {
+            options.clutter = static_cast<UINT32>(value);
+        }
+        else if (ParseArgument(argc, argv, i, "--chunk", value))
+        {
+            options.chunkSize = static_cast<float>(value);
+        }
+        else if (strcmp(argv[i], "--no-seams") == 0)
+        {
+            options.nonManifoldSeams = false;
+        }
+        else if (ParseArgument(argc, argv, i, "--simplify", value))
+        {
+            simplifiedOptions.simplifyCellScale = static_cast<float>(value);
+        }
+        else if (strcmp(argv[i], "--no-reattach") == 0)
+        {
+            simplifiedOptions.reattachVertices = false;
+        }
+        else if (strcmp(argv[i], "--ransac") == 0)
+        {
+            ransac = true;
+        }
+        else if (strcmp(argv[i], "--write-capture") == 0 && i + 1 < argc)
+        {
+            capturePath = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "%s: unknown option %s; see the top of PlaneFindingBenchmark.cpp\n", argv[0], argv[i]);
+            return 2;
+        }
+    }
+
+    if (capturePath)
+    {
+        options.vertexCount = static_cast<UINT32>(llround(maxVertices));
+        SyntheticRoom room = GenerateSyntheticRoom(options);
+        if (!WriteSurfaceCapture(room, capturePath, max(1u, static_cast<UINT32>(passes))))
+        {
+            fprintf(stderr, "%s: could not write the capture; a mesh may need more than 16 bit indices, see --chunk\n", capturePath);
+            return 1;
+        }
+        printf("%s: %u vertices, %u triangles in %zu surfaces\n", capturePath, room.GetVertexCount(), room.GetTriangleCount(), room.meshes.size());
+        return 0;
+    }
+
+    UINT32 runs = max(1u, static_cast<UINT32>(repeat));
+    vector<Summary> summaries;
+    for (UINT32 step = 0; ; ++step)
+    {
+        double target = minVertices * pow(10.0, step * 0.5);
+        if (target > maxVertices * 1.0001)
+        {
+            break;
+        }
+
+        options.vertexCount = static_cast<UINT32>(llround(target));
+        SyntheticRoom room = GenerateSyntheticRoom(options);
+        vector<MeshData> meshes = room.GetMeshData();
+
+        printf("%u vertices, %u triangles in %zu meshes, %zu ground truth planes\n",
+            room.GetVertexCount(), room.GetTriangleCount(), meshes.size(), room.groundTruth.size());
+        Summary full = Measure("full", room, meshes, runs, FindPlanesOptions(), static_cast<float>(minArea));
+        summaries.push_back(full);
+        if (simplifiedOptions.simplifyCellScale > 0.0f)
+        {
+            Summary simplified = Measure("simplified", room, meshes, runs, simplifiedOptions, static_cast<float>(minArea));
+            summaries.push_back(simplified);
+            printf("  simplifying is %.2fx as fast\n", (full.find + full.merge) / max(simplified.find + simplified.merge, 1e-6));
+        }
+        if (ransac)
+        {
+            FindPlanesOptions ransacOptions;
+            ransacOptions.engine = PlaneFindingEngine::Ransac;
+            Summary found = Measure("ransac", room, meshes, runs, ransacOptions, static_cast<float>(minArea));
+            summaries.push_back(found);
+            printf("  RANSAC is %.2fx as fast\n", (full.find + full.merge) / max(found.find + found.merge, 1e-6));
+        }
+    }
+
+    ScratchStatistics scratch = GetScratchStatistics();
+    printf("Scratch arenas: %" PRIu64 " heap allocations, %.1f KB held\n\n", scratch.heapAllocations, scratch.bytesReserved / 1024.0);
+
+    printf("%10s %10s %7s %-10s %12s %12s %12s %17s %17s\n",
+        "vertices", "triangles", "meshes", "engine", "find ms", "merge ms", "allocations", "sub-plane P/R", "merged P/R");
+    for (const Summary& summary : summaries)
+    {
+        printf("%10u %10u %7zu %-10s %12.3f %12.3f %12" PRIu64 "       %.3f/%.3f       %.3f/%.3f\n",
+            summary.vertices, summary.triangles, summary.meshes, summary.engine, summary.find, summary.merge,
+            summary.steadyAllocations, summary.subPlanes.Precision(), summary.subPlanes.Recall(),
+            summary.mergedPlanes.Precision(), summary.mergedPlanes.Recall());
+    }
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include "common.h"
+#include "pch.h"
+#include "PlaneScore.h"
+
+using namespace DirectX;
+
+namespace PlaneFinding
+{
+    const float cMaxMatchAngle = 10.0f; // degrees between the normals of a found plane and the reference plane it matches
+    const float cMaxMatchOffset = 0.05f; // meters between their plane offsets
+    const float cMatchMargin = 0.1f; // meters the center of the found plane may lie outside the reference plane's bounds
+
+    static bool PlanesMatch(const BoundedPlane& plane, const BoundedPlane& reference)
+    {
+        XMVECTOR normal = XMLoadFloat3(&plane.plane.normal);
+        XMVECTOR referenceNormal = XMLoadFloat3(&reference.plane.normal);
+        if (XMVectorGetX(XMVector3Dot(normal, referenceNormal)) < cosf(XMConvertToRadians(cMaxMatchAngle)) ||
+            fabsf(plane.plane.d - reference.plane.d) > cMaxMatchOffset)
+        {
+            return false;
+        }
+
+        BoundingOrientedBox face = reference.bounds;
+        face.Extents.x += cMatchMargin;
+        face.Extents.y += cMatchMargin;
+        face.Extents.z += cMatchMargin;
+        return face.Contains(XMLoadFloat3(&plane.bounds.Center)) != DISJOINT;
+    }
+
+    PlaneScore ScorePlanes(
+        _In_ const vector<BoundedPlane>& planes,
+        _In_ const vector<BoundedPlane>& reference,
+        _In_ float minArea)
+    {
+        PlaneScore score;
+        vector<bool> recovered(reference.size(), false);
+        for (const BoundedPlane& plane : planes)
+        {
+            if (plane.area < minArea)
+            {
+                continue;
+            }
+
+            ++score.found;
+            bool matched = false;
+            for (size_t i = 0; i < reference.size(); ++i)
+            {
+                if (PlanesMatch(plane, reference[i]))
+                {
+                    matched = true;
+                    recovered[i] = true;
+                }
+            }
+            score.matched += matched ? 1 : 0;
+        }
+
+        for (size_t i = 0; i < reference.size(); ++i)
+        {
+            if (reference[i].area >= minArea)
+            {
+                ++score.reference;
+                score.recovered += recovered[i] ? 1 : 0;
+            }
+        }
+        return score;
+    }
+}
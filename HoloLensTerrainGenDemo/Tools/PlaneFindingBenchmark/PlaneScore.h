@@ -0,0 +1,27 @@
+#pragma once
+#include "PlaneFinding.h"
+
+namespace PlaneFinding
+{
+    // How well a set of planes matches a reference set, such as the ground truth of a synthetic room or the planes
+    // found on the full resolution of a mesh.
+    struct PlaneScore
+    {
+        UINT32 found = 0;      // found planes of at least the minimum area
+        UINT32 matched = 0;    // of those, the ones that match any reference plane
+        UINT32 reference = 0;  // reference planes of at least the minimum area
+        UINT32 recovered = 0;  // of those, the ones some found plane matches
+
+        double Precision() const { return found > 0 ? double(matched) / found : 1.0; }
+        double Recall() const { return reference > 0 ? double(recovered) / reference : 1.0; }
+    };
+
+    // A found plane matches a reference plane when their normals are within a few degrees, their offsets within a
+    // few centimeters, and the center of the found plane lies within the bounds of the reference plane. Found planes
+    // smaller than minArea are ignored. Reference planes smaller than minArea need not be found, but a found plane
+    // matching one still counts as correct.
+    PlaneScore ScorePlanes(
+        _In_ const vector<BoundedPlane>& planes,
+        _In_ const vector<BoundedPlane>& reference,
+        _In_ float minArea);
+}
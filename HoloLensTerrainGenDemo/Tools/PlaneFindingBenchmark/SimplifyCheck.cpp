@@ -0,0 +1,155 @@
+// Checks that FindPlanes with simplification (FindPlanesOptions::simplifyCellScale) only returns planes it can bound,
+// on meshes where the simplified mesh and the full one disagree.
+//
+//   flat             a flat 60cm square grid at 1cm spacing: one plane, with and without simplification, of the same
+//                    size
+//   zigzag           the same grid with its vertices 2cm above and below it in a checkerboard, all facing up. The
+//                    full mesh has no plane, but merging the vertices of each cell flattens it, so the simplified
+//                    mesh has one that none of the full mesh's vertices are close to. With reattachment it must be
+//                    dropped, as without simplification; without, it is returned, with the simplified mesh's bounds.
+//   few vertices     GetBoundsInOrientedSpace given no, one and two vertices, which have no convex hull, must return
+//                    finite boxes
+//
+// Every plane returned must have finite bounds and a positive area.
+//
+// Usage: SimplifyCheck
+//
+// Built by Tools/CMakeLists.txt. Exits with 1 if a check fails. Build with -DPLANEFINDING_SANITIZE=address to also
+// catch reads past the vertices of a plane.
+
+#include "common.h"
+#include "pch.h"
+#include "PlaneFinding.h"
+#include "Util.h"
+
+#include <cmath>
+#include <cstdio>
+
+using namespace DirectX;
+using namespace PlaneFinding;
+
+namespace
+{
+    const float cCellScale = 4.0f;
+
+    struct Grid
+    {
+        vector<XMFLOAT3> verts;
+        vector<XMFLOAT3> normals;
+        vector<INT32> indices;
+
+        MeshData GetMeshData()
+        {
+            MeshData mesh;
+            mesh.vertCount = static_cast<INT32>(verts.size());
+            mesh.indexCount = static_cast<INT32>(indices.size());
+            mesh.verts = verts.data();
+            mesh.normals = normals.data();
+            mesh.indices = indices.data();
+            XMStoreFloat4x4(&mesh.transform, XMMatrixIdentity());
+            return mesh;
+        }
+    };
+
+    // An n by n grid of vertices spacing apart in x and z, facing up, whose vertices alternate between zigzag above
+    // and below y = 0.
+    Grid BuildGrid(int n, float spacing, float zigzag)
+    {
+        Grid grid;
+        for (int z = 0; z < n; ++z)
+        {
+            for (int x = 0; x < n; ++x)
+            {
+                grid.verts.push_back({ x * spacing, ((x + z) & 1) ? zigzag : -zigzag, z * spacing });
+                grid.normals.push_back({ 0.0f, 1.0f, 0.0f });
+            }
+        }
+
+        for (int z = 0; z + 1 < n; ++z)
+        {
+            for (int x = 0; x + 1 < n; ++x)
+            {
+                INT32 a = z * n + x;
+                INT32 b = a + 1;
+                INT32 c = a + n;
+                INT32 d = c + 1;
+                grid.indices.insert(grid.indices.end(), { a, c, b, b, c, d });
+            }
+        }
+        return grid;
+    }
+
+    bool IsFinite(const BoundingOrientedBox& box)
+    {
+        const float values[] = { box.Center.x, box.Center.y, box.Center.z, box.Extents.x, box.Extents.y, box.Extents.z,
+            box.Orientation.x, box.Orientation.y, box.Orientation.z, box.Orientation.w };
+        for (float value : values)
+        {
+            if (!std::isfinite(value))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    vector<BoundedPlane> Find(Grid& grid, float simplifyCellScale, bool reattachVertices)
+    {
+        MeshData mesh = grid.GetMeshData();
+        FindPlanesOptions options;
+        options.simplifyCellScale = simplifyCellScale;
+        options.reattachVertices = reattachVertices;
+        return FindPlanes(1, &mesh, 5.0f, nullptr, options);
+    }
+
+    // Finds the planes of grid as name says, and checks there are expectedPlanes of them, each bounded.
+    bool Check(const char* name, Grid& grid, float simplifyCellScale, bool reattachVertices, size_t expectedPlanes)
+    {
+        vector<BoundedPlane> planes = Find(grid, simplifyCellScale, reattachVertices);
+        bool passed = planes.size() == expectedPlanes;
+        float largestExtent = 0.0f;
+        for (const BoundedPlane& plane : planes)
+        {
+            passed = passed && IsFinite(plane.bounds) && plane.area > 0.0f && std::isfinite(plane.area);
+            largestExtent = max(largestExtent, max(plane.bounds.Extents.x, max(plane.bounds.Extents.y, plane.bounds.Extents.z)));
+        }
+
+        printf("%-30s %7zu %10.3f %8s\n", name, planes.size(), largestExtent, passed ? "yes" : "NO");
+        return passed;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        fprintf(stderr, "%s: unknown option %s; see the top of SimplifyCheck.cpp\n", argv[0], argv[1]);
+        return 2;
+    }
+
+    bool passed = true;
+    printf("%-30s %7s %10s %8s\n", "case", "planes", "extent (m)", "passed");
+
+    Grid flat = BuildGrid(60, 0.01f, 0.0f);
+    passed = Check("flat", flat, 0.0f, true, 1) && passed;
+    passed = Check("flat, simplified", flat, cCellScale, true, 1) && passed;
+
+    Grid zigzag = BuildGrid(60, 0.01f, 0.02f);
+    passed = Check("zigzag", zigzag, 0.0f, true, 0) && passed;
+    passed = Check("zigzag, simplified", zigzag, cCellScale, true, 0) && passed;
+    passed = Check("zigzag, simplified, unattached", zigzag, cCellScale, false, 1) && passed;
+
+    const XMFLOAT3 verts[] = { { 0.1f, 0.2f, 0.0f }, { 0.4f, -0.3f, 0.0f } };
+    bool fewVerticesPassed = true;
+    for (UINT32 cVerts = 0; cVerts <= 2; ++cVerts)
+    {
+        for (bool findTightestBounds : { false, true })
+        {
+            fewVerticesPassed = fewVerticesPassed && IsFinite(GetBoundsInOrientedSpace(findTightestBounds, verts, cVerts));
+        }
+    }
+    printf("%-30s %7s %10s %8s\n", "few vertices", "", "", fewVerticesPassed ? "yes" : "NO");
+    passed = passed && fewVerticesPassed;
+
+    return passed ? 0 : 1;
+}
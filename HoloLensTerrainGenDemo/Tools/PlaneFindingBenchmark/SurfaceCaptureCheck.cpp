@@ -0,0 +1,191 @@
+// Checks that SurfaceCaptureReader returns every intact record of a capture and stops where it should, and that
+// DecodeSurfaceCaptureRecord decodes what it returns.
+//
+// Each case builds a capture in memory of three records: a small mesh, a mesh without vertices or indices, and another
+// small mesh, then spoils it as below. For each it checks how many records the reader returns, whether it reports the
+// capture corrupt, and that the records it returns decode to the vertex and index counts they were written with.
+//
+//   intact            nothing spoiled: three records, not corrupt
+//   cut short         the last record loses its final bytes, as when the app is closed during a capture: two
+//                     records, not corrupt
+//   cut header        only half the header of a fourth record is there: three records, not corrupt
+//   bad magic         the second record's magic is wrong: one record, corrupt
+//   bad size          the second record's size disagrees with its counts: one record, corrupt
+//   partial triangle  the first record has an index count that is not a multiple of 3: none, corrupt
+//   index too large   the third record has an index equal to its vertex count: two records, corrupt
+//   no vertices       the second record has indices but no vertices: one record, corrupt
+//
+// DecodeSurfaceCaptureRecord must also refuse the record with the index too large when given it directly.
+//
+// Usage: SurfaceCaptureCheck
+//
+// Built by Tools/CMakeLists.txt. Exits with 1 if a check fails.
+
+#include "common.h"
+#include "pch.h"
+#include "PlaneFinding.h"
+#include "SurfaceCapture.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+using namespace DirectX;
+using namespace PlaneFinding;
+
+namespace
+{
+    struct Mesh
+    {
+        UINT32 vertexCount;
+        vector<UINT16> indices;
+    };
+
+    // The offset of each record, so cases can spoil them.
+    struct Capture
+    {
+        vector<BYTE> bytes;
+        vector<size_t> records;
+    };
+
+    void AppendRecord(const Mesh& mesh, Capture* capture)
+    {
+        SurfaceCaptureRecordHeader header = {};
+        header.magic = cSurfaceCaptureRecordMagic;
+        header.recordBytes = static_cast<UINT32>(GetSurfaceCaptureRecordBytes(mesh.vertexCount, static_cast<UINT32>(mesh.indices.size())));
+        header.surfaceId[0] = static_cast<BYTE>(capture->records.size());
+        XMStoreFloat4x4(reinterpret_cast<XMFLOAT4X4*>(header.meshToCapture), XMMatrixIdentity());
+        header.vertexPositionScale[0] = header.vertexPositionScale[1] = header.vertexPositionScale[2] = 1.0f;
+        header.vertexCount = mesh.vertexCount;
+        header.indexCount = static_cast<UINT32>(mesh.indices.size());
+
+        size_t offset = capture->bytes.size();
+        capture->records.push_back(offset);
+        capture->bytes.resize(offset + header.recordBytes, 0);
+        memcpy(capture->bytes.data() + offset, &header, sizeof(header));
+
+        // positions spread along x, normals up
+        BYTE* payload = capture->bytes.data() + offset + sizeof(header);
+        for (UINT32 i = 0; i < mesh.vertexCount; ++i)
+        {
+            int16_t position[4] = { static_cast<int16_t>(i * 100), 0, 0, 0 };
+            memcpy(payload + i * 8, position, sizeof(position));
+            int8_t normal[4] = { 0, 127, 0, 0 };
+            memcpy(payload + mesh.vertexCount * 8 + i * 4, normal, sizeof(normal));
+        }
+        if (!mesh.indices.empty())
+        {
+            memcpy(payload + mesh.vertexCount * 12, mesh.indices.data(), mesh.indices.size() * sizeof(UINT16));
+        }
+    }
+
+    Capture BuildCapture(const vector<Mesh>& meshes)
+    {
+        Capture capture;
+        SurfaceCaptureFileHeader header = { cSurfaceCaptureMagic, cSurfaceCaptureVersion };
+        capture.bytes.resize(sizeof(header));
+        memcpy(capture.bytes.data(), &header, sizeof(header));
+        for (const Mesh& mesh : meshes)
+        {
+            AppendRecord(mesh, &capture);
+        }
+        return capture;
+    }
+
+    SurfaceCaptureRecordHeader* HeaderOf(Capture* capture, size_t record)
+    {
+        return reinterpret_cast<SurfaceCaptureRecordHeader*>(capture->bytes.data() + capture->records[record]);
+    }
+
+    // Reads the capture through, and checks the records the reader returns and whether it reports it corrupt.
+    bool Check(const char* name, const Capture& capture, const vector<Mesh>& meshes, UINT32 expectedRecords, bool expectCorrupt)
+    {
+        SurfaceCaptureReader reader(capture.bytes.data(), capture.bytes.size());
+        bool passed = reader.IsValid();
+
+        vector<XMFLOAT3> verts, normals;
+        vector<INT32> indices;
+        SurfaceCaptureRecord record;
+        UINT32 records = 0;
+        while (passed && reader.Next(&record))
+        {
+            MeshData mesh;
+            passed = records < meshes.size() && DecodeSurfaceCaptureRecord(record, verts, normals, indices, &mesh) &&
+                mesh.vertCount == static_cast<INT32>(meshes[records].vertexCount) &&
+                mesh.indexCount == static_cast<INT32>(meshes[records].indices.size());
+            for (INT32 i = 0; passed && i < mesh.indexCount; ++i)
+            {
+                passed = mesh.indices[i] == meshes[records].indices[i];
+            }
+            ++records;
+        }
+
+        passed = passed && records == expectedRecords && reader.IsCorrupt() == expectCorrupt;
+        printf("%-17s %7u %8s %8s\n", name, records, reader.IsCorrupt() ? "yes" : "no", passed ? "yes" : "NO");
+        return passed;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        fprintf(stderr, "%s: unknown option %s; see the top of SurfaceCaptureCheck.cpp\n", argv[0], argv[1]);
+        return 2;
+    }
+
+    const vector<Mesh> meshes =
+    {
+        { 4, { 0, 1, 2, 0, 2, 3 } },
+        { 0, {} },
+        { 3, { 0, 1, 2 } },
+    };
+    bool passed = true;
+
+    printf("%-17s %7s %8s %8s\n", "case", "records", "corrupt", "passed");
+    passed = Check("intact", BuildCapture(meshes), meshes, 3, false) && passed;
+
+    Capture capture = BuildCapture(meshes);
+    capture.bytes.resize(capture.bytes.size() - 4);
+    passed = Check("cut short", capture, meshes, 2, false) && passed;
+
+    capture = BuildCapture(meshes);
+    capture.bytes.resize(capture.bytes.size() + sizeof(SurfaceCaptureRecordHeader) / 2, 0);
+    passed = Check("cut header", capture, meshes, 3, false) && passed;
+
+    capture = BuildCapture(meshes);
+    HeaderOf(&capture, 1)->magic = cSurfaceCaptureMagic;
+    passed = Check("bad magic", capture, meshes, 1, true) && passed;
+
+    capture = BuildCapture(meshes);
+    HeaderOf(&capture, 1)->recordBytes += 8;
+    passed = Check("bad size", capture, meshes, 1, true) && passed;
+
+    vector<Mesh> spoiled = meshes;
+    spoiled[0].indices.pop_back();
+    passed = Check("partial triangle", BuildCapture(spoiled), spoiled, 0, true) && passed;
+
+    spoiled = meshes;
+    spoiled[2].indices[1] = static_cast<UINT16>(spoiled[2].vertexCount);
+    capture = BuildCapture(spoiled);
+    passed = Check("index too large", capture, spoiled, 2, true) && passed;
+
+    // the reader never returns that record, so it is handed to the decoder as the reader would have
+    SurfaceCaptureRecord record;
+    memcpy(&record.header, HeaderOf(&capture, 2), sizeof(record.header));
+    record.positions = capture.bytes.data() + capture.records[2] + sizeof(SurfaceCaptureRecordHeader);
+    record.normals = record.positions + record.header.vertexCount * 8;
+    record.indices = record.positions + record.header.vertexCount * 12;
+    vector<XMFLOAT3> verts, normals;
+    vector<INT32> indices;
+    MeshData mesh;
+    bool decodeRefused = !DecodeSurfaceCaptureRecord(record, verts, normals, indices, &mesh);
+    printf("%-17s %7s %8s %8s\n", "decode refuses", "", "", decodeRefused ? "yes" : "NO");
+    passed = passed && decodeRefused;
+
+    spoiled = meshes;
+    spoiled[1].indices = { 0, 0, 0 };
+    passed = Check("no vertices", BuildCapture(spoiled), spoiled, 1, true) && passed;
+
+    return passed ? 0 : 1;
+}
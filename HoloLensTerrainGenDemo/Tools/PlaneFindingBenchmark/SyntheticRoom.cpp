@@ -0,0 +1,522 @@
+#include "common.h"
+#include "pch.h"
+#include "SyntheticRoom.h"
+#include "SurfaceCapture.h"
+#include <DirectXPackedVector.h>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <tuple>
+
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+
+namespace PlaneFinding
+{
+    const float cTableHeight = 0.74f;
+    const float cTableThickness = 0.04f;
+    const float cTableLegSize = 0.05f;
+    const float cTableMargin = 0.3f; // tables keep this far from the walls
+    const float cHoleMinRadius = 0.1f;
+    const float cHoleMaxRadius = 0.3f;
+    const UINT64 cCaptureRecordInterval = 100000; // microseconds between records of a synthetic capture
+
+    namespace
+    {
+        // A flat rectangle of the room: origin + s * u + t * v for s and t in [0, 1], facing along u x v.
+        struct Quad
+        {
+            XMFLOAT3 origin;
+            XMFLOAT3 u;
+            XMFLOAT3 v;
+            XMFLOAT3 normal;
+            bool shell; // part of the walls, floor or ceiling
+        };
+
+        class RoomBuilder
+        {
+        public:
+            RoomBuilder(const SyntheticRoomOptions& options) :
+                m_options(options),
+                m_random(options.seed)
+            {
+            }
+
+            void AddQuad(const XMFLOAT3& origin, const XMFLOAT3& u, const XMFLOAT3& v, const XMFLOAT3& normal, bool shell)
+            {
+                // keep the triangles wound to face along normal
+                bool flip = XMVectorGetX(XMVector3Dot(XMVector3Cross(XMLoadFloat3(&u), XMLoadFloat3(&v)), XMLoadFloat3(&normal))) < 0.0f;
+                m_quads.push_back({ origin, flip ? v : u, flip ? u : v, normal, shell });
+            }
+
+            // The sides of an axis aligned box, and its top if it can be seen.
+            void AddBox(const XMFLOAT3& minimum, const XMFLOAT3& maximum, bool top)
+            {
+                XMFLOAT3 dx(maximum.x - minimum.x, 0.0f, 0.0f);
+                XMFLOAT3 dy(0.0f, maximum.y - minimum.y, 0.0f);
+                XMFLOAT3 dz(0.0f, 0.0f, maximum.z - minimum.z);
+                AddQuad(minimum, dx, dy, XMFLOAT3(0.0f, 0.0f, -1.0f), false);
+                AddQuad(XMFLOAT3(minimum.x, minimum.y, maximum.z), dx, dy, XMFLOAT3(0.0f, 0.0f, 1.0f), false);
+                AddQuad(minimum, dz, dy, XMFLOAT3(-1.0f, 0.0f, 0.0f), false);
+                AddQuad(XMFLOAT3(maximum.x, minimum.y, minimum.z), dz, dy, XMFLOAT3(1.0f, 0.0f, 0.0f), false);
+                if (top)
+                {
+                    AddQuad(XMFLOAT3(minimum.x, maximum.y, minimum.z), dx, dz, XMFLOAT3(0.0f, 1.0f, 0.0f), false);
+                }
+            }
+
+            float Uniform(float minimum, float maximum)
+            {
+                return maximum > minimum ? uniform_real_distribution<float>(minimum, maximum)(m_random) : minimum;
+            }
+
+            SyntheticRoom Build();
+
+        private:
+            void Tessellate(const Quad& quad, float cellSize);
+            void AddSeamFins(const Quad& quad, INT32 base, UINT32 columns, UINT32 rows, float cellSize);
+            void ComputeNormals();
+            SyntheticRoom Split();
+
+            const SyntheticRoomOptions& m_options;
+            mt19937 m_random;
+            vector<Quad> m_quads;
+
+            vector<XMFLOAT3> m_verts;
+            vector<XMFLOAT3> m_normals;
+            vector<INT32> m_indices;
+            vector<BoundedPlane> m_groundTruth;
+        };
+
+        void RoomBuilder::Tessellate(const Quad& quad, float cellSize)
+        {
+            XMVECTOR origin = XMLoadFloat3(&quad.origin);
+            XMVECTOR u = XMLoadFloat3(&quad.u);
+            XMVECTOR v = XMLoadFloat3(&quad.v);
+            XMVECTOR normal = XMLoadFloat3(&quad.normal);
+            float uLength = XMVectorGetX(XMVector3Length(u));
+            float vLength = XMVectorGetX(XMVector3Length(v));
+
+            // the face as it was meant to be, before noise and holes
+            XMVECTOR center = origin + 0.5f * (u + v);
+            BoundedPlane truth;
+            truth.plane = Plane(XMPlaneFromPointNormal(center, normal));
+            float up = quad.normal.y;
+            truth.plane.surface = up > 0.99f ? FLOOR : up < -0.99f ? CEILING : fabsf(up) < 0.01f ? WALL : UNKNOWN;
+            XMStoreFloat3(&truth.bounds.Center, center);
+            truth.bounds.Extents = XMFLOAT3(0.5f * uLength, 0.5f * vLength, 0.0f);
+            XMMATRIX orientation(XMVector3Normalize(u), XMVector3Normalize(v), normal, XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f));
+            XMStoreFloat4(&truth.bounds.Orientation, XMQuaternionRotationMatrix(orientation));
+            truth.area = uLength * vLength;
+            m_groundTruth.push_back(truth);
+
+            UINT32 columns = max(1u, static_cast<UINT32>(lroundf(uLength / cellSize)));
+            UINT32 rows = max(1u, static_cast<UINT32>(lroundf(vLength / cellSize)));
+            INT32 base = static_cast<INT32>(m_verts.size());
+
+            normal_distribution<float> noise(0.0f, m_options.noise);
+            for (UINT32 row = 0; row <= rows; ++row)
+            {
+                for (UINT32 column = 0; column <= columns; ++column)
+                {
+                    float offset = m_options.noise > 0.0f ? noise(m_random) : 0.0f;
+                    XMVECTOR position = origin + (float(column) / columns) * u + (float(row) / rows) * v + offset * normal;
+                    XMFLOAT3 vert;
+                    XMStoreFloat3(&vert, position);
+                    m_verts.push_back(vert);
+                }
+            }
+
+            // holes are circles in the face's own coordinates, in meters
+            struct Hole
+            {
+                float s, t, radius;
+            };
+            vector<Hole> holes;
+            if (quad.shell && m_options.holeFraction > 0.0f)
+            {
+                float meanRadius = 0.5f * (cHoleMinRadius + cHoleMaxRadius);
+                UINT32 count = static_cast<UINT32>(lroundf(m_options.holeFraction * truth.area / (XM_PI * meanRadius * meanRadius)));
+                for (UINT32 i = 0; i < count; ++i)
+                {
+                    holes.push_back({ Uniform(0.0f, uLength), Uniform(0.0f, vLength), Uniform(cHoleMinRadius, cHoleMaxRadius) });
+                }
+            }
+
+            auto inHole = [&](float column, float row)
+            {
+                float s = column * uLength / columns;
+                float t = row * vLength / rows;
+                for (const Hole& hole : holes)
+                {
+                    if ((s - hole.s) * (s - hole.s) + (t - hole.t) * (t - hole.t) < hole.radius * hole.radius)
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            };
+
+            for (UINT32 row = 0; row < rows; ++row)
+            {
+                for (UINT32 column = 0; column < columns; ++column)
+                {
+                    INT32 v00 = base + static_cast<INT32>(row * (columns + 1) + column);
+                    INT32 v10 = v00 + 1;
+                    INT32 v01 = v00 + static_cast<INT32>(columns + 1);
+                    INT32 v11 = v01 + 1;
+
+                    // each triangle is kept or dropped by its centroid
+                    if (!inHole(column + 2.0f / 3.0f, row + 1.0f / 3.0f))
+                    {
+                        m_indices.insert(m_indices.end(), { v00, v10, v11 });
+                    }
+                    if (!inHole(column + 1.0f / 3.0f, row + 2.0f / 3.0f))
+                    {
+                        m_indices.insert(m_indices.end(), { v00, v11, v01 });
+                    }
+                }
+            }
+
+            if (m_options.nonManifoldSeams && quad.shell && truth.plane.surface == WALL)
+            {
+                AddSeamFins(quad, base, columns, rows, cellSize);
+            }
+        }
+
+        // Where a wall meets the floor or the ceiling, two extra triangles are hung off every edge, one into the room
+        // and one behind the wall, so each of those edges belongs to three triangles. Scans show the same thing where
+        // surfaces are stitched together.
+        void RoomBuilder::AddSeamFins(const Quad& quad, INT32 base, UINT32 columns, UINT32 rows, float cellSize)
+        {
+            XMVECTOR normal = XMLoadFloat3(&quad.normal);
+            auto gridVert = [&](UINT32 column, UINT32 row) { return base + static_cast<INT32>(row * (columns + 1) + column); };
+
+            // the four sides of the grid, as start, step and length
+            struct Side
+            {
+                UINT32 column, row;
+                INT32 columnStep, rowStep;
+                UINT32 length;
+            };
+            const Side sides[] =
+            {
+                { 0, 0, 1, 0, columns },
+                { 0, rows, 1, 0, columns },
+                { 0, 0, 0, 1, rows },
+                { columns, 0, 0, 1, rows },
+            };
+
+            for (const Side& side : sides)
+            {
+                // only sides lying along the floor or the ceiling are seams
+                XMFLOAT3 start = m_verts[gridVert(side.column, side.row)];
+                XMFLOAT3 end = m_verts[gridVert(side.column + side.columnStep * side.length, side.row + side.rowStep * side.length)];
+                float tolerance = 4.0f * m_options.noise + 0.001f;
+                bool floorSeam = fabsf(start.y) < tolerance && fabsf(end.y) < tolerance;
+                bool ceilingSeam = fabsf(start.y - m_options.height) < tolerance && fabsf(end.y - m_options.height) < tolerance;
+                if (!floorSeam && !ceilingSeam)
+                {
+                    continue;
+                }
+
+                XMVECTOR away = XMVectorSet(0.0f, floorSeam ? -1.0f : 1.0f, 0.0f, 0.0f);
+                for (UINT32 i = 0; i < side.length; ++i)
+                {
+                    INT32 a = gridVert(side.column + side.columnStep * i, side.row + side.rowStep * i);
+                    INT32 b = gridVert(side.column + side.columnStep * (i + 1), side.row + side.rowStep * (i + 1));
+                    XMVECTOR middle = 0.5f * (XMLoadFloat3(&m_verts[a]) + XMLoadFloat3(&m_verts[b]));
+
+                    INT32 fin = static_cast<INT32>(m_verts.size());
+                    XMFLOAT3 vert;
+                    XMStoreFloat3(&vert, middle + 0.5f * cellSize * (normal + away));
+                    m_verts.push_back(vert);
+                    XMStoreFloat3(&vert, middle + 0.5f * cellSize * (away - normal));
+                    m_verts.push_back(vert);
+
+                    m_indices.insert(m_indices.end(), { a, b, fin, b, a, fin + 1 });
+                }
+            }
+        }
+
+        // Area weighted vertex normals of the whole scan, so they carry the noise and bend across seams and edges the
+        // way the normals of a real scan do.
+        void RoomBuilder::ComputeNormals()
+        {
+            vector<XMVECTOR> sums(m_verts.size(), XMVectorZero());
+            for (size_t i = 0; i + 2 < m_indices.size(); i += 3)
+            {
+                XMVECTOR a = XMLoadFloat3(&m_verts[m_indices[i]]);
+                XMVECTOR b = XMLoadFloat3(&m_verts[m_indices[i + 1]]);
+                XMVECTOR c = XMLoadFloat3(&m_verts[m_indices[i + 2]]);
+                XMVECTOR faceNormal = XMVector3Cross(b - a, c - a);
+                for (size_t j = 0; j < 3; ++j)
+                {
+                    sums[m_indices[i + j]] += faceNormal;
+                }
+            }
+
+            m_normals.resize(m_verts.size());
+            for (size_t i = 0; i < m_verts.size(); ++i)
+            {
+                XMVECTOR normal = XMVector3Greater(XMVector3LengthSq(sums[i]), XMVectorReplicate(1e-12f)) ?
+                    XMVector3Normalize(sums[i]) : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+                XMStoreFloat3(&m_normals[i], normal);
+            }
+        }
+
+        // Divides the triangles among chunks by their centroids, giving each chunk its own copy of the vertices it uses.
+        // Vertices used by no triangle, such as those inside holes, are dropped.
+        SyntheticRoom RoomBuilder::Split()
+        {
+            map<tuple<INT32, INT32, INT32>, UINT32> chunkIndices;
+            vector<vector<UINT32>> chunkTriangles;
+            for (size_t i = 0; i + 2 < m_indices.size(); i += 3)
+            {
+                tuple<INT32, INT32, INT32> key(0, 0, 0);
+                if (m_options.chunkSize > 0.0f)
+                {
+                    XMVECTOR centroid = (XMLoadFloat3(&m_verts[m_indices[i]]) + XMLoadFloat3(&m_verts[m_indices[i + 1]]) +
+                        XMLoadFloat3(&m_verts[m_indices[i + 2]])) / 3.0f;
+                    XMFLOAT3 cell;
+                    XMStoreFloat3(&cell, XMVectorFloor(centroid / m_options.chunkSize));
+                    key = make_tuple(static_cast<INT32>(cell.x), static_cast<INT32>(cell.y), static_cast<INT32>(cell.z));
+                }
+
+                auto inserted = chunkIndices.insert(make_pair(key, static_cast<UINT32>(chunkTriangles.size())));
+                if (inserted.second)
+                {
+                    chunkTriangles.emplace_back();
+                }
+                chunkTriangles[inserted.first->second].push_back(static_cast<UINT32>(i));
+            }
+
+            SyntheticRoom room;
+            room.meshes.resize(chunkTriangles.size());
+            vector<UINT32> owner(m_verts.size(), UINT32_MAX);
+            vector<INT32> local(m_verts.size());
+            for (UINT32 chunk = 0; chunk < chunkTriangles.size(); ++chunk)
+            {
+                SyntheticMesh& mesh = room.meshes[chunk];
+                for (UINT32 triangle : chunkTriangles[chunk])
+                {
+                    for (UINT32 j = 0; j < 3; ++j)
+                    {
+                        INT32 vert = m_indices[triangle + j];
+                        if (owner[vert] != chunk)
+                        {
+                            owner[vert] = chunk;
+                            local[vert] = static_cast<INT32>(mesh.verts.size());
+                            mesh.verts.push_back(m_verts[vert]);
+                            mesh.normals.push_back(m_normals[vert]);
+                        }
+                        mesh.indices.push_back(local[vert]);
+                    }
+                }
+            }
+
+            room.groundTruth = move(m_groundTruth);
+            return room;
+        }
+
+        SyntheticRoom RoomBuilder::Build()
+        {
+            float totalArea = 0.0f;
+            for (const Quad& quad : m_quads)
+            {
+                totalArea += XMVectorGetX(XMVector3Length(XMVector3Cross(XMLoadFloat3(&quad.u), XMLoadFloat3(&quad.v))));
+            }
+
+            // a grid of square cells of this size gives about the requested number of vertices
+            float cellSize = sqrtf(totalArea / max(1u, m_options.vertexCount));
+            for (const Quad& quad : m_quads)
+            {
+                Tessellate(quad, cellSize);
+            }
+
+            ComputeNormals();
+            return Split();
+        }
+    }
+
+    SyntheticRoom GenerateSyntheticRoom(_In_ const SyntheticRoomOptions& options)
+    {
+        RoomBuilder builder(options);
+        float width = options.width;
+        float depth = options.depth;
+        float height = options.height;
+
+        builder.AddQuad(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(width, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, depth), XMFLOAT3(0.0f, 1.0f, 0.0f), true);
+        builder.AddQuad(XMFLOAT3(0.0f, height, 0.0f), XMFLOAT3(width, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, depth), XMFLOAT3(0.0f, -1.0f, 0.0f), true);
+        builder.AddQuad(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(width, 0.0f, 0.0f), XMFLOAT3(0.0f, height, 0.0f), XMFLOAT3(0.0f, 0.0f, 1.0f), true);
+        builder.AddQuad(XMFLOAT3(0.0f, 0.0f, depth), XMFLOAT3(width, 0.0f, 0.0f), XMFLOAT3(0.0f, height, 0.0f), XMFLOAT3(0.0f, 0.0f, -1.0f), true);
+        builder.AddQuad(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, depth), XMFLOAT3(0.0f, height, 0.0f), XMFLOAT3(1.0f, 0.0f, 0.0f), true);
+        builder.AddQuad(XMFLOAT3(width, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, depth), XMFLOAT3(0.0f, height, 0.0f), XMFLOAT3(-1.0f, 0.0f, 0.0f), true);
+
+        // tables are the surfaces clutter can stand on, besides the floor
+        struct Support
+        {
+            XMFLOAT3 minimum;
+            XMFLOAT3 maximum;
+        };
+        vector<Support> tables;
+        for (UINT32 i = 0; i < options.tables; ++i)
+        {
+            float length = min(builder.Uniform(0.8f, 1.6f), width - 2.0f * cTableMargin);
+            float breadth = min(builder.Uniform(0.6f, 0.9f), depth - 2.0f * cTableMargin);
+            if (length <= cTableLegSize * 2.0f || breadth <= cTableLegSize * 2.0f)
+            {
+                break;
+            }
+
+            float x = builder.Uniform(cTableMargin, width - cTableMargin - length);
+            float z = builder.Uniform(cTableMargin, depth - cTableMargin - breadth);
+            Support table = { XMFLOAT3(x, cTableHeight - cTableThickness, z), XMFLOAT3(x + length, cTableHeight, z + breadth) };
+            builder.AddBox(table.minimum, table.maximum, true);
+
+            float legTop = cTableHeight - cTableThickness;
+            const float legX[] = { x, x + length - cTableLegSize };
+            const float legZ[] = { z, z + breadth - cTableLegSize };
+            for (float legx : legX)
+            {
+                for (float legz : legZ)
+                {
+                    builder.AddBox(XMFLOAT3(legx, 0.0f, legz), XMFLOAT3(legx + cTableLegSize, legTop, legz + cTableLegSize), false);
+                }
+            }
+            tables.push_back(table);
+        }
+
+        for (UINT32 i = 0; i < options.clutter; ++i)
+        {
+            Support ground = { XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(width, 0.0f, depth) };
+            bool onTable = !tables.empty() && builder.Uniform(0.0f, 1.0f) < 0.5f;
+            const Support& support = onTable ? tables[min(tables.size() - 1, static_cast<size_t>(builder.Uniform(0.0f, float(tables.size()))))] : ground;
+
+            float sizeX = builder.Uniform(0.1f, 0.4f);
+            float sizeY = builder.Uniform(0.1f, 0.4f);
+            float sizeZ = builder.Uniform(0.1f, 0.4f);
+            float x = builder.Uniform(support.minimum.x, max(support.minimum.x, support.maximum.x - sizeX));
+            float z = builder.Uniform(support.minimum.z, max(support.minimum.z, support.maximum.z - sizeZ));
+            float y = support.maximum.y;
+            builder.AddBox(XMFLOAT3(x, y, z), XMFLOAT3(x + sizeX, y + sizeY, z + sizeZ), true);
+        }
+
+        return builder.Build();
+    }
+
+    vector<MeshData> SyntheticRoom::GetMeshData()
+    {
+        vector<MeshData> meshData(meshes.size());
+        for (size_t i = 0; i < meshes.size(); ++i)
+        {
+            XMStoreFloat4x4(&meshData[i].transform, XMMatrixIdentity());
+            meshData[i].vertCount = static_cast<INT32>(meshes[i].verts.size());
+            meshData[i].indexCount = static_cast<INT32>(meshes[i].indices.size());
+            meshData[i].verts = meshes[i].verts.data();
+            meshData[i].normals = meshes[i].normals.data();
+            meshData[i].indices = meshes[i].indices.data();
+        }
+        return meshData;
+    }
+
+    UINT32 SyntheticRoom::GetVertexCount() const
+    {
+        size_t count = 0;
+        for (const SyntheticMesh& mesh : meshes)
+        {
+            count += mesh.verts.size();
+        }
+        return static_cast<UINT32>(count);
+    }
+
+    UINT32 SyntheticRoom::GetTriangleCount() const
+    {
+        size_t count = 0;
+        for (const SyntheticMesh& mesh : meshes)
+        {
+            count += mesh.indices.size() / 3;
+        }
+        return static_cast<UINT32>(count);
+    }
+
+    bool WriteSurfaceCapture(_In_ const SyntheticRoom& room, _In_ const char* path, _In_ UINT32 passes)
+    {
+        for (const SyntheticMesh& mesh : room.meshes)
+        {
+            if (mesh.verts.size() > 0x10000)
+            {
+                return false;
+            }
+        }
+
+        FILE* file = fopen(path, "wb");
+        if (!file)
+        {
+            return false;
+        }
+
+        SurfaceCaptureFileHeader fileHeader = { cSurfaceCaptureMagic, cSurfaceCaptureVersion };
+        bool written = fwrite(&fileHeader, sizeof(fileHeader), 1, file) == 1;
+
+        vector<BYTE> record;
+        UINT64 captureTime = 0;
+        for (UINT32 pass = 0; pass < passes && written; ++pass)
+        {
+            for (UINT32 surface = 0; surface < room.meshes.size() && written; ++surface)
+            {
+                const SyntheticMesh& mesh = room.meshes[surface];
+                UINT32 vertexCount = static_cast<UINT32>(mesh.verts.size());
+                UINT32 indexCount = static_cast<UINT32>(mesh.indices.size());
+
+                // like the device, positions are stored relative to the mesh's own origin, at the center of its
+                // bounds, and scaled to fit SNORM16
+                BoundingBox bounds;
+                BoundingBox::CreateFromPoints(bounds, vertexCount, mesh.verts.data(), sizeof(XMFLOAT3));
+                XMVECTOR center = XMLoadFloat3(&bounds.Center);
+                XMVECTOR scale = XMVectorMax(XMLoadFloat3(&bounds.Extents), XMVectorReplicate(1e-3f));
+
+                SurfaceCaptureRecordHeader header = {};
+                header.magic = cSurfaceCaptureRecordMagic;
+                header.recordBytes = static_cast<UINT32>(GetSurfaceCaptureRecordBytes(vertexCount, indexCount));
+                memcpy(header.surfaceId, &surface, sizeof(surface));
+                header.updateTime = pass;
+                header.captureTime = captureTime;
+                XMFLOAT4X4 meshToCapture;
+                XMStoreFloat4x4(&meshToCapture, XMMatrixTranslationFromVector(center));
+                memcpy(header.meshToCapture, &meshToCapture, sizeof(header.meshToCapture));
+                XMFLOAT3 positionScale;
+                XMStoreFloat3(&positionScale, scale);
+                memcpy(header.vertexPositionScale, &positionScale, sizeof(header.vertexPositionScale));
+                header.vertexCount = vertexCount;
+                header.indexCount = indexCount;
+
+                record.assign(header.recordBytes, 0);
+                memcpy(record.data(), &header, sizeof(header));
+                BYTE* positions = record.data() + sizeof(header);
+                BYTE* normals = positions + size_t(vertexCount) * sizeof(XMSHORTN4);
+                BYTE* indices = positions + size_t(vertexCount) * 12;
+                for (UINT32 i = 0; i < vertexCount; ++i)
+                {
+                    XMSHORTN4 position;
+                    XMStoreShortN4(&position, XMVectorSetW((XMLoadFloat3(&mesh.verts[i]) - center) / scale, 1.0f));
+                    memcpy(positions + i * sizeof(position), &position, sizeof(position));
+
+                    XMBYTEN4 normal;
+                    XMStoreByteN4(&normal, XMVectorSetW(XMLoadFloat3(&mesh.normals[i]), 0.0f));
+                    memcpy(normals + i * sizeof(normal), &normal, sizeof(normal));
+                }
+                for (UINT32 i = 0; i < indexCount; ++i)
+                {
+                    UINT16 index = static_cast<UINT16>(mesh.indices[i]);
+                    memcpy(indices + i * sizeof(index), &index, sizeof(index));
+                }
+
+                written = fwrite(record.data(), record.size(), 1, file) == 1;
+                captureTime += cCaptureRecordInterval;
+            }
+        }
+
+        return fclose(file) == 0 && written;
+    }
+}
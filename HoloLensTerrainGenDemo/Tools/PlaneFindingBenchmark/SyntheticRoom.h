@@ -0,0 +1,52 @@
+#pragma once
+#include "PlaneFinding.h"
+
+namespace PlaneFinding
+{
+    // Settings for a synthetic room scan. The room spans [0, width] x [0, height] x [0, depth], with y up, as plane
+    // finding expects.
+    struct SyntheticRoomOptions
+    {
+        float width = 5.0f;
+        float depth = 4.0f;
+        float height = 2.5f;
+        UINT32 vertexCount = 10000;   // roughly how many vertices the scan has; sets the triangle density
+        float noise = 0.005f;         // standard deviation of the offset of each vertex along its surface normal, in meters
+        float holeFraction = 0.02f;   // fraction of the walls, floor and ceiling cut away as round holes
+        UINT32 tables = 2;
+        UINT32 clutter = 12;          // small boxes on the floor and the tables
+        bool nonManifoldSeams = true; // adds fins along the seams of the walls, so those edges have three triangles
+        float chunkSize = 0.0f;       // splits the scan into meshes of cubes this size, like spatial surfaces; 0 for one mesh
+        UINT32 seed = 1;
+    };
+
+    struct SyntheticMesh
+    {
+        vector<DirectX::XMFLOAT3> verts;
+        vector<DirectX::XMFLOAT3> normals;
+        vector<INT32> indices;
+    };
+
+    // A generated scan, and every flat face it was built from.
+    struct SyntheticRoom
+    {
+        vector<SyntheticMesh> meshes;
+        vector<BoundedPlane> groundTruth;
+
+        // The meshes in the layout FindPlanes takes. They point into meshes, so they are valid while the room is.
+        vector<MeshData> GetMeshData();
+
+        UINT32 GetVertexCount() const;
+        UINT32 GetTriangleCount() const;
+    };
+
+    // Builds a room scan: the walls, floor and ceiling, tables, and boxes of clutter, tessellated into a grid, with
+    // noise, holes and seams as set by options. The same options always give the same room.
+    SyntheticRoom GenerateSyntheticRoom(_In_ const SyntheticRoomOptions& options);
+
+    // Writes the room as a surface capture (see SurfaceCapture.h) that PlaneFindingReplay can replay: every mesh is a
+    // surface, and all of them are recorded once per pass, a tenth of a second apart, the way the device delivers a
+    // room again as it refines it. Positions and normals are quantized as the device quantizes them. Returns false if
+    // the file could not be written, or a mesh has more vertices than 16 bit indices can address.
+    bool WriteSurfaceCapture(_In_ const SyntheticRoom& room, _In_ const char* path, _In_ UINT32 passes);
+}
@@ -0,0 +1,448 @@
+// Replays a surface capture recorded by the app (see SurfaceCapture.h) through plane finding, away from the device.
+// Each record is decoded, run through FindPlanes and given to a PlaneMap as the planes of its surface, the way the
+// app does it, and the map is merged after every record. At the end it prints the time each stage took and a digest
+// of the merged planes, so runs before and after a change to plane finding can be compared for speed and results.
+//
+// Usage: PlaneFindingReplay <capture> [--max-speed] [--simplify <scale> [--no-reattach]] [--ransac]
+//
+// Records are replayed at the speed they were captured at, unless --max-speed is given. With --simplify, every record
+// is also run through FindPlanes with FindPlanesOptions::simplifyCellScale set to scale, into a plane map of its own,
+// and the merged planes of that map are scored against those found on the full meshes. With --ransac, after every
+// record the latest mesh of every surface is run through the RANSAC engine at once, as the app does when it is
+// selected, and its merged planes are scored the same way.
+//
+// PlaneFindingBenchmark --write-capture writes a synthetic room as a capture, for a replay without a device.
+//
+// Exits with 1 if the capture can't be read, or has a damaged record; the records before it are still replayed. A
+// last record cut short, as when the app was closed during a capture, is not damage.
+//
+// The capture is memory mapped with POSIX calls. Built by Tools/CMakeLists.txt. By hand, with GCC or Clang: compile it
+// as C++14 with ../PlaneFindingBenchmark/PlaneScore.cpp and every .cpp file of Common/PlaneFinding, with this directory,
+// ../PlaneFindingBenchmark, Common/PlaneFinding, the Inc directory of DirectXMath and the directory of a sal.h on the
+// include path.
+//
+// Plane finding's parallel loops run serially in this build (see Portability.h), so stage timings compare with each
+// other rather than with a device.
+
+#include "common.h"
+#include "pch.h"
+#include "PlaneMap.h"
+#include "PlaneScore.h"
+#include "SurfaceCapture.h"
+
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace DirectX;
+using namespace PlaneFinding;
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // the app's plane map settings, from RealtimeSurfaceMeshRenderer
+    const float cMinArea = 0.0f;
+    const float cSnapToGravityThreshold = 5.0f;
+
+    // merged planes smaller than this are left out of the score of simplification
+    const float cScoreMinArea = 0.05f;
+
+    // plane values are rounded to this fraction before they are hashed, so rounding differences between compilers
+    // and instruction sets don't change the digest
+    const float cDigestPrecision = 1000.0f;
+
+    double MillisecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // FNV-1a, 64 bit.
+    class Digest
+    {
+    public:
+        void Add(const void* data, size_t size)
+        {
+            const BYTE* bytes = static_cast<const BYTE*>(data);
+            for (size_t i = 0; i < size; ++i)
+            {
+                m_hash = (m_hash ^ bytes[i]) * 0x100000001b3ull;
+            }
+        }
+
+        void AddQuantized(float value)
+        {
+            INT64 quantized = static_cast<INT64>(std::llround(value * cDigestPrecision));
+            Add(&quantized, sizeof(quantized));
+        }
+
+        UINT64 Value() const { return m_hash; }
+
+    private:
+        UINT64 m_hash = 0xcbf29ce484222325ull;
+    };
+
+    UINT64 DigestPlanes(const vector<MergedPlane>& planes)
+    {
+        Digest digest;
+        for (const MergedPlane& merged : planes)
+        {
+            const BoundedPlane& plane = merged.plane;
+            INT32 surface = plane.plane.surface;
+            digest.Add(&merged.id, sizeof(merged.id));
+            digest.Add(&surface, sizeof(surface));
+            const float values[] =
+            {
+                plane.plane.normal.x, plane.plane.normal.y, plane.plane.normal.z, plane.plane.d,
+                plane.bounds.Center.x, plane.bounds.Center.y, plane.bounds.Center.z,
+                plane.bounds.Extents.x, plane.bounds.Extents.y, plane.bounds.Extents.z,
+                plane.bounds.Orientation.x, plane.bounds.Orientation.y, plane.bounds.Orientation.z, plane.bounds.Orientation.w,
+                plane.area
+            };
+            for (float value : values)
+            {
+                digest.AddQuantized(value);
+            }
+        }
+        return digest.Value();
+    }
+
+    // A read only mapping of a whole file.
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const char* path)
+        {
+            int file = open(path, O_RDONLY);
+            if (file < 0)
+            {
+                return;
+            }
+
+            struct stat info;
+            if (fstat(file, &info) == 0 && info.st_size > 0)
+            {
+                void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+                if (data != MAP_FAILED)
+                {
+                    m_data = static_cast<const BYTE*>(data);
+                    m_size = static_cast<size_t>(info.st_size);
+                }
+            }
+            close(file);
+        }
+
+        ~MappedFile()
+        {
+            if (m_data)
+            {
+                munmap(const_cast<BYTE*>(m_data), m_size);
+            }
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const BYTE* Data() const { return m_data; }
+        size_t Size() const { return m_size; }
+
+    private:
+        const BYTE* m_data = nullptr;
+        size_t m_size = 0;
+    };
+
+    struct StageStatistics
+    {
+        double total = 0.0;
+        double max = 0.0;
+
+        void Add(double milliseconds)
+        {
+            total += milliseconds;
+            max = std::max(max, milliseconds);
+        }
+    };
+
+    void PrintStage(const char* name, const StageStatistics& stage, UINT32 count)
+    {
+        printf("  %-18s %10.3f ms total %8.3f ms mean %8.3f ms max\n",
+            name, stage.total, count > 0 ? stage.total / count : 0.0, stage.max);
+    }
+
+    // The latest mesh of a surface, for engines that find planes in all surfaces at once.
+    struct SurfaceMeshCopy
+    {
+        vector<XMFLOAT3> verts;
+        vector<XMFLOAT3> normals;
+        vector<INT32> indices;
+        MeshData mesh;
+    };
+
+    // Plane finding run one way over every record, into a plane map of its own.
+    struct Engine
+    {
+        const char* name;
+        FindPlanesOptions options;
+        PlaneMap planeMap{ cMinArea, cSnapToGravityThreshold };
+        UINT64 subPlanes = 0;
+        StageStatistics findPlanes, merge;
+        StageStatistics gather, hypotheses, simplify, adjacency, curvature, smoothing, regions, planeEquations, assignment, bounds;
+        // the longest stretch of each FindPlanes call without asking FindPlanesOptions::isCanceled, which bounds how
+        // long the app waits for a canceled plane update.
+        StageStatistics uncancelable;
+
+        Engine(const char* name, const FindPlanesOptions& options) : name(name), options(options) {}
+
+        // Finds the planes of the meshes given, and gives them to the plane map as the planes of source.
+        void Replay(INT32 numMeshes, MeshData* meshes, UINT32 source)
+        {
+            Clock::time_point start = Clock::now();
+            Clock::time_point lastAsked = start;
+            double longest = 0.0;
+            FindPlanesOptions asking = options;
+            asking.isCanceled = [&]
+            {
+                longest = std::max(longest, MillisecondsSince(lastAsked));
+                lastAsked = Clock::now();
+                return false;
+            };
+            FindPlanesTimings timings;
+            vector<BoundedPlane> planes = FindPlanes(numMeshes, meshes, cSnapToGravityThreshold, &timings, asking);
+            findPlanes.Add(MillisecondsSince(start));
+            uncancelable.Add(std::max(longest, MillisecondsSince(lastAsked)));
+            gather.Add(timings.gather);
+            hypotheses.Add(timings.hypotheses);
+            simplify.Add(timings.simplify);
+            adjacency.Add(timings.adjacency);
+            curvature.Add(timings.curvature);
+            smoothing.Add(timings.smoothing);
+            regions.Add(timings.regions);
+            planeEquations.Add(timings.planeEquations);
+            assignment.Add(timings.assignment);
+            bounds.Add(timings.bounds);
+
+            start = Clock::now();
+            planeMap.SetSubPlanes(source, planes);
+            planeMap.Update();
+            merge.Add(MillisecondsSince(start));
+
+            subPlanes += planes.size();
+        }
+
+        void Print(UINT32 records) const
+        {
+            printf("Stages of %s plane finding, over %u records:\n", name, records);
+            PrintStage("find planes", findPlanes, records);
+            PrintStage("  gather", gather, records);
+            PrintStage("  hypotheses", hypotheses, records);
+            PrintStage("  simplify", simplify, records);
+            PrintStage("  adjacency", adjacency, records);
+            PrintStage("  curvature", curvature, records);
+            PrintStage("  smoothing", smoothing, records);
+            PrintStage("  regions", regions, records);
+            PrintStage("  plane equations", planeEquations, records);
+            PrintStage("  assignment", assignment, records);
+            PrintStage("  bounds", bounds, records);
+            PrintStage("  uncancelable", uncancelable, records);
+            PrintStage("merge", merge, records);
+
+            const vector<MergedPlane>& mergedPlanes = planeMap.GetPlanes();
+            printf("%" PRIu64 " sub-planes found, %zu merged planes, digest %016" PRIx64 "\n",
+                subPlanes, mergedPlanes.size(), DigestPlanes(mergedPlanes));
+        }
+
+        vector<BoundedPlane> GetMergedPlanes() const
+        {
+            vector<BoundedPlane> planes;
+            for (const MergedPlane& merged : planeMap.GetPlanes())
+            {
+                planes.push_back(merged.plane);
+            }
+            return planes;
+        }
+    };
+
+    // Prints how fast other was next to full, and how well its merged planes match those of full.
+    void PrintComparison(const Engine& full, const Engine& other)
+    {
+        double fullMilliseconds = full.findPlanes.total + full.merge.total;
+        double otherMilliseconds = other.findPlanes.total + other.merge.total;
+        PlaneScore score = ScorePlanes(other.GetMergedPlanes(), full.GetMergedPlanes(), cScoreMinArea);
+        printf("%s plane finding is %.2fx as fast as %s. Against the %s merged planes of at least %.2f m^2: precision %.3f (%u/%u), recall %.3f (%u/%u)\n",
+            other.name, fullMilliseconds / max(otherMilliseconds, 1e-6), full.name, full.name, cScoreMinArea,
+            score.Precision(), score.matched, score.found, score.Recall(), score.recovered, score.reference);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = nullptr;
+    bool maxSpeed = false;
+    bool badArguments = false;
+    FindPlanesOptions simplifiedOptions;
+    bool ransac = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--max-speed") == 0)
+        {
+            maxSpeed = true;
+        }
+        else if (strcmp(argv[i], "--simplify") == 0 && i + 1 < argc)
+        {
+            simplifiedOptions.simplifyCellScale = static_cast<float>(atof(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--no-reattach") == 0)
+        {
+            simplifiedOptions.reattachVertices = false;
+        }
+        else if (strcmp(argv[i], "--ransac") == 0)
+        {
+            ransac = true;
+        }
+        else if (!path)
+        {
+            path = argv[i];
+        }
+        else
+        {
+            badArguments = true;
+        }
+    }
+
+    if (!path || badArguments)
+    {
+        fprintf(stderr, "usage: %s <capture> [--max-speed] [--simplify <scale> [--no-reattach]] [--ransac]\n", argv[0]);
+        return 2;
+    }
+
+    MappedFile file(path);
+    if (!file.Data())
+    {
+        fprintf(stderr, "%s: could not map the capture\n", path);
+        return 1;
+    }
+
+    SurfaceCaptureReader reader(file.Data(), file.Size());
+    if (!reader.IsValid())
+    {
+        fprintf(stderr, "%s: not a surface capture this version can read\n", path);
+        return 1;
+    }
+
+    Engine full("full", FindPlanesOptions());
+    unique_ptr<Engine> simplified;
+    if (simplifiedOptions.simplifyCellScale > 0.0f)
+    {
+        simplified.reset(new Engine("simplified", simplifiedOptions));
+    }
+    unique_ptr<Engine> acrossSurfaces;
+    if (ransac)
+    {
+        FindPlanesOptions ransacOptions;
+        ransacOptions.engine = PlaneFindingEngine::Ransac;
+        acrossSurfaces.reset(new Engine("ransac", ransacOptions));
+    }
+
+    map<std::array<BYTE, 16>, UINT32> sources;
+    vector<SurfaceMeshCopy> latestMeshes; // by source, for the RANSAC engine
+    vector<MeshData> meshes;
+
+    vector<XMFLOAT3> verts;
+    vector<XMFLOAT3> normals;
+    vector<INT32> indices;
+
+    UINT32 records = 0;
+    UINT64 vertices = 0;
+    UINT64 triangles = 0;
+    StageStatistics decode;
+
+    Clock::time_point replayStart = Clock::now();
+    SurfaceCaptureRecord record;
+    while (reader.Next(&record))
+    {
+        if (!maxSpeed)
+        {
+            std::this_thread::sleep_until(replayStart + std::chrono::microseconds(record.header.captureTime));
+        }
+
+        Clock::time_point start = Clock::now();
+        MeshData mesh;
+        if (!DecodeSurfaceCaptureRecord(record, verts, normals, indices, &mesh))
+        {
+            // the reader checks every record it returns, so this is a bug in one or the other
+            fprintf(stderr, "%s: record %u could not be decoded\n", path, records);
+            return 1;
+        }
+        decode.Add(MillisecondsSince(start));
+
+        // each surface keeps the source it was first seen under, as in the app
+        std::array<BYTE, 16> surfaceId;
+        memcpy(surfaceId.data(), record.header.surfaceId, surfaceId.size());
+        auto source = sources.insert(make_pair(surfaceId, static_cast<UINT32>(sources.size()))).first->second;
+
+        full.Replay(1, &mesh, source);
+        if (simplified)
+        {
+            simplified->Replay(1, &mesh, source);
+        }
+        if (acrossSurfaces)
+        {
+            latestMeshes.resize(sources.size());
+            SurfaceMeshCopy& latest = latestMeshes[source];
+            latest.verts = verts;
+            latest.normals = normals;
+            latest.indices = indices;
+            latest.mesh = mesh;
+            latest.mesh.verts = latest.verts.data();
+            latest.mesh.normals = latest.normals.data();
+            latest.mesh.indices = latest.indices.data();
+
+            meshes.clear();
+            for (SurfaceMeshCopy& surface : latestMeshes)
+            {
+                meshes.push_back(surface.mesh);
+            }
+            acrossSurfaces->Replay(static_cast<INT32>(meshes.size()), meshes.data(), 0);
+        }
+
+        ++records;
+        vertices += record.header.vertexCount;
+        triangles += record.header.indexCount / 3;
+    }
+
+    double replayMilliseconds = MillisecondsSince(replayStart);
+
+    printf("%s: %u records of %zu surfaces, %" PRIu64 " vertices, %" PRIu64 " triangles, replayed in %.3f ms%s\n",
+        path, records, sources.size(), vertices, triangles, replayMilliseconds, maxSpeed ? " at maximum speed" : "");
+    PrintStage("decode", decode, records);
+    full.Print(records);
+
+    if (simplified)
+    {
+        simplified->Print(records);
+        PrintComparison(full, *simplified);
+    }
+    if (acrossSurfaces)
+    {
+        acrossSurfaces->Print(records);
+        PrintComparison(full, *acrossSurfaces);
+    }
+
+    if (reader.IsCorrupt())
+    {
+        fprintf(stderr, "%s: record %u is damaged, only the records before it were replayed\n", path, records);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// The plane finding sources include "pch.h" for the app's precompiled header. The replayer has nothing to
+// precompile, so this stands in for it.
@@ -0,0 +1,396 @@
+// Stress tests the app's snapshot publication (see Common/AtomicSnapshot.h and Common/PlaneSnapshot.h). Writer threads
+// build new values and publish them while reader threads load the current one and walk it:
+//
+//   planes    writers publish floors through DX::PublishPlanes, as SurfacePlaneRenderer::UpdatePlanes does, with
+//             stand-ins for the vertex buffer and the coordinate system; a device thread loses and recreates the
+//             device through DX::ReleasePlaneBuffer and DX::RecreatePlaneBuffer, as the renderer's device resource
+//             calls do. Readers hold a snapshot for a frame, as Update and Render do, and check its buffer, if it
+//             has one, was built from its planes. Once the device is recreated the planes must be drawn again, from
+//             a buffer of the new device.
+//   surfaces  writers add, update in place and expire their own surfaces through AtomicSnapshot::Update, as
+//             AddOrUpdateSurfaceAsync and Update do; readers walk every surface of the collection they loaded.
+//
+// Every object carries a check value its destructor clears, so a reader that walks a value after it was freed, or
+// one that was not fully built, fails the run, as does a writer whose surfaces are missing from the final collection
+// (a lost update). Build with PLANEFINDING_SANITIZE=thread or =address (see CMakeLists.txt) to have ThreadSanitizer
+// or AddressSanitizer check every access as well.
+//
+// Usage: SnapshotStress [options]
+//
+//   --seconds <s>   how long to run, default 2
+//   --readers <n>   reader threads of each kind, default 4
+//   --writers <n>   writer threads of each kind, default 2
+
+#include "common.h"
+#include "PlaneMap.h"
+#include "PlaneSnapshot.h"
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <set>
+#include <thread>
+
+using namespace DirectX;
+using namespace PlaneFinding;
+
+namespace
+{
+    const UINT32 cAlive = 0x5AFE5AFEu;
+    const UINT32 cMaxFloors = 64;
+    const UINT32 cSurfacesPerWriter = 48;
+    const UINT32 cVerticesPerSurface = 96;
+
+    std::atomic<bool> g_stop{ false };
+    std::atomic<UINT64> g_failures{ 0 };
+
+    // the device the vertex buffers are created on; the device thread moves to the next one when it loses it
+    std::atomic<UINT32> g_device{ 1 };
+
+    void Fail(const char* what)
+    {
+        if (g_failures++ == 0)
+        {
+            fprintf(stderr, "check failed: %s\n", what);
+        }
+    }
+
+    UINT64 DigestFloors(const vector<MergedPlane>& planes)
+    {
+        UINT64 hash = 0xcbf29ce484222325ull;
+        for (const MergedPlane& plane : planes)
+        {
+            hash = (hash ^ plane.id) * 0x100000001b3ull;
+            const XMFLOAT3& center = plane.plane.bounds.Center;
+            hash = (hash ^ static_cast<UINT64>(center.x * 1000.0f + center.z * 1000000.0f)) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    // Stands in for the ID3D11Buffer the floors are drawn from.
+    struct VertexBuffer
+    {
+        UINT32 check = cAlive;
+        UINT32 device = 0;
+        size_t planeCount = 0;
+        UINT64 digest = 0;
+
+        ~VertexBuffer() { check = 0; }
+    };
+
+    // Stands in for the SpatialCoordinateSystem the floors were found in.
+    struct CoordinateSystem
+    {
+        UINT32 check = cAlive;
+
+        ~CoordinateSystem() { check = 0; }
+    };
+
+    typedef std::shared_ptr<const VertexBuffer> BufferPtr;
+    typedef std::shared_ptr<const CoordinateSystem> CoordinateSystemPtr;
+
+    // SurfacePlaneRenderer::PlaneSnapshot, with the stand-ins.
+    typedef DX::PlaneSnapshot<MergedPlane, BufferPtr, CoordinateSystemPtr> PlaneSnapshot;
+
+    // Stands in for SurfacePlaneRenderer::CreateVertexBuffer.
+    BufferPtr CreateVertexBuffer(const vector<MergedPlane>& planes)
+    {
+        auto buffer = std::make_shared<VertexBuffer>();
+        buffer->device = g_device;
+        buffer->planeCount = planes.size();
+        buffer->digest = DigestFloors(planes);
+        return buffer;
+    }
+
+    // Stands in for a SurfaceMesh: readers only touch it through the collection they loaded.
+    struct SurfaceMesh
+    {
+        UINT32 check = cAlive;
+        UINT64 id = 0;
+        vector<UINT64> vertices;
+        std::atomic<UINT32> updates{ 0 };
+
+        ~SurfaceMesh() { check = 0; }
+    };
+
+    typedef std::map<UINT64, std::shared_ptr<SurfaceMesh>> MeshCollection;
+
+    void PlaneWriter(DX::AtomicSnapshot<PlaneSnapshot>* published, UINT32 seed, UINT64* publishes)
+    {
+        std::mt19937 random(seed);
+        CoordinateSystemPtr coordinateSystem = std::make_shared<CoordinateSystem>();
+        vector<MergedPlane> floors;
+        while (!g_stop)
+        {
+            // about half the updates leave the floors as they were, so the vertex buffer is shared between snapshots
+            if (random() % 2 == 0)
+            {
+                floors.resize(random() % (cMaxFloors + 1));
+                for (MergedPlane& floor : floors)
+                {
+                    floor = MergedPlane();
+                    floor.id = random();
+                    floor.plane.bounds.Center = XMFLOAT3(static_cast<float>(random() % 1000) / 100.0f, 0.0f,
+                        static_cast<float>(random() % 1000) / 100.0f);
+                }
+            }
+            if (random() % 64 == 0)
+            {
+                coordinateSystem = std::make_shared<CoordinateSystem>();
+            }
+
+            DX::PublishPlanes(*published, floors, coordinateSystem, CreateVertexBuffer);
+            ++*publishes;
+        }
+    }
+
+    // Loses the device and recreates it over and over, as DeviceResources does when the display adapter is reset.
+    void DeviceThread(DX::AtomicSnapshot<PlaneSnapshot>* published, UINT64* losses)
+    {
+        while (!g_stop)
+        {
+            bool hadPlanes = published->Load() != nullptr;
+
+            // the buffers of the old device are released after the device is gone, so a writer that takes the writer
+            // lock later creates its buffer on the new one
+            ++g_device;
+            DX::ReleasePlaneBuffer(*published);
+            if (hadPlanes && !published->Load())
+            {
+                Fail("the planes were dropped with the device");
+            }
+            std::this_thread::yield();
+
+            DX::RecreatePlaneBuffer(*published, CreateVertexBuffer);
+            auto current = published->Load();
+            if (hadPlanes && (!current || !current->vertexBuffer || current->vertexBuffer->device != g_device))
+            {
+                Fail("the planes were not drawn again on the new device");
+            }
+            ++*losses;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+
+    void CheckPlaneSnapshot(const PlaneSnapshot& snapshot)
+    {
+        if (!snapshot.coordinateSystem || snapshot.coordinateSystem->check != cAlive)
+        {
+            Fail("plane snapshot freed or not fully built");
+            return;
+        }
+        // the snapshot has no buffer while the device is lost
+        if (!snapshot.vertexBuffer)
+        {
+            return;
+        }
+        if (snapshot.vertexBuffer->check != cAlive)
+        {
+            Fail("plane vertex buffer freed under a reader");
+            return;
+        }
+        if (snapshot.vertexBuffer->planeCount != snapshot.planes.size() || snapshot.vertexBuffer->digest != DigestFloors(snapshot.planes))
+        {
+            Fail("plane snapshot drawn with the vertex buffer of other floors");
+        }
+    }
+
+    void PlaneReader(const DX::AtomicSnapshot<PlaneSnapshot>* published, UINT64* reads)
+    {
+        // Update takes the snapshot and Render draws it later in the frame, while newer ones are published
+        std::shared_ptr<const PlaneSnapshot> frameSnapshot;
+        while (!g_stop)
+        {
+            if (frameSnapshot)
+            {
+                CheckPlaneSnapshot(*frameSnapshot);
+            }
+            frameSnapshot = published->Load();
+            if (frameSnapshot)
+            {
+                CheckPlaneSnapshot(*frameSnapshot);
+            }
+            ++*reads;
+        }
+    }
+
+    std::shared_ptr<SurfaceMesh> MakeSurface(UINT64 id)
+    {
+        auto surface = std::make_shared<SurfaceMesh>();
+        surface->id = id;
+        surface->vertices.assign(cVerticesPerSurface, id);
+        return surface;
+    }
+
+    // Each writer owns the surface ids writer * cSurfacesPerWriter and up, and remembers which of them it left in the
+    // collection, so lost updates show in the final collection.
+    void SurfaceWriter(DX::AtomicSnapshot<MeshCollection>* published, UINT32 writer, std::set<UINT64>* live, UINT64* publishes)
+    {
+        std::mt19937 random(writer + 1);
+        while (!g_stop)
+        {
+            UINT64 id = writer * cSurfacesPerWriter + random() % cSurfacesPerWriter;
+            UINT32 action = random() % 4;
+
+            bool changed = false;
+            published->Update([&](const std::shared_ptr<const MeshCollection>& current)
+            {
+                auto found = current->find(id);
+                if (action == 0 && found != current->end())
+                {
+                    // a surface that was already in the collection is updated in place, as SurfaceMesh::UpdateSurface is
+                    found->second->updates++;
+                    return std::shared_ptr<const MeshCollection>();
+                }
+
+                auto updated = std::make_shared<MeshCollection>(*current);
+                if (action == 1)
+                {
+                    updated->erase(id);
+                    live->erase(id);
+                }
+                else
+                {
+                    (*updated)[id] = MakeSurface(id);
+                    live->insert(id);
+                }
+                changed = true;
+                return std::shared_ptr<const MeshCollection>(updated);
+            });
+            if (changed)
+            {
+                ++*publishes;
+            }
+        }
+    }
+
+    void SurfaceReader(const DX::AtomicSnapshot<MeshCollection>* published, UINT64* reads)
+    {
+        while (!g_stop)
+        {
+            auto collection = published->Load();
+            for (const auto& pair : *collection)
+            {
+                const SurfaceMesh& surface = *pair.second;
+                if (surface.check != cAlive || surface.id != pair.first)
+                {
+                    Fail("surface freed or not fully built");
+                    continue;
+                }
+                UINT64 sum = 0;
+                for (UINT64 vertex : surface.vertices)
+                {
+                    sum += vertex;
+                }
+                if (surface.vertices.size() != cVerticesPerSurface || sum != surface.id * cVerticesPerSurface)
+                {
+                    Fail("surface vertices changed under a reader");
+                }
+            }
+            ++*reads;
+        }
+    }
+
+    bool ParseArgument(int argc, char** argv, int& i, const char* name, double& value)
+    {
+        if (strcmp(argv[i], name) != 0 || i + 1 >= argc)
+        {
+            return false;
+        }
+        value = atof(argv[++i]);
+        return true;
+    }
+
+    UINT64 Sum(const vector<UINT64>& values)
+    {
+        UINT64 sum = 0;
+        for (UINT64 value : values)
+        {
+            sum += value;
+        }
+        return sum;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = 2.0;
+    double readers = 4.0;
+    double writers = 2.0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!ParseArgument(argc, argv, i, "--seconds", seconds) &&
+            !ParseArgument(argc, argv, i, "--readers", readers) &&
+            !ParseArgument(argc, argv, i, "--writers", writers))
+        {
+            fprintf(stderr, "%s: unknown option %s; see the top of SnapshotStress.cpp\n", argv[0], argv[i]);
+            return 2;
+        }
+    }
+
+    UINT32 readerCount = max(1u, static_cast<UINT32>(readers));
+    UINT32 writerCount = max(1u, static_cast<UINT32>(writers));
+
+    DX::AtomicSnapshot<PlaneSnapshot> planes;
+    DX::AtomicSnapshot<MeshCollection> surfaces(std::make_shared<MeshCollection>());
+
+    // each thread counts into its own slot, read once the threads are joined
+    vector<UINT64> planePublishes(writerCount), planeReads(readerCount);
+    vector<UINT64> surfacePublishes(writerCount), surfaceReads(readerCount);
+    vector<std::set<UINT64>> live(writerCount);
+    UINT64 deviceLosses = 0;
+
+    vector<std::thread> threads;
+    for (UINT32 i = 0; i < writerCount; ++i)
+    {
+        threads.emplace_back(PlaneWriter, &planes, i + 1, &planePublishes[i]);
+        threads.emplace_back(SurfaceWriter, &surfaces, i, &live[i], &surfacePublishes[i]);
+    }
+    threads.emplace_back(DeviceThread, &planes, &deviceLosses);
+    for (UINT32 i = 0; i < readerCount; ++i)
+    {
+        threads.emplace_back(PlaneReader, &planes, &planeReads[i]);
+        threads.emplace_back(SurfaceReader, &surfaces, &surfaceReads[i]);
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    g_stop = true;
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    // every surface a writer left in the collection, and no other, is in the last collection published
+    std::set<UINT64> expected;
+    for (const std::set<UINT64>& ids : live)
+    {
+        expected.insert(ids.begin(), ids.end());
+    }
+    std::set<UINT64> remaining;
+    for (const auto& pair : *surfaces.Load())
+    {
+        remaining.insert(pair.first);
+    }
+    if (remaining != expected)
+    {
+        Fail("a surface update was lost");
+    }
+
+    printf("planes:   %" PRIu64 " snapshots published, %" PRIu64 " frames read, %" PRIu64 " device losses\n",
+        Sum(planePublishes), Sum(planeReads), deviceLosses);
+    printf("surfaces: %" PRIu64 " collections published, %" PRIu64 " collections walked, %zu surfaces at the end\n",
+        Sum(surfacePublishes), Sum(surfaceReads), remaining.size());
+    if (g_failures > 0)
+    {
+        printf("FAILED: %" PRIu64 " checks failed\n", static_cast<UINT64>(g_failures));
+        return 1;
+    }
+    printf("passed\n");
+    return 0;
+}
@@ -0,0 +1,271 @@
+// Checks and benchmarks the terrain's batched height and normal queries (see Content/HeightmapSampling.h), which
+// Terrain::SampleAnchorSpace and Terrain::SampleWorldSpace run over chunks of points.
+//
+//   check      random points on a random heightmap, under a random anchor-space transform as Terrain builds it from
+//              its position and orientation, some of them beyond the edges. Heights and normals must match a scalar
+//              bilinear interpolation of the same texels, and points on texels must return the texel's height. The
+//              normals of points on a texel edge, where the slope jumps, are not compared.
+//   benchmark  batches of 1k, 100k and 1M points are sampled with normals, and the queries per second reported.
+//
+// Usage: TerrainSamplingBenchmark [options]
+//
+//   --points <n>      random points to check, default 100000
+//   --max-batch <n>   largest benchmark batch, default 1000000
+//   --repeat <n>      runs per benchmark batch, default 5; times are from the fastest run
+//
+// Built by Tools/CMakeLists.txt. Exits with 1 if a check fails. The app samples batches of 16k points or more on
+// several cores; this measures one, chunk after chunk.
+
+#include "HeightmapSampling.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace DirectX;
+using namespace HoloLensTerrainGenDemo;
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // a terrain of 2m by 1.5m, at the 1cm texel spacing Terrain uses
+    const float cWidth = 2.0f;
+    const float cHeight = 1.5f;
+    const unsigned int cTexelsX = 200;
+    const unsigned int cTexelsY = 150;
+
+    const float cHeightTolerance = 1e-5f;
+    const float cNormalTolerance = 1e-4f;
+
+    // the sampled batches are summed here, so sampling them cannot be optimized away
+    volatile float g_sink;
+
+    struct Heightmap
+    {
+        std::vector<float> texels;
+        unsigned int w;
+        unsigned int h;
+    };
+
+    // Heights of up to 1cm: slopes of up to 45 degrees between neighbouring texels, steeper than erosion leaves.
+    Heightmap BuildHeightmap(std::mt19937& random)
+    {
+        Heightmap map;
+        map.w = cTexelsX;
+        map.h = cTexelsY;
+        map.texels.resize((map.w + 1) * (map.h + 1));
+        std::uniform_real_distribution<float> height(0.0f, 0.01f);
+        for (float& texel : map.texels)
+        {
+            texel = height(random);
+        }
+        return map;
+    }
+
+    // The model to anchor transform Terrain::SampleAnchorSpace uses: the terrain centered on the anchor, turned
+    // about the vertical and laid flat.
+    XMMATRIX BuildModelToAnchor(std::mt19937& random)
+    {
+        std::uniform_real_distribution<float> angle(0.0f, XM_2PI);
+        XMMATRIX orientation = XMMatrixRotationZ(angle(random)) * XMMatrixRotationX(-XM_PIDIV2);
+        return XMMatrixTranslation(-cWidth / 2.0f, -cHeight / 2.0f, 0.0f) * orientation;
+    }
+
+    // The slope of a bilinear patch jumps from one texel to the next, so the normals of points within rounding of a
+    // texel's row or column depend on which side the transform rounded them to.
+    bool IsOnTexelEdge(float x, float y)
+    {
+        float tx = x * 100.0f;
+        float ty = y * 100.0f;
+        return std::fabs(tx - std::round(tx)) < 0.01f || std::fabs(ty - std::round(ty)) < 0.01f;
+    }
+
+    // The bilinear height and normal of the texels around local (x, y), one point at a time.
+    void SampleScalar(const Heightmap& map, CXMMATRIX modelToQuery, float x, float y, float& height, XMFLOAT3& normal)
+    {
+        float tx = std::min(std::max(x * 100.0f, 0.0f), float(map.w));
+        float ty = std::min(std::max(y * 100.0f, 0.0f), float(map.h));
+        unsigned int x0 = std::min(static_cast<unsigned int>(std::floor(tx)), map.w > 1 ? map.w - 1 : 0u);
+        unsigned int y0 = std::min(static_cast<unsigned int>(std::floor(ty)), map.h > 1 ? map.h - 1 : 0u);
+        tx -= float(x0);
+        ty -= float(y0);
+
+        const float* texel = map.texels.data() + x0 + y0 * (map.w + 1);
+        float h00 = texel[0], h10 = texel[1], h01 = texel[map.w + 1], h11 = texel[map.w + 2];
+        float top = h00 + (h10 - h00) * tx;
+        float bottom = h01 + (h11 - h01) * tx;
+        height = top + (bottom - top) * ty;
+
+        float dhdx = ((h10 - h00) + ((h11 - h01) - (h10 - h00)) * ty) * 100.0f;
+        float dhdy = (bottom - top) * 100.0f;
+        XMVECTOR local = XMVectorSet(-dhdx, -dhdy, 1.0f, 0.0f);
+        XMStoreFloat3(&normal, XMVector3Normalize(XMVector3TransformNormal(local, modelToQuery)));
+    }
+
+    // Samples count points in chunks, as Terrain::Sample does below its parallel threshold.
+    void Sample(const Heightmap& map, FXMMATRIX modelToQuery, const XMFLOAT3* points, size_t count, float* heights,
+        XMFLOAT3* normals)
+    {
+        XMVECTOR determinant;
+        XMMATRIX queryToLocal = XMMatrixInverse(&determinant, modelToQuery);
+        for (size_t start = 0; start < count; start += c_heightmapSampleChunkSize)
+        {
+            SampleHeightmapChunk(map.texels.data(), map.w, map.h, queryToLocal, modelToQuery, points + start,
+                std::min(c_heightmapSampleChunkSize, count - start), heights + start, normals ? normals + start : nullptr);
+        }
+    }
+
+    // Returns what is wrong with sampling count random points, or nullptr.
+    const char* Check(std::mt19937& random, size_t count)
+    {
+        Heightmap map = BuildHeightmap(random);
+        XMMATRIX modelToAnchor = BuildModelToAnchor(random);
+
+        // a tenth of the points lie up to 10cm beyond the edges, and a tenth on texels
+        std::uniform_real_distribution<float> inX(-0.1f, cWidth + 0.1f);
+        std::uniform_real_distribution<float> inY(-0.1f, cHeight + 0.1f);
+        std::vector<XMFLOAT2> local(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            local[i] = XMFLOAT2(inX(random), inY(random));
+            if (i % 10 == 0)
+            {
+                local[i] = XMFLOAT2(std::min(std::max(local[i].x, 0.0f), cWidth), std::min(std::max(local[i].y, 0.0f), cHeight));
+            }
+            else if (i % 10 == 1)
+            {
+                local[i] = XMFLOAT2(float(random() % (cTexelsX + 1)) / 100.0f, float(random() % (cTexelsY + 1)) / 100.0f);
+            }
+        }
+
+        std::vector<XMFLOAT3> points(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            XMStoreFloat3(&points[i], XMVector3TransformCoord(XMVectorSet(local[i].x, local[i].y, 0.0f, 1.0f), modelToAnchor));
+        }
+
+        std::vector<float> heights(count);
+        std::vector<XMFLOAT3> normals(count);
+        Sample(map, modelToAnchor, points.data(), count, heights.data(), normals.data());
+
+        std::vector<float> heightsOnly(count);
+        Sample(map, modelToAnchor, points.data(), count, heightsOnly.data(), nullptr);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            float expectedHeight;
+            XMFLOAT3 expectedNormal;
+            SampleScalar(map, modelToAnchor, local[i].x, local[i].y, expectedHeight, expectedNormal);
+
+            if (std::fabs(heights[i] - expectedHeight) > cHeightTolerance)
+            {
+                fprintf(stderr, "point %zu at (%f, %f): height %f, expected %f\n", i, local[i].x, local[i].y, heights[i], expectedHeight);
+                return "a height differs from the scalar interpolation";
+            }
+            if (heightsOnly[i] != heights[i])
+            {
+                return "a height differs when no normals are asked for";
+            }
+            if (!IsOnTexelEdge(local[i].x, local[i].y) && (std::fabs(normals[i].x - expectedNormal.x) > cNormalTolerance ||
+                std::fabs(normals[i].y - expectedNormal.y) > cNormalTolerance ||
+                std::fabs(normals[i].z - expectedNormal.z) > cNormalTolerance))
+            {
+                return "a normal differs from the scalar interpolation";
+            }
+            if (i % 10 == 1)
+            {
+                unsigned int x = static_cast<unsigned int>(std::lround(local[i].x * 100.0f));
+                unsigned int y = static_cast<unsigned int>(std::lround(local[i].y * 100.0f));
+                if (std::fabs(heights[i] - map.texels[x + y * (map.w + 1)]) > cHeightTolerance)
+                {
+                    return "a point on a texel does not return its height";
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    bool ParseArgument(int argc, char** argv, int& i, const char* name, double& value)
+    {
+        if (strcmp(argv[i], name) != 0 || i + 1 >= argc)
+        {
+            return false;
+        }
+        value = atof(argv[++i]);
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double points = 100000.0;
+    double maxBatch = 1000000.0;
+    double repeat = 5.0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!ParseArgument(argc, argv, i, "--points", points) &&
+            !ParseArgument(argc, argv, i, "--max-batch", maxBatch) &&
+            !ParseArgument(argc, argv, i, "--repeat", repeat))
+        {
+            fprintf(stderr, "%s: unknown option %s; see the top of TerrainSamplingBenchmark.cpp\n", argv[0], argv[i]);
+            return 2;
+        }
+    }
+
+    size_t pointCount = static_cast<size_t>(points);
+    unsigned int runs = std::max(1u, static_cast<unsigned int>(repeat));
+
+    std::mt19937 random(1);
+    const char* problem = Check(random, pointCount);
+    if (problem != nullptr)
+    {
+        fprintf(stderr, "check failed: %s\n", problem);
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("check: %zu points against scalar bilinear sampling\n\n", pointCount);
+
+    Heightmap map = BuildHeightmap(random);
+    XMMATRIX modelToAnchor = BuildModelToAnchor(random);
+    size_t largest = static_cast<size_t>(maxBatch);
+    std::uniform_real_distribution<float> inX(0.0f, cWidth);
+    std::uniform_real_distribution<float> inY(0.0f, cHeight);
+    std::vector<XMFLOAT3> batch(largest);
+    for (XMFLOAT3& point : batch)
+    {
+        XMStoreFloat3(&point, XMVector3TransformCoord(XMVectorSet(inX(random), inY(random), 0.0f, 1.0f), modelToAnchor));
+    }
+    std::vector<float> heights(largest);
+    std::vector<XMFLOAT3> normals(largest);
+
+    printf("%10s %12s %14s\n", "batch", "us/batch", "queries/s");
+    for (size_t batchSize : { size_t(1000), size_t(100000), size_t(1000000) })
+    {
+        if (batchSize > largest)
+        {
+            break;
+        }
+        // small batches are sampled repeatedly until each timed run covers about a million queries
+        size_t calls = std::max(size_t(1), size_t(1000000) / batchSize);
+        double fastest = 1e30;
+        for (unsigned int run = 0; run < runs; ++run)
+        {
+            Clock::time_point start = Clock::now();
+            for (size_t call = 0; call < calls; ++call)
+            {
+                Sample(map, modelToAnchor, batch.data(), batchSize, heights.data(), normals.data());
+                g_sink = heights[call % batchSize] + normals[call % batchSize].z;
+            }
+            fastest = std::min(fastest, std::chrono::duration<double>(Clock::now() - start).count() / double(calls));
+        }
+        printf("%10zu %12.1f %14.0f\n", batchSize, fastest * 1e6, double(batchSize) / fastest);
+    }
+    return 0;
+}
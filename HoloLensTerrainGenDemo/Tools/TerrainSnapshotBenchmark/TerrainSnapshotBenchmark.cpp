@@ -0,0 +1,278 @@
+// Checks and benchmarks the compressed heightmap format of terrain snapshots (see Content/TerrainSnapshotCodec.h),
+// which Terrain decodes when it restores a saved terrain instead of replaying its recipe.
+//
+//   check      a fault formation terrain, a flat one and one of random noise, which escapes most residuals, are
+//              encoded and decoded. Every height must come back within half a quantization step. Every truncation
+//              of the encoded terrain, and a damaged header or row parameter, must fail to decode.
+//   benchmark  the fault formation terrain is encoded and decoded, and the size and times reported.
+//
+// Usage: TerrainSnapshotBenchmark [options]
+//
+//   --width <n>    heightmap width in texels, default 500 (a 5m terrain at 1cm texels)
+//   --height <n>   heightmap height in texels, default 500
+//   --repeat <n>   runs per benchmark, default 5; times are from the fastest run
+//
+// Built by Tools/CMakeLists.txt. Exits with 1 if a check fails. The terrain is built from straight faults and an
+// IIR filter like Terrain's, without the BSP tree or erosion, so its residuals are close to but not the same as a
+// generated terrain's. Regenerating from the recipe needs the app's Terrain class and is not timed here.
+
+#include "TerrainSnapshotCodec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace HoloLensTerrainGenDemo;
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // Terrain's fault formation settings
+    const unsigned int cFaultIterations = 500;
+    const float cFaultAmplitude = 0.005f;
+    const float cIirFilter = 0.1f;
+
+    // the decoded heights are checked here, so decoding cannot be optimized away
+    volatile float g_sink;
+
+    struct Heightmap
+    {
+        std::vector<float> texels;
+        unsigned int w;
+        unsigned int h;
+    };
+
+    Heightmap Allocate(unsigned int w, unsigned int h)
+    {
+        Heightmap map;
+        map.w = w;
+        map.h = h;
+        map.texels.assign((w + 1) * (h + 1), 0.0f);
+        return map;
+    }
+
+    // Raises one side of a random line per iteration, smooths the rows and columns with a one pole filter in both
+    // directions, and moves the lowest point to zero.
+    Heightmap BuildFaultTerrain(std::mt19937& random, unsigned int w, unsigned int h)
+    {
+        Heightmap map = Allocate(w, h);
+        const unsigned int pitch = w + 1;
+        std::uniform_real_distribution<float> inX(0.0f, float(w));
+        std::uniform_real_distribution<float> inY(0.0f, float(h));
+        std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+        for (unsigned int i = 0; i < cFaultIterations; ++i)
+        {
+            float px = inX(random), py = inY(random), a = angle(random);
+            float nx = std::cos(a), ny = std::sin(a);
+            for (unsigned int y = 0; y <= h; ++y)
+            {
+                for (unsigned int x = 0; x <= w; ++x)
+                {
+                    if ((float(x) - px) * nx + (float(y) - py) * ny > 0.0f)
+                    {
+                        map.texels[x + y * pitch] += cFaultAmplitude;
+                    }
+                }
+            }
+        }
+
+        for (unsigned int y = 0; y <= h; ++y)
+        {
+            float* row = map.texels.data() + y * pitch;
+            for (unsigned int x = 1; x <= w; ++x)
+            {
+                row[x] = cIirFilter * row[x - 1] + (1.0f - cIirFilter) * row[x];
+            }
+            for (unsigned int x = w; x-- > 0;)
+            {
+                row[x] = cIirFilter * row[x + 1] + (1.0f - cIirFilter) * row[x];
+            }
+        }
+        for (unsigned int x = 0; x <= w; ++x)
+        {
+            for (unsigned int y = 1; y <= h; ++y)
+            {
+                map.texels[x + y * pitch] = cIirFilter * map.texels[x + (y - 1) * pitch] + (1.0f - cIirFilter) * map.texels[x + y * pitch];
+            }
+            for (unsigned int y = h; y-- > 0;)
+            {
+                map.texels[x + y * pitch] = cIirFilter * map.texels[x + (y + 1) * pitch] + (1.0f - cIirFilter) * map.texels[x + y * pitch];
+            }
+        }
+
+        float lowest = *std::min_element(map.texels.begin(), map.texels.end());
+        for (float& texel : map.texels)
+        {
+            texel -= lowest;
+        }
+        return map;
+    }
+
+    Heightmap BuildNoise(std::mt19937& random, unsigned int w, unsigned int h)
+    {
+        Heightmap map = Allocate(w, h);
+        std::uniform_real_distribution<float> height(0.0f, 0.5f);
+        for (float& texel : map.texels)
+        {
+            texel = height(random);
+        }
+        return map;
+    }
+
+    // Returns what is wrong with the round trip of map, or nullptr.
+    const char* CheckRoundTrip(const Heightmap& map)
+    {
+        std::vector<uint8_t> data = TerrainSnapshotCodec::Encode(map.texels.data(), map.w, map.h);
+        std::vector<float> decoded(map.texels.size());
+        if (!TerrainSnapshotCodec::Decode(data.data(), data.size(), decoded.data(), map.w, map.h))
+        {
+            return "an encoded heightmap does not decode";
+        }
+
+        float highest = *std::max_element(map.texels.begin(), map.texels.end());
+        float step = highest > 0.0f ? highest / 65535.0f : 1.0f;
+        for (size_t i = 0; i < decoded.size(); ++i)
+        {
+            if (std::fabs(decoded[i] - map.texels[i]) > step * 0.5f + highest * 1e-6f)
+            {
+                fprintf(stderr, "texel %zu: %f decoded as %f, step %g\n", i, map.texels[i], decoded[i], step);
+                return "a height is off by more than half a quantization step";
+            }
+        }
+
+        if (TerrainSnapshotCodec::Decode(data.data(), data.size(), decoded.data(), map.w + 1, map.h))
+        {
+            return "a heightmap decodes with the wrong dimensions";
+        }
+        return nullptr;
+    }
+
+    // Returns what is wrong with decoding damaged copies of map's encoding, or nullptr.
+    const char* CheckDamage(const Heightmap& map)
+    {
+        std::vector<uint8_t> data = TerrainSnapshotCodec::Encode(map.texels.data(), map.w, map.h);
+        std::vector<float> decoded(map.texels.size());
+
+        // the decoder is only given the truncated bytes, so reading past them is caught by AddressSanitizer builds
+        for (size_t size = 0; size < data.size(); ++size)
+        {
+            std::vector<uint8_t> truncated(data.begin(), data.begin() + size);
+            if (TerrainSnapshotCodec::Decode(truncated.data(), truncated.size(), decoded.data(), map.w, map.h))
+            {
+                fprintf(stderr, "%zu of %zu bytes decoded\n", size, data.size());
+                return "a truncated snapshot decodes";
+            }
+        }
+
+        std::vector<uint8_t> damaged = data;
+        damaged[0] ^= 1;
+        if (TerrainSnapshotCodec::Decode(damaged.data(), damaged.size(), decoded.data(), map.w, map.h))
+        {
+            return "a snapshot with a damaged magic number decodes";
+        }
+
+        // the row parameters follow the 24 byte header, which ends with the payload size. The last row's parameter is
+        // put out of range, and padding appended so the larger parameter does not simply run out of bits.
+        const size_t padding = 64;
+        damaged = data;
+        damaged.resize(data.size() + padding, 0);
+        uint32_t payloadBytes;
+        memcpy(&payloadBytes, &damaged[20], sizeof(payloadBytes));
+        payloadBytes += padding;
+        memcpy(&damaged[20], &payloadBytes, sizeof(payloadBytes));
+        damaged[24 + map.h] = 17;
+        if (TerrainSnapshotCodec::Decode(damaged.data(), damaged.size(), decoded.data(), map.w, map.h))
+        {
+            return "a snapshot with an out of range row parameter decodes";
+        }
+        return nullptr;
+    }
+
+    bool ParseArgument(int argc, char** argv, int& i, const char* name, double& value)
+    {
+        if (strcmp(argv[i], name) != 0 || i + 1 >= argc)
+        {
+            return false;
+        }
+        value = atof(argv[++i]);
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double width = 500.0;
+    double height = 500.0;
+    double repeat = 5.0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!ParseArgument(argc, argv, i, "--width", width) &&
+            !ParseArgument(argc, argv, i, "--height", height) &&
+            !ParseArgument(argc, argv, i, "--repeat", repeat))
+        {
+            fprintf(stderr, "%s: unknown option %s; see the top of TerrainSnapshotBenchmark.cpp\n", argv[0], argv[i]);
+            return 2;
+        }
+    }
+
+    unsigned int w = std::max(1u, static_cast<unsigned int>(width));
+    unsigned int h = std::max(1u, static_cast<unsigned int>(height));
+    unsigned int runs = std::max(1u, static_cast<unsigned int>(repeat));
+
+    std::mt19937 random(1);
+    Heightmap terrain = BuildFaultTerrain(random, w, h);
+    // truncating every byte of a large encoding is quadratic, so that check uses a small terrain
+    Heightmap small = BuildFaultTerrain(random, 40, 30);
+
+    const char* problem = CheckRoundTrip(terrain);
+    if (problem == nullptr)
+    {
+        problem = CheckRoundTrip(Allocate(w, h));
+    }
+    if (problem == nullptr)
+    {
+        problem = CheckRoundTrip(BuildNoise(random, w, h));
+    }
+    if (problem == nullptr)
+    {
+        problem = CheckDamage(small);
+    }
+    if (problem != nullptr)
+    {
+        fprintf(stderr, "check failed: %s\n", problem);
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("check: fault, flat and noise heightmaps of %ux%u texels, and damaged snapshots\n\n", w + 1, h + 1);
+
+    std::vector<uint8_t> data;
+    std::vector<float> decoded(terrain.texels.size());
+    double fastestEncode = 1e30;
+    double fastestDecode = 1e30;
+    for (unsigned int run = 0; run < runs; ++run)
+    {
+        Clock::time_point start = Clock::now();
+        data = TerrainSnapshotCodec::Encode(terrain.texels.data(), w, h);
+        fastestEncode = std::min(fastestEncode, std::chrono::duration<double>(Clock::now() - start).count());
+
+        start = Clock::now();
+        TerrainSnapshotCodec::Decode(data.data(), data.size(), decoded.data(), w, h);
+        fastestDecode = std::min(fastestDecode, std::chrono::duration<double>(Clock::now() - start).count());
+        g_sink = decoded[run % decoded.size()];
+    }
+
+    size_t texels = terrain.texels.size();
+    printf("%zu texels, %zu bytes as floats, %zu bytes encoded (%.2f bits per texel)\n",
+        texels, texels * sizeof(float), data.size(), double(data.size()) * 8.0 / double(texels));
+    printf("%10s %12s %14s\n", "", "ms", "Mtexels/s");
+    printf("%10s %12.3f %14.1f\n", "encode", fastestEncode * 1e3, double(texels) / fastestEncode * 1e-6);
+    printf("%10s %12.3f %14.1f\n", "decode", fastestDecode * 1e3, double(texels) / fastestDecode * 1e-6);
+    return 0;
+}
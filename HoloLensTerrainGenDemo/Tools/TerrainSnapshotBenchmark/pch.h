@@ -0,0 +1,4 @@
+#pragma once
+
+// Content/TerrainSnapshotCodec.cpp includes "pch.h" for the app's precompiled header. The benchmark has nothing to
+// precompile, so this stands in for it.